@@ -15,11 +15,20 @@
 #include <audit/audit.hpp>
 #include <boost/beast/core/detail/base64.hpp>
 #include <boost/format.hpp>
+#include <set>
 
 using namespace bzn;
 
-audit::audit(std::shared_ptr<bzn::node_base> node)
+namespace
+{
+    const size_t COMMIT_WINDOW_ENTRIES = 100000;
+    const size_t STATE_WINDOW_ENTRIES = 16;
+}
+
+audit::audit(std::shared_ptr<bzn::node_base> node, bzn::peers_list_t peers, bzn::uuid_t uuid)
         : node(std::move(node))
+        , peers(std::move(peers))
+        , uuid(std::move(uuid))
 {
 
 }
@@ -57,7 +66,11 @@ audit::handle(const bzn::message& json, std::shared_ptr<bzn::session_base> /*ses
 
     LOG(debug) << "Got audit message" << message.DebugString();
 
-    if(message.has_commit())
+    if(message.has_commits())
+    {
+        this->handle_commit_batch(message.commits());
+    }
+    else if(message.has_commit())
     {
         this->handle_commit(message.commit());
     }
@@ -65,6 +78,10 @@ audit::handle(const bzn::message& json, std::shared_ptr<bzn::session_base> /*ses
     {
         this->handle_leader_status(message.leader_status());
     }
+    else if(message.has_state())
+    {
+        this->handle_state_digest(message.state());
+    }
     else
     {
         LOG(error) << "Got an empty audit message?";
@@ -91,22 +108,162 @@ audit::handle_leader_status(const leader_status& leader_status)
     }
 }
 
+void
+audit::handle_commit_batch(const commit_batch& batch)
+{
+    LOG(debug) << "audit checking " << batch.commits_size() << " commits from " << batch.sender_uuid();
+
+    for (const auto& commit : batch.commits())
+    {
+        this->handle_commit(commit);
+    }
+}
+
 void
 audit::handle_commit(const commit_notification& commit)
 {
-    if(this->recorded_commits.count(commit.log_index()) == 0)
+    if (commit.log_index() <= this->forgotten_through)
+    {
+        return;
+    }
+
+    auto it = this->recorded_commits.find(commit.log_index());
+
+    if (it == this->recorded_commits.end())
     {
-        LOG(info) << "audit recording that message " << commit.operation() << " is committed at index " << commit.log_index();
-        this->recorded_commits[commit.log_index()] = commit.operation();
+        this->recorded_commits[commit.log_index()] = recorded_commit{commit.term(), commit.digest()};
+
+        if (this->recorded_commits.size() > COMMIT_WINDOW_ENTRIES)
+        {
+            this->forgotten_through = this->recorded_commits.begin()->first;
+            this->recorded_commits.erase(this->recorded_commits.begin());
+        }
     }
-    else if(this->recorded_commits[commit.log_index()] != commit.operation())
+    else if (it->second.term != commit.term() || it->second.digest != commit.digest())
     {
         std::string err = str(boost::format(
-                "Conflicting commit detected! %1% is the recorded entry at index %2%, but %3% has been committed with the same index.")
-                              % this->recorded_commits[commit.log_index()]
+                "Conflicting commit detected! term %1% digest %2$016x is the recorded entry at index %3%, but term %4% digest %5$016x has been committed with the same index.")
+                              % it->second.term
+                              % it->second.digest
                               % commit.log_index()
-                              % commit.operation());
+                              % commit.term()
+                              % commit.digest());
+        this->recorded_errors.push_back(err);
+        LOG(fatal) << err;
+    }
+}
+
+void
+audit::report_state(uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& buckets)
+{
+    audit_message msg;
+    msg.mutable_state()->set_sender_uuid(this->uuid);
+    msg.mutable_state()->set_log_index(log_index);
+
+    for (const auto& db : buckets)
+    {
+        auto digest = msg.mutable_state()->add_databases();
+        digest->set_uuid(db.first);
+        *digest->mutable_buckets() = {db.second.begin(), db.second.end()};
+    }
+
+    auto encoded = std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(
+        R"({"bzn-api":"audit","audit-data":")" + boost::beast::detail::base64_encode(msg.SerializeAsString()) + R"("})"));
+
+    for (const auto& peer : this->peers)
+    {
+        auto ep = boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string(peer.host), peer.port};
+        this->node->send_on_channel(ep, encoded);
+    }
+}
+
+void
+audit::set_divergence_handler(bzn::divergence_handler handler)
+{
+    this->divergence_handler = std::move(handler);
+}
+
+
+void
+audit::handle_state_digest(const state_digest& state)
+{
+    std::map<bzn::uuid_t, std::vector<uint64_t>> databases;
+
+    for (const auto& db : state.databases())
+    {
+        databases[db.uuid()] = {db.buckets().begin(), db.buckets().end()};
+    }
+
+    auto it = this->recorded_states.find(state.log_index());
+
+    if (it == this->recorded_states.end())
+    {
+        if (this->recorded_states.size() >= STATE_WINDOW_ENTRIES && state.log_index() < this->recorded_states.begin()->first)
+        {
+            return;
+        }
+
+        this->recorded_states[state.log_index()] = {state.sender_uuid(), std::move(databases)};
+
+        if (this->recorded_states.size() > STATE_WINDOW_ENTRIES)
+        {
+            this->recorded_states.erase(this->recorded_states.begin());
+        }
+        return;
+    }
+
+    const auto& recorded = it->second.second;
+
+    // a database one side lacks differs wherever the other has records...
+    std::set<bzn::uuid_t> uuids;
+    for (const auto& db : recorded)
+    {
+        uuids.insert(db.first);
+    }
+    for (const auto& db : databases)
+    {
+        uuids.insert(db.first);
+    }
+
+    bool diverged = false;
+
+    for (const auto& uuid : uuids)
+    {
+        const auto ours = recorded.find(uuid);
+        const auto theirs = databases.find(uuid);
+        const auto& a = (ours != recorded.end()) ? ours->second : std::vector<uint64_t>();
+        const auto& b = (theirs != databases.end()) ? theirs->second : std::vector<uint64_t>();
+
+        if (a == b)
+        {
+            continue;
+        }
+
+        std::string differing;
+        for (size_t i = 0; i < std::max(a.size(), b.size()); ++i)
+        {
+            if ((i < a.size() ? a[i] : 0) != (i < b.size() ? b[i] : 0))
+            {
+                differing += (differing.empty() ? "" : ",") + std::to_string(i);
+            }
+        }
+
+        std::string err = str(boost::format(
+                "Divergent state detected! Database %1% at commit index %2% differs between %3% and %4% in buckets %5% of %6%.")
+                              % uuid
+                              % state.log_index()
+                              % it->second.first
+                              % state.sender_uuid()
+                              % differing
+                              % std::max(a.size(), b.size()));
         this->recorded_errors.push_back(err);
         LOG(fatal) << err;
+
+        diverged = true;
+    }
+
+    if (diverged && this->divergence_handler)
+    {
+        this->divergence_handler(state.log_index(), it->second.first, state.sender_uuid());
     }
 }
@@ -15,6 +15,7 @@
 #pragma once
 
 #include <audit/audit_base.hpp>
+#include <bootstrap/bootstrap_peers_base.hpp>
 #include <node/node_base.hpp>
 #include <mutex>
 
@@ -24,7 +25,7 @@ namespace bzn
     class audit : public audit_base, public std::enable_shared_from_this<audit>
     {
     public:
-        audit(std::shared_ptr<bzn::node_base> node);
+        audit(std::shared_ptr<bzn::node_base> node, bzn::peers_list_t peers = {}, bzn::uuid_t uuid = {});
 
         size_t error_count() const override;
 
@@ -32,7 +33,13 @@ namespace bzn
 
         void handle(const bzn::message& message, std::shared_ptr<bzn::session_base> session) override;
         void handle_commit(const commit_notification&) override;
+        void handle_commit_batch(const commit_batch&) override;
         void handle_leader_status(const leader_status&) override;
+        void handle_state_digest(const state_digest&) override;
+
+        void report_state(uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& buckets) override;
+
+        void set_divergence_handler(bzn::divergence_handler handler) override;
 
         void start() override;
 
@@ -40,9 +47,24 @@ namespace bzn
 
         std::list<std::string> recorded_errors;
         const std::shared_ptr<bzn::node_base> node;
+        const bzn::peers_list_t peers;
+        const bzn::uuid_t uuid;
 
         std::map<uint64_t, bzn::uuid_t> recorded_leaders;
-        std::map<uint64_t, std::string> recorded_commits;
+        struct recorded_commit
+        {
+            uint64_t term;
+            uint64_t digest;
+        };
+
+        // a sliding window over the most recent commit indexes, older ones can no longer be checked...
+        std::map<uint64_t, recorded_commit> recorded_commits;
+        uint64_t forgotten_through = 0;
+
+        // the first state reported for each of the last few commit indexes, by database...
+        std::map<uint64_t, std::pair<bzn::uuid_t, std::map<bzn::uuid_t, std::vector<uint64_t>>>> recorded_states;
+
+        bzn::divergence_handler divergence_handler;
 
         std::once_flag start_once;
     };
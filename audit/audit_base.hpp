@@ -14,9 +14,12 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <list>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include <include/bluzelle.hpp>
 #include <node/node_base.hpp>
@@ -26,6 +29,9 @@
 namespace bzn
 {
 
+    // commit index and the two nodes whose storage differs at it...
+    using divergence_handler = std::function<void(uint64_t log_index, const bzn::uuid_t& a, const bzn::uuid_t& b)>;
+
     class audit_base
     {
         virtual void start() = 0;
@@ -38,7 +44,17 @@ namespace bzn
 
         virtual void handle_commit(const commit_notification&) = 0;
 
+        virtual void handle_commit_batch(const commit_batch&) = 0;
+
         virtual void handle_leader_status(const leader_status&) = 0;
+
+        virtual void handle_state_digest(const state_digest&) = 0;
+
+        // sends the hash tree buckets of each database as of the commit index to every peer...
+        virtual void report_state(uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& buckets) = 0;
+
+        // called once for each pair of nodes found to differ...
+        virtual void set_divergence_handler(bzn::divergence_handler handler) = 0;
     };
 
 }
@@ -14,6 +14,7 @@
 
 #include <audit/audit.hpp>
 #include <mocks/mock_node_base.hpp>
+#include <boost/beast/core/detail/base64.hpp>
 
 using namespace ::testing;
 
@@ -50,13 +51,16 @@ TEST(audit_test, audit_throws_error_when_commits_conflict)
 {
     commit_notification a, b, c;
 
-    a.set_operation("do something");
+    a.set_digest(0x1111);
+    a.set_term(1);
     a.set_log_index(1);
 
-    b.set_operation("do a different thing");
+    b.set_digest(0x2222);
+    b.set_term(1);
     b.set_log_index(2);
 
-    c.set_operation("do something else");
+    c.set_digest(0x3333);
+    c.set_term(1);
     c.set_log_index(1);
 
     bzn::audit audit(nullptr);
@@ -68,3 +72,125 @@ TEST(audit_test, audit_throws_error_when_commits_conflict)
 
     EXPECT_EQ(audit.error_count(), 1u);
 }
+
+TEST(audit_test, audit_checks_every_commit_in_a_batch)
+{
+    commit_batch first, second;
+
+    for (uint64_t i = 1; i <= 3; ++i)
+    {
+        auto commit = first.add_commits();
+        commit->set_log_index(i);
+        commit->set_term(1);
+        commit->set_digest(i);
+    }
+
+    *second.add_commits() = first.commits(0);
+    *second.add_commits() = first.commits(2);
+    second.mutable_commits(1)->set_term(2);
+
+    bzn::audit audit(nullptr);
+
+    audit.handle_commit_batch(first);
+    EXPECT_EQ(audit.error_count(), 0u);
+
+    // same digest in a different term is still a conflict...
+    audit.handle_commit_batch(second);
+    EXPECT_EQ(audit.error_count(), 1u);
+}
+
+TEST(audit_test, audit_forgets_commits_that_fall_out_of_the_window)
+{
+    bzn::audit audit(nullptr);
+
+    commit_notification commit;
+    commit.set_term(1);
+
+    for (uint64_t i = 1; i <= 200000; ++i)
+    {
+        commit.set_log_index(i);
+        commit.set_digest(i);
+        audit.handle_commit(commit);
+    }
+
+    // the oldest indexes can no longer be checked...
+    commit.set_log_index(1);
+    commit.set_digest(42);
+    audit.handle_commit(commit);
+    EXPECT_EQ(audit.error_count(), 0u);
+
+    // but recent ones are...
+    commit.set_log_index(200000);
+    audit.handle_commit(commit);
+    EXPECT_EQ(audit.error_count(), 1u);
+}
+
+TEST(audit_test, audit_reports_the_buckets_where_replica_states_differ)
+{
+    auto make_state = [](const std::string& sender, uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& databases)
+    {
+        state_digest state;
+        state.set_sender_uuid(sender);
+        state.set_log_index(log_index);
+
+        for (const auto& db : databases)
+        {
+            auto digest = state.add_databases();
+            digest->set_uuid(db.first);
+            *digest->mutable_buckets() = {db.second.begin(), db.second.end()};
+        }
+        return state;
+    };
+
+    bzn::audit audit(nullptr);
+
+    std::vector<std::tuple<uint64_t, bzn::uuid_t, bzn::uuid_t>> divergences;
+    audit.set_divergence_handler([&](uint64_t log_index, const bzn::uuid_t& a, const bzn::uuid_t& b)
+        {
+            divergences.emplace_back(log_index, a, b);
+        });
+
+    audit.handle_state_digest(make_state("fred", 10, {{"db1", {1, 2, 3, 4}}, {"db2", {5, 6, 7, 8}}}));
+    audit.handle_state_digest(make_state("smith", 10, {{"db1", {1, 2, 3, 4}}, {"db2", {5, 6, 7, 8}}}));
+    audit.handle_state_digest(make_state("smith", 20, {{"db1", {1, 2, 3, 4}}}));
+    EXPECT_EQ(audit.error_count(), 0u);
+
+    // one bucket of one database...
+    audit.handle_state_digest(make_state("jones", 10, {{"db1", {1, 2, 9, 4}}, {"db2", {5, 6, 7, 8}}}));
+    ASSERT_EQ(audit.error_count(), 1u);
+    EXPECT_NE(std::string::npos, audit.error_strings().back().find("db1 at commit index 10 differs between fred and jones in buckets 2 of 4"));
+
+    // a database a replica lacks...
+    audit.handle_state_digest(make_state("jones", 20, {{"db1", {1, 2, 3, 4}}, {"db3", {0, 1, 0, 1}}}));
+    ASSERT_EQ(audit.error_count(), 2u);
+    EXPECT_NE(std::string::npos, audit.error_strings().back().find("db3 at commit index 20 differs between smith and jones in buckets 1,3 of 4"));
+
+    ASSERT_EQ(size_t(2), divergences.size());
+    EXPECT_EQ(std::make_tuple(uint64_t(10), bzn::uuid_t("fred"), bzn::uuid_t("jones")), divergences[0]);
+    EXPECT_EQ(std::make_tuple(uint64_t(20), bzn::uuid_t("smith"), bzn::uuid_t("jones")), divergences[1]);
+}
+
+TEST(audit_test, audit_sends_its_state_to_every_peer)
+{
+    auto mock_node = std::make_shared<bzn::Mocknode_base>();
+
+    bzn::peers_list_t peers{{"127.0.0.1", 8081, 80, "name1", "uuid1"}, {"127.0.0.1", 8082, 81, "name2", "uuid2"}};
+    bzn::audit audit(mock_node, peers, "uuid1");
+
+    std::shared_ptr<bzn::encoded_message> sent;
+    EXPECT_CALL(*mock_node, send_on_channel(_, _)).Times(2).WillRepeatedly(SaveArg<1>(&sent));
+
+    audit.report_state(10, {{"db1", {1, 2}}});
+
+    ASSERT_TRUE(sent);
+    bzn::message json;
+    ASSERT_TRUE(Json::Reader().parse(*sent->front(), json));
+
+    audit_message msg;
+    ASSERT_TRUE(msg.ParseFromString(boost::beast::detail::base64_decode(json["audit-data"].asString())));
+    ASSERT_TRUE(msg.has_state());
+    EXPECT_EQ("uuid1", msg.state().sender_uuid());
+    EXPECT_EQ(10u, msg.state().log_index());
+    ASSERT_EQ(1, msg.state().databases_size());
+    EXPECT_EQ(2u, msg.state().databases(0).buckets(1));
+}
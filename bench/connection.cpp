@@ -0,0 +1,510 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <bench/connection.hpp>
+#include <proto/bluzelle.pb.h>
+#include <boost/beast/core/detail/base64.hpp>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace bzn::bench;
+
+namespace
+{
+    // a node that is down is retried after this long...
+    const std::chrono::milliseconds RECONNECT_DELAY{500};
+
+    // a request redirected more often than this is failed, the nodes disagree on who leads...
+    const uint8_t MAX_REDIRECTS = 3;
+
+    const std::string READ_REQ = "read";
+    const std::string CREATE_REQ = "create";
+    const std::string UPDATE_REQ = "update";
+}
+
+
+connection::connection(boost::asio::io_context& io_context, std::string host, uint16_t port, std::string uuid, size_t pipeline)
+    : io_context(io_context)
+    , host(std::move(host))
+    , port(port)
+    , uuid(std::move(uuid))
+    , pipeline(std::max<size_t>(pipeline, 1))
+    , resolver(io_context)
+    , backoff_timer(io_context)
+{
+}
+
+
+void
+connection::send(operation op, completion done)
+{
+    this->waiting.push_back({this->next_id++, std::move(op), std::move(done), 0});
+
+    if (this->state == connection_state::closed)
+    {
+        this->connect();
+        return;
+    }
+
+    this->pump();
+}
+
+
+void
+connection::close()
+{
+    ++this->generation;
+
+    this->backoff_timer.cancel();
+    this->resolver.cancel();
+    this->reset();
+    this->state = connection_state::closed;
+    this->writing = false;
+
+    this->complete_all("closed");
+}
+
+
+void
+connection::connect()
+{
+    this->state = connection_state::connecting;
+    this->writing = false;
+
+    const auto generation = ++this->generation;
+    auto socket = this->reset();
+
+    this->resolver.async_resolve(this->host, std::to_string(this->port),
+        [self = shared_from_this(), generation, socket](const boost::system::error_code& ec, const boost::asio::ip::tcp::resolver::results_type& results)
+        {
+            if (generation != self->generation)
+            {
+                return;
+            }
+
+            if (ec)
+            {
+                self->fail("resolve: " + ec.message());
+                return;
+            }
+
+            boost::asio::async_connect(*socket, results,
+                [self, generation, socket](const boost::system::error_code& ec, const boost::asio::ip::tcp::endpoint& /*ep*/)
+                {
+                    if (generation != self->generation)
+                    {
+                        return;
+                    }
+
+                    if (ec)
+                    {
+                        self->fail("connect: " + ec.message());
+                        return;
+                    }
+
+                    // latencies are what is measured, so small requests are not held back to be coalesced...
+                    boost::system::error_code option_ec;
+                    socket->set_option(boost::asio::ip::tcp::no_delay(true), option_ec);
+
+                    self->handshake(
+                        [self, generation](const boost::system::error_code& ec)
+                        {
+                            if (generation != self->generation)
+                            {
+                                return;
+                            }
+
+                            if (ec)
+                            {
+                                self->fail("handshake: " + ec.message());
+                                return;
+                            }
+
+                            self->state = connection_state::open;
+                            self->read_next();
+                            self->pump();
+                        });
+                });
+        });
+}
+
+
+void
+connection::pump()
+{
+    // writes go out one at a time...
+    if (this->state != connection_state::open || this->writing || this->waiting.empty() || this->sent.size() >= this->pipeline)
+    {
+        return;
+    }
+
+    this->sent.push_back(std::move(this->waiting.front()));
+    this->waiting.pop_front();
+    this->writing = true;
+
+    this->write(this->sent.back(),
+        [self = shared_from_this(), generation = this->generation](const boost::system::error_code& ec)
+        {
+            if (generation != self->generation)
+            {
+                return;
+            }
+
+            self->writing = false;
+
+            if (ec)
+            {
+                self->fail("write: " + ec.message());
+                return;
+            }
+
+            self->pump();
+        });
+}
+
+
+void
+connection::read_next()
+{
+    this->read(
+        [self = shared_from_this(), generation = this->generation](const boost::system::error_code& ec, uint64_t id, const reply& reply)
+        {
+            if (generation != self->generation)
+            {
+                return;
+            }
+
+            if (ec)
+            {
+                self->fail("read: " + ec.message());
+                return;
+            }
+
+            self->handle_reply(id, reply);
+
+            // the reply may have moved the connection...
+            if (generation == self->generation)
+            {
+                self->read_next();
+            }
+        });
+}
+
+
+void
+connection::handle_reply(uint64_t id, const reply& reply)
+{
+    auto it = std::find_if(this->sent.begin(), this->sent.end(), [id](const request& request){ return request.id == id; });
+
+    if (it == this->sent.end())
+    {
+        return;
+    }
+
+    auto request = std::move(*it);
+    this->sent.erase(it);
+
+    if (reply.redirect && (reply.leader_host.empty() || request.redirects >= MAX_REDIRECTS))
+    {
+        request.done(reply.leader_host.empty() ? "redirected to an unknown leader" : "too many redirects");
+    }
+    else if (reply.redirect)
+    {
+        ++this->redirects;
+        ++request.redirects;
+        this->waiting.push_front(std::move(request));
+
+        // requests already written are answered before the connection moves...
+        this->state = connection_state::moving;
+        this->host = reply.leader_host;
+        this->port = reply.leader_port;
+    }
+    else
+    {
+        request.done(reply.error);
+    }
+
+    if (reply.closing)
+    {
+        // the node will not answer what was written after this...
+        this->waiting.insert(this->waiting.begin(), std::make_move_iterator(this->sent.begin()), std::make_move_iterator(this->sent.end()));
+        this->sent.clear();
+    }
+
+    if ((this->state == connection_state::moving || reply.closing) && this->sent.empty())
+    {
+        this->connect();
+        return;
+    }
+
+    this->pump();
+}
+
+
+void
+connection::fail(const std::string& error)
+{
+    ++this->generation;
+
+    this->reset();
+    this->state = connection_state::backing_off;
+    this->writing = false;
+
+    this->backoff_timer.expires_after(RECONNECT_DELAY);
+    this->backoff_timer.async_wait(
+        [self = shared_from_this(), generation = this->generation](const boost::system::error_code& ec)
+        {
+            if (ec || generation != self->generation)
+            {
+                return;
+            }
+
+            self->state = connection_state::closed;
+
+            if (!self->waiting.empty())
+            {
+                self->connect();
+            }
+        });
+
+    this->complete_all(error);
+}
+
+
+void
+connection::complete_all(const std::string& error)
+{
+    // completions may send again, so they run on lists no longer ours...
+    auto failed = std::move(this->sent);
+    failed.insert(failed.end(), std::make_move_iterator(this->waiting.begin()), std::make_move_iterator(this->waiting.end()));
+
+    this->sent.clear();
+    this->waiting.clear();
+
+    for (auto& request : failed)
+    {
+        request.done(error);
+    }
+}
+
+
+std::shared_ptr<boost::asio::ip::tcp::socket>
+websocket_connection::reset()
+{
+    if (this->current)
+    {
+        boost::system::error_code ec;
+        this->current->stream.next_layer().close(ec);
+    }
+
+    this->current = std::make_shared<stream_state>(this->io_context);
+
+    return std::shared_ptr<boost::asio::ip::tcp::socket>(this->current, &this->current->stream.next_layer());
+}
+
+
+void
+websocket_connection::handshake(io_handler handler)
+{
+    this->current->stream.async_handshake(this->host, "/",
+        [current = this->current, handler = std::move(handler)](const boost::system::error_code& ec)
+        {
+            handler(ec);
+        });
+}
+
+
+void
+websocket_connection::write(const request& request, io_handler handler)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_header()->set_db_uuid(this->uuid);
+    msg.mutable_db()->mutable_header()->set_transaction_id(request.id);
+
+    switch (request.op.type)
+    {
+        case operation_type::read:
+            msg.mutable_db()->mutable_read()->set_key(request.op.key);
+            break;
+
+        case operation_type::update:
+            msg.mutable_db()->mutable_update()->set_key(request.op.key);
+            msg.mutable_db()->mutable_update()->set_value(request.op.value);
+            break;
+
+        case operation_type::insert:
+            msg.mutable_db()->mutable_create()->set_key(request.op.key);
+            msg.mutable_db()->mutable_create()->set_value(request.op.value);
+            break;
+    }
+
+    this->current->outgoing = R"({"bzn-api":"database","msg":")" + boost::beast::detail::base64_encode(msg.SerializeAsString()) + R"("})";
+
+    this->current->stream.text(true);
+    this->current->stream.async_write(boost::asio::buffer(this->current->outgoing),
+        [current = this->current, handler = std::move(handler)](const boost::system::error_code& ec, size_t /*bytes*/)
+        {
+            handler(ec);
+        });
+}
+
+
+void
+websocket_connection::read(reply_handler handler)
+{
+    auto current = this->current;
+
+    current->buffer.consume(current->buffer.size());
+    current->stream.async_read(current->buffer,
+        [current, handler = std::move(handler)](const boost::system::error_code& ec, size_t /*bytes*/)
+        {
+            if (ec)
+            {
+                handler(ec, 0, {});
+                return;
+            }
+
+            database_response response;
+            if (!response.ParseFromString(boost::beast::buffers_to_string(current->buffer.data())))
+            {
+                handler(boost::asio::error::invalid_argument, 0, {});
+                return;
+            }
+
+            reply reply;
+
+            if (response.success_case() == database_response::kRedirect)
+            {
+                reply.redirect = true;
+                reply.leader_host = response.redirect().leader_host();
+                reply.leader_port = uint16_t(response.redirect().leader_port());
+            }
+            else
+            {
+                reply.error = response.resp().error();
+            }
+
+            // watch notifications carry no transaction id and match no request...
+            handler(ec, response.success_case() == database_response::kNotification ? 0 : response.header().transaction_id(), reply);
+        });
+}
+
+
+std::shared_ptr<boost::asio::ip::tcp::socket>
+http_connection::reset()
+{
+    if (this->current)
+    {
+        boost::system::error_code ec;
+        this->current->socket.close(ec);
+    }
+
+    this->current = std::make_shared<stream_state>(this->io_context);
+
+    return std::shared_ptr<boost::asio::ip::tcp::socket>(this->current, &this->current->socket);
+}
+
+
+void
+http_connection::handshake(io_handler handler)
+{
+    boost::asio::post(this->io_context, [handler = std::move(handler)](){ handler({}); });
+}
+
+
+void
+http_connection::write(const request& request, io_handler handler)
+{
+    namespace http = boost::beast::http;
+
+    auto& outgoing = this->current->outgoing;
+    outgoing = {};
+    outgoing.version(11);
+    outgoing.keep_alive(true);
+    outgoing.set(http::field::host, this->host + ":" + std::to_string(this->port));
+
+    const auto& req = (request.op.type == operation_type::read) ? READ_REQ : (request.op.type == operation_type::update) ? UPDATE_REQ : CREATE_REQ;
+
+    outgoing.method((request.op.type == operation_type::read) ? http::verb::get : http::verb::post);
+    outgoing.target("/" + req + "/" + this->uuid + "/" + request.op.key);
+    outgoing.body() = request.op.value;
+    outgoing.prepare_payload();
+
+    http::async_write(this->current->socket, outgoing,
+        [current = this->current, handler = std::move(handler)](const boost::system::error_code& ec, size_t /*bytes*/)
+        {
+            handler(ec);
+        });
+}
+
+
+void
+http_connection::read(reply_handler handler)
+{
+    namespace http = boost::beast::http;
+
+    auto current = this->current;
+
+    current->incoming = {};
+    http::async_read(current->socket, current->buffer, current->incoming,
+        [self = std::static_pointer_cast<http_connection>(shared_from_this()), current, handler = std::move(handler)](const boost::system::error_code& ec, size_t /*bytes*/)
+        {
+            if (ec)
+            {
+                handler(ec, 0, {});
+                return;
+            }
+
+            const auto& response = current->incoming;
+
+            reply reply;
+            reply.closing = !response.keep_alive();
+
+            switch (response.result())
+            {
+                case http::status::temporary_redirect:
+                {
+                    // http://<host>:<port>/<req>/<uuid>/<key>...
+                    std::string location = response[http::field::location].to_string();
+
+                    if (const auto scheme = location.find("://"); scheme != std::string::npos)
+                    {
+                        location = location.substr(scheme + 3);
+                    }
+
+                    location = location.substr(0, location.find('/'));
+
+                    const auto separator = location.rfind(':');
+
+                    reply.redirect = true;
+                    reply.leader_host = location.substr(0, separator);
+                    reply.leader_port = (separator != std::string::npos) ? uint16_t(std::strtoul(location.c_str() + separator + 1, nullptr, 10)) : uint16_t(80);
+                    break;
+                }
+
+                case http::status::ok:
+                    reply.error = (response.body().compare(0, 3, "ack") == 0) ? "" : response.body().substr(0, 64);
+                    break;
+
+                case http::status::not_modified:
+                    break;
+
+                default:
+                    reply.error = "http " + std::to_string(response.result_int());
+            }
+
+            // responses come back in request order...
+            handler(ec, self->sent.empty() ? 0 : self->sent.front().id, reply);
+        });
+}
@@ -0,0 +1,172 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <bench/workload.hpp>
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+
+namespace bzn::bench
+{
+    // A connection to a swarm node that keeps up to pipeline requests in flight. A request the node redirects is
+    // sent again once the connection has moved to the leader, so callers only see the final outcome...
+    class connection : public std::enable_shared_from_this<connection>
+    {
+    public:
+        // empty on success...
+        using completion = std::function<void(const std::string& error)>;
+
+        connection(boost::asio::io_context& io_context, std::string host, uint16_t port, std::string uuid, size_t pipeline);
+
+        virtual ~connection() = default;
+
+        void send(operation op, completion done);
+
+        // fails whatever has not completed...
+        void close();
+
+        // requests written or waiting to be...
+        size_t in_flight() const { return this->sent.size() + this->waiting.size(); }
+
+        uint64_t redirect_count() const { return this->redirects; }
+
+    protected:
+        struct request
+        {
+            uint64_t id;
+            operation op;
+            completion done;
+            uint8_t redirects;
+        };
+
+        // a redirect names the leader, a closing node answers no more requests on the connection...
+        struct reply
+        {
+            std::string error;
+            bool redirect = false;
+            std::string leader_host;
+            uint16_t leader_port = 0;
+            bool closing = false;
+        };
+
+        using io_handler = std::function<void(const boost::system::error_code& ec)>;
+        using reply_handler = std::function<void(const boost::system::error_code& ec, uint64_t id, const reply& reply)>;
+
+        // a fresh socket for each connect, shared with the state it belongs to...
+        virtual std::shared_ptr<boost::asio::ip::tcp::socket> reset() = 0;
+        virtual void handshake(io_handler handler) = 0;
+        virtual void write(const request& request, io_handler handler) = 0;
+        virtual void read(reply_handler handler) = 0;
+
+        boost::asio::io_context& io_context;
+        std::string host;
+        uint16_t port;
+        const std::string uuid;
+
+        // written and not yet answered, oldest first...
+        std::deque<request> sent;
+
+    private:
+        enum class connection_state : uint8_t
+        {
+            closed=0,
+            connecting,
+            open,
+            moving,
+            backing_off
+        };
+
+        void connect();
+        void pump();
+        void read_next();
+        void handle_reply(uint64_t id, const reply& reply);
+        void fail(const std::string& error);
+        void complete_all(const std::string& error);
+
+        const size_t pipeline;
+        std::deque<request> waiting;
+        connection_state state = connection_state::closed;
+        bool writing = false;
+
+        // completions of a socket that has since been replaced are ignored...
+        uint64_t generation = 0;
+
+        uint64_t next_id = 1;
+        uint64_t redirects = 0;
+        boost::asio::ip::tcp::resolver resolver;
+        boost::asio::steady_timer backoff_timer;
+    };
+
+
+    // requests as the swarm client libraries send them: json wrapping a base64 protobuf, answered by a protobuf...
+    class websocket_connection final : public connection
+    {
+    public:
+        using connection::connection;
+
+    private:
+        std::shared_ptr<boost::asio::ip::tcp::socket> reset() override;
+        void handshake(io_handler handler) override;
+        void write(const request& request, io_handler handler) override;
+        void read(reply_handler handler) override;
+
+        // kept alive by the operations on it after it is replaced...
+        struct stream_state
+        {
+            explicit stream_state(boost::asio::io_context& io_context) : stream(io_context) {}
+
+            boost::beast::websocket::stream<boost::asio::ip::tcp::socket> stream;
+            std::string outgoing;
+            boost::beast::flat_buffer buffer;
+        };
+
+        std::shared_ptr<stream_state> current;
+    };
+
+
+    // the /<req>/<uuid>/<key> rest api over a keep-alive connection, requests are pipelined...
+    class http_connection final : public connection
+    {
+    public:
+        using connection::connection;
+
+    private:
+        std::shared_ptr<boost::asio::ip::tcp::socket> reset() override;
+        void handshake(io_handler handler) override;
+        void write(const request& request, io_handler handler) override;
+        void read(reply_handler handler) override;
+
+        // kept alive by the operations on it after it is replaced...
+        struct stream_state
+        {
+            explicit stream_state(boost::asio::io_context& io_context) : socket(io_context) {}
+
+            boost::asio::ip::tcp::socket socket;
+            boost::beast::http::request<boost::beast::http::string_body> outgoing;
+            boost::beast::http::response<boost::beast::http::string_body> incoming;
+            boost::beast::flat_buffer buffer;
+        };
+
+        std::shared_ptr<stream_state> current;
+    };
+
+} // bzn::bench
@@ -0,0 +1,157 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <bench/runner.hpp>
+#include <boost/program_options.hpp>
+#include <iostream>
+
+namespace po = boost::program_options;
+
+namespace
+{
+    bool parse_node(const std::string& node, std::pair<std::string, uint16_t>& address)
+    {
+        const auto separator = node.rfind(':');
+
+        if (separator == std::string::npos || separator == 0)
+        {
+            return false;
+        }
+
+        try
+        {
+            address = {node.substr(0, separator), uint16_t(std::stoul(node.substr(separator + 1)))};
+            return address.second != 0;
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+
+    bool parse_distribution(const std::string& name, bzn::bench::key_distribution& distribution)
+    {
+        static const std::map<std::string, bzn::bench::key_distribution> distributions{
+            {"uniform", bzn::bench::key_distribution::uniform},
+            {"zipfian", bzn::bench::key_distribution::zipfian},
+            {"latest", bzn::bench::key_distribution::latest}};
+
+        const auto it = distributions.find(name);
+
+        if (it == distributions.end())
+        {
+            return false;
+        }
+
+        distribution = it->second;
+        return true;
+    }
+}
+
+
+int
+main(int argc, const char* argv[])
+{
+    bzn::bench::bench_options options;
+
+    std::vector<std::string> nodes;
+    std::string distribution = "zipfian";
+    uint64_t duration = options.duration.count();
+
+    po::options_description desc("Options");
+
+    desc.add_options()
+        ("help,h", "Shows this information")
+        ("node,n", po::value<std::vector<std::string>>(&nodes), "Node to connect to as host:port, repeat for more. Connections are spread over them")
+        ("http", po::bool_switch(&options.http), "Use the HTTP api, nodes are then given by their http port")
+        ("uuid,u", po::value<std::string>(&options.uuid)->default_value(options.uuid), "Database uuid")
+        ("connections,c", po::value<size_t>(&options.connections)->default_value(options.connections), "Websocket sessions or HTTP keep-alive connections")
+        ("pipeline,p", po::value<size_t>(&options.pipeline)->default_value(options.pipeline), "Requests each connection keeps in flight")
+        ("rate,r", po::value<double>(&options.rate)->default_value(options.rate), "Operations per second over all connections, 0 runs a closed loop")
+        ("duration,d", po::value<uint64_t>(&duration)->default_value(duration), "Seconds to run the workload for")
+        ("operations", po::value<uint64_t>(&options.operations)->default_value(options.operations), "Stop after this many operations, 0 for no limit")
+        ("records", po::value<uint64_t>(&options.workload.records)->default_value(options.workload.records), "Records the workload chooses keys from")
+        ("load", "Insert the records before running the workload")
+        ("read-proportion", po::value<double>(&options.workload.read_proportion)->default_value(options.workload.read_proportion), "Share of reads")
+        ("update-proportion", po::value<double>(&options.workload.update_proportion)->default_value(options.workload.update_proportion), "Share of updates")
+        ("insert-proportion", po::value<double>(&options.workload.insert_proportion)->default_value(options.workload.insert_proportion), "Share of inserts of new records")
+        ("distribution", po::value<std::string>(&distribution)->default_value(distribution), "Key distribution: uniform, zipfian or latest")
+        ("value-size", po::value<size_t>(&options.workload.value_size)->default_value(options.workload.value_size), "Value size in bytes")
+        ("value-size-max", po::value<size_t>(&options.workload.value_size_max)->default_value(options.workload.value_size_max), "Values are sized uniformly up to this when it is larger than value-size")
+        ("seed", po::value<uint64_t>(&options.seed)->default_value(options.seed), "Workload seed, 0 for a random one");
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help") || vm.count("node") == 0)
+        {
+            std::cout << "Usage:" << '\n'
+                      << "  " << "swarm_bench" << " [OPTION]" << '\n'
+                      << '\n' << desc << '\n';
+            return 0;
+        }
+
+        po::notify(vm);
+    }
+    catch(po::error& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    for (const auto& node : nodes)
+    {
+        std::pair<std::string, uint16_t> address;
+
+        if (!parse_node(node, address))
+        {
+            std::cerr << "ERROR: node is not host:port: " << node << std::endl;
+            return 1;
+        }
+
+        options.nodes.push_back(address);
+    }
+
+    if (!parse_distribution(distribution, options.workload.distribution))
+    {
+        std::cerr << "ERROR: unknown distribution: " << distribution << std::endl;
+        return 1;
+    }
+
+    if (options.workload.read_proportion < 0 || options.workload.update_proportion < 0 || options.workload.insert_proportion < 0 ||
+        options.workload.read_proportion + options.workload.update_proportion + options.workload.insert_proportion <= 0)
+    {
+        std::cerr << "ERROR: operation proportions must be positive" << std::endl;
+        return 1;
+    }
+
+    options.duration = std::chrono::seconds(duration);
+
+    boost::asio::io_context io_context;
+    bzn::bench::runner runner(io_context, options);
+
+    if (vm.count("load"))
+    {
+        bzn::bench::runner::report(*runner.load(), std::cout);
+    }
+
+    bzn::bench::runner::report(*runner.run(), std::cout);
+
+    return 0;
+}
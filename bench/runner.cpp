@@ -0,0 +1,410 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <bench/runner.hpp>
+#include <iomanip>
+#include <numeric>
+#include <random>
+
+using namespace bzn::bench;
+
+namespace
+{
+    const std::array<std::string, 3> OPERATION_NAMES{"read", "update", "insert"};
+
+    const std::array<std::pair<double, const char*>, 6> PERCENTILES{{{0.5, "p50"}, {0.9, "p90"}, {0.99, "p99"}, {0.999, "p99.9"}, {0.9999, "p99.99"}, {1.0, "max"}}};
+
+    uint64_t microseconds(std::chrono::steady_clock::duration duration)
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+}
+
+
+bzn::metrics::histogram::snapshot
+bzn::bench::corrected(const bzn::metrics::histogram::snapshot& snapshot, uint64_t expected_interval)
+{
+    auto result = snapshot;
+
+    if (!expected_interval)
+    {
+        return result;
+    }
+
+    for (size_t i = 0; i < snapshot.counts.size(); ++i)
+    {
+        const auto count = snapshot.counts[i];
+
+        if (!count)
+        {
+            continue;
+        }
+
+        const auto value = bzn::metrics::histogram::bucket_upper_bound(i);
+
+        for (uint64_t missing = (value > expected_interval) ? value - expected_interval : 0; missing >= expected_interval; missing -= expected_interval)
+        {
+            result.counts[bzn::metrics::histogram::bucket_index(missing)] += count;
+            result.count += count;
+            result.sum += missing * count;
+        }
+    }
+
+    return result;
+}
+
+
+runner::runner(boost::asio::io_context& io_context, const bench_options& options)
+    : io_context(io_context)
+    , options(options)
+    , workload(options.workload, options.seed ? options.seed : std::random_device{}())
+    , schedule_timer(io_context)
+    , stop_timer(io_context)
+{
+    for (size_t i = 0; i < std::max<size_t>(options.connections, 1); ++i)
+    {
+        const auto& node = options.nodes[i % options.nodes.size()];
+
+        if (options.http)
+        {
+            this->connections.push_back(std::make_shared<http_connection>(io_context, node.first, node.second, options.uuid, options.pipeline));
+        }
+        else
+        {
+            this->connections.push_back(std::make_shared<websocket_connection>(io_context, node.first, node.second, options.uuid, options.pipeline));
+        }
+    }
+}
+
+
+std::unique_ptr<phase_results>
+runner::load()
+{
+    return this->execute("load",
+        [this, i = uint64_t(0)]() mutable -> std::optional<operation>
+        {
+            if (i >= this->options.workload.records)
+            {
+                return std::nullopt;
+            }
+            return this->workload.load(i++);
+        }, false, std::nullopt);
+}
+
+
+std::unique_ptr<phase_results>
+runner::run()
+{
+    return this->execute("run",
+        [this, count = uint64_t(0)]() mutable -> std::optional<operation>
+        {
+            if (this->options.operations && count >= this->options.operations)
+            {
+                return std::nullopt;
+            }
+            ++count;
+            return this->workload.next();
+        }, this->options.rate > 0, this->options.duration);
+}
+
+
+std::unique_ptr<phase_results>
+runner::execute(const std::string& name, std::function<std::optional<operation>()> next, bool open_loop, std::optional<std::chrono::steady_clock::duration> limit)
+{
+    this->results = std::make_unique<phase_results>();
+    this->results->name = name;
+    this->results->open_loop = open_loop;
+
+    this->next_operation = std::move(next);
+    this->stopping = false;
+    this->finished = false;
+    this->backlog.clear();
+    this->scheduled_count = 0;
+
+    const auto redirects = std::accumulate(this->connections.begin(), this->connections.end(), uint64_t(0),
+        [](uint64_t total, const auto& connection){ return total + connection->redirect_count(); });
+
+    this->io_context.restart();
+    this->start = std::chrono::steady_clock::now();
+
+    if (limit)
+    {
+        this->stop_timer.expires_after(*limit);
+        this->stop_timer.async_wait(
+            [this](const boost::system::error_code& ec)
+            {
+                if (ec)
+                {
+                    return;
+                }
+
+                this->stopping = true;
+                this->results->unsent += this->backlog.size();
+                this->backlog.clear();
+                this->schedule_timer.cancel();
+                this->finish_if_done();
+            });
+    }
+
+    if (open_loop)
+    {
+        this->schedule();
+    }
+    else
+    {
+        for (const auto& connection : this->connections)
+        {
+            for (size_t i = 0; i < std::max<size_t>(this->options.pipeline, 1); ++i)
+            {
+                this->issue_next(connection);
+            }
+        }
+    }
+
+    this->finish_if_done();
+    this->io_context.run();
+
+    this->results->redirects = std::accumulate(this->connections.begin(), this->connections.end(), uint64_t(0),
+        [](uint64_t total, const auto& connection){ return total + connection->redirect_count(); }) - redirects;
+
+    return std::move(this->results);
+}
+
+
+void
+runner::issue(const std::shared_ptr<connection>& connection, operation op, std::chrono::steady_clock::time_point intended)
+{
+    const auto type = op.type;
+
+    connection->send(std::move(op),
+        [this, connection, type, intended, sent = std::chrono::steady_clock::now()](const std::string& error)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            auto& stats = this->results->operations[size_t(type)];
+
+            stats.service.record(microseconds(now - sent));
+            stats.response.record(microseconds(now - intended));
+
+            if (!error.empty())
+            {
+                ++stats.errors;
+                ++this->results->errors[error];
+            }
+
+            if (this->results->open_loop)
+            {
+                this->dispatch();
+            }
+            else
+            {
+                this->issue_next(connection);
+            }
+
+            this->finish_if_done();
+        });
+}
+
+
+void
+runner::issue_next(const std::shared_ptr<connection>& connection)
+{
+    if (this->stopping)
+    {
+        return;
+    }
+
+    auto op = this->next_operation();
+
+    if (!op)
+    {
+        this->stopping = true;
+        return;
+    }
+
+    // a closed loop sends as soon as it can, so it meant to send now...
+    this->issue(connection, std::move(*op), std::chrono::steady_clock::now());
+}
+
+
+void
+runner::schedule()
+{
+    const auto now = std::chrono::steady_clock::now();
+    auto due = now;
+
+    while (!this->stopping)
+    {
+        due = this->start + std::chrono::nanoseconds(uint64_t(this->scheduled_count * 1e9 / this->options.rate));
+
+        if (due > now)
+        {
+            break;
+        }
+
+        auto op = this->next_operation();
+
+        if (!op)
+        {
+            this->stopping = true;
+            break;
+        }
+
+        this->backlog.push_back({std::move(*op), due});
+        ++this->scheduled_count;
+    }
+
+    this->dispatch();
+
+    if (this->stopping)
+    {
+        this->finish_if_done();
+        return;
+    }
+
+    this->schedule_timer.expires_at(due);
+    this->schedule_timer.async_wait(
+        [this](const boost::system::error_code& ec)
+        {
+            if (!ec)
+            {
+                this->schedule();
+            }
+        });
+}
+
+
+void
+runner::dispatch()
+{
+    // requests wait in the backlog for a connection with room, their response time counting all the while...
+    for (size_t full = 0; !this->backlog.empty() && full < this->connections.size(); ++this->next_connection)
+    {
+        const auto& connection = this->connections[this->next_connection % this->connections.size()];
+
+        if (connection->in_flight() >= std::max<size_t>(this->options.pipeline, 1))
+        {
+            ++full;
+            continue;
+        }
+
+        auto next = std::move(this->backlog.front());
+        this->backlog.pop_front();
+
+        this->issue(connection, std::move(next.op), next.intended);
+        full = 0;
+    }
+}
+
+
+void
+runner::finish_if_done()
+{
+    if (this->finished || !this->stopping || !this->backlog.empty() || this->in_flight())
+    {
+        return;
+    }
+
+    this->finished = true;
+    this->results->elapsed = std::chrono::steady_clock::now() - this->start;
+
+    this->stop_timer.cancel();
+    this->schedule_timer.cancel();
+
+    for (const auto& connection : this->connections)
+    {
+        connection->close();
+    }
+
+    this->io_context.stop();
+}
+
+
+size_t
+runner::in_flight() const
+{
+    return std::accumulate(this->connections.begin(), this->connections.end(), size_t(0),
+        [](size_t total, const auto& connection){ return total + connection->in_flight(); });
+}
+
+
+void
+runner::report(const phase_results& results, std::ostream& os)
+{
+    const double seconds = std::chrono::duration<double>(results.elapsed).count();
+
+    uint64_t total = 0;
+    for (const auto& stats : results.operations)
+    {
+        total += stats.service.get_snapshot().count;
+    }
+
+    os << std::fixed << std::setprecision(2)
+       << results.name << ": " << total << " operations in " << seconds << "s, " << (seconds > 0 ? total / seconds : 0) << " ops/s, "
+       << results.redirects << " redirects";
+
+    if (results.unsent)
+    {
+        os << ", " << results.unsent << " scheduled but not sent";
+    }
+
+    os << "\n\n" << std::left << std::setw(18) << "latency (us)" << std::right << std::setw(10) << "count" << std::setw(8) << "errors" << std::setw(10) << "mean";
+
+    for (const auto& percentile : PERCENTILES)
+    {
+        os << std::setw(10) << percentile.second;
+    }
+
+    os << '\n';
+
+    auto row = [&](const std::string& label, const bzn::metrics::histogram::snapshot& snapshot, uint64_t errors)
+    {
+        os << std::left << std::setw(18) << label << std::right << std::setw(10) << snapshot.count << std::setw(8) << errors
+           << std::setw(10) << std::setprecision(0) << double(snapshot.sum) / snapshot.count;
+
+        for (const auto& percentile : PERCENTILES)
+        {
+            os << std::setw(10) << snapshot.quantile(percentile.first);
+        }
+
+        os << '\n';
+    };
+
+    for (size_t i = 0; i < results.operations.size(); ++i)
+    {
+        const auto& stats = results.operations[i];
+        const auto service = stats.service.get_snapshot();
+
+        if (!service.count)
+        {
+            continue;
+        }
+
+        row(OPERATION_NAMES[i] + " service", service, stats.errors);
+
+        // a closed loop has no schedule, so the requests it held back are added as HdrHistogram does...
+        row(OPERATION_NAMES[i] + " response", results.open_loop ? stats.response.get_snapshot() : corrected(service, service.sum / service.count), stats.errors);
+    }
+
+    if (!results.errors.empty())
+    {
+        os << "\nerrors:\n";
+
+        for (const auto& error : results.errors)
+        {
+            os << "  " << error.first << ": " << error.second << '\n';
+        }
+    }
+
+    os << std::endl;
+}
@@ -0,0 +1,128 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <bench/connection.hpp>
+#include <bench/workload.hpp>
+#include <metrics/metrics.hpp>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+
+namespace bzn::bench
+{
+    struct bench_options
+    {
+        std::vector<std::pair<std::string, uint16_t>> nodes;
+        bool http = false;
+        std::string uuid = "swarm_bench";
+        size_t connections = 16;
+        size_t pipeline = 1;
+        double rate = 0; // operations per second over all connections, 0 runs a closed loop
+        std::chrono::seconds duration{10};
+        uint64_t operations = 0; // stops after this many when not 0
+        workload_options workload;
+        uint64_t seed = 0;
+    };
+
+
+    // Latencies in microseconds. Service time runs from a request being sent, response time from when the schedule
+    // meant it to be sent so the wait behind a slow request is counted and not omitted...
+    struct operation_stats
+    {
+        bzn::metrics::histogram service;
+        bzn::metrics::histogram response;
+        uint64_t errors = 0;
+    };
+
+
+    struct phase_results
+    {
+        std::string name;
+        bool open_loop = false;
+        std::chrono::steady_clock::duration elapsed{};
+        std::array<operation_stats, 3> operations; // by operation_type
+        std::map<std::string, uint64_t> errors;
+        uint64_t redirects = 0;
+        uint64_t unsent = 0;  // scheduled but not sent by the end of the run
+    };
+
+
+    /**
+     * Add the samples a closed loop held back while it waited on a slow request, as HdrHistogram does.
+     * @param snapshot           what was measured
+     * @param expected_interval  the time between requests had none been slow
+     * @return a copy with a sample every expected interval below each slower one
+     */
+    bzn::metrics::histogram::snapshot corrected(const bzn::metrics::histogram::snapshot& snapshot, uint64_t expected_interval);
+
+
+    class runner final
+    {
+    public:
+        runner(boost::asio::io_context& io_context, const bench_options& options);
+
+        // inserts the workload's records as fast as the connections allow...
+        std::unique_ptr<phase_results> load();
+
+        // runs the workload for the duration or the operation count...
+        std::unique_ptr<phase_results> run();
+
+        static void report(const phase_results& results, std::ostream& os);
+
+    private:
+        struct scheduled
+        {
+            operation op;
+            std::chrono::steady_clock::time_point intended;
+        };
+
+        std::unique_ptr<phase_results> execute(const std::string& name, std::function<std::optional<operation>()> next, bool open_loop,
+            std::optional<std::chrono::steady_clock::duration> limit);
+
+        void issue(const std::shared_ptr<connection>& connection, operation op, std::chrono::steady_clock::time_point intended);
+        void issue_next(const std::shared_ptr<connection>& connection);
+        void schedule();
+        void dispatch();
+        void finish_if_done();
+        size_t in_flight() const;
+
+        boost::asio::io_context& io_context;
+        const bench_options options;
+        bzn::bench::workload workload;
+        std::vector<std::shared_ptr<connection>> connections;
+
+        // the phase being run...
+        std::unique_ptr<phase_results> results;
+        std::function<std::optional<operation>()> next_operation;
+        bool stopping = false;
+        bool finished = false;
+        std::chrono::steady_clock::time_point start;
+
+        // open loop schedule and the requests waiting for a connection...
+        boost::asio::steady_timer schedule_timer;
+        boost::asio::steady_timer stop_timer;
+        std::deque<scheduled> backlog;
+        uint64_t scheduled_count = 0;
+        size_t next_connection = 0;
+    };
+
+} // bzn::bench
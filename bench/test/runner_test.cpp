@@ -0,0 +1,201 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <bench/runner.hpp>
+#include <proto/bluzelle.pb.h>
+#include <boost/beast/core/detail/base64.hpp>
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+using namespace bzn::bench;
+
+namespace
+{
+    // answers database requests over websockets, a follower redirecting every one of them to the leader...
+    class fake_node : public std::enable_shared_from_this<fake_node>
+    {
+    public:
+        fake_node(boost::asio::io_context& io_context, uint16_t leader_port = 0)
+            : acceptor(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+            , leader_port(leader_port)
+        {
+        }
+
+        void start()
+        {
+            this->acceptor.async_accept(
+                [self = shared_from_this()](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)
+                {
+                    if (ec)
+                    {
+                        return;
+                    }
+
+                    auto ws = std::make_shared<boost::beast::websocket::stream<boost::asio::ip::tcp::socket>>(std::move(socket));
+                    ws->async_accept(
+                        [self, ws](const boost::system::error_code& ec)
+                        {
+                            if (!ec)
+                            {
+                                self->read(ws, std::make_shared<boost::beast::flat_buffer>());
+                            }
+                        });
+
+                    self->start();
+                });
+        }
+
+        uint16_t port() const { return this->acceptor.local_endpoint().port(); }
+
+        size_t requests = 0;
+
+    private:
+        void read(std::shared_ptr<boost::beast::websocket::stream<boost::asio::ip::tcp::socket>> ws, std::shared_ptr<boost::beast::flat_buffer> buffer)
+        {
+            ws->async_read(*buffer,
+                [self = shared_from_this(), ws, buffer](const boost::system::error_code& ec, size_t /*bytes*/)
+                {
+                    if (ec)
+                    {
+                        return;
+                    }
+
+                    Json::Value json;
+                    Json::Reader().parse(boost::beast::buffers_to_string(buffer->data()), json);
+                    buffer->consume(buffer->size());
+
+                    bzn_msg msg;
+                    msg.ParseFromString(boost::beast::detail::base64_decode(json["msg"].asString()));
+
+                    database_response response;
+                    *response.mutable_header() = msg.db().header();
+
+                    if (self->leader_port)
+                    {
+                        response.mutable_redirect()->set_leader_host("127.0.0.1");
+                        response.mutable_redirect()->set_leader_port(self->leader_port);
+                    }
+                    else
+                    {
+                        ++self->requests;
+                    }
+
+                    // replies are written one at a time and in order, as a session does...
+                    ws->binary(true);
+                    ws->write(boost::asio::buffer(response.SerializeAsString()));
+
+                    self->read(ws, buffer);
+                });
+        }
+
+        boost::asio::ip::tcp::acceptor acceptor;
+        const uint16_t leader_port;
+    };
+}
+
+
+TEST(runner_test, test_that_a_closed_loop_correction_adds_the_samples_held_back)
+{
+    bzn::metrics::histogram histogram;
+
+    // a request every 1ms and one that stalled for 10ms...
+    for (int i = 0; i < 100; ++i)
+    {
+        histogram.record(1000);
+    }
+    histogram.record(10000);
+
+    const auto measured = histogram.get_snapshot();
+    const auto result = corrected(measured, 1000);
+
+    // the nine requests that would have gone out during the stall, waiting 9ms down to 1ms...
+    EXPECT_EQ(measured.count + 9, result.count);
+    EXPECT_GT(result.quantile(0.95), measured.quantile(0.95));
+    EXPECT_EQ(measured.quantile(1.0), result.quantile(1.0));
+
+    EXPECT_EQ(measured.count, corrected(measured, 0).count);
+}
+
+
+TEST(runner_test, test_that_requests_follow_redirects_to_the_leader)
+{
+    boost::asio::io_context io_context;
+
+    auto leader = std::make_shared<fake_node>(io_context);
+    auto follower = std::make_shared<fake_node>(io_context, leader->port());
+    leader->start();
+    follower->start();
+
+    bench_options options;
+    options.nodes = {{"127.0.0.1", follower->port()}};
+    options.connections = 2;
+    options.pipeline = 2;
+    options.operations = 100;
+    options.workload.records = 10;
+    options.seed = 1;
+
+    runner runner(io_context, options);
+
+    const auto load = runner.load();
+    EXPECT_EQ(0u, load->operations[size_t(operation_type::read)].service.get_snapshot().count);
+    EXPECT_EQ(10u, load->operations[size_t(operation_type::insert)].service.get_snapshot().count);
+
+    // each connection moved once, answering the requests it had in flight first...
+    EXPECT_EQ(4u, load->redirects);
+
+    const auto run = runner.run();
+    EXPECT_EQ(100u, run->operations[size_t(operation_type::read)].service.get_snapshot().count + run->operations[size_t(operation_type::update)].service.get_snapshot().count);
+    EXPECT_EQ(0u, run->redirects);
+    EXPECT_TRUE(run->errors.empty());
+
+    EXPECT_EQ(110u, leader->requests);
+
+    std::ostringstream report;
+    runner::report(*run, report);
+    EXPECT_NE(std::string::npos, report.str().find("run: 100 operations"));
+}
+
+
+TEST(runner_test, test_that_an_open_loop_measures_from_the_schedule)
+{
+    boost::asio::io_context io_context;
+
+    auto leader = std::make_shared<fake_node>(io_context);
+    leader->start();
+
+    bench_options options;
+    options.nodes = {{"127.0.0.1", leader->port()}};
+    options.connections = 1;
+    options.rate = 1000;
+    options.operations = 200;
+    options.seed = 1;
+
+    runner runner(io_context, options);
+    const auto run = runner.run();
+
+    EXPECT_TRUE(run->open_loop);
+    EXPECT_EQ(200u, leader->requests);
+
+    // about 200ms at the rate asked for...
+    EXPECT_GE(run->elapsed, std::chrono::milliseconds(190));
+
+    for (const auto& stats : run->operations)
+    {
+        const auto service = stats.service.get_snapshot();
+        const auto response = stats.response.get_snapshot();
+
+        EXPECT_EQ(service.count, response.count);
+        EXPECT_GE(response.sum, service.sum);
+    }
+}
@@ -0,0 +1,122 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <bench/workload.hpp>
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+
+using namespace bzn::bench;
+
+
+TEST(workload_test, test_that_zipfian_ranks_favour_the_first_items)
+{
+    std::mt19937_64 gen(1);
+    zipfian_generator zipfian(1000);
+
+    std::vector<size_t> counts(1000);
+    for (int i = 0; i < 100000; ++i)
+    {
+        const auto rank = zipfian.next(gen);
+        ASSERT_LT(rank, 1000u);
+        ++counts[rank];
+    }
+
+    EXPECT_GT(counts[0], counts[1]);
+    EXPECT_GT(counts[1], counts[10]);
+    EXPECT_GT(counts[10], counts[500]);
+
+    // with theta near 1 the first item is drawn about 1/zeta(1000) of the time...
+    EXPECT_NEAR(0.134, counts[0] / 100000.0, 0.01);
+
+    // growing keeps the ranks inside the new count...
+    zipfian.grow(2000);
+    EXPECT_EQ(2000u, zipfian.items());
+
+    bool beyond = false;
+    for (int i = 0; i < 100000; ++i)
+    {
+        const auto rank = zipfian.next(gen);
+        ASSERT_LT(rank, 2000u);
+        beyond |= rank >= 1000;
+    }
+    EXPECT_TRUE(beyond);
+}
+
+
+TEST(workload_test, test_that_operations_follow_the_mix_and_inserts_add_records)
+{
+    workload_options options;
+    options.read_proportion = 0.6;
+    options.update_proportion = 0.3;
+    options.insert_proportion = 0.1;
+    options.distribution = key_distribution::uniform;
+    options.records = 100;
+    options.value_size = 10;
+    options.value_size_max = 20;
+
+    workload workload(options, 1);
+
+    std::array<size_t, 3> counts{};
+    std::set<std::string> inserted;
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        const auto op = workload.next();
+        ++counts[size_t(op.type)];
+
+        if (op.type == operation_type::read)
+        {
+            EXPECT_TRUE(op.value.empty());
+        }
+        else
+        {
+            EXPECT_GE(op.value.size(), 10u);
+            EXPECT_LE(op.value.size(), 20u);
+        }
+
+        if (op.type == operation_type::insert)
+        {
+            EXPECT_TRUE(inserted.insert(op.key).second);
+        }
+    }
+
+    EXPECT_NEAR(6000, counts[size_t(operation_type::read)], 300);
+    EXPECT_NEAR(3000, counts[size_t(operation_type::update)], 300);
+    EXPECT_NEAR(1000, counts[size_t(operation_type::insert)], 300);
+
+    EXPECT_EQ(100 + counts[size_t(operation_type::insert)], workload.record_count());
+    EXPECT_EQ(1u, inserted.count(workload::key(100)));
+    EXPECT_EQ(workload::key(7), workload.load(7).key);
+}
+
+
+TEST(workload_test, test_that_latest_favours_the_newest_records)
+{
+    workload_options options;
+    options.read_proportion = 1;
+    options.update_proportion = 0;
+    options.distribution = key_distribution::latest;
+    options.records = 1000;
+
+    workload workload(options, 1);
+
+    size_t newest = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        newest += workload.next().key == workload::key(999);
+    }
+
+    EXPECT_GT(newest, 1000u);
+}
@@ -0,0 +1,188 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <bench/workload.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace bzn::bench;
+
+namespace
+{
+    // values are cut from this many bytes of random text so they are cheap to make...
+    const size_t VALUE_POOL_SIZE = 1024 * 1024;
+
+    uint64_t fnv_hash(uint64_t value)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for (int i = 0; i < 8; ++i)
+        {
+            hash ^= value & 0xff;
+            hash *= 0x100000001b3ull;
+            value >>= 8;
+        }
+
+        return hash;
+    }
+
+    const std::string& value_pool()
+    {
+        static const std::string pool = []()
+        {
+            std::mt19937_64 gen(0);
+            std::uniform_int_distribution<int> letter('a', 'z');
+
+            std::string pool(VALUE_POOL_SIZE, ' ');
+            std::generate(pool.begin(), pool.end(), [&](){ return char(letter(gen)); });
+            return pool;
+        }();
+
+        return pool;
+    }
+}
+
+
+zipfian_generator::zipfian_generator(uint64_t items, double theta)
+    : item_count(0)
+    , theta(theta)
+    , zeta2(1 + std::pow(0.5, theta))
+{
+    this->grow(std::max<uint64_t>(items, 1));
+}
+
+
+void
+zipfian_generator::grow(uint64_t items)
+{
+    // zeta(n) = sum of 1/i^theta for i in [1, n], extended from the last count...
+    for (uint64_t i = this->item_count + 1; i <= items; ++i)
+    {
+        this->zetan += 1 / std::pow(double(i), this->theta);
+    }
+
+    this->item_count = std::max(this->item_count, items);
+    this->update_constants();
+}
+
+
+void
+zipfian_generator::update_constants()
+{
+    this->alpha = 1 / (1 - this->theta);
+    this->eta = (1 - std::pow(2.0 / this->item_count, 1 - this->theta)) / (1 - this->zeta2 / this->zetan);
+}
+
+
+uint64_t
+zipfian_generator::next(std::mt19937_64& gen)
+{
+    const double u = std::uniform_real_distribution<double>(0, 1)(gen);
+    const double uz = u * this->zetan;
+
+    if (uz < 1)
+    {
+        return 0;
+    }
+
+    if (uz < this->zeta2)
+    {
+        return std::min<uint64_t>(1, this->item_count - 1);
+    }
+
+    return std::min<uint64_t>(uint64_t(this->item_count * std::pow(this->eta * u - this->eta + 1, this->alpha)), this->item_count - 1);
+}
+
+
+workload::workload(const workload_options& options, uint64_t seed)
+    : options(options)
+    , gen(seed)
+    , zipfian(options.records)
+    , records(options.records)
+{
+}
+
+
+operation
+workload::next()
+{
+    const double total = this->options.read_proportion + this->options.update_proportion + this->options.insert_proportion;
+    const double u = this->unit(this->gen) * total;
+
+    if (u < this->options.read_proportion)
+    {
+        return {operation_type::read, workload::key(this->next_record()), {}};
+    }
+
+    if (u < this->options.read_proportion + this->options.update_proportion)
+    {
+        return {operation_type::update, workload::key(this->next_record()), this->next_value()};
+    }
+
+    return {operation_type::insert, workload::key(this->records++), this->next_value()};
+}
+
+
+operation
+workload::load(uint64_t i)
+{
+    return {operation_type::insert, workload::key(i), this->next_value()};
+}
+
+
+std::string
+workload::key(uint64_t i)
+{
+    return "user" + std::to_string(i);
+}
+
+
+uint64_t
+workload::next_record()
+{
+    const auto records = std::max<uint64_t>(this->records, 1);
+
+    switch (this->options.distribution)
+    {
+        case key_distribution::uniform:
+            return std::uniform_int_distribution<uint64_t>(0, records - 1)(this->gen);
+
+        case key_distribution::zipfian:
+            this->zipfian.grow(records);
+
+            // scattered so the popular records are not all neighbours...
+            return fnv_hash(this->zipfian.next(this->gen)) % records;
+
+        case key_distribution::latest:
+            this->zipfian.grow(records);
+
+            // the most recent inserts are the most popular...
+            return records - 1 - this->zipfian.next(this->gen);
+    }
+
+    return 0;
+}
+
+
+std::string
+workload::next_value()
+{
+    const size_t size = std::min(VALUE_POOL_SIZE, (this->options.value_size_max > this->options.value_size)
+        ? std::uniform_int_distribution<size_t>(this->options.value_size, this->options.value_size_max)(this->gen)
+        : this->options.value_size);
+
+    const size_t offset = std::uniform_int_distribution<size_t>(0, VALUE_POOL_SIZE - size)(this->gen);
+
+    return value_pool().substr(offset, size);
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+
+namespace bzn::bench
+{
+    enum class operation_type : uint8_t
+    {
+        read=0,
+        update,
+        insert
+    };
+
+    enum class key_distribution : uint8_t
+    {
+        uniform=0,
+        zipfian,
+        latest
+    };
+
+    struct operation
+    {
+        operation_type type;
+        std::string key;
+        std::string value; // empty for reads
+    };
+
+    struct workload_options
+    {
+        double read_proportion = 0.5;
+        double update_proportion = 0.5;
+        double insert_proportion = 0;
+        key_distribution distribution = key_distribution::zipfian;
+        uint64_t records = 10000;
+        size_t value_size = 100;
+        size_t value_size_max = 0; // sizes are uniform between value_size and this when it is larger
+    };
+
+
+    // Item ranks drawn with probability proportional to 1/rank^theta, after Gray et al. "Quickly Generating
+    // Billion-Record Synthetic Databases" as YCSB does. The item count may grow without starting over...
+    class zipfian_generator final
+    {
+    public:
+        static constexpr double ZIPFIAN_CONSTANT = 0.99;
+
+        explicit zipfian_generator(uint64_t items, double theta = ZIPFIAN_CONSTANT);
+
+        // rank in [0, items), 0 the most popular...
+        uint64_t next(std::mt19937_64& gen);
+
+        void grow(uint64_t items);
+
+        uint64_t items() const { return this->item_count; }
+
+    private:
+        void update_constants();
+
+        uint64_t item_count;
+        const double theta;
+        const double zeta2;
+        double zetan = 0;
+        double alpha = 0;
+        double eta = 0;
+    };
+
+
+    // YCSB style core workload: a mix of reads, updates and inserts over keys chosen by a distribution...
+    class workload final
+    {
+    public:
+        workload(const workload_options& options, uint64_t seed);
+
+        operation next();
+
+        // the insert of record i of the load phase...
+        operation load(uint64_t i);
+
+        // records loaded and inserted so far...
+        uint64_t record_count() const { return this->records; }
+
+        static std::string key(uint64_t i);
+
+    private:
+        uint64_t next_record();
+        std::string next_value();
+
+        const workload_options options;
+        std::mt19937_64 gen;
+        std::uniform_real_distribution<double> unit{0, 1};
+        zipfian_generator zipfian;
+        uint64_t records;
+    };
+
+} // bzn::bench
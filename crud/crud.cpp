@@ -13,18 +13,151 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <crud/crud.hpp>
+#include <metrics/metrics.hpp>
 #include <numeric>
+#include <set>
 #include <storage/storage.hpp>
 
 #include <boost/beast/core/detail/base64.hpp>
 
+namespace
+{
+    // how long a client waits for its write to commit...
+    const std::chrono::seconds COMMIT_TIMEOUT{10};
+
+    const std::chrono::milliseconds COMMIT_TIMER_INTERVAL{500};
+
+    // a forwarded write also pays for the hop to the leader and back...
+    const std::chrono::seconds FORWARD_TIMEOUT{COMMIT_TIMEOUT + std::chrono::seconds(2)};
+
+    // scans return values so their pages are bounded even when the client asks for more...
+    const size_t MAX_SCAN_LIMIT = 100;
+
+    // keys pages are larger as they carry no values, but never a whole database...
+    const size_t MAX_KEYS_LIMIT = 10000;
+
+    // keys removed by one eviction entry...
+    const size_t MAX_EXPIRE_BATCH = 1000;
+
+    // commits remembered for writes that commit before they can be parked...
+    const size_t RECENT_COMMITS = 1024;
+
+    const std::string FORWARD_ID_KEY{"forward_id"};
+    const std::string FORWARD_API{"database_forward"};
+
+    struct crud_metrics
+    {
+        crud_metrics()
+        {
+            // a counter per request type...
+            const auto oneof = database_msg::descriptor()->FindOneofByName("msg");
+
+            for (int i = 0; i < oneof->field_count(); ++i)
+            {
+                this->requests[database_msg::MsgCase(oneof->field(i)->number())] = &bzn::metrics::registry::global().get_counter(
+                    "crud_requests_total", "Database requests received.", {{"type", oneof->field(i)->name()}});
+            }
+        }
+
+        std::unordered_map<database_msg::MsgCase, bzn::metrics::counter*> requests;
+
+        bzn::metrics::histogram& latency = bzn::metrics::registry::global().get_histogram("crud_response_latency_microseconds", "Time to respond to a request, including the commit for writes.");
+        bzn::metrics::counter& errors = bzn::metrics::registry::global().get_counter("crud_errors_total", "Responses carrying an error.");
+        bzn::metrics::gauge& pending_writes = bzn::metrics::registry::global().get_gauge("crud_pending_writes", "Writes waiting for a commit.");
+        bzn::metrics::counter& forwarded_writes = bzn::metrics::registry::global().get_counter("crud_forwarded_writes_total", "Writes a follower forwarded to the leader.");
+        bzn::metrics::counter& redirected_writes = bzn::metrics::registry::global().get_counter("crud_redirected_writes_total", "Writes a follower redirected back to the client.");
+        bzn::metrics::counter& expired_keys = bzn::metrics::registry::global().get_counter("crud_expired_keys_total", "Keys removed once their ttl passed.");
+        bzn::metrics::histogram& forward_latency = bzn::metrics::registry::global().get_histogram("crud_forward_latency_microseconds", "Time for the leader to answer a forwarded write.");
+    };
+
+    crud_metrics& get_metrics()
+    {
+        static crud_metrics metrics;
+        return metrics;
+    }
+
+    bzn::storage_base::operation expiring_write(bzn::storage_base::operation::type op, const std::string& key, const std::string& value, uint64_t expires)
+    {
+        bzn::storage_base::operation operation;
+        operation.op = op;
+        operation.key = key;
+        operation.value = value;
+        operation.expires = std::chrono::seconds(expires);
+
+        return operation;
+    }
+
+
+    const std::string& commit_result_error(bzn::storage_base::result result)
+    {
+        switch (result)
+        {
+            case bzn::storage_base::result::exists:
+                return bzn::MSG_RECORD_EXISTS;
+
+            case bzn::storage_base::result::not_found:
+                return bzn::MSG_RECORD_NOT_FOUND;
+
+            case bzn::storage_base::result::value_too_large:
+                return bzn::MSG_VALUE_SIZE_TOO_LARGE;
+
+            case bzn::storage_base::result::precondition_failed:
+                return bzn::MSG_PRECONDITION_FAILED;
+
+            case bzn::storage_base::result::not_a_number:
+                return bzn::MSG_VALUE_NOT_A_NUMBER;
+
+            default:
+                return bzn::MSG_INVALID_CRUD_COMMAND;
+        }
+    }
+
+
+    // fingerprint of an entry's request taken without copying it...
+    size_t request_hash(const bzn::message& msg)
+    {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+
+        if (!msg["msg"].isString() || !msg["msg"].getString(&begin, &end))
+        {
+            return 0;
+        }
+
+        return std::hash<std::string_view>{}(std::string_view(begin, end - begin));
+    }
+
+
+    void send_response(const bzn::message& ws_msg, const std::shared_ptr<bzn::session_base>& session, const database_response& response, bool end_session)
+    {
+        if (ws_msg.isMember(FORWARD_ID_KEY))
+        {
+            // the follower relays the response to its client...
+            bzn::message msg;
+            msg["bzn-api"] = FORWARD_API;
+            msg[FORWARD_ID_KEY] = ws_msg[FORWARD_ID_KEY];
+            msg["msg"] = boost::beast::detail::base64_encode(response.SerializeAsString());
+
+            session->send_message(std::make_shared<bzn::message>(std::move(msg)), end_session);
+            return;
+        }
+
+        session->send_message(std::make_shared<std::string>(response.SerializeAsString()), end_session);
+    }
+}
+
+
 using namespace bzn;
 
 
-crud::crud(std::shared_ptr<bzn::node_base> node, std::shared_ptr<bzn::raft_base> raft, std::shared_ptr<bzn::storage_base> storage)
+crud::crud(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::node_base> node, std::shared_ptr<bzn::raft_base> raft,
+    std::shared_ptr<bzn::storage_base> storage, bool forward_writes)
         : raft(std::move(raft))
         , node(std::move(node))
         , storage(std::move(storage))
+        , commit_timer(io_context->make_unique_steady_timer())
+        , recent_commits(RECENT_COMMITS)
+        , forward_writes(forward_writes)
 {
     this->register_route_handlers();
     this->register_command_handlers();
@@ -48,19 +181,33 @@ crud::start()
                 throw std::runtime_error("Unable to register for DATABASE messages!");
             }
 
+            // responses from the leader to writes we forwarded...
+            if (!this->node->register_for_message(FORWARD_API
+                                                  , std::bind(&crud::handle_forwarded_response
+                                                  , shared_from_this()
+                                                  , std::placeholders::_1
+                                                  , std::placeholders::_2)))
+            {
+                throw std::runtime_error("Unable to register for DATABASE_FORWARD messages!");
+            }
+
             // the commit handler deals with tasks that require concensus from RAFT
             this->raft->register_commit_handler(
-                [self = shared_from_this()](const bzn::message& ws_msg)
+                [self = shared_from_this()](const bzn::message& ws_msg, uint32_t log_index)
                 {
                     bzn_msg msg;
+                    auto result = bzn::storage_base::result::ok;
 
                     if (msg.ParseFromString(boost::beast::detail::base64_decode(ws_msg["msg"].asString())))
                     {
                         if (msg.msg_case() == bzn_msg::kDb)
                         {
+                            self->storage->set_commit_index(log_index);
+                            self->storage->set_commit_time(std::chrono::seconds(msg.db().timestamp()));
+
                             if (auto search = self->commit_handlers.find(msg.db().msg_case()); search != self->commit_handlers.end())
                             {
-                                search->second(msg.db());
+                                result = search->second(msg.db());
                             }
                         }
                     }
@@ -69,47 +216,281 @@ crud::start()
                         LOG(error) << "failed to decode commit message:\n" << ws_msg.toStyledString().substr(0,60);
                     }
 
+                    self->complete_pending_write(ws_msg, log_index, result);
+
                     return true;
                 });
+
+            this->start_commit_timer();
         });
 }
 
 
 void
-crud::do_raft_task_routing(const bzn::message& msg, const database_msg& request, database_response& response)
+crud::append_write(const bzn::message& msg, database_response response, bzn::crud_base::response_handler handler)
+{
+    // the forward id only routes the reply back to the follower, which the parked handler already does,
+    // so it is kept out of the log every replica stores and replays...
+    const bzn::message* entry = &msg;
+    bzn::message stripped;
+
+    if (msg.isMember(FORWARD_ID_KEY))
+    {
+        stripped = msg;
+        stripped.removeMember(FORWARD_ID_KEY);
+        entry = &stripped;
+    }
+
+    uint32_t log_index;
+
+    if (!this->raft->append_log(*entry, log_index))
+    {
+        // lost leadership since routing...
+        this->set_leader_info(response);
+        handler(response);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+
+        if (log_index > this->last_commit_index)
+        {
+            this->pending_writes[log_index] = pending_write{msg["msg"].asString(), std::move(response), std::move(handler),
+                std::chrono::steady_clock::now() + COMMIT_TIMEOUT};
+            get_metrics().pending_writes.set(this->pending_writes.size());
+            return;
+        }
+
+        // raft committed the entry before we could park it, so answer with what the commit left behind...
+        const auto& commit = this->recent_commits[log_index % RECENT_COMMITS];
+
+        if (commit.log_index != log_index)
+        {
+            LOG(warning) << "result of commit " << log_index << " is no longer held";
+            response.mutable_resp()->set_error(bzn::MSG_COMMIT_TIMEOUT);
+        }
+        else
+        {
+            set_commit_error(response, commit.request_hash != request_hash(*entry), commit.result);
+        }
+    }
+
+    handler(response);
+}
+
+
+void
+crud::set_commit_error(database_response& response, bool replaced, bzn::storage_base::result result)
+{
+    if (replaced)
+    {
+        // a new leader replaced our entry...
+        response.mutable_resp()->set_error(bzn::MSG_LEADER_CHANGED);
+    }
+    else if (result != bzn::storage_base::result::ok)
+    {
+        response.mutable_resp()->set_error(commit_result_error(result));
+    }
+}
+
+
+void
+crud::complete_pending_write(const bzn::message& msg, uint32_t log_index, bzn::storage_base::result result)
+{
+    pending_write write;
+
+    {
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+
+        this->last_commit_index = std::max(this->last_commit_index, log_index);
+
+        auto it = this->pending_writes.find(log_index);
+
+        if (it == this->pending_writes.end())
+        {
+            // the write may still be on its way to being parked...
+            this->recent_commits[log_index % RECENT_COMMITS] = {log_index, request_hash(msg), result};
+            return;
+        }
+
+        write = std::move(it->second);
+        this->pending_writes.erase(it);
+        get_metrics().pending_writes.set(this->pending_writes.size());
+    }
+
+    set_commit_error(write.response, write.msg != msg["msg"].asString(), result);
+
+    write.handler(write.response);
+}
+
+
+void
+crud::start_commit_timer()
+{
+    this->commit_timer->expires_from_now(COMMIT_TIMER_INTERVAL);
+
+    this->commit_timer->async_wait(std::bind(&crud::handle_commit_timeout, shared_from_this(), std::placeholders::_1));
+}
+
+
+void
+crud::handle_commit_timeout(const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        LOG(debug) << "commit timer canceled: " << ec.message();
+        return;
+    }
+
+    std::vector<pending_write> failed;
+
+    // once we are no longer the leader our entries may or may not be committed by the new leader...
+    const bool leader = this->raft->get_state() == bzn::raft_state::leader;
+
+    {
+        const auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+
+        for (auto it = this->pending_writes.begin(); it != this->pending_writes.end();)
+        {
+            if (!leader || it->second.deadline <= now)
+            {
+                it->second.response.mutable_resp()->set_error(leader ? bzn::MSG_COMMIT_TIMEOUT : bzn::MSG_LEADER_CHANGED);
+                failed.emplace_back(std::move(it->second));
+                it = this->pending_writes.erase(it);
+                continue;
+            }
+
+            ++it;
+        }
+
+        get_metrics().pending_writes.set(this->pending_writes.size());
+
+        // the leader may have died or changed while holding our forwarded writes...
+        for (auto it = this->pending_forwards.begin(); it != this->pending_forwards.end();)
+        {
+            if (it->second.deadline <= now)
+            {
+                it->second.response.mutable_resp()->set_error(bzn::MSG_COMMIT_TIMEOUT);
+                failed.emplace_back(std::move(it->second));
+                it = this->pending_forwards.erase(it);
+                continue;
+            }
+
+            ++it;
+        }
+    }
+
+    if (!failed.empty())
+    {
+        LOG(info) << "failing " << failed.size() << " uncommitted writes";
+    }
+
+    for (auto& write : failed)
+    {
+        write.handler(write.response);
+    }
+
+    if (leader)
+    {
+        this->propose_expired();
+    }
+
+    this->start_commit_timer();
+}
+
+
+void
+crud::propose_expired()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+
+        // wait for the previous batch so the same keys are not proposed twice...
+        if (this->expire_index > this->last_commit_index)
+        {
+            return;
+        }
+    }
+
+    const auto cutoff = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+
+    // the index is in expiry order, so this costs the same however many keys carry a ttl...
+    std::map<bzn::uuid_t, bzn_msg> batches;
+
+    for (const auto& expired : this->storage->get_expired(cutoff, MAX_EXPIRE_BATCH))
+    {
+        auto& batch = batches[expired.first];
+        batch.mutable_db()->mutable_header()->set_db_uuid(expired.first);
+        batch.mutable_db()->mutable_expire()->set_cutoff(cutoff.count());
+        batch.mutable_db()->mutable_expire()->add_keys(expired.second);
+    }
+
+    for (const auto& batch : batches)
+    {
+        bzn::message msg;
+        msg["bzn-api"] = "database";
+        msg["msg"] = boost::beast::detail::base64_encode(batch.second.SerializeAsString());
+
+        uint32_t log_index;
+
+        if (!this->raft->append_log(msg, log_index))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+        this->expire_index = log_index;
+    }
+}
+
+
+void
+crud::do_raft_task_routing(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
 {
     if (auto it = this->route_handlers.find(raft->get_state()); it != this->route_handlers.end())
     {
-        it->second(msg, request, response);
+        it->second(msg, request, std::move(handler));
         return;
     }
 
+    database_response response;
+    *response.mutable_header() = request.header();
     response.mutable_resp()->set_error(bzn::MSG_INVALID_RAFT_STATE);
+
+    handler(response);
 }
 
 
 void
-crud::handle_create(const bzn::message& msg, const database_msg& request, database_response& response)
+crud::handle_create(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
 {
+    database_response response;
+    *response.mutable_header() = request.header();
+
     if (this->validate_value_size(request.create().value().size()))
     {
         response.mutable_resp()->set_error(bzn::MSG_VALUE_SIZE_TOO_LARGE);
+        handler(response);
         return;
     }
 
     if (this->storage->has(request.header().db_uuid(), request.create().key()))
     {
         response.mutable_resp()->set_error(bzn::MSG_RECORD_EXISTS);
+        handler(response);
         return;
     }
 
     if (this->raft->get_state() == bzn::raft_state::leader)
     {
-        this->raft->append_log(msg);
+        this->append_write(this->stamp_expiry(msg, request), std::move(response), std::move(handler));
         return;
     }
 
-    this->set_leader_info(response);
+    this->redirect_write(msg, std::move(response), std::move(handler));
 }
 
 
@@ -118,6 +499,18 @@ crud::handle_read(const bzn::message& /*msg*/, const database_msg& request, data
 {
     if (auto record = this->storage->read(request.header().db_uuid(), request.read().key()); record)
     {
+        response.mutable_resp()->set_version(record->version());
+
+        // the client already holds this version...
+        for (const auto& version : request.read().if_none_match())
+        {
+            if (version == response.resp().version() || version == "*")
+            {
+                response.mutable_resp()->set_not_modified(true);
+                return;
+            }
+        }
+
         response.mutable_resp()->set_value(record->value);
         return;
     }
@@ -133,63 +526,96 @@ crud::handle_read(const bzn::message& /*msg*/, const database_msg& request, data
 
 
 void
-crud::handle_update(const bzn::message& msg, const database_msg& request, database_response& response)
+crud::handle_update(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
 {
+    database_response response;
+    *response.mutable_header() = request.header();
+
     if (this->validate_value_size(request.update().value().size()))
     {
         response.mutable_resp()->set_error(bzn::MSG_VALUE_SIZE_TOO_LARGE);
+        handler(response);
         return;
     }
 
     if (!this->storage->has(request.header().db_uuid(), request.update().key()))
     {
         response.mutable_resp()->set_error(bzn::MSG_RECORD_NOT_FOUND);
+        handler(response);
         return;
     }
 
     if (this->raft->get_state() == bzn::raft_state::leader)
     {
-        this->raft->append_log(msg);
+        this->append_write(this->stamp_expiry(msg, request), std::move(response), std::move(handler));
         return;
     }
 
-    this->set_leader_info(response);
+    this->redirect_write(msg, std::move(response), std::move(handler));
 }
 
 
 void
-crud::handle_delete(const bzn::message& msg, const database_msg& request, database_response& response)
+crud::handle_delete(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
 {
+    database_response response;
+    *response.mutable_header() = request.header();
+
     if (this->raft->get_state() != bzn::raft_state::leader)
     {
-        this->set_leader_info(response);
+        this->redirect_write(msg, std::move(response), std::move(handler));
         return;
     }
 
     if (this->storage->has(request.header().db_uuid(), request.delete_().key()))
     {
-        this->raft->append_log(msg);
+        this->append_write(this->stamp_expiry(msg, request), std::move(response), std::move(handler));
         return;
     }
 
     response.mutable_resp()->set_error(bzn::MSG_RECORD_NOT_FOUND);
+    handler(response);
 }
 
 
 void
 crud::handle_get_keys(const bzn::message& /*msg*/, const database_msg& request, database_response& response)
 {
-    auto keys = this->storage->get_keys(request.header().db_uuid());
+    for (const auto& record : this->scan_page(request.header().db_uuid(), request.keys(), MAX_KEYS_LIMIT, response))
+    {
+        response.mutable_resp()->add_keys(record.first);
+    }
+}
+
 
-    if (keys.empty())
+void
+crud::handle_scan(const bzn::message& /*msg*/, const database_msg& request, database_response& response)
+{
+    for (const auto& record : this->scan_page(request.header().db_uuid(), request.scan(), MAX_SCAN_LIMIT, response))
     {
-        return;
+        auto entry = response.mutable_resp()->add_records();
+        entry->set_key(record.first);
+        entry->set_value(record.second->value);
+        entry->set_version(record.second->version());
     }
+}
+
 
-    for (const auto& key : keys)
+bzn::storage_base::scan_result
+crud::scan_page(const bzn::uuid_t& uuid, const database_range& range, size_t max_limit, database_response& response)
+{
+    const size_t limit = (range.limit()) ? std::min<size_t>(range.limit(), max_limit) : max_limit;
+
+    // one extra record tells us where the next page starts...
+    auto records = this->storage->scan(uuid, range.start(), range.end(), range.prefix(), limit + 1);
+
+    if (records.size() > limit)
     {
-        response.mutable_resp()->add_keys(key);
+        response.mutable_resp()->set_next_key(records.back().first);
+        records.pop_back();
     }
+
+    return records;
 }
 
 
@@ -208,32 +634,430 @@ crud::handle_size(const bzn::message& /*msg*/, const database_msg& request, data
 
 
 void
+crud::handle_batch(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
+{
+    database_response response;
+    *response.mutable_header() = request.header();
+
+    if (request.batch().ops().empty())
+    {
+        response.mutable_resp()->set_error(bzn::MSG_INVALID_ARGUMENTS);
+        handler(response);
+        return;
+    }
+
+    if (size_t(request.batch().ops_size()) > bzn::MAX_BATCH_OPS)
+    {
+        response.mutable_resp()->set_error(bzn::MSG_BATCH_TOO_LARGE);
+        handler(response);
+        return;
+    }
+
+    // preconditions are evaluated when the batch commits...
+    for (const auto& op : request.batch().ops())
+    {
+        if (op.op_case() == database_batch_op::OP_NOT_SET)
+        {
+            response.mutable_resp()->set_error(bzn::MSG_INVALID_ARGUMENTS);
+            handler(response);
+            return;
+        }
+
+        if (this->validate_value_size(std::max({op.create().value().size(), op.update().value().size(), op.append().value().size(), op.put().value().size()})))
+        {
+            response.mutable_resp()->set_error(bzn::MSG_VALUE_SIZE_TOO_LARGE);
+            handler(response);
+            return;
+        }
+    }
+
+    this->route_write(msg, request, std::move(response), std::move(handler));
+}
+
+
+void
+crud::handle_cas(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
+{
+    database_response response;
+    *response.mutable_header() = request.header();
+
+    if (this->validate_value_size(request.cas().value().size()))
+    {
+        response.mutable_resp()->set_error(bzn::MSG_VALUE_SIZE_TOO_LARGE);
+        handler(response);
+        return;
+    }
+
+    this->route_write(msg, request, std::move(response), std::move(handler));
+}
+
+
+void
+crud::handle_increment(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
+{
+    database_response response;
+    *response.mutable_header() = request.header();
+
+    this->route_write(msg, request, std::move(response), std::move(handler));
+}
+
+
+void
+crud::handle_append(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
+{
+    database_response response;
+    *response.mutable_header() = request.header();
+
+    if (this->validate_value_size(request.append().value().size()))
+    {
+        response.mutable_resp()->set_error(bzn::MSG_VALUE_SIZE_TOO_LARGE);
+        handler(response);
+        return;
+    }
+
+    this->route_write(msg, request, std::move(response), std::move(handler));
+}
+
+
+void
+crud::route_write(const bzn::message& msg, const database_msg& request, database_response response, bzn::crud_base::response_handler handler)
+{
+    // the outcome is decided when the entry commits...
+    if (this->raft->get_state() == bzn::raft_state::leader)
+    {
+        this->append_write(this->stamp_expiry(msg, request), std::move(response), std::move(handler));
+        return;
+    }
+
+    this->redirect_write(msg, std::move(response), std::move(handler));
+}
+
+
+bzn::storage_base::result
 crud::commit_create(const database_msg& msg)
 {
-    if (this->storage->create(msg.header().db_uuid(), msg.create().key(), msg.create().value()) != storage_base::result::ok)
+    auto result = (msg.create().expires())
+        ? this->storage->apply(msg.header().db_uuid(), {expiring_write(storage_base::operation::type::create, msg.create().key(), msg.create().value(), msg.create().expires())})
+        : this->storage->create(msg.header().db_uuid(), msg.create().key(), msg.create().value());
+
+    if (result != storage_base::result::ok)
     {
         LOG(error) << "Request:" <<msg.header().transaction_id() << " Create failed";
+        return result;
     }
+
+    this->subscriptions.inspect_commit(msg.header().db_uuid(), msg.create().key(), database_watch_notification::CREATED, msg.create().value());
+
+    return storage_base::result::ok;
 }
 
 
-void
+bzn::storage_base::result
 crud::commit_update(const database_msg& msg)
 {
-    if (this->storage->update(msg.header().db_uuid(), msg.update().key(), msg.update().value()) != storage_base::result::ok)
+    auto result = (msg.update().expires())
+        ? this->storage->apply(msg.header().db_uuid(), {expiring_write(storage_base::operation::type::update, msg.update().key(), msg.update().value(), msg.update().expires())})
+        : this->storage->update(msg.header().db_uuid(), msg.update().key(), msg.update().value());
+
+    if (result != storage_base::result::ok)
     {
         LOG(error) << "Request:" << msg.header().transaction_id() << " Update failed";
+        return result;
     }
+
+    this->subscriptions.inspect_commit(msg.header().db_uuid(), msg.update().key(), database_watch_notification::UPDATED, msg.update().value());
+
+    return storage_base::result::ok;
 }
 
 
-void
+bzn::storage_base::result
 crud::commit_delete(const database_msg& msg)
 {
-    if (this->storage->remove(msg.header().db_uuid(), msg.delete_().key()) != storage_base::result::ok)
+    if (auto result = this->storage->remove(msg.header().db_uuid(), msg.delete_().key()); result != storage_base::result::ok)
     {
         LOG(error) << "Request:" << msg.header().transaction_id() << " Delete failed";
+        return result;
     }
+
+    this->subscriptions.inspect_commit(msg.header().db_uuid(), msg.delete_().key(), database_watch_notification::DELETED, {});
+
+    return storage_base::result::ok;
+}
+
+
+void
+crud::handle_watch(const database_msg& request, std::shared_ptr<bzn::session_base> session, database_response& response)
+{
+    if (request.msg_case() == database_msg::kWatch)
+    {
+        if (this->subscriptions.subscribe(request.header().db_uuid(), request.watch().key(), request.watch().prefix(), session))
+        {
+            session->add_shutdown_handler(
+                [weak_self = this->weak_from_this(), id = session->get_session_id()]()
+                {
+                    if (auto self = weak_self.lock())
+                    {
+                        self->subscriptions.unsubscribe_all(id);
+                    }
+                });
+        }
+        return;
+    }
+
+    if (!this->subscriptions.unsubscribe(request.header().db_uuid(), request.unwatch().key(), request.unwatch().prefix(), session))
+    {
+        response.mutable_resp()->set_error(bzn::MSG_WATCH_NOT_FOUND);
+    }
+}
+
+
+bzn::storage_base::result
+crud::commit_batch(const database_msg& msg)
+{
+    std::vector<bzn::storage_base::operation> operations;
+    operations.reserve(msg.batch().ops_size());
+
+    for (const auto& op : msg.batch().ops())
+    {
+        bzn::storage_base::operation operation;
+
+        switch (op.op_case())
+        {
+            case database_batch_op::kCreate:
+                operation.op = bzn::storage_base::operation::type::create;
+                operation.key = op.create().key();
+                operation.value = op.create().value();
+                break;
+
+            case database_batch_op::kUpdate:
+                operation.op = bzn::storage_base::operation::type::update;
+                operation.key = op.update().key();
+                operation.value = op.update().value();
+                break;
+
+            case database_batch_op::kDelete:
+                operation.op = bzn::storage_base::operation::type::remove;
+                operation.key = op.delete_().key();
+                break;
+
+            case database_batch_op::kIncrement:
+                operation.op = bzn::storage_base::operation::type::increment;
+                operation.key = op.increment().key();
+                operation.delta = op.increment().delta();
+                break;
+
+            case database_batch_op::kAppend:
+                operation.op = bzn::storage_base::operation::type::append;
+                operation.key = op.append().key();
+                operation.value = op.append().value();
+                break;
+
+            case database_batch_op::kPut:
+                operation.op = bzn::storage_base::operation::type::put;
+                operation.key = op.put().key();
+                operation.value = op.put().value();
+                break;
+
+            default:
+                operation.key = op.check();
+                break;
+        }
+
+        switch (op.precondition_case())
+        {
+            case database_batch_op::kIfExists:
+                operation.precondition = bzn::storage_base::operation::condition::exists;
+                break;
+
+            case database_batch_op::kIfAbsent:
+                operation.precondition = bzn::storage_base::operation::condition::absent;
+                break;
+
+            case database_batch_op::kIfVersion:
+                operation.precondition = bzn::storage_base::operation::condition::version;
+                operation.version = op.if_version();
+                break;
+
+            default:
+                break;
+        }
+
+        operations.emplace_back(std::move(operation));
+    }
+
+    // watchers are told whether a put created its record or replaced it...
+    std::set<std::string> replaced;
+    for (const auto& op : msg.batch().ops())
+    {
+        if (op.op_case() == database_batch_op::kPut && this->storage->has(msg.header().db_uuid(), op.put().key()))
+        {
+            replaced.insert(op.put().key());
+        }
+    }
+
+    if (auto result = this->storage->apply(msg.header().db_uuid(), operations); result != storage_base::result::ok)
+    {
+        LOG(debug) << "Request:" << msg.header().transaction_id() << " Batch not applied";
+        return result;
+    }
+
+    for (const auto& op : msg.batch().ops())
+    {
+        switch (op.op_case())
+        {
+            case database_batch_op::kCreate:
+                this->subscriptions.inspect_commit(msg.header().db_uuid(), op.create().key(), database_watch_notification::CREATED, op.create().value());
+                break;
+
+            case database_batch_op::kUpdate:
+                this->subscriptions.inspect_commit(msg.header().db_uuid(), op.update().key(), database_watch_notification::UPDATED, op.update().value());
+                break;
+
+            case database_batch_op::kDelete:
+                this->subscriptions.inspect_commit(msg.header().db_uuid(), op.delete_().key(), database_watch_notification::DELETED, {});
+                break;
+
+            case database_batch_op::kPut:
+                this->subscriptions.inspect_commit(msg.header().db_uuid(), op.put().key(),
+                    (replaced.count(op.put().key())) ? database_watch_notification::UPDATED : database_watch_notification::CREATED, op.put().value());
+                break;
+
+            case database_batch_op::kIncrement:
+            case database_batch_op::kAppend:
+            {
+                // watchers are sent the resulting value...
+                const auto& key = (op.op_case() == database_batch_op::kIncrement) ? op.increment().key() : op.append().key();
+
+                if (auto record = this->storage->read(msg.header().db_uuid(), key); record)
+                {
+                    this->subscriptions.inspect_commit(msg.header().db_uuid(), key, database_watch_notification::UPDATED, record->value);
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return storage_base::result::ok;
+}
+
+
+bzn::storage_base::result
+crud::commit_expire(const database_msg& msg)
+{
+    // a key refreshed since the leader proposed it no longer meets the cutoff and is kept...
+    for (const auto& key : msg.expire().keys())
+    {
+        bzn::storage_base::operation operation;
+        operation.op = bzn::storage_base::operation::type::remove;
+        operation.precondition = bzn::storage_base::operation::condition::expired;
+        operation.key = key;
+        operation.expires = std::chrono::seconds(msg.expire().cutoff());
+
+        if (this->storage->apply(msg.header().db_uuid(), {operation}) == storage_base::result::ok)
+        {
+            get_metrics().expired_keys.increment();
+            this->subscriptions.inspect_commit(msg.header().db_uuid(), key, database_watch_notification::DELETED, {});
+        }
+    }
+
+    return storage_base::result::ok;
+}
+
+
+bzn::message
+crud::stamp_expiry(const bzn::message& msg, const database_msg& request)
+{
+    bzn_msg stamped;
+    *stamped.mutable_db() = request;
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    // replicas apply the entry at different times, so the leader's clock decides which records it finds expired...
+    stamped.mutable_db()->set_timestamp(now);
+
+    // the leader turns the ttl into an expiry so every replica stores the same one, clients cannot set it...
+    auto stamp = [now](auto write)
+    {
+        write->set_expires((write->ttl()) ? now + write->ttl() : 0);
+    };
+
+    if (request.msg_case() == database_msg::kCreate)
+    {
+        stamp(stamped.mutable_db()->mutable_create());
+    }
+    else if (request.msg_case() == database_msg::kUpdate)
+    {
+        stamp(stamped.mutable_db()->mutable_update());
+    }
+
+    bzn::message result = msg;
+    result["msg"] = boost::beast::detail::base64_encode(stamped.SerializeAsString());
+
+    return result;
+}
+
+
+bzn::storage_base::result
+crud::commit_cas(const database_msg& msg)
+{
+    bzn::storage_base::operation operation;
+    operation.op = bzn::storage_base::operation::type::update;
+    operation.precondition = bzn::storage_base::operation::condition::version;
+    operation.key = msg.cas().key();
+    operation.value = msg.cas().value();
+    operation.version = msg.cas().version();
+
+    return this->apply_read_modify_write(msg, operation);
+}
+
+
+bzn::storage_base::result
+crud::commit_increment(const database_msg& msg)
+{
+    bzn::storage_base::operation operation;
+    operation.op = bzn::storage_base::operation::type::increment;
+    operation.key = msg.increment().key();
+    operation.delta = msg.increment().delta();
+
+    return this->apply_read_modify_write(msg, operation);
+}
+
+
+bzn::storage_base::result
+crud::commit_append(const database_msg& msg)
+{
+    bzn::storage_base::operation operation;
+    operation.op = bzn::storage_base::operation::type::append;
+    operation.key = msg.append().key();
+    operation.value = msg.append().value();
+
+    return this->apply_read_modify_write(msg, operation);
+}
+
+
+bzn::storage_base::result
+crud::apply_read_modify_write(const database_msg& msg, const bzn::storage_base::operation& operation)
+{
+    // the log carries the request, every node computes the new value from its own copy...
+    const bool existed = bool(this->storage->read(msg.header().db_uuid(), operation.key));
+
+    if (auto result = this->storage->apply(msg.header().db_uuid(), {operation}); result != storage_base::result::ok)
+    {
+        LOG(debug) << "Request:" << msg.header().transaction_id() << " " << msg.msg_case() << " of " << operation.key << " not applied";
+        return result;
+    }
+
+    if (auto record = this->storage->read(msg.header().db_uuid(), operation.key); record)
+    {
+        this->subscriptions.inspect_commit(msg.header().db_uuid(), operation.key,
+            (existed) ? database_watch_notification::UPDATED : database_watch_notification::CREATED, record->value);
+    }
+
+    return storage_base::result::ok;
 }
 
 
@@ -247,7 +1071,7 @@ crud::handle_ws_crud_messages(const bzn::message& ws_msg, std::shared_ptr<bzn::s
     {
         LOG(error) << "Invalid message: " << ws_msg.toStyledString().substr(0,60) << "...";
         response.mutable_resp()->set_error(bzn::MSG_INVALID_CRUD_COMMAND);
-        session->send_message(std::make_shared<std::string>(response.SerializeAsString()), true);
+        send_response(ws_msg, session, response, true);
         return;
     }
 
@@ -255,7 +1079,7 @@ crud::handle_ws_crud_messages(const bzn::message& ws_msg, std::shared_ptr<bzn::s
     {
         LOG(error) << "Failed to decode message: " << ws_msg.toStyledString().substr(0,60) << "...";
         response.mutable_resp()->set_error(bzn::MSG_INVALID_CRUD_COMMAND);
-        session->send_message(std::make_shared<std::string>(response.SerializeAsString()), true);
+        send_response(ws_msg, session, response, true);
         return;
     }
 
@@ -263,34 +1087,106 @@ crud::handle_ws_crud_messages(const bzn::message& ws_msg, std::shared_ptr<bzn::s
     {
         LOG(error) << "Invalid message type: " << msg.msg_case();
         response.mutable_resp()->set_error(bzn::MSG_INVALID_ARGUMENTS);
-        session->send_message(std::make_shared<std::string>(response.SerializeAsString()), true);
+        send_response(ws_msg, session, response, true);
         return;
     }
 
     *response.mutable_header() = msg.db().header();
 
-    this->do_raft_task_routing(ws_msg, msg.db(), response);
+    if (auto it = get_metrics().requests.find(msg.db().msg_case()); it != get_metrics().requests.end())
+    {
+        it->second->increment();
+    }
+
+    // watches belong to the session and are served by any node regardless of raft state...
+    if (msg.db().msg_case() == database_msg::kWatch || msg.db().msg_case() == database_msg::kUnwatch)
+    {
+        this->handle_watch(msg.db(), session, response);
+        session->send_message(std::make_shared<std::string>(response.SerializeAsString()), false);
+        return;
+    }
+
+    // a write waits for its commit without traffic on the session...
+    session->hold_idle();
 
-    session->send_message(std::make_shared<std::string>(response.SerializeAsString()), false);
+    this->do_raft_task_routing(ws_msg, msg.db(),
+        [ws_msg, session, start = std::chrono::steady_clock::now()](const database_response& response)
+        {
+            session->release_idle();
+
+            get_metrics().latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+            if (response.success_case() == database_response::kResp && !response.resp().error().empty())
+            {
+                get_metrics().errors.increment();
+            }
+
+            send_response(ws_msg, session, response, false);
+        });
 }
 
 
 void
-crud::do_candidate_tasks(const bzn::message& /*msg*/, const database_msg& /*request*/, database_response& response)
+crud::handle_forwarded_response(const bzn::message& ws_msg, std::shared_ptr<bzn::session_base> /*session*/)
 {
+    pending_write forward;
+
+    {
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+
+        auto it = this->pending_forwards.find(ws_msg[FORWARD_ID_KEY].asUInt64());
+
+        if (it == this->pending_forwards.end())
+        {
+            LOG(debug) << "dropping response to unknown or expired forward: " << ws_msg[FORWARD_ID_KEY].asString();
+            return;
+        }
+
+        forward = std::move(it->second);
+        this->pending_forwards.erase(it);
+    }
+
+    get_metrics().forward_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - (forward.deadline - FORWARD_TIMEOUT)).count());
+
+    database_response response;
+
+    if (!response.ParseFromString(boost::beast::detail::base64_decode(ws_msg["msg"].asString())))
+    {
+        LOG(error) << "Failed to decode forwarded response: " << ws_msg.toStyledString().substr(0,60) << "...";
+        forward.response.mutable_resp()->set_error(bzn::MSG_INVALID_CRUD_COMMAND);
+        forward.handler(forward.response);
+        return;
+    }
+
+    forward.handler(response);
+}
+
+
+void
+crud::do_candidate_tasks(const bzn::message& /*msg*/, const database_msg& request, bzn::crud_base::response_handler handler)
+{
+    database_response response;
+    *response.mutable_header() = request.header();
     response.mutable_resp()->set_error(bzn::MSG_ELECTION_IN_PROGRESS);
+
+    handler(response);
 }
 
 
 void
-crud::do_follower_tasks(const bzn::message& msg, const database_msg& request, database_response& response)
+crud::do_follower_tasks(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
 {
+    database_response response;
+    *response.mutable_header() = request.header();
+
     switch(request.msg_case())
     {
         case database_msg::kRead:
         case database_msg::kKeys:
         case database_msg::kHas:
         case database_msg::kSize:
+        case database_msg::kScan:
         {
             this->command_handlers[request.msg_case()](msg, request, response);
             break;
@@ -298,23 +1194,43 @@ crud::do_follower_tasks(const bzn::message& msg, const database_msg& request, da
 
         default:
         {
+            if (this->write_handlers.count(request.msg_case()))
+            {
+                this->redirect_write(msg, std::move(response), std::move(handler));
+                return;
+            }
+
             this->set_leader_info(response);
             break;
         }
     }
+
+    handler(response);
 }
 
 
 void
-crud::do_leader_tasks(const bzn::message& msg, const database_msg& request, database_response& response)
+crud::do_leader_tasks(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)
 {
+    if (auto it = this->write_handlers.find(request.msg_case()); it != this->write_handlers.end())
+    {
+        it->second(msg, request, std::move(handler));
+        return;
+    }
+
+    database_response response;
+    *response.mutable_header() = request.header();
+
     if (auto it = this->command_handlers.find(request.msg_case()); it != this->command_handlers.end())
     {
         it->second(msg, request, response);
-        return;
+    }
+    else
+    {
+        LOG(error) << "dropping unknown request: " << request.msg_case();
     }
 
-    LOG(error) << "dropping unknown request: " << request.msg_case();
+    handler(response);
 }
 
 
@@ -336,13 +1252,20 @@ void crud::register_command_handlers()
     // the READ work.
     // Candidates will refuse all commands.
 
-    this->command_handlers[database_msg::kCreate] = std::bind(&crud::handle_create,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    // Writes are answered once they commit...
+    this->write_handlers[database_msg::kCreate]   = std::bind(&crud::handle_create,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->write_handlers[database_msg::kUpdate]   = std::bind(&crud::handle_update,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->write_handlers[database_msg::kDelete]   = std::bind(&crud::handle_delete,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->write_handlers[database_msg::kBatch]    = std::bind(&crud::handle_batch,    this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->write_handlers[database_msg::kCas]      = std::bind(&crud::handle_cas,      this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->write_handlers[database_msg::kIncrement] = std::bind(&crud::handle_increment, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->write_handlers[database_msg::kAppend]   = std::bind(&crud::handle_append,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+
     this->command_handlers[database_msg::kRead]   = std::bind(&crud::handle_read,     this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
-    this->command_handlers[database_msg::kUpdate] = std::bind(&crud::handle_update,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
-    this->command_handlers[database_msg::kDelete] = std::bind(&crud::handle_delete,   this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
     this->command_handlers[database_msg::kKeys]   = std::bind(&crud::handle_get_keys, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
     this->command_handlers[database_msg::kHas]    = std::bind(&crud::handle_has,      this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
     this->command_handlers[database_msg::kSize]   = std::bind(&crud::handle_size,     this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->command_handlers[database_msg::kScan]   = std::bind(&crud::handle_scan,     this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
 }
 
 
@@ -353,6 +1276,46 @@ void crud::register_commit_handlers()
     this->commit_handlers[database_msg::kCreate] = std::bind(&crud::commit_create, this, std::placeholders::_1);
     this->commit_handlers[database_msg::kUpdate] = std::bind(&crud::commit_update, this, std::placeholders::_1);
     this->commit_handlers[database_msg::kDelete] = std::bind(&crud::commit_delete, this, std::placeholders::_1);
+    this->commit_handlers[database_msg::kBatch] = std::bind(&crud::commit_batch, this, std::placeholders::_1);
+    this->commit_handlers[database_msg::kCas] = std::bind(&crud::commit_cas, this, std::placeholders::_1);
+    this->commit_handlers[database_msg::kIncrement] = std::bind(&crud::commit_increment, this, std::placeholders::_1);
+    this->commit_handlers[database_msg::kAppend] = std::bind(&crud::commit_append, this, std::placeholders::_1);
+    this->commit_handlers[database_msg::kExpire] = std::bind(&crud::commit_expire, this, std::placeholders::_1);
+}
+
+
+void
+crud::redirect_write(const bzn::message& msg, database_response response, bzn::crud_base::response_handler handler)
+{
+    // a forwarded write is never forwarded again to avoid loops while leadership changes...
+    const auto leader = (this->forward_writes && !msg.isMember(FORWARD_ID_KEY)) ? this->raft->get_leader() : bzn::peer_address_t("", 0, 0, "", "");
+
+    if (leader.host.empty())
+    {
+        get_metrics().redirected_writes.increment();
+        this->set_leader_info(response);
+        handler(response);
+        return;
+    }
+
+    bzn::message forward_msg = msg;
+    forward_msg["bzn-api"] = "database";
+
+    {
+        std::lock_guard<std::mutex> lock(this->pending_writes_lock);
+
+        const auto forward_id = ++this->next_forward_id;
+        forward_msg[FORWARD_ID_KEY] = Json::UInt64(forward_id);
+
+        this->pending_forwards[forward_id] = pending_write{{}, std::move(response), std::move(handler),
+            std::chrono::steady_clock::now() + FORWARD_TIMEOUT};
+    }
+
+    get_metrics().forwarded_writes.increment();
+
+    // every write to the same leader shares one connection and the leader answers over it...
+    this->node->send_on_channel(boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string(leader.host), leader.port},
+        std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(forward_msg.toStyledString())));
 }
 
 
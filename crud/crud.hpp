@@ -15,48 +15,100 @@
 #pragma once
 
 #include <include/bluzelle.hpp>
+#include <include/boost_asio_beast.hpp>
 #include <crud/crud_base.hpp>
+#include <crud/subscription_manager.hpp>
 #include <raft/raft_base.hpp>
 #include <node/node_base.hpp>
 #include <storage/storage_base.hpp>
+#include <map>
+#include <mutex>
 #include <unordered_map>
 
+#include <gtest/gtest_prod.h>
+
 
 namespace bzn
 {
     class crud final : public bzn::crud_base, public std::enable_shared_from_this<crud>
     {
     public:
-        crud(std::shared_ptr<bzn::node_base> node, std::shared_ptr<bzn::raft_base> raft, std::shared_ptr<bzn::storage_base> storage);
+        crud(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::node_base> node, std::shared_ptr<bzn::raft_base> raft,
+            std::shared_ptr<bzn::storage_base> storage, bool forward_writes);
 
-        void handle_create(const bzn::message& msg, const database_msg& request, database_response& response) override;
+        void handle_create(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) override;
 
         void handle_read(const bzn::message& msg, const database_msg& request, database_response& response) override;
 
-        void handle_update(const bzn::message& msg, const database_msg& request, database_response& response) override;
+        void handle_update(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) override;
+
+        void handle_delete(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) override;
 
-        void handle_delete(const bzn::message& msg, const database_msg& request, database_response& response) override;
+        void handle_batch(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) override;
 
         void start() override;
 
     private:
+        FRIEND_TEST(crud_test, test_that_pending_writes_fail_on_timeout_and_leader_change);
+        FRIEND_TEST(crud_test, test_that_a_write_committed_before_it_is_parked_is_answered_with_its_result);
+
+        // a write appended to the raft log waiting for its commit...
+        struct pending_write
+        {
+            std::string msg; // encoded request used to detect a different entry committed at our index
+            database_response response;
+            bzn::crud_base::response_handler handler;
+            std::chrono::steady_clock::time_point deadline;
+        };
+
         void handle_ws_crud_messages(const bzn::message& msg, std::shared_ptr<bzn::session_base> session);
 
+        void handle_watch(const database_msg& request, std::shared_ptr<bzn::session_base> session, database_response& response);
+
         void set_leader_info(database_response& msg);
 
-        void do_raft_task_routing(const bzn::message& msg, const database_msg& request, database_response& response);
+        void redirect_write(const bzn::message& msg, database_response response, bzn::crud_base::response_handler handler);
+        void handle_forwarded_response(const bzn::message& msg, std::shared_ptr<bzn::session_base> session);
+
+        void do_raft_task_routing(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+
+        void do_candidate_tasks(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+        void  do_follower_tasks(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+        void    do_leader_tasks(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+
+        void append_write(const bzn::message& msg, database_response response, bzn::crud_base::response_handler handler);
+        void complete_pending_write(const bzn::message& msg, uint32_t log_index, bzn::storage_base::result result);
+        static void set_commit_error(database_response& response, bool replaced, bzn::storage_base::result result);
 
-        void do_candidate_tasks(const bzn::message& msg, const database_msg& request, database_response& response);
-        void  do_follower_tasks(const bzn::message& msg, const database_msg& request, database_response& response);
-        void    do_leader_tasks(const bzn::message& msg, const database_msg& request, database_response& response);
+        void propose_expired();
+        bzn::message stamp_expiry(const bzn::message& msg, const database_msg& request);
+
+        void start_commit_timer();
+        void handle_commit_timeout(const boost::system::error_code& ec);
 
         void handle_get_keys(const bzn::message& msg, const database_msg& request, database_response& response);
         void      handle_has(const bzn::message& msg, const database_msg& request, database_response& response);
         void     handle_size(const bzn::message& msg, const database_msg& request, database_response& response);
+        void     handle_scan(const bzn::message& msg, const database_msg& request, database_response& response);
+
+        bzn::storage_base::scan_result scan_page(const bzn::uuid_t& uuid, const database_range& range, size_t max_limit, database_response& response);
+
+        void       handle_cas(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+        void handle_increment(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+        void    handle_append(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler);
+
+        void route_write(const bzn::message& msg, const database_msg& request, database_response response, bzn::crud_base::response_handler handler);
+
+        bzn::storage_base::result commit_create(const database_msg& msg);
+        bzn::storage_base::result commit_update(const database_msg& msg);
+        bzn::storage_base::result commit_delete(const database_msg& msg);
+        bzn::storage_base::result commit_batch(const database_msg& msg);
+        bzn::storage_base::result commit_expire(const database_msg& msg);
+        bzn::storage_base::result commit_cas(const database_msg& msg);
+        bzn::storage_base::result commit_increment(const database_msg& msg);
+        bzn::storage_base::result commit_append(const database_msg& msg);
 
-        void commit_create(const database_msg& msg);
-        void commit_update(const database_msg& msg);
-        void commit_delete(const database_msg& msg);
+        bzn::storage_base::result apply_read_modify_write(const database_msg& msg, const bzn::storage_base::operation& operation);
 
         void register_route_handlers();
         void register_command_handlers();
@@ -70,14 +122,40 @@ namespace bzn
         std::shared_ptr<bzn::raft_base>    raft;
         std::shared_ptr<bzn::node_base>    node;
         std::shared_ptr<bzn::storage_base> storage;
+        std::unique_ptr<bzn::asio::steady_timer_base> commit_timer;
 
-        using route_handler_t   = std::function<void(const bzn::message& msg, const database_msg& request, database_response& response)>;
+        bzn::subscription_manager subscriptions;
+
+        using route_handler_t   = std::function<void(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)>;
         using command_handler_t = std::function<void(const bzn::message& msg, const database_msg& request, database_response& response)>;
-        using commit_handler_t  = std::function<void(const database_msg& msg)>;
+        using write_handler_t   = std::function<void(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler)>;
+        using commit_handler_t  = std::function<bzn::storage_base::result(const database_msg& msg)>;
 
         std::unordered_map<bzn::raft_state, route_handler_t>         route_handlers;
         std::unordered_map<database_msg::MsgCase, commit_handler_t>  commit_handlers;
         std::unordered_map<database_msg::MsgCase, command_handler_t> command_handlers;
+        std::unordered_map<database_msg::MsgCase, write_handler_t>   write_handlers;
+
+        // writes waiting for a commit keyed by log index...
+        std::map<uint32_t, pending_write> pending_writes;
+        uint32_t last_commit_index = 0;
+
+        // the outcome of recent commits nothing was parked for, by log index modulo their number...
+        struct commit_result
+        {
+            uint32_t log_index = 0;
+            size_t request_hash = 0;
+            bzn::storage_base::result result = bzn::storage_base::result::ok;
+        };
+
+        std::vector<commit_result> recent_commits;
+        uint32_t expire_index = 0; // of the last eviction entry we proposed
+        std::mutex pending_writes_lock;
+
+        // writes relayed to the leader keyed by forward id...
+        const bool forward_writes;
+        std::map<uint64_t, pending_write> pending_forwards;
+        uint64_t next_forward_id = 0;
 
         std::once_flag start_once;
     };
@@ -27,19 +27,37 @@ namespace bzn
     const std::string MSG_RECORD_NOT_FOUND = "RECORD_NOT_FOUND";
     const std::string MSG_INVALID_ARGUMENTS = "INVALID_ARGUMENTS";
     const std::string MSG_VALUE_SIZE_TOO_LARGE = "VALUE_SIZE_TOO_LARGE";
+    const std::string MSG_WATCH_NOT_FOUND = "WATCH_NOT_FOUND";
+    const std::string MSG_COMMIT_TIMEOUT = "COMMIT_TIMEOUT";
+    const std::string MSG_LEADER_CHANGED = "LEADER_CHANGED";
+    const std::string MSG_PRECONDITION_FAILED = "PRECONDITION_FAILED";
+    const std::string MSG_VALUE_NOT_A_NUMBER = "VALUE_NOT_A_NUMBER";
+    const std::string MSG_BATCH_TOO_LARGE = "BATCH_TOO_LARGE";
+
+    // a batch is a single raft entry so its ops are bounded...
+    const size_t MAX_BATCH_OPS = 1000;
 
     class crud_base
     {
     public:
+        using response_handler = std::function<void(const database_response& response)>;
+
         virtual ~crud_base() = default;
 
-        virtual void handle_create(const bzn::message& msg, const database_msg& request, database_response& response) = 0;
+        /**
+         * Writes are answered once raft commits them, or fail with MSG_COMMIT_TIMEOUT or
+         * MSG_LEADER_CHANGED. The handler is called exactly once and may be called before returning.
+         */
+        virtual void handle_create(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) = 0;
 
         virtual void handle_read(const bzn::message& msg, const database_msg& request, database_response& response) = 0;
 
-        virtual void handle_update(const bzn::message& msg, const database_msg& request, database_response& response) = 0;
+        virtual void handle_update(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) = 0;
+
+        virtual void handle_delete(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) = 0;
 
-        virtual void handle_delete(const bzn::message& msg, const database_msg& request, database_response& response) = 0;
+        // every op in the batch is applied as one raft entry, or none of them...
+        virtual void handle_batch(const bzn::message& msg, const database_msg& request, bzn::crud_base::response_handler handler) = 0;
 
         virtual void start() = 0;
     };
@@ -0,0 +1,240 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <crud/subscription_manager.hpp>
+#include <algorithm>
+
+using namespace bzn;
+
+
+bool
+subscription_manager::subscribe(const bzn::uuid_t& db_uuid, const std::string& key, bool prefix, std::shared_ptr<bzn::session_base> session)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    const auto id = session->get_session_id();
+
+    auto& db = this->subscriptions[db_uuid];
+
+    if (prefix)
+    {
+        db.prefixes[key][id] = session;
+    }
+    else
+    {
+        db.keys[key][id] = session;
+    }
+
+    const bool first = !this->sessions.count(id);
+
+    this->sessions[id].emplace(db_uuid, key, prefix);
+
+    return first;
+}
+
+
+bool
+subscription_manager::unsubscribe(const bzn::uuid_t& db_uuid, const std::string& key, bool prefix, const std::shared_ptr<bzn::session_base>& session)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    const auto id = session->get_session_id();
+
+    // the session's entry stays until it closes so it is only told to clean up once...
+    if (auto watches = this->sessions.find(id); watches != this->sessions.end())
+    {
+        watches->second.erase({db_uuid, key, prefix});
+    }
+
+    return this->remove({db_uuid, key, prefix}, id);
+}
+
+
+void
+subscription_manager::unsubscribe_all(bzn::session_id session)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    auto watches = this->sessions.find(session);
+
+    if (watches == this->sessions.end())
+    {
+        return;
+    }
+
+    for (const auto& watch : watches->second)
+    {
+        this->remove(watch, session);
+    }
+
+    this->sessions.erase(watches);
+}
+
+
+bool
+subscription_manager::remove(const watch_t& watch, bzn::session_id session)
+{
+    const auto& [db_uuid, key, prefix] = watch;
+
+    auto db = this->subscriptions.find(db_uuid);
+
+    if (db == this->subscriptions.end())
+    {
+        return false;
+    }
+
+    bool removed = false;
+
+    if (prefix)
+    {
+        if (auto it = db->second.prefixes.find(key); it != db->second.prefixes.end())
+        {
+            removed = it->second.erase(session);
+
+            if (it->second.empty())
+            {
+                db->second.prefixes.erase(it);
+            }
+        }
+    }
+    else
+    {
+        if (auto it = db->second.keys.find(key); it != db->second.keys.end())
+        {
+            removed = it->second.erase(session);
+
+            if (it->second.empty())
+            {
+                db->second.keys.erase(it);
+            }
+        }
+    }
+
+    if (db->second.keys.empty() && db->second.prefixes.empty())
+    {
+        this->subscriptions.erase(db);
+    }
+
+    return removed;
+}
+
+
+void
+subscription_manager::collect(subscribers_t& subscribers, std::vector<std::shared_ptr<bzn::session_base>>& sessions)
+{
+    for (auto it = subscribers.begin(); it != subscribers.end();)
+    {
+        if (auto session = it->second.lock())
+        {
+            sessions.emplace_back(std::move(session));
+            ++it;
+        }
+        else
+        {
+            // destroyed and not yet unsubscribed by its shutdown handler...
+            it = subscribers.erase(it);
+        }
+    }
+}
+
+
+void
+subscription_manager::inspect_commit(const bzn::uuid_t& db_uuid, const std::string& key, database_watch_notification::operation_type operation, const std::string& value)
+{
+    std::vector<std::shared_ptr<bzn::session_base>> sessions;
+
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        auto db = this->subscriptions.find(db_uuid);
+
+        if (db == this->subscriptions.end())
+        {
+            return;
+        }
+
+        if (auto it = db->second.keys.find(key); it != db->second.keys.end())
+        {
+            this->collect(it->second, sessions);
+        }
+
+        if (!db->second.prefixes.empty())
+        {
+            // every prefix of the key is a candidate...
+            for (size_t len = 0; len <= key.size(); ++len)
+            {
+                if (auto it = db->second.prefixes.find(key.substr(0, len)); it != db->second.prefixes.end())
+                {
+                    this->collect(it->second, sessions);
+                }
+            }
+        }
+    }
+
+    if (sessions.empty())
+    {
+        return;
+    }
+
+    // a session watching both the key and one of its prefixes is told once...
+    std::sort(sessions.begin(), sessions.end());
+    sessions.erase(std::unique(sessions.begin(), sessions.end()), sessions.end());
+
+    database_response response;
+    response.mutable_header()->set_db_uuid(db_uuid);
+    response.mutable_notification()->set_operation(operation);
+    response.mutable_notification()->set_key(key);
+
+    if (operation != database_watch_notification::DELETED)
+    {
+        response.mutable_notification()->set_value(value);
+    }
+
+    auto msg = std::make_shared<std::string>(response.SerializeAsString());
+    // length prefixed as either part may hold any character...
+    const std::string coalesce_key = std::to_string(db_uuid.size()) + ':' + db_uuid + key;
+
+    for (const auto& session : sessions)
+    {
+        session->send_notification(coalesce_key, msg);
+    }
+}
+
+
+size_t
+subscription_manager::subscription_count(const bzn::uuid_t& db_uuid)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    auto db = this->subscriptions.find(db_uuid);
+
+    if (db == this->subscriptions.end())
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+
+    for (const auto& key : db->second.keys)
+    {
+        count += key.second.size();
+    }
+
+    for (const auto& prefix : db->second.prefixes)
+    {
+        count += prefix.second.size();
+    }
+
+    return count;
+}
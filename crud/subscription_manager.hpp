@@ -0,0 +1,89 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <include/bluzelle.hpp>
+#include <node/node_base.hpp>
+#include <proto/bluzelle.pb.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+
+
+namespace bzn
+{
+    class subscription_manager final
+    {
+    public:
+        /**
+         * Register a session's interest in a key or, if prefix is set, every key starting with it
+         * @param db_uuid   database
+         * @param key       key or key prefix
+         * @param prefix    treat key as a prefix
+         * @param session   session notifications are pushed to
+         * @return true for the session's first subscription, its watches are to be dropped with unsubscribe_all() when it closes
+         */
+        bool subscribe(const bzn::uuid_t& db_uuid, const std::string& key, bool prefix, std::shared_ptr<bzn::session_base> session);
+
+        /**
+         * Remove a subscription previously made with subscribe()
+         * @return true if the subscription existed
+         */
+        bool unsubscribe(const bzn::uuid_t& db_uuid, const std::string& key, bool prefix, const std::shared_ptr<bzn::session_base>& session);
+
+        /**
+         * Remove every subscription of a session that has closed
+         */
+        void unsubscribe_all(bzn::session_id session);
+
+        /**
+         * Push a change notification to everyone watching the key. The notification is
+         * serialized once and the same buffer is shared by every subscriber.
+         */
+        void inspect_commit(const bzn::uuid_t& db_uuid, const std::string& key, database_watch_notification::operation_type operation, const std::string& value);
+
+        /**
+         * Number of live subscriptions for a database
+         */
+        size_t subscription_count(const bzn::uuid_t& db_uuid);
+
+    private:
+        // keyed by the session's id so unwatch and re-watch are O(1)...
+        using subscribers_t = std::unordered_map<bzn::session_id, std::weak_ptr<bzn::session_base>>;
+
+        struct database_subscriptions
+        {
+            std::unordered_map<std::string, subscribers_t> keys;
+            std::map<std::string, subscribers_t>           prefixes;
+        };
+
+        // database, key and whether it is a prefix...
+        using watch_t = std::tuple<bzn::uuid_t, std::string, bool>;
+
+        bool remove(const watch_t& watch, bzn::session_id session);
+
+        void collect(subscribers_t& subscribers, std::vector<std::shared_ptr<bzn::session_base>>& sessions);
+
+        std::unordered_map<bzn::uuid_t, database_subscriptions> subscriptions;
+
+        // the watches of each session, so they go when it closes...
+        std::unordered_map<bzn::session_id, std::set<watch_t>> sessions;
+
+        std::mutex lock;
+    };
+
+} // bzn
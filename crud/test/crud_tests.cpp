@@ -101,6 +101,16 @@ namespace
         return generate_generic_request(uid, msg);
     }
 
+    bzn::message generate_watch_request(const bzn::uuid_t& uid, const std::string& key, bool prefix)
+    {
+        bzn_msg msg;
+
+        msg.mutable_db()->mutable_watch()->set_key(key);
+        msg.mutable_db()->mutable_watch()->set_prefix(prefix);
+
+        return generate_generic_request(uid, msg);
+    }
+
     bzn::message generate_size_request(const bzn::uuid_t& uid)
     {
         bzn_msg msg;
@@ -117,6 +127,7 @@ class crud_test : public Test
 public:
     crud_test()
     {
+        this->mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         this->mock_node = std::make_shared<bzn::Mocknode_base>();
         this->mock_raft = std::make_shared<bzn::Mockraft_base>();
         this->mock_storage = std::make_shared<bzn::Mockstorage_base>();
@@ -132,25 +143,64 @@ public:
                 return true;
             }));
 
+        EXPECT_CALL(*this->mock_node, register_for_message("database_forward", _)).WillOnce(Invoke(
+            [&](const std::string&, auto  mh)
+            {
+                this->forward_mh = mh;
+                return true;
+            }));
+
         EXPECT_CALL(*mock_raft, register_commit_handler(_)).WillOnce(Invoke(
             [&](bzn::raft_base::commit_handler ch) { this->ch = ch; }));
 
-        this->crud = std::make_shared<bzn::crud>(mock_node, mock_raft, mock_storage);
+        EXPECT_CALL(*this->mock_storage, set_commit_index(_)).Times(AnyNumber());
+
+        auto mock_commit_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+
+        EXPECT_CALL(*mock_commit_timer, async_wait(_)).WillRepeatedly(Invoke(
+            [&](auto handler) { this->commit_timer_handler = handler; }));
+
+        EXPECT_CALL(*this->mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
+            [&]() { return std::move(mock_commit_timer); }));
+
+        this->crud = std::make_shared<bzn::crud>(mock_io_context, mock_node, mock_raft, mock_storage, this->forward_writes);
 
         this->crud->start();
     }
 
+    void expire_commit_timer()
+    {
+        // the handler re-arms the timer...
+        auto handler = this->commit_timer_handler;
+        handler(boost::system::error_code());
+    }
+
+    std::shared_ptr<bzn::asio::Mockio_context_base> mock_io_context;
     std::shared_ptr<bzn::Mocknode_base> mock_node;
     std::shared_ptr<bzn::Mockraft_base> mock_raft;
     std::shared_ptr<bzn::Mockstorage_base> mock_storage;
     std::shared_ptr<bzn::Mocksession_base> mock_session;
 
+    bool forward_writes = false;
+
     bzn::message_handler mh;
+    bzn::message_handler forward_mh;
     bzn::raft_base::commit_handler ch;
+    bzn::asio::wait_handler commit_timer_handler;
     std::shared_ptr<bzn::crud> crud;
 };
 
 
+class crud_forward_test : public crud_test
+{
+public:
+    crud_forward_test()
+    {
+        this->forward_writes = true;
+    }
+};
+
+
 TEST_F(crud_test, test_that_follower_not_knowing_leader_fails_to_create)
 {
     auto request = generate_create_request(USER_UUID, "key0", TEST_VALUE);
@@ -228,7 +278,8 @@ TEST_F(crud_test, test_that_a_leader_can_create_a_new_record)
 
     EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
 
-    EXPECT_CALL(*this->mock_raft, append_log(_)).WillOnce(Return(true));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
 
     EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
         [&](std::shared_ptr<std::string> msg, auto)
@@ -242,13 +293,16 @@ TEST_F(crud_test, test_that_a_leader_can_create_a_new_record)
 
     this->mh(request, this->mock_session);
 
+    // the record's transaction id is numbered from the entry's log index...
+    InSequence seq;
+    EXPECT_CALL(*this->mock_storage, set_commit_index(1));
     EXPECT_CALL(*this->mock_storage, create(USER_UUID, "key0", "skdif9ek34587fk30df6vm73==")).WillOnce(Invoke(
         [](const bzn::uuid_t& /*uuid*/, const std::string& /*key*/, const std::string& /*value*/)
         {
             return bzn::storage_base::result::ok;
         }));
 
-    this->ch(request);
+    this->ch(appended, 1);
 }
 
 
@@ -293,7 +347,7 @@ TEST_F(crud_test, test_that_a_follower_can_read_an_existing_record)
             std::shared_ptr<bzn::storage_base::record> record = std::make_shared<bzn::storage_base::record>();
             record->value = "skdif9ek34587fk30df6vm73==";
             record->timestamp = std::chrono::seconds(0);
-            record->transaction_id = TEST_NODE_UUID;
+            record->transaction_id = boost::uuids::string_generator()(TEST_NODE_UUID);
             return record;
         }));
 
@@ -371,7 +425,7 @@ TEST_F(crud_test, test_that_a_leader_can_read_existing_record)
             auto record = std::make_shared<bzn::storage_base::record>();
             record->value = "skdif9ek34587fk30df6vm73==";
             record->timestamp = std::chrono::seconds(0);
-            record->transaction_id = TEST_NODE_UUID;
+            record->transaction_id = boost::uuids::string_generator()(TEST_NODE_UUID);
             return record;
         }));
 
@@ -463,7 +517,8 @@ TEST_F(crud_test, test_that_a_leader_can_update)
 
     EXPECT_CALL( *this->mock_storage, has(USER_UUID, key)).WillOnce(Return(true));
 
-    EXPECT_CALL(*this->mock_raft, append_log(_)).WillOnce(Return(true));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
 
     EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
         [&](std::shared_ptr<std::string> msg, auto)
@@ -477,7 +532,7 @@ TEST_F(crud_test, test_that_a_leader_can_update)
 
     EXPECT_CALL(*this->mock_storage, update(USER_UUID, key, TEST_VALUE));
 
-    this->ch(request);
+    this->ch(appended, 1);
 }
 
 
@@ -590,7 +645,8 @@ TEST_F(crud_test, test_that_a_leader_can_delete_an_existing_record)
     EXPECT_CALL(*this->mock_storage, has(USER_UUID, "key0")).WillOnce(Return(true));
 
     // since we do have a valid record to delete, we tell raft, raft will be cool with it...
-    EXPECT_CALL(*this->mock_raft, append_log(_)).WillOnce(Return(true));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
 
     // we respond to the user with OK.
     EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
@@ -609,7 +665,7 @@ TEST_F(crud_test, test_that_a_leader_can_delete_an_existing_record)
     // apon reaching concensus RAFT will call the commit handler
     EXPECT_CALL(*this->mock_storage, remove(USER_UUID, key));
 
-    this->ch(request);
+    this->ch(appended, 1);
 }
 
 
@@ -646,11 +702,8 @@ TEST_F(crud_test, test_that_a_leader_can_return_all_of_a_users_keys)
 
     EXPECT_CALL(*this->mock_raft, get_state()).WillOnce(Return(bzn::raft_state::leader));
 
-    EXPECT_CALL(*this->mock_storage, get_keys(USER_UUID)).WillOnce(Invoke(
-        [](const bzn::uuid_t& /*uuid*/)
-        {
-            return std::vector<std::string>{"key0", "key1", "key2"};
-        }));
+    EXPECT_CALL(*this->mock_storage, scan(USER_UUID, "", "", "", _)).WillOnce(Return(
+        bzn::storage_base::scan_result{{"key0", nullptr}, {"key1", nullptr}, {"key2", nullptr}}));
 
     EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
         [&](std::shared_ptr<std::string> msg, auto)
@@ -673,11 +726,8 @@ TEST_F(crud_test, test_that_a_follower_can_return_all_of_a_users_keys)
 
     EXPECT_CALL(*this->mock_raft, get_state()).WillOnce(Return(bzn::raft_state::follower));
 
-    EXPECT_CALL(*this->mock_storage, get_keys(USER_UUID)).WillOnce(Invoke(
-        [](const bzn::uuid_t& /*uuid*/)
-        {
-            return std::vector<std::string>{"key0", "key1", "key2"};
-        }));
+    EXPECT_CALL(*this->mock_storage, scan(USER_UUID, "", "", "", _)).WillOnce(Return(
+        bzn::storage_base::scan_result{{"key0", nullptr}, {"key1", nullptr}, {"key2", nullptr}}));
 
     EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
         [&](std::shared_ptr<std::string> msg, auto)
@@ -694,6 +744,36 @@ TEST_F(crud_test, test_that_a_follower_can_return_all_of_a_users_keys)
 }
 
 
+TEST_F(crud_test, test_that_keys_without_a_limit_return_a_bounded_page_and_its_continuation)
+{
+    auto request = generate_keys_request(USER_UUID);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillOnce(Return(bzn::raft_state::follower));
+
+    // the server's page size and one more for the continuation...
+    const size_t page_size = 10000;
+
+    bzn::storage_base::scan_result records;
+    for (size_t i = 0; i <= page_size; ++i)
+    {
+        records.emplace_back("key" + std::to_string(i), nullptr);
+    }
+
+    EXPECT_CALL(*this->mock_storage, scan(USER_UUID, "", "", "", page_size + 1)).WillOnce(Return(records));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(size_t(resp.resp().keys().size()), page_size);
+            EXPECT_EQ(resp.resp().next_key(), "key" + std::to_string(page_size));
+        }));
+
+    this->mh(request, mock_session);
+}
+
+
 TEST_F(crud_test, test_that_a_follower_can_respond_to_has_command)
 {
     // Ask local storage for all the keys for the user
@@ -875,7 +955,8 @@ TEST_F(crud_test, test_that_a_create_command_can_create_largest_value_record)
 
     EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
 
-    EXPECT_CALL(*this->mock_raft, append_log(_)).WillOnce(Return(true));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
 
     EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
         [&](std::shared_ptr<std::string> msg, auto)
@@ -891,7 +972,7 @@ TEST_F(crud_test, test_that_a_create_command_can_create_largest_value_record)
 
     EXPECT_CALL(*this->mock_storage, create(USER_UUID, "key0", std::string(bzn::MAX_VALUE_SIZE, 'c'))).WillOnce(Return(bzn::storage_base::result::ok));
 
-    this->ch(request);
+    this->ch(appended, 1);
 }
 
 
@@ -914,3 +995,664 @@ TEST_F(crud_test, test_that_a_update_command_fails_when_the_size_of_the_value_ex
 
     this->mh(request, this->mock_session);
 }
+
+
+TEST_F(crud_test, test_that_watching_session_is_notified_when_update_commits)
+{
+    // watches are accepted in any raft state...
+    auto request = generate_watch_request(USER_UUID, "key0", false);
+
+    EXPECT_CALL(*this->mock_session, get_session_id()).WillRepeatedly(Return(1));
+
+    bzn::session_shutdown_handler shutdown_handler;
+    EXPECT_CALL(*this->mock_session, add_shutdown_handler(_)).WillOnce(SaveArg<0>(&shutdown_handler));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),false)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_TRUE(resp.resp().error().empty());
+        }));
+
+    this->mh(request, this->mock_session);
+
+    EXPECT_CALL(*this->mock_storage, update(USER_UUID, "key0", "new value")).WillOnce(Return(bzn::storage_base::result::ok));
+
+    EXPECT_CALL(*this->mock_session, send_notification(std::to_string(USER_UUID.size()) + ":" + USER_UUID + "key0", _)).WillOnce(Invoke(
+        [&](auto, std::shared_ptr<std::string> msg)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.notification().key(), "key0");
+            EXPECT_EQ(resp.notification().value(), "new value");
+        }));
+
+    this->ch(generate_update_request(USER_UUID, "key0", "new value"), 1);
+
+    // failed commits are not pushed...
+    EXPECT_CALL(*this->mock_storage, update(USER_UUID, "key0", "newer value")).WillOnce(Return(bzn::storage_base::result::not_found));
+
+    this->ch(generate_update_request(USER_UUID, "key0", "newer value"), 2);
+
+    // the session closing drops its watches...
+    ASSERT_TRUE(shutdown_handler);
+    shutdown_handler();
+
+    EXPECT_CALL(*this->mock_storage, update(USER_UUID, "key0", "closed")).WillOnce(Return(bzn::storage_base::result::ok));
+    EXPECT_CALL(*this->mock_session, send_notification(_, _)).Times(0);
+
+    this->ch(generate_update_request(USER_UUID, "key0", "closed"), 3);
+}
+
+
+TEST_F(crud_test, test_that_a_leader_acknowledges_a_write_once_it_commits)
+{
+    auto request = generate_create_request(USER_UUID, "key0", "value");
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    EXPECT_CALL(*this->mock_storage, has(USER_UUID, "key0")).WillOnce(Return(false));
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SetArgReferee<1>(7), Return(true)));
+
+    std::vector<database_response> responses;
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillRepeatedly(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            responses.emplace_back(resp);
+        }));
+
+    this->mh(request, this->mock_session);
+
+    // nothing until raft commits the entry...
+    EXPECT_TRUE(responses.empty());
+
+    // another leader's entry committed at our index...
+    this->ch(generate_create_request(USER_UUID, "key1", "value"), 7);
+
+    ASSERT_EQ(responses.size(), size_t(1));
+    EXPECT_EQ(responses[0].resp().error(), bzn::MSG_LEADER_CHANGED);
+    EXPECT_EQ(responses[0].header().transaction_id(), uint64_t(85746));
+}
+
+
+TEST_F(crud_test, test_that_a_read_with_the_current_version_omits_the_value)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_read()->set_key("key0");
+    msg.mutable_db()->mutable_read()->add_if_none_match(TEST_NODE_UUID);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::follower));
+
+    auto record = std::make_shared<bzn::storage_base::record>();
+    record->value = "value";
+    record->transaction_id = boost::uuids::string_generator()(TEST_NODE_UUID);
+    EXPECT_CALL(*this->mock_storage, read(USER_UUID, "key0")).WillRepeatedly(Return(record));
+
+    std::vector<database_response> responses;
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillRepeatedly(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            responses.emplace_back(resp);
+        }));
+
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+
+    // the record changed since...
+    record->transaction_id = boost::uuids::string_generator()(LEADER_UUID);
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+
+    ASSERT_EQ(responses.size(), size_t(2));
+    EXPECT_TRUE(responses[0].resp().not_modified());
+    EXPECT_EQ(responses[0].resp().version(), TEST_NODE_UUID);
+    EXPECT_TRUE(responses[0].resp().value().empty());
+
+    EXPECT_FALSE(responses[1].resp().not_modified());
+    EXPECT_EQ(responses[1].resp().version(), LEADER_UUID);
+    EXPECT_EQ(responses[1].resp().value(), "value");
+}
+
+
+TEST_F(crud_test, test_that_a_batch_put_creates_or_replaces_its_records)
+{
+    bzn_msg msg;
+    auto first = msg.mutable_db()->mutable_batch()->add_ops()->mutable_put();
+    first->set_key("key0");
+    first->set_value("value0");
+    auto second = msg.mutable_db()->mutable_batch()->add_ops()->mutable_put();
+    second->set_key("key1");
+    second->set_value("value1");
+
+    auto request = generate_generic_request(USER_UUID, msg);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_TRUE(resp.resp().error().empty());
+            EXPECT_EQ(resp.header().transaction_id(), uint64_t(85746));
+        }));
+
+    this->mh(request, this->mock_session);
+
+    EXPECT_CALL(*this->mock_storage, has(USER_UUID, "key0")).WillOnce(Return(true));
+    EXPECT_CALL(*this->mock_storage, has(USER_UUID, "key1")).WillOnce(Return(false));
+    EXPECT_CALL(*this->mock_storage, apply(USER_UUID, _)).WillOnce(Invoke(
+        [](auto, const std::vector<bzn::storage_base::operation>& operations)
+        {
+            EXPECT_EQ(operations.size(), size_t(2));
+            EXPECT_EQ(operations[0].op, bzn::storage_base::operation::type::put);
+            EXPECT_EQ(operations[0].key, "key0");
+            EXPECT_EQ(operations[0].value, "value0");
+            EXPECT_EQ(operations[1].op, bzn::storage_base::operation::type::put);
+            EXPECT_EQ(operations[1].key, "key1");
+            EXPECT_EQ(operations[1].value, "value1");
+            return bzn::storage_base::result::ok;
+        }));
+
+    this->ch(appended, 1);
+}
+
+
+TEST_F(crud_test, test_that_an_empty_batch_fails)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_batch();
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.resp().error(), bzn::MSG_INVALID_ARGUMENTS);
+        }));
+
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+}
+
+
+TEST_F(crud_test, test_that_a_batch_over_the_op_limit_fails)
+{
+    bzn_msg msg;
+
+    for (size_t i = 0; i <= bzn::MAX_BATCH_OPS; ++i)
+    {
+        auto put = msg.mutable_db()->mutable_batch()->add_ops()->mutable_put();
+        put->set_key("key" + std::to_string(i));
+        put->set_value("value");
+    }
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).Times(0);
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.resp().error(), bzn::MSG_BATCH_TOO_LARGE);
+        }));
+
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+}
+
+
+namespace bzn
+{
+    TEST_F(crud_test, test_that_pending_writes_fail_on_timeout_and_leader_change)
+    {
+        EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+        EXPECT_CALL(*this->mock_storage, has(USER_UUID, _)).WillRepeatedly(Return(false));
+        EXPECT_CALL(*this->mock_storage, get_expired(_, _)).WillRepeatedly(Return(std::vector<std::pair<bzn::uuid_t, std::string>>()));
+        EXPECT_CALL(*this->mock_raft, append_log(_, _))
+            .WillOnce(DoAll(SetArgReferee<1>(1), Return(true)))
+            .WillOnce(DoAll(SetArgReferee<1>(2), Return(true)));
+
+        std::vector<std::string> errors;
+        EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillRepeatedly(Invoke(
+            [&](std::shared_ptr<std::string> msg, auto)
+            {
+                database_response resp;
+                ASSERT_TRUE(resp.ParseFromString(*msg));
+                errors.emplace_back(resp.resp().error());
+            }));
+
+        this->mh(generate_create_request(USER_UUID, "key0", "value"), this->mock_session);
+        this->mh(generate_create_request(USER_UUID, "key1", "value"), this->mock_session);
+
+        // nothing has expired yet...
+        this->expire_commit_timer();
+        EXPECT_TRUE(errors.empty());
+
+        this->crud->pending_writes[1].deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+        this->expire_commit_timer();
+        EXPECT_EQ(errors, std::vector<std::string>({bzn::MSG_COMMIT_TIMEOUT}));
+
+        // we lost leadership and can no longer say what happens to the rest...
+        EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::follower));
+        this->expire_commit_timer();
+        EXPECT_EQ(errors, std::vector<std::string>({bzn::MSG_COMMIT_TIMEOUT, bzn::MSG_LEADER_CHANGED}));
+        EXPECT_TRUE(this->crud->pending_writes.empty());
+    }
+
+
+    TEST_F(crud_test, test_that_a_write_committed_before_it_is_parked_is_answered_with_its_result)
+    {
+        EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+        EXPECT_CALL(*this->mock_storage, has(USER_UUID, _)).WillRepeatedly(Return(false));
+
+        // raft commits each entry before append_log returns...
+        uint32_t next_index = 0;
+        EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillRepeatedly(Invoke(
+            [&](const bzn::message& msg, uint32_t& log_index)
+            {
+                log_index = ++next_index;
+                this->ch(msg, log_index);
+                return true;
+            }));
+
+        EXPECT_CALL(*this->mock_storage, create(USER_UUID, "key0", "value"))
+            .WillOnce(Return(bzn::storage_base::result::ok))
+            .WillOnce(Return(bzn::storage_base::result::exists));
+
+        std::vector<std::string> errors;
+        EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillRepeatedly(Invoke(
+            [&](std::shared_ptr<std::string> msg, auto)
+            {
+                database_response resp;
+                ASSERT_TRUE(resp.ParseFromString(*msg));
+                errors.emplace_back(resp.resp().error());
+            }));
+
+        // the session does not idle out while a write waits...
+        EXPECT_CALL(*this->mock_session, hold_idle()).Times(2);
+        EXPECT_CALL(*this->mock_session, release_idle()).Times(2);
+
+        this->mh(generate_create_request(USER_UUID, "key0", "value"), this->mock_session);
+        this->mh(generate_create_request(USER_UUID, "key0", "value"), this->mock_session);
+
+        EXPECT_EQ(errors, std::vector<std::string>({"", bzn::MSG_RECORD_EXISTS}));
+        EXPECT_TRUE(this->crud->pending_writes.empty());
+    }
+}
+
+
+TEST_F(crud_forward_test, test_that_a_follower_forwards_a_write_and_relays_the_leaders_response)
+{
+    auto request = generate_create_request(USER_UUID, "key0", "value");
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::follower));
+    EXPECT_CALL(*this->mock_raft, get_leader()).WillOnce(Return(bzn::peer_address_t("127.0.0.1",49153,8080,"iron maiden",LEADER_UUID)));
+
+    std::shared_ptr<bzn::message> forwarded;
+    EXPECT_CALL(*this->mock_node, send_message(_, An<std::shared_ptr<bzn::message>>())).Times(0);
+    EXPECT_CALL(*this->mock_node, send_on_channel(boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string("127.0.0.1"), 49153}, _))
+        .WillOnce(Invoke(
+            [&](const auto& /*ep*/, std::shared_ptr<bzn::encoded_message> msg)
+            {
+                forwarded = std::make_shared<bzn::message>();
+                ASSERT_EQ(size_t(1), msg->size());
+                ASSERT_TRUE(Json::Reader().parse(*msg->front(), *forwarded));
+            }));
+
+    std::vector<database_response> responses;
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillRepeatedly(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            responses.emplace_back(resp);
+        }));
+
+    this->mh(request, this->mock_session);
+
+    ASSERT_TRUE(forwarded);
+    EXPECT_EQ((*forwarded)["bzn-api"].asString(), "database");
+    EXPECT_EQ((*forwarded)["msg"], request["msg"]);
+    ASSERT_TRUE(forwarded->isMember("forward_id"));
+    EXPECT_TRUE(responses.empty());
+
+    // the leader answers once the write commits...
+    database_response leader_response;
+    leader_response.mutable_header()->set_transaction_id(85746);
+    leader_response.mutable_resp();
+
+    bzn::message reply;
+    reply["bzn-api"] = "database_forward";
+    reply["forward_id"] = (*forwarded)["forward_id"];
+    reply["msg"] = boost::beast::detail::base64_encode(leader_response.SerializeAsString());
+
+    this->forward_mh(reply, nullptr);
+
+    ASSERT_EQ(responses.size(), size_t(1));
+    EXPECT_EQ(responses[0].success_case(), database_response::kResp);
+    EXPECT_TRUE(responses[0].resp().error().empty());
+    EXPECT_EQ(responses[0].header().transaction_id(), uint64_t(85746));
+
+    // a duplicate reply is dropped...
+    this->forward_mh(reply, nullptr);
+    EXPECT_EQ(responses.size(), size_t(1));
+}
+
+
+TEST_F(crud_forward_test, test_that_a_leader_answers_a_forwarded_write_through_the_peer_channel)
+{
+    auto request = generate_create_request(USER_UUID, "key0", "value");
+    request["forward_id"] = Json::UInt64(42);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    EXPECT_CALL(*this->mock_storage, has(USER_UUID, "key0")).WillOnce(Return(false));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+    EXPECT_CALL(*this->mock_storage, create(USER_UUID, "key0", "value")).WillOnce(Return(bzn::storage_base::result::ok));
+
+    std::shared_ptr<bzn::message> reply;
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<bzn::message>>(), false)).WillOnce(SaveArg<0>(&reply));
+
+    this->mh(request, this->mock_session);
+
+    // the entry replicas store carries nothing of the hop...
+    EXPECT_FALSE(appended.isMember("forward_id"));
+
+    this->ch(appended, 1);
+
+    ASSERT_TRUE(reply);
+    EXPECT_EQ((*reply)["bzn-api"].asString(), "database_forward");
+    EXPECT_EQ((*reply)["forward_id"].asUInt64(), uint64_t(42));
+
+    database_response resp;
+    ASSERT_TRUE(resp.ParseFromString(boost::beast::detail::base64_decode((*reply)["msg"].asString())));
+    EXPECT_TRUE(resp.resp().error().empty());
+    EXPECT_EQ(resp.header().transaction_id(), uint64_t(85746));
+}
+
+
+TEST_F(crud_forward_test, test_that_a_forwarded_write_is_redirected_when_the_leader_is_unknown)
+{
+    auto request = generate_create_request(USER_UUID, "key0", "value");
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::follower));
+    EXPECT_CALL(*this->mock_raft, get_leader()).WillRepeatedly(Return(bzn::peer_address_t("",0,0,"","")));
+    EXPECT_CALL(*this->mock_node, send_on_channel(_, _)).Times(0);
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.success_case(), database_response::kRedirect);
+        }));
+
+    this->mh(request, this->mock_session);
+}
+
+
+TEST_F(crud_test, test_that_a_leader_applies_a_batch_as_one_entry_and_reports_failed_preconditions)
+{
+    bzn_msg msg;
+    auto create = msg.mutable_db()->mutable_batch()->add_ops();
+    create->mutable_create()->set_key("key0");
+    create->mutable_create()->set_value("value0");
+    create->mutable_if_absent();
+    auto remove = msg.mutable_db()->mutable_batch()->add_ops();
+    remove->mutable_delete_()->set_key("key1");
+    remove->set_if_version("version1");
+
+    auto request = generate_generic_request(USER_UUID, msg);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.resp().error(), bzn::MSG_PRECONDITION_FAILED);
+        }));
+
+    this->mh(request, this->mock_session);
+
+    // preconditions are only evaluated by storage at commit...
+    EXPECT_CALL(*this->mock_storage, apply(USER_UUID, _)).WillOnce(Invoke(
+        [](auto, const std::vector<bzn::storage_base::operation>& operations)
+        {
+            EXPECT_EQ(operations.size(), size_t(2));
+            EXPECT_EQ(operations[0].op, bzn::storage_base::operation::type::create);
+            EXPECT_EQ(operations[0].precondition, bzn::storage_base::operation::condition::absent);
+            EXPECT_EQ(operations[0].key, "key0");
+            EXPECT_EQ(operations[0].value, "value0");
+            EXPECT_EQ(operations[1].op, bzn::storage_base::operation::type::remove);
+            EXPECT_EQ(operations[1].precondition, bzn::storage_base::operation::condition::version);
+            EXPECT_EQ(operations[1].version, "version1");
+            return bzn::storage_base::result::precondition_failed;
+        }));
+
+    this->ch(appended, 1);
+}
+
+
+TEST_F(crud_test, test_that_a_batch_with_an_empty_op_fails)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_batch()->add_ops();
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).Times(0);
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.resp().error(), bzn::MSG_INVALID_ARGUMENTS);
+        }));
+
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+}
+
+
+TEST_F(crud_test, test_that_an_increment_is_computed_when_it_commits)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_increment()->set_key("counter");
+    msg.mutable_db()->mutable_increment()->set_delta(5);
+
+    auto request = generate_generic_request(USER_UUID, msg);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_TRUE(resp.resp().error().empty());
+        }));
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+
+    this->mh(request, this->mock_session);
+
+    // replicas decide what has expired by the leader's clock...
+    bzn_msg stamped;
+    ASSERT_TRUE(stamped.ParseFromString(boost::beast::detail::base64_decode(appended["msg"].asString())));
+    EXPECT_GE(stamped.db().timestamp(), uint64_t(now.count()));
+    EXPECT_LE(stamped.db().timestamp(), uint64_t(now.count() + 1));
+    EXPECT_CALL(*this->mock_storage, set_commit_time(std::chrono::seconds(stamped.db().timestamp())));
+
+    EXPECT_CALL(*this->mock_storage, read(USER_UUID, "counter"))
+        .WillOnce(Return(nullptr))
+        .WillOnce(Return(std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{{}, "5", "version"})));
+
+    EXPECT_CALL(*this->mock_storage, apply(USER_UUID, _)).WillOnce(Invoke(
+        [](auto, const std::vector<bzn::storage_base::operation>& operations)
+        {
+            EXPECT_EQ(operations.size(), size_t(1));
+            EXPECT_EQ(operations[0].op, bzn::storage_base::operation::type::increment);
+            EXPECT_EQ(operations[0].delta, 5);
+            return bzn::storage_base::result::ok;
+        }));
+
+    this->ch(appended, 1);
+}
+
+
+TEST_F(crud_test, test_that_a_cas_with_a_stale_version_fails)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_cas()->set_key("key0");
+    msg.mutable_db()->mutable_cas()->set_value("value1");
+    msg.mutable_db()->mutable_cas()->set_version("version0");
+
+    auto request = generate_generic_request(USER_UUID, msg);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            EXPECT_EQ(resp.resp().error(), bzn::MSG_PRECONDITION_FAILED);
+        }));
+
+    this->mh(request, this->mock_session);
+
+    EXPECT_CALL(*this->mock_storage, read(USER_UUID, "key0")).WillOnce(Return(nullptr));
+    EXPECT_CALL(*this->mock_storage, apply(USER_UUID, _)).WillOnce(Invoke(
+        [](auto, const std::vector<bzn::storage_base::operation>& operations)
+        {
+            EXPECT_EQ(operations.size(), size_t(1));
+            EXPECT_EQ(operations[0].op, bzn::storage_base::operation::type::update);
+            EXPECT_EQ(operations[0].precondition, bzn::storage_base::operation::condition::version);
+            EXPECT_EQ(operations[0].version, "version0");
+            return bzn::storage_base::result::precondition_failed;
+        }));
+
+    this->ch(appended, 1);
+}
+
+
+TEST_F(crud_test, test_that_a_scan_returns_a_bounded_page_and_its_continuation)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_scan()->set_start("key1");
+    msg.mutable_db()->mutable_scan()->set_prefix("key");
+    msg.mutable_db()->mutable_scan()->set_limit(2);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillOnce(Return(bzn::raft_state::follower));
+
+    auto record = [](const std::string& value)
+    {
+        return std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{{}, value, boost::uuids::string_generator()(TEST_NODE_UUID)});
+    };
+
+    // one record more than the page...
+    EXPECT_CALL(*this->mock_storage, scan(USER_UUID, "key1", "", "key", 3)).WillOnce(Return(
+        bzn::storage_base::scan_result{{"key1", record("1")}, {"key2", record("2")}, {"key3", record("3")}}));
+
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_)).WillOnce(Invoke(
+        [&](std::shared_ptr<std::string> msg, auto)
+        {
+            database_response resp;
+            ASSERT_TRUE(resp.ParseFromString(*msg));
+            ASSERT_EQ(resp.resp().records().size(), int(2));
+            EXPECT_EQ(resp.resp().records(0).key(), "key1");
+            EXPECT_EQ(resp.resp().records(0).value(), "1");
+            EXPECT_EQ(resp.resp().records(0).version(), TEST_NODE_UUID);
+            EXPECT_EQ(resp.resp().records(1).key(), "key2");
+            EXPECT_EQ(resp.resp().next_key(), "key3");
+        }));
+
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+}
+
+
+TEST_F(crud_test, test_that_a_leader_stamps_the_expiry_of_a_create_with_a_ttl)
+{
+    bzn_msg msg;
+    msg.mutable_db()->mutable_create()->set_key("session");
+    msg.mutable_db()->mutable_create()->set_value("value");
+    msg.mutable_db()->mutable_create()->set_ttl(60);
+
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    EXPECT_CALL(*this->mock_storage, has(USER_UUID, "session")).WillOnce(Return(false));
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+    EXPECT_CALL(*this->mock_session, send_message(An<std::shared_ptr<std::string>>(),_));
+
+    this->mh(generate_generic_request(USER_UUID, msg), this->mock_session);
+
+    bzn_msg stamped;
+    ASSERT_TRUE(stamped.ParseFromString(boost::beast::detail::base64_decode(appended["msg"].asString())));
+    EXPECT_GE(stamped.db().create().expires(), uint64_t(now + 60));
+    EXPECT_LE(stamped.db().create().expires(), uint64_t(now + 61));
+
+    // every replica stores the stamped expiry...
+    EXPECT_CALL(*this->mock_storage, apply(USER_UUID, _)).WillOnce(Invoke(
+        [&](auto, const std::vector<bzn::storage_base::operation>& operations)
+        {
+            EXPECT_EQ(operations.size(), size_t(1));
+            EXPECT_EQ(operations[0].op, bzn::storage_base::operation::type::create);
+            EXPECT_EQ(uint64_t(operations[0].expires.count()), stamped.db().create().expires());
+            return bzn::storage_base::result::ok;
+        }));
+
+    this->ch(appended, 1);
+}
+
+
+TEST_F(crud_test, test_that_a_leader_proposes_expired_keys_in_one_entry)
+{
+    EXPECT_CALL(*this->mock_raft, get_state()).WillRepeatedly(Return(bzn::raft_state::leader));
+    EXPECT_CALL(*this->mock_storage, get_expired(_, _)).WillRepeatedly(Return(
+        std::vector<std::pair<bzn::uuid_t, std::string>>{{USER_UUID, "key0"}, {USER_UUID, "key1"}}));
+
+    bzn::message appended;
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SaveArg<0>(&appended), SetArgReferee<1>(1), Return(true)));
+
+    this->expire_commit_timer();
+
+    // nothing more is proposed until the entry commits...
+    this->expire_commit_timer();
+
+    bzn_msg msg;
+    ASSERT_TRUE(msg.ParseFromString(boost::beast::detail::base64_decode(appended["msg"].asString())));
+    ASSERT_EQ(msg.db().msg_case(), database_msg::kExpire);
+    EXPECT_EQ(msg.db().header().db_uuid(), USER_UUID);
+    ASSERT_EQ(msg.db().expire().keys().size(), 2);
+
+    // key1 was refreshed before the entry committed...
+    EXPECT_CALL(*this->mock_storage, apply(USER_UUID, _)).WillOnce(Invoke(
+        [&](auto, const std::vector<bzn::storage_base::operation>& operations)
+        {
+            EXPECT_EQ(operations[0].key, "key0");
+            EXPECT_EQ(operations[0].precondition, bzn::storage_base::operation::condition::expired);
+            EXPECT_EQ(uint64_t(operations[0].expires.count()), msg.db().expire().cutoff());
+            return bzn::storage_base::result::ok;
+        })).WillOnce(Return(bzn::storage_base::result::precondition_failed));
+
+    this->ch(appended, 1);
+
+    EXPECT_CALL(*this->mock_raft, append_log(_, _)).WillOnce(DoAll(SetArgReferee<1>(2), Return(true)));
+    this->expire_commit_timer();
+}
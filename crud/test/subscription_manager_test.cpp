@@ -0,0 +1,162 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <crud/subscription_manager.hpp>
+#include <mocks/mock_session_base.hpp>
+
+using namespace ::testing;
+
+
+namespace
+{
+    const bzn::uuid_t USER_UUID{"80174b53-2dda-49f1-9d6a-6a780d4cceca"};
+
+    std::shared_ptr<bzn::Mocksession_base> make_session(bzn::session_id id)
+    {
+        auto session = std::make_shared<bzn::Mocksession_base>();
+        EXPECT_CALL(*session, get_session_id()).WillRepeatedly(Return(id));
+        return session;
+    }
+
+    std::string coalesce_key(const bzn::uuid_t& db_uuid, const std::string& key)
+    {
+        return std::to_string(db_uuid.size()) + ":" + db_uuid + key;
+    }
+}
+
+
+TEST(subscription_manager, test_that_key_watchers_receive_shared_notification)
+{
+    bzn::subscription_manager sm;
+
+    auto session1 = make_session(1);
+    auto session2 = make_session(2);
+
+    sm.subscribe(USER_UUID, "key0", false, session1);
+    sm.subscribe(USER_UUID, "key0", false, session2);
+    sm.subscribe(USER_UUID, "key1", false, session2);
+
+    EXPECT_EQ(size_t(3), sm.subscription_count(USER_UUID));
+
+    std::shared_ptr<std::string> msg1, msg2;
+    EXPECT_CALL(*session1, send_notification(coalesce_key(USER_UUID, "key0"), _)).WillOnce(SaveArg<1>(&msg1));
+    EXPECT_CALL(*session2, send_notification(coalesce_key(USER_UUID, "key0"), _)).WillOnce(SaveArg<1>(&msg2));
+
+    sm.inspect_commit(USER_UUID, "key0", database_watch_notification::UPDATED, "value");
+
+    // serialized once...
+    ASSERT_TRUE(msg1);
+    EXPECT_EQ(msg1, msg2);
+
+    database_response resp;
+    ASSERT_TRUE(resp.ParseFromString(*msg1));
+    EXPECT_EQ(resp.success_case(), database_response::kNotification);
+    EXPECT_EQ(resp.header().db_uuid(), USER_UUID);
+    EXPECT_EQ(resp.notification().key(), "key0");
+    EXPECT_EQ(resp.notification().value(), "value");
+    EXPECT_EQ(resp.notification().operation(), database_watch_notification::UPDATED);
+
+    // nobody watching...
+    sm.inspect_commit(USER_UUID, "key2", database_watch_notification::UPDATED, "value");
+}
+
+
+TEST(subscription_manager, test_that_prefix_watchers_are_notified_once)
+{
+    bzn::subscription_manager sm;
+
+    auto session = make_session(1);
+
+    sm.subscribe(USER_UUID, "user/", true, session);
+    sm.subscribe(USER_UUID, "", true, session);
+    sm.subscribe(USER_UUID, "user/1", false, session);
+
+    EXPECT_CALL(*session, send_notification(coalesce_key(USER_UUID, "user/1"), _)).Times(1);
+    sm.inspect_commit(USER_UUID, "user/1", database_watch_notification::DELETED, "");
+
+    EXPECT_TRUE(sm.unsubscribe(USER_UUID, "", true, session));
+    EXPECT_FALSE(sm.unsubscribe(USER_UUID, "", true, session));
+
+    EXPECT_CALL(*session, send_notification(_, _)).Times(0);
+    sm.inspect_commit(USER_UUID, "other", database_watch_notification::CREATED, "value");
+}
+
+
+TEST(subscription_manager, test_that_expired_sessions_are_pruned)
+{
+    bzn::subscription_manager sm;
+
+    {
+        auto session = make_session(1);
+        sm.subscribe(USER_UUID, "key0", false, session);
+    }
+
+    EXPECT_EQ(size_t(1), sm.subscription_count(USER_UUID));
+
+    sm.inspect_commit(USER_UUID, "key0", database_watch_notification::CREATED, "value");
+
+    EXPECT_EQ(size_t(0), sm.subscription_count(USER_UUID));
+}
+
+
+TEST(subscription_manager, test_that_a_closed_session_loses_every_watch)
+{
+    bzn::subscription_manager sm;
+
+    auto session = make_session(1);
+    auto other = make_session(2);
+
+    // only the first subscription asks for the session's shutdown handler...
+    EXPECT_TRUE(sm.subscribe(USER_UUID, "never-written", false, session));
+    EXPECT_FALSE(sm.subscribe(USER_UUID, "user/", true, session));
+    EXPECT_TRUE(sm.unsubscribe(USER_UUID, "user/", true, session));
+    EXPECT_FALSE(sm.subscribe(USER_UUID, "user/", true, session));
+    EXPECT_TRUE(sm.subscribe(USER_UUID, "never-written", false, other));
+
+    sm.unsubscribe_all(1);
+
+    EXPECT_EQ(size_t(1), sm.subscription_count(USER_UUID));
+
+    // a new session is a stranger even at the same address...
+    EXPECT_TRUE(sm.subscribe(USER_UUID, "never-written", false, session));
+
+    sm.unsubscribe_all(1);
+    sm.unsubscribe_all(2);
+
+    EXPECT_EQ(size_t(0), sm.subscription_count(USER_UUID));
+}
+
+
+TEST(subscription_manager, test_that_coalesce_keys_tell_database_and_key_apart)
+{
+    bzn::subscription_manager sm;
+
+    auto session = make_session(1);
+
+    sm.subscribe("a/b", "c", false, session);
+    sm.subscribe("a", "b/c", false, session);
+
+    std::vector<std::string> keys;
+    EXPECT_CALL(*session, send_notification(_, _)).Times(2).WillRepeatedly(Invoke(
+        [&](const std::string& key, auto)
+        {
+            keys.push_back(key);
+        }));
+
+    sm.inspect_commit("a/b", "c", database_watch_notification::UPDATED, "value");
+    sm.inspect_commit("a", "b/c", database_watch_notification::UPDATED, "value");
+
+    ASSERT_EQ(keys.size(), size_t(2));
+    EXPECT_NE(keys[0], keys[1]);
+}
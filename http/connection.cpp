@@ -14,9 +14,14 @@
 
 #include <include/bluzelle.hpp>
 #include <http/connection.hpp>
+#include <metrics/metrics.hpp>
+
+#include <algorithm>
 
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
 
 
 namespace
@@ -26,7 +31,16 @@ namespace
     const std::string UPDATE_REQ = "update";
     const std::string DELETE_REQ = "delete";
 
-    const std::chrono::seconds HTTP_TIMEOUT{10};
+    const std::string BATCH_READ_REQ = "batch-read";
+    const std::string BATCH_WRITE_REQ = "batch-write";
+
+    const std::string METRICS_TARGET = "/metrics";
+    const std::string METRICS_CONTENT_TYPE = "text/plain; version=0.0.4";
+
+    const std::chrono::seconds DEFAULT_HTTP_IDLE_TIMEOUT{10};
+
+    // stop reading ahead when this many responses are waiting to be written...
+    const size_t MAX_PIPELINED_REQUESTS = 16;
 
     //             0   1     2      3
     // url format:  /<req>/<uuid>/<key>
@@ -35,6 +49,39 @@ namespace
     const uint8_t     KEY_PATH_IDX = 3;
     const size_t     MAX_PATH_SIZE = 4;
 
+    //             0     1         2
+    // url format:  /<batch req>/<uuid>
+    // batch-read bodies are a key per line, batch-write bodies a tab separated key and value per line.
+    // batch-read answers a line per key: "ack<value length>:<value>" or "err"
+    const size_t   BATCH_PATH_SIZE = 3;
+
+    const char BATCH_VALUE_SEPARATOR = '\t';
+
+    void format_http_value(std::ostream& os, const database_response& response)
+    {
+        if (response.resp().value().size())
+        {
+            os << "ack" << response.resp().value();
+        }
+        else
+        {
+            os << ((response.resp().error().empty()) ? "ack" : "err");
+        }
+    }
+
+    void format_batch_value(std::ostream& os, const database_response& response)
+    {
+        // a follower redirects a key it doesn't have rather than report it missing...
+        if (response.success_case() != database_response::kResp || !response.resp().error().empty())
+        {
+            os << "err";
+            return;
+        }
+
+        // length prefixed so empty values and values holding newlines keep the framing...
+        os << "ack" << response.resp().value().size() << ':' << response.resp().value();
+    }
+
     void format_http_response(const boost::beast::string_view& target, const database_response& response, boost::beast::http::response<boost::beast::http::dynamic_body>& http_response)
     {
         if (response.success_case() == database_response::kRedirect)
@@ -53,24 +100,109 @@ namespace
             return;
         }
 
-        if (response.resp().value().size())
+        if (!response.resp().version().empty())
         {
-            boost::beast::ostream(http_response.body()) << "ack" << response.resp().value();
+            http_response.set(boost::beast::http::field::etag, "\"" + response.resp().version() + "\"");
         }
-        else
+
+        if (response.resp().not_modified())
+        {
+            http_response.result(boost::beast::http::status::not_modified);
+            return;
+        }
+
+        auto os = boost::beast::ostream(http_response.body());
+        format_http_value(os, response);
+    }
+
+    // If-None-Match is a comma separated list of quoted, possibly weak, entity tags or "*"...
+    std::vector<std::string> parse_entity_tags(const boost::beast::string_view& header)
+    {
+        std::vector<std::string> tags;
+        std::vector<std::string> items;
+        boost::split(items, header, boost::is_any_of(","));
+
+        for (auto& item : items)
         {
-            boost::beast::ostream(http_response.body()) << ((response.resp().error().empty()) ? "ack" : "err");
+            boost::trim(item);
+
+            if (boost::starts_with(item, "W/"))
+            {
+                item.erase(0, 2);
+            }
+
+            if (item.size() >= 2 && item.front() == '"' && item.back() == '"')
+            {
+                item = item.substr(1, item.size() - 2);
+            }
+
+            if (!item.empty())
+            {
+                tags.emplace_back(std::move(item));
+            }
+        }
+
+        return tags;
+    }
+
+    // walks the lines of a body across its buffers without first copying it...
+    template<typename ConstBufferSequence>
+    void for_each_line(const ConstBufferSequence& buffers, const std::function<void(const std::string& line)>& handler)
+    {
+        std::string line;
+
+        auto emit = [&]()
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+
+            if (!line.empty())
+            {
+                handler(line);
+            }
+
+            line.clear();
+        };
+
+        for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++it)
+        {
+            const boost::asio::const_buffer buffer = *it;
+
+            auto begin = static_cast<const char*>(buffer.data());
+            const auto end = begin + buffer.size();
+
+            while (begin != end)
+            {
+                auto eol = std::find(begin, end, '\n');
+
+                line.append(begin, eol);
+
+                if (eol == end)
+                {
+                    break;
+                }
+
+                emit();
+                begin = eol + 1;
+            }
         }
+
+        emit();
     }
 }
 
 using namespace bzn::http;
 
 
-connection::connection(std::shared_ptr<bzn::asio::io_context_base> io_context, std::unique_ptr<bzn::beast::http_socket_base> http_socket, std::shared_ptr<bzn::crud_base> crud)
+connection::connection(std::shared_ptr<bzn::asio::io_context_base> /*io_context*/, std::unique_ptr<bzn::beast::http_socket_base> http_socket, std::shared_ptr<bzn::crud_base> crud,
+    std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel, const std::chrono::milliseconds& idle_timeout, size_t max_requests)
     : http_socket(std::move(http_socket))
-    , deadline_timer(io_context->make_unique_steady_timer())
     , crud(std::move(crud))
+    , idle_timer_wheel(std::move(idle_timer_wheel))
+    , idle_timeout(idle_timeout.count() ? idle_timeout : DEFAULT_HTTP_IDLE_TIMEOUT)
+    , max_requests(max_requests)
 {
 }
 
@@ -78,108 +210,288 @@ connection::connection(std::shared_ptr<bzn::asio::io_context_base> io_context, s
 void
 connection::start()
 {
-    std::call_once(this->start_once, &connection::do_read_request, this);
+    std::call_once(this->start_once,
+        [this]()
+        {
+            this->start_idle_timeout();
+
+            std::lock_guard<std::mutex> lock(this->lock);
+
+            this->do_read_request();
+        });
 }
 
 
 void
 connection::do_read_request()
 {
-    this->start_deadline_timer();
+    this->reading = true;
+
+    // only idle when nothing is left to write...
+    if (this->write_queue.empty())
+    {
+        this->idle_entry->reset();
+    }
+
+    this->request = {};
 
-    // todo: strands?
     this->http_socket->async_read(this->buffer, this->request,
         [self = shared_from_this()](boost::beast::error_code ec, std::size_t /*bytes_transferred*/)
         {
-            if(!ec)
-            {
-                self->deadline_timer->cancel();
+            std::unique_lock<std::mutex> lock(self->lock);
 
-                // extract the path levels from the target...
-                std::vector<std::string> path;
-                std::string target = self->request.target().to_string();
-                boost::split(path, target, boost::is_any_of("/"));
+            self->reading = false;
 
-                // test path...
-                if (path.size() != MAX_PATH_SIZE)
+            if (ec)
+            {
+                if (ec != boost::beast::http::error::end_of_stream)
                 {
-                    self->response.result(boost::beast::http::status::bad_request);
+                    LOG(error) << "read failed: " << ec.message();
                 }
-                else
+
+                // finish writing any responses we owe...
+                self->closing = true;
+
+                if (!self->writing)
                 {
-                    switch (self->request.method())
-                    {
-                        case boost::beast::http::verb::get:
-                        {
-                            self->handle_get(path);
-                            break;
-                        }
-
-                        case boost::beast::http::verb::post:
-                        {
-                            self->handle_post(path);
-                            break;
-                        }
-
-                        default:
-                        {
-                            self->response.result(boost::beast::http::status::bad_request);
-                            break;
-                        }
-                    }
+                    self->do_write();
                 }
 
-                self->write_response();
-
                 return;
             }
 
-            LOG(error) << "read failed: " << ec.message();
+            // don't expire while the request is handled and the response written...
+            self->idle_entry->suspend();
+
+            // the next read reuses the request member...
+            auto request = std::make_shared<http_request>(std::move(self->request));
+
+            ++self->request_count;
+
+            auto entry = std::make_shared<queued_response>();
+            entry->response = std::make_shared<http_response>();
+            entry->response->version(request->version());
+            entry->response->set(boost::beast::http::field::server, "Bluzelle/" SWARM_VERSION);
+            entry->response->set(boost::beast::http::field::content_type, "text/plain");
+            entry->response->keep_alive(request->keep_alive() && (!self->max_requests || self->request_count < self->max_requests));
+
+            if (!entry->response->keep_alive())
+            {
+                self->closing = true;
+            }
+
+            self->write_queue.emplace_back(entry);
+
+            if (!self->closing && !self->reading && self->write_queue.size() < MAX_PIPELINED_REQUESTS)
+            {
+                self->do_read_request();
+            }
+
+            self->unhandled.emplace_back(std::move(request), entry);
+
+            // the thread already handling our requests will get to this one after the ones before it...
+            if (!self->handling)
+            {
+                self->handle_requests(lock);
+            }
         });
 }
 
 
 void
-connection::start_deadline_timer()
+connection::handle_requests(std::unique_lock<std::mutex>& lock)
+{
+    this->handling = true;
+
+    while (!this->unhandled.empty())
+    {
+        auto [request, entry] = std::move(this->unhandled.front());
+        this->unhandled.pop_front();
+
+        // writes are answered once committed so crud must not be called while holding our lock...
+        lock.unlock();
+
+        this->handle_request(*request, entry);
+
+        lock.lock();
+    }
+
+    this->handling = false;
+}
+
+
+void
+connection::handle_request(const http_request& request, const std::shared_ptr<queued_response>& entry)
+{
+    // extract the path levels from the target...
+    std::vector<std::string> path;
+    std::string target = request.target().to_string();
+    boost::split(path, target, boost::is_any_of("/"));
+
+    if (target == METRICS_TARGET && request.method() == boost::beast::http::verb::get)
+    {
+        entry->response->set(boost::beast::http::field::content_type, METRICS_CONTENT_TYPE);
+        boost::beast::ostream(entry->response->body()) << bzn::metrics::registry::global().to_prometheus();
+        this->complete_response(entry);
+        return;
+    }
+
+    if (path.size() == BATCH_PATH_SIZE && request.method() == boost::beast::http::verb::post)
+    {
+        this->handle_batch(path, request, entry);
+        return;
+    }
+
+    // test path...
+    if (path.size() != MAX_PATH_SIZE)
+    {
+        entry->response->result(boost::beast::http::status::bad_request);
+        this->complete_response(entry);
+        return;
+    }
+
+    switch (request.method())
+    {
+        case boost::beast::http::verb::get:
+        {
+            this->handle_get(path, request, entry);
+            break;
+        }
+
+        case boost::beast::http::verb::post:
+        {
+            this->handle_post(path, request, entry);
+            break;
+        }
+
+        default:
+        {
+            entry->response->result(boost::beast::http::status::bad_request);
+            this->complete_response(entry);
+            break;
+        }
+    }
+}
+
+
+bzn::crud_base::response_handler
+connection::make_crud_handler(const http_request& req, const std::shared_ptr<queued_response>& entry)
+{
+    return [self = shared_from_this(), target = req.target().to_string(), entry](const database_response& response)
+        {
+            format_http_response(target, response, *entry->response);
+            self->complete_response(entry);
+        };
+}
+
+
+void
+connection::complete_response(const std::shared_ptr<queued_response>& entry)
 {
-    this->deadline_timer->expires_from_now(std::chrono::seconds(HTTP_TIMEOUT));
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    // a 304 describes the value it did not send...
+    if (entry->response->result() != boost::beast::http::status::not_modified)
+    {
+        entry->response->set(boost::beast::http::field::content_length, entry->response->body().size());
+    }
+
+    entry->ready = true;
+
+    if (!this->writing)
+    {
+        this->do_write();
+    }
+}
 
-    // todo: strands?
-    this->deadline_timer->async_wait(
-        [self = shared_from_this()](auto ec)
+
+void
+connection::start_idle_timeout()
+{
+    // the wheel must not keep the connection alive...
+    this->idle_entry = this->idle_timer_wheel->add(this->idle_timeout,
+        [weak_self = std::weak_ptr<connection>(shared_from_this())]()
         {
-            if (!ec)
+            if (auto self = weak_self.lock())
             {
-                LOG(info) << "reached deadline timeout -- closing session";
+                LOG(info) << "reached idle timeout -- closing connection";
                 self->http_socket->close();
-                return;
             }
         });
 }
 
 
 void
-connection::write_response()
+connection::do_write()
 {
-    auto self = shared_from_this();
+    if (this->write_queue.empty())
+    {
+        this->writing = false;
 
-    this->response.version(this->request.version());
-    this->response.set(boost::beast::http::field::server, "Bluzelle/" SWARM_VERSION);
-    this->response.set(boost::beast::http::field::content_type, "text/plain");
-    this->response.set(boost::beast::http::field::content_length, this->response.body().size());
-    this->response.keep_alive(false);
+        if (this->closing)
+        {
+            this->close();
+        }
+        else if (this->reading)
+        {
+            this->idle_entry->reset();
+        }
 
-    this->http_socket->async_write(
-        this->response,
-        [self](boost::beast::error_code ec, std::size_t)
+        return;
+    }
+
+    // still waiting on crud for the oldest request...
+    if (!this->write_queue.front()->ready)
+    {
+        this->writing = false;
+        return;
+    }
+
+    this->writing = true;
+
+    auto response = this->write_queue.front()->response;
+
+    this->http_socket->async_write(*response,
+        [self = shared_from_this(), response](boost::beast::error_code ec, std::size_t)
         {
-            self->http_socket->get_socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+            std::lock_guard<std::mutex> lock(self->lock);
+
+            if (ec)
+            {
+                LOG(error) << "write failed: " << ec.message();
+
+                self->writing = false;
+                self->write_queue.clear();
+                self->close();
+                return;
+            }
+
+            self->write_queue.pop_front();
+
+            // resume reading if we had to stop for a slow reader...
+            if (!self->closing && !self->reading && self->write_queue.size() < MAX_PIPELINED_REQUESTS)
+            {
+                self->do_read_request();
+            }
+
+            self->do_write();
         });
 }
 
 
 void
-connection::handle_get(const std::vector<std::string>& path)
+connection::close()
+{
+    this->closing = true;
+    this->idle_entry->cancel();
+
+    boost::system::error_code ec;
+    this->http_socket->get_socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+}
+
+
+void
+connection::handle_get(const std::vector<std::string>& path, const http_request& req, const std::shared_ptr<queued_response>& entry)
 {
     // Only read is supported by a GET...
     if (path[REQUEST_PATH_IDX] == READ_REQ)
@@ -193,24 +505,33 @@ connection::handle_get(const std::vector<std::string>& path)
         request.mutable_header()->set_db_uuid(path[UUID_PATH_IDX]);
         request.mutable_read()->set_key(path[KEY_PATH_IDX]);
 
+        if (auto it = req.find(boost::beast::http::field::if_none_match); it != req.end())
+        {
+            for (auto& tag : parse_entity_tags(it->value()))
+            {
+                request.mutable_read()->add_if_none_match(std::move(tag));
+            }
+        }
+
         this->crud->handle_read(bzn::message(), request, response);
-        format_http_response(this->request.target(), response, this->response);
+        format_http_response(req.target(), response, *entry->response);
+        this->complete_response(entry);
 
         return;
     }
 
-    this->response.result(boost::beast::http::status::bad_request);
+    entry->response->result(boost::beast::http::status::bad_request);
+    this->complete_response(entry);
 }
 
 
 void
-connection::handle_post(const std::vector<std::string>& path)
+connection::handle_post(const std::vector<std::string>& path, const http_request& req, const std::shared_ptr<queued_response>& entry)
 {
     std::stringstream post_data;
-    post_data << boost::beast::buffers(this->request.body().data());
+    post_data << boost::beast::buffers(req.body().data());
 
     // format request using protobuf...
-    database_response response;
     bzn::message crud_msg;
     crud_msg["bzn-api"] = "crud";
 
@@ -227,8 +548,7 @@ connection::handle_post(const std::vector<std::string>& path)
         // todo: temp until we remove all json api or we store the request instead of the json message...
         crud_msg["msg"] = boost::beast::detail::base64_encode(msg.SerializeAsString());
 
-        this->crud->handle_create(crud_msg, msg.db(), response);
-        format_http_response(this->request.target(), response, this->response);
+        this->crud->handle_create(crud_msg, msg.db(), this->make_crud_handler(req, entry));
 
         return;
     }
@@ -245,8 +565,7 @@ connection::handle_post(const std::vector<std::string>& path)
         // todo: temp until we remove all json api or we store the request instead of the json message...
         crud_msg["msg"] = boost::beast::detail::base64_encode(msg.SerializeAsString());
 
-        this->crud->handle_update(crud_msg, msg.db(), response);
-        format_http_response(this->request.target(), response, this->response);
+        this->crud->handle_update(crud_msg, msg.db(), this->make_crud_handler(req, entry));
 
         return;
     }
@@ -262,11 +581,106 @@ connection::handle_post(const std::vector<std::string>& path)
         // todo: temp until we remove all json api or we store the request instead of the json message...
         crud_msg["msg"] = boost::beast::detail::base64_encode(msg.SerializeAsString());
 
-        this->crud->handle_delete(crud_msg, msg.db(), response);
-        format_http_response(this->request.target(), response, this->response);
+        this->crud->handle_delete(crud_msg, msg.db(), this->make_crud_handler(req, entry));
+
+        return;
+    }
+
+    entry->response->result(boost::beast::http::status::bad_request);
+    this->complete_response(entry);
+}
+
+
+void
+connection::handle_batch(const std::vector<std::string>& path, const http_request& req, const std::shared_ptr<queued_response>& entry)
+{
+    if (path[REQUEST_PATH_IDX] == BATCH_READ_REQ)
+    {
+        database_msg request;
+        request.mutable_header()->set_db_uuid(path[UUID_PATH_IDX]);
+
+        // results are returned a line per key in request order...
+        size_t count = 0;
+        {
+            // the body is only complete once the stream is flushed, before the content length is set...
+            auto os = boost::beast::ostream(entry->response->body());
+
+            for_each_line(req.body().data(),
+                [&](const std::string& key)
+                {
+                    database_response response;
+
+                    request.mutable_read()->set_key(key);
+                    this->crud->handle_read(bzn::message(), request, response);
 
+                    format_batch_value(os, response);
+                    os << '\n';
+                    ++count;
+                });
+        }
+
+        LOG(debug) << "batch read: " << count << " keys";
+
+        this->complete_response(entry);
         return;
     }
+    else if (path[REQUEST_PATH_IDX] == BATCH_WRITE_REQ)
+    {
+        bzn_msg msg;
+        msg.mutable_db()->mutable_header()->set_db_uuid(path[UUID_PATH_IDX]);
+
+        auto batch = msg.mutable_db()->mutable_batch();
+
+        bool valid = true;
+        bool too_large = false;
+        for_each_line(req.body().data(),
+            [&](const std::string& line)
+            {
+                if (size_t(batch->ops_size()) == bzn::MAX_BATCH_OPS)
+                {
+                    too_large = true;
+                    return;
+                }
+
+                auto separator = line.find(BATCH_VALUE_SEPARATOR);
+
+                if (separator == std::string::npos || separator == 0)
+                {
+                    valid = false;
+                    return;
+                }
+
+                auto put = batch->add_ops()->mutable_put();
+                put->set_key(line.substr(0, separator));
+                put->set_value(line.substr(separator + 1));
+            });
+
+        if (too_large)
+        {
+            LOG(debug) << "batch write over " << bzn::MAX_BATCH_OPS << " records";
+
+            // split it into smaller batches...
+            entry->response->result(boost::beast::http::status::payload_too_large);
+            boost::beast::ostream(entry->response->body()) << "err";
+            this->complete_response(entry);
+            return;
+        }
+
+        if (valid && batch->ops_size())
+        {
+            LOG(debug) << "batch write: " << batch->ops_size() << " records";
+
+            // the whole batch is a single raft entry...
+            bzn::message crud_msg;
+            crud_msg["bzn-api"] = "crud";
+            crud_msg["msg"] = boost::beast::detail::base64_encode(msg.SerializeAsString());
+
+            this->crud->handle_batch(crud_msg, msg.db(), this->make_crud_handler(req, entry));
+
+            return;
+        }
+    }
 
-    this->response.result(boost::beast::http::status::bad_request);
+    entry->response->result(boost::beast::http::status::bad_request);
+    this->complete_response(entry);
 }
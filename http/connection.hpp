@@ -16,8 +16,11 @@
 
 #include <include/boost_asio_beast.hpp>
 #include <crud/crud_base.hpp>
+#include <node/idle_timer_wheel_base.hpp>
 #include <storage/storage_base.hpp>
+#include <list>
 #include <memory>
+#include <mutex>
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
@@ -28,10 +31,18 @@
 
 namespace bzn::http
 {
+    using http_request = boost::beast::http::request<boost::beast::http::dynamic_body>;
+    using http_response = boost::beast::http::response<boost::beast::http::dynamic_body>;
+
+    // HTTP/1.1 connection. Requests are read and handled in order while earlier responses are
+    // still being written, and the connection is kept open until the client asks to close it,
+    // the request cap is reached or it goes idle. Completions may run on any io thread so only
+    // one of them at a time handles the connection's requests.
     class connection : public std::enable_shared_from_this<connection>
     {
     public:
-        connection(std::shared_ptr<bzn::asio::io_context_base> io_context, std::unique_ptr<bzn::beast::http_socket_base> http_socket, std::shared_ptr<bzn::crud_base> crud);
+        connection(std::shared_ptr<bzn::asio::io_context_base> io_context, std::unique_ptr<bzn::beast::http_socket_base> http_socket, std::shared_ptr<bzn::crud_base> crud,
+            std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel, const std::chrono::milliseconds& idle_timeout, size_t max_requests);
 
         void start();
 
@@ -42,24 +53,69 @@ namespace bzn::http
         FRIEND_TEST(http_connection, test_that_post_calls_crud_create_and_returns_redirect_when_not_the_leader);
         FRIEND_TEST(http_connection, test_that_post_calls_crud_update_and_returns_success);
         FRIEND_TEST(http_connection, test_that_post_calls_crud_delete_and_returns_success);
+        FRIEND_TEST(http_connection, test_that_keep_alive_requests_are_read_until_the_request_cap);
+        FRIEND_TEST(http_connection, test_that_pipelined_responses_are_written_in_order);
+
+        FRIEND_TEST(http_connection, test_that_responses_wait_for_uncommitted_writes);
+        FRIEND_TEST(http_connection, test_that_batch_read_returns_a_line_per_key);
+        FRIEND_TEST(http_connection, test_that_batch_read_on_a_follower_frames_redirects_empty_and_multiline_values);
+        FRIEND_TEST(http_connection, test_that_batch_write_submits_a_single_crud_batch);
+        FRIEND_TEST(http_connection, test_that_a_batch_write_over_the_op_limit_is_rejected);
+        FRIEND_TEST(http_connection, test_that_metrics_are_served_in_the_prometheus_format);
+        FRIEND_TEST(http_connection, test_that_conditional_get_returns_not_modified_for_a_matching_etag);
+
+        // a response is written once the request has been answered and everything before it was written...
+        struct queued_response
+        {
+            std::shared_ptr<http_response> response;
+            bool ready = false;
+        };
+
+        void handle_request(const http_request& request, const std::shared_ptr<queued_response>& entry);
+
+        void handle_get(const std::vector<std::string>& path, const http_request& req, const std::shared_ptr<queued_response>& entry);
+        void handle_post(const std::vector<std::string>& path, const http_request& req, const std::shared_ptr<queued_response>& entry);
+        void handle_batch(const std::vector<std::string>& path, const http_request& req, const std::shared_ptr<queued_response>& entry);
+
+        bzn::crud_base::response_handler make_crud_handler(const http_request& req, const std::shared_ptr<queued_response>& entry);
 
-        void handle_get(const std::vector<std::string>& path);
-        void handle_post(const std::vector<std::string>& path);
+        void complete_response(const std::shared_ptr<queued_response>& entry);
 
-        void do_read_request();
-        void write_response();
+        // hands the queued requests to crud one at a time, lock must be held...
+        void handle_requests(std::unique_lock<std::mutex>& lock);
 
-        void start_deadline_timer();
+        void do_read_request(); // lock must be held
+        void do_write();        // lock must be held
+
+        void close();           // lock must be held
+
+        void start_idle_timeout();
 
         std::shared_ptr<bzn::beast::http_socket_base> http_socket;
-        std::unique_ptr<bzn::asio::steady_timer_base> deadline_timer;
         std::shared_ptr<bzn::crud_base> crud;
+        std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel;
+        std::shared_ptr<bzn::idle_timer_entry> idle_entry;
+
+        const std::chrono::milliseconds idle_timeout;
+        const size_t max_requests;
+
+        boost::beast::flat_buffer buffer{bzn::beast::HTTP_BODY_LIMIT + 1024}; // add a bit of room for a header
+        http_request request;
+
+        // responses are written in the order the requests arrived...
+        std::list<std::shared_ptr<queued_response>> write_queue;
+
+        // requests read ahead of the one being handled...
+        std::list<std::pair<std::shared_ptr<http_request>, std::shared_ptr<queued_response>>> unhandled;
 
-        boost::beast::flat_buffer buffer{bzn::MAX_VALUE_SIZE + 1024}; // add a bit of room for a header
-        boost::beast::http::request<boost::beast::http::dynamic_body> request;
-        boost::beast::http::response<boost::beast::http::dynamic_body> response;
+        size_t request_count = 0;
+        bool reading = false;
+        bool writing = false;
+        bool handling = false;
+        bool closing = false; // no more requests will be read
 
+        std::mutex lock;
         std::once_flag start_once;
     };
 
-} // bzn::http
\ No newline at end of file
+} // bzn::http
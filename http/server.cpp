@@ -18,10 +18,14 @@
 using namespace bzn::http;
 
 
-server::server(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::crud_base> crud, const boost::asio::ip::tcp::endpoint& ep)
+server::server(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::crud_base> crud, std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel,
+    const boost::asio::ip::tcp::endpoint& ep, const std::chrono::milliseconds& idle_timeout, size_t max_requests)
     : tcp_acceptor(io_context->make_unique_tcp_acceptor(ep))
     , io_context(std::move(io_context))
     , crud(std::move(crud))
+    , idle_timer_wheel(std::move(idle_timer_wheel))
+    , idle_timeout(idle_timeout)
+    , max_requests(max_requests)
 {
 }
 
@@ -53,7 +57,8 @@ server::do_accept()
 
                 auto hs = std::make_unique<bzn::beast::http_socket>(std::move(self->acceptor_socket->get_tcp_socket()));
 
-                std::make_shared<bzn::http::connection>(self->io_context, std::move(hs), self->crud)->start();
+                std::make_shared<bzn::http::connection>(self->io_context, std::move(hs), self->crud, self->idle_timer_wheel, self->idle_timeout,
+                    self->max_requests)->start();
             }
 
             self->do_accept();
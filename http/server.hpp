@@ -16,6 +16,7 @@
 
 #include <include/bluzelle.hpp>
 #include <crud/crud_base.hpp>
+#include <node/idle_timer_wheel_base.hpp>
 #include <include/boost_asio_beast.hpp>
 #include <memory>
 
@@ -28,7 +29,8 @@ namespace bzn::http
     class server : public std::enable_shared_from_this<server>
     {
     public:
-        server(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::crud_base> crud, const boost::asio::ip::tcp::endpoint& ep);
+        server(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::crud_base> crud, std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel,
+            const boost::asio::ip::tcp::endpoint& ep, const std::chrono::milliseconds& idle_timeout, size_t max_requests);
 
         void start();
 
@@ -39,6 +41,9 @@ namespace bzn::http
         std::unique_ptr<bzn::asio::tcp_socket_base>   acceptor_socket;
         std::shared_ptr<bzn::asio::io_context_base>   io_context;
         std::shared_ptr<bzn::crud_base>               crud;
+        std::shared_ptr<bzn::idle_timer_wheel_base>   idle_timer_wheel;
+        const std::chrono::milliseconds               idle_timeout;
+        const size_t                                  max_requests;
 
         std::once_flag start_once;
     };
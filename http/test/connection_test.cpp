@@ -15,13 +15,41 @@
 #include <http/connection.hpp>
 #include <mocks/mock_boost_asio_beast.hpp>
 #include <mocks/mock_crud_base.hpp>
+#include <mocks/mock_idle_timer_wheel_base.hpp>
+#include <metrics/metrics.hpp>
 
 #include <gmock/gmock.h>
+#include <future>
+#include <list>
+#include <thread>
 
 using namespace ::testing;
 
 // todo: use fixture and param tests...
 
+namespace
+{
+    const std::chrono::seconds TEST_IDLE_TIMEOUT{10};
+
+    std::shared_ptr<bzn::Mockidle_timer_wheel_base> make_mock_idle_timer_wheel(bzn::idle_timer_entry::expiry_handler* expiry_handler = nullptr)
+    {
+        auto mock_idle_timer_wheel = std::make_shared<bzn::Mockidle_timer_wheel_base>();
+
+        EXPECT_CALL(*mock_idle_timer_wheel, add(_, _)).WillOnce(Invoke(
+            [expiry_handler](auto, auto handler)
+            {
+                if (expiry_handler)
+                {
+                    *expiry_handler = handler;
+                }
+
+                return std::make_shared<bzn::idle_timer_entry>(std::make_shared<std::atomic<uint64_t>>(0), 100, handler);
+            }));
+
+        return mock_idle_timer_wheel;
+    }
+}
+
 namespace bzn::http
 {
 
@@ -30,9 +58,14 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
 
-        EXPECT_CALL(*mock_http_socket, async_write(_,_));
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_,_,_)).WillOnce(Invoke(
@@ -41,18 +74,13 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
-
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
         // setup the request...
         con->request.method(boost::beast::http::verb::get);
         con->request.target("/read/uuid/key");
+        con->request.keep_alive(false);
 
         EXPECT_CALL(*mock_crud, handle_read(_, _, _)).WillOnce(Invoke(
             [](auto, const database_msg& request, database_response& response)
@@ -66,7 +94,7 @@ namespace bzn::http
 
         // should get an error response
         std::stringstream ss;
-        ss << boost::beast::buffers(con->response.body().data());
+        ss << boost::beast::buffers(response->body().data());
         EXPECT_EQ(ss.str(), "err");
 
     }
@@ -77,9 +105,14 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
 
-        EXPECT_CALL(*mock_http_socket, async_write(_,_));
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_,_,_)).WillOnce(Invoke(
@@ -88,18 +121,13 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
-
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
         // setup the request...
         con->request.method(boost::beast::http::verb::get);
         con->request.target("/read/uuid/key");
+        con->request.keep_alive(false);
 
         // test with a response to the query...
         EXPECT_CALL(*mock_crud, handle_read(_, _, _)).WillOnce(Invoke(
@@ -114,7 +142,7 @@ namespace bzn::http
 
         // should get the value
         std::stringstream ss;
-        ss << boost::beast::buffers(con->response.body().data());
+        ss << boost::beast::buffers(response->body().data());
         EXPECT_EQ(ss.str(), "ackvalue");
     }
 
@@ -124,9 +152,14 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
 
-        EXPECT_CALL(*mock_http_socket, async_write(_, _));
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
@@ -135,32 +168,28 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
-
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
         // setup the request...
         con->request.method(boost::beast::http::verb::post);
         con->request.target("/create/uuid/key");
+        con->request.keep_alive(false);
         boost::beast::ostream(con->request.body()) << "value";
 
         // test with a response to the query...
         EXPECT_CALL(*mock_crud, handle_create(_, _, _)).WillOnce(Invoke(
-            [](auto, const database_msg& request, database_response& /*response*/)
+            [](auto, const database_msg& request, bzn::crud_base::response_handler handler)
             {
                 EXPECT_EQ(request.header().db_uuid(), "uuid");
                 EXPECT_EQ(request.create().key(), "key");
+                handler(database_response());
             }));
 
         rh(boost::beast::error_code(), 0);
 
         std::stringstream ss;
-        ss << boost::beast::buffers(con->response.body().data());
+        ss << boost::beast::buffers(response->body().data());
         EXPECT_EQ(ss.str(), "ack");
     }
 
@@ -170,9 +199,14 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
 
-        EXPECT_CALL(*mock_http_socket, async_write(_, _));
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
@@ -181,36 +215,33 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
-
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
         // setup the request...
         con->request.method(boost::beast::http::verb::post);
         con->request.target("/create/uuid/key");
+        con->request.keep_alive(false);
         boost::beast::ostream(con->request.body()) << "value";
 
         // test with a response to the query...
         EXPECT_CALL(*mock_crud, handle_create(_, _, _)).WillOnce(Invoke(
-            [](auto, const database_msg& request, database_response& response)
+            [](auto, const database_msg& request, bzn::crud_base::response_handler handler)
             {
                 EXPECT_EQ(request.header().db_uuid(), "uuid");
                 EXPECT_EQ(request.create().key(), "key");
 
                 // force a redirect...
+                database_response response;
                 response.mutable_redirect()->set_leader_host("127.0.0.1");
                 response.mutable_redirect()->set_leader_http_port(8888);
+                handler(response);
             }));
 
         rh(boost::beast::error_code(), 0);
 
-        EXPECT_EQ(con->response.result(), boost::beast::http::status::temporary_redirect);
-        EXPECT_EQ(std::string(con->response.at(boost::beast::http::field::location)), "http://127.0.0.1:8888/create/uuid/key");
+        EXPECT_EQ(response->result(), boost::beast::http::status::temporary_redirect);
+        EXPECT_EQ(std::string(response->at(boost::beast::http::field::location)), "http://127.0.0.1:8888/create/uuid/key");
     }
 
 
@@ -219,9 +250,14 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
 
-        EXPECT_CALL(*mock_http_socket, async_write(_, _));
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
@@ -230,32 +266,28 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
-
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
         // setup the request...
         con->request.method(boost::beast::http::verb::post);
         con->request.target("/update/uuid/key");
+        con->request.keep_alive(false);
         boost::beast::ostream(con->request.body()) << "value";
 
         // test with a response to the query...
         EXPECT_CALL(*mock_crud, handle_update(_, _, _)).WillOnce(Invoke(
-            [](auto, const database_msg& request, database_response& /*response*/)
+            [](auto, const database_msg& request, bzn::crud_base::response_handler handler)
             {
                 EXPECT_EQ(request.header().db_uuid(), "uuid");
                 EXPECT_EQ(request.update().key(), "key");
+                handler(database_response());
             }));
 
         rh(boost::beast::error_code(), 0);
 
         std::stringstream ss;
-        ss << boost::beast::buffers(con->response.body().data());
+        ss << boost::beast::buffers(response->body().data());
         EXPECT_EQ(ss.str(), "ack");
     }
 
@@ -265,9 +297,14 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
 
-        EXPECT_CALL(*mock_http_socket, async_write(_, _));
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
@@ -276,32 +313,28 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
-
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
         // setup the request...
         con->request.method(boost::beast::http::verb::post);
         con->request.target("/delete/uuid/key");
+        con->request.keep_alive(false);
         boost::beast::ostream(con->request.body()) << "value";
 
         // test with a response to the query...
         EXPECT_CALL(*mock_crud, handle_delete(_, _, _)).WillOnce(Invoke(
-            [](auto, const database_msg& request, database_response& /*response*/)
+            [](auto, const database_msg& request, bzn::crud_base::response_handler handler)
             {
                 EXPECT_EQ(request.header().db_uuid(), "uuid");
                 EXPECT_EQ(request.delete_().key(), "key");
+                handler(database_response());
             }));
 
         rh(boost::beast::error_code(), 0);
 
         std::stringstream ss;
-        ss << boost::beast::buffers(con->response.body().data());
+        ss << boost::beast::buffers(response->body().data());
         EXPECT_EQ(ss.str(), "ack");
     }
 
@@ -311,7 +344,8 @@ namespace bzn::http
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
         auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
-        auto mock_timer = std::make_unique<bzn::asio::Mocksteady_timer_base>();
+        bzn::idle_timer_entry::expiry_handler expiry_handler;
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel(&expiry_handler);
 
         bzn::beast::read_handler rh;
         EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
@@ -320,26 +354,614 @@ namespace bzn::http
                 rh = handler;
             }));
 
-        EXPECT_CALL(*mock_timer, expires_from_now(_));
+        EXPECT_CALL(*mock_http_socket, close());
 
-        bzn::asio::wait_handler wh;
-        EXPECT_CALL(*mock_timer, async_wait(_)).WillOnce(Invoke(
-            [&](auto handler)
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        expiry_handler();
+    }
+
+
+    TEST(http_connection, test_that_keep_alive_requests_are_read_until_the_request_cap)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<NiceMock<bzn::Mockcrud_base>>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        // handlers are invoked from a copy since the connection schedules the next operation from within them...
+        std::list<bzn::beast::read_handler> read_handlers;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).Times(2).WillRepeatedly(Invoke(
+            [&](auto, auto, auto handler)
             {
-                wh = handler;
+                read_handlers.push_back(handler);
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
+        std::list<bzn::beast::write_handler> write_handlers;
+        std::vector<http_response*> responses;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).Times(2).WillRepeatedly(Invoke(
+            [&](auto& response, auto handler)
             {
-                return std::move(mock_timer);
+                responses.push_back(&response);
+                write_handlers.push_back(handler);
             }));
 
-        EXPECT_CALL(*mock_http_socket, close());
+        // the socket is shutdown once the last response is written...
+        boost::asio::io_context io;
+        boost::asio::ip::tcp::socket socket(io);
+        EXPECT_CALL(*mock_http_socket, get_socket()).WillOnce(ReturnRef(socket));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 2);
+        con->start();
+
+        for (size_t i = 0; i < 2; ++i)
+        {
+            con->request.method(boost::beast::http::verb::get);
+            con->request.target("/read/uuid/key");
+
+            auto handler = read_handlers.front();
+            read_handlers.pop_front();
+            handler(boost::beast::error_code(), 0);
+        }
+
+        ASSERT_EQ(responses.size(), size_t(1));
+        EXPECT_TRUE(responses[0]->keep_alive());
+
+        auto write_handler = write_handlers.front();
+        write_handlers.pop_front();
+        write_handler(boost::beast::error_code(), 0);
+
+        // the request cap was reached...
+        ASSERT_EQ(responses.size(), size_t(2));
+        EXPECT_FALSE(responses[1]->keep_alive());
+
+        write_handler = write_handlers.front();
+        write_handlers.pop_front();
+        write_handler(boost::beast::error_code(), 0);
+
+        EXPECT_TRUE(read_handlers.empty());
+    }
+
+
+    TEST(http_connection, test_that_pipelined_responses_are_written_in_order)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        std::list<bzn::beast::read_handler> read_handlers;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillRepeatedly(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                read_handlers.push_back(handler);
+            }));
+
+        std::list<bzn::beast::write_handler> write_handlers;
+        std::vector<std::string> written;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillRepeatedly(Invoke(
+            [&](auto& response, auto handler)
+            {
+                std::stringstream ss;
+                ss << boost::beast::buffers(response.body().data());
+                written.push_back(ss.str());
+                write_handlers.push_back(handler);
+            }));
+
+        EXPECT_CALL(*mock_crud, handle_read(_, _, _)).Times(3).WillRepeatedly(Invoke(
+            [](auto, const database_msg& request, database_response& response)
+            {
+                response.mutable_resp()->set_value(request.read().key());
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        // three requests arrive before the first response is written...
+        for (const auto& key : {"k1", "k2", "k3"})
+        {
+            con->request.method(boost::beast::http::verb::get);
+            con->request.target(std::string("/read/uuid/") + key);
+
+            auto handler = read_handlers.front();
+            read_handlers.pop_front();
+            handler(boost::beast::error_code(), 0);
+        }
+
+        // only one write is outstanding at a time...
+        EXPECT_EQ(written, std::vector<std::string>({"ackk1"}));
+
+        while (!write_handlers.empty())
+        {
+            auto handler = write_handlers.front();
+            write_handlers.pop_front();
+            handler(boost::beast::error_code(), 0);
+        }
+
+        EXPECT_EQ(written, std::vector<std::string>({"ackk1", "ackk2", "ackk3"}));
+
+        // still reading...
+        EXPECT_EQ(read_handlers.size(), size_t(1));
+    }
+
+
+    TEST(http_connection, test_that_pipelined_requests_are_handled_one_at_a_time_on_many_threads)
+    {
+        const size_t REQUESTS = 64;
+
+        boost::asio::io_context io;
+        auto work = boost::asio::make_work_guard(io);
+
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        // every completion is posted so it may run on any of the threads...
+        std::atomic<size_t> next_key{0};
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillRepeatedly(Invoke(
+            [&](auto, auto& request, auto handler)
+            {
+                const size_t key = next_key++;
+
+                if (key == REQUESTS)
+                {
+                    boost::asio::post(io, [handler](){ handler(boost::beast::http::error::end_of_stream, 0); });
+                    return;
+                }
+
+                request.method(boost::beast::http::verb::get);
+                request.target("/read/uuid/" + std::to_string(key));
+                request.keep_alive(true);
+
+                boost::asio::post(io, [handler](){ handler(boost::beast::error_code(), 0); });
+            }));
+
+        std::mutex written_lock;
+        std::vector<std::string> written;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillRepeatedly(Invoke(
+            [&](auto& response, auto handler)
+            {
+                std::stringstream ss;
+                ss << boost::beast::buffers(response.body().data());
+
+                {
+                    std::lock_guard<std::mutex> lock(written_lock);
+                    written.push_back(ss.str());
+                }
+
+                boost::asio::post(io, [handler](){ handler(boost::beast::error_code(), 0); });
+            }));
+
+        std::atomic<size_t> handling{0};
+        std::atomic<size_t> overlapped{0};
+        EXPECT_CALL(*mock_crud, handle_read(_, _, _)).Times(REQUESTS).WillRepeatedly(Invoke(
+            [&](auto, const database_msg& request, database_response& response)
+            {
+                if (handling++)
+                {
+                    ++overlapped;
+                }
+
+                // give the other threads a chance to complete the reads queued behind this one...
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+                response.mutable_resp()->set_value(request.read().key());
+                --handling;
+            }));
+
+        // the socket is shutdown once the last response is written...
+        std::promise<void> closed;
+        boost::asio::ip::tcp::socket socket(io);
+        EXPECT_CALL(*mock_http_socket, get_socket()).WillOnce(Invoke(
+            [&]() -> boost::asio::ip::tcp::socket&
+            {
+                closed.set_value();
+                return socket;
+            }));
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            threads.emplace_back([&](){ io.run(); });
+        }
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        EXPECT_EQ(closed.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+
+        work.reset();
+        io.stop();
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        EXPECT_EQ(overlapped, size_t(0));
+
+        std::vector<std::string> expected;
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            expected.push_back("ack" + std::to_string(i));
+        }
+
+        EXPECT_EQ(written, expected);
+    }
+
+
+    TEST(http_connection, test_that_responses_wait_for_uncommitted_writes)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        std::list<bzn::beast::read_handler> read_handlers;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillRepeatedly(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                read_handlers.push_back(handler);
+            }));
+
+        std::list<bzn::beast::write_handler> write_handlers;
+        std::vector<std::string> written;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillRepeatedly(Invoke(
+            [&](auto& response, auto handler)
+            {
+                std::stringstream ss;
+                ss << boost::beast::buffers(response.body().data());
+                written.push_back(ss.str());
+                write_handlers.push_back(handler);
+            }));
+
+        // the create is answered later, once it commits...
+        bzn::crud_base::response_handler create_handler;
+        EXPECT_CALL(*mock_crud, handle_create(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, bzn::crud_base::response_handler handler)
+            {
+                create_handler = handler;
+            }));
+
+        EXPECT_CALL(*mock_crud, handle_read(_, _, _)).WillOnce(Invoke(
+            [](auto, const database_msg& request, database_response& response)
+            {
+                response.mutable_resp()->set_value(request.read().key());
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        con->request.method(boost::beast::http::verb::post);
+        con->request.target("/create/uuid/key");
+        boost::beast::ostream(con->request.body()) << "value";
+
+        auto handler = read_handlers.front();
+        read_handlers.pop_front();
+        handler(boost::beast::error_code(), 0);
+
+        con->request.method(boost::beast::http::verb::get);
+        con->request.target("/read/uuid/key");
+
+        handler = read_handlers.front();
+        read_handlers.pop_front();
+        handler(boost::beast::error_code(), 0);
+
+        // the read is answered but must not overtake the create...
+        EXPECT_TRUE(written.empty());
+
+        database_response response;
+        response.mutable_resp()->set_error(bzn::MSG_COMMIT_TIMEOUT);
+        create_handler(response);
+
+        while (!write_handlers.empty())
+        {
+            auto write_handler = write_handlers.front();
+            write_handlers.pop_front();
+            write_handler(boost::beast::error_code(), 0);
+        }
+
+        EXPECT_EQ(written, std::vector<std::string>({"err", "ackkey"}));
+    }
+
+
+    TEST(http_connection, test_that_batch_read_returns_a_line_per_key)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
+
+        bzn::beast::read_handler rh;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                rh = handler;
+            }));
+
+        EXPECT_CALL(*mock_crud, handle_read(_, _, _)).Times(3).WillRepeatedly(Invoke(
+            [](auto, const database_msg& request, database_response& response)
+            {
+                EXPECT_EQ(request.header().db_uuid(), "uuid");
+
+                if (request.read().key() == "missing")
+                {
+                    response.mutable_resp()->set_error(bzn::MSG_RECORD_NOT_FOUND);
+                    return;
+                }
+
+                response.mutable_resp()->set_value(request.read().key() + "-value");
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        con->request.method(boost::beast::http::verb::post);
+        con->request.target("/batch-read/uuid");
+        con->request.keep_alive(false);
+        boost::beast::ostream(con->request.body()) << "k1\r\nmissing\n\nk2";
+
+        rh(boost::beast::error_code(), 0);
+
+        ASSERT_NE(response, nullptr);
+        EXPECT_FALSE(response->chunked());
+        EXPECT_EQ(response->at(boost::beast::http::field::content_length), "32");
+
+        std::stringstream ss;
+        ss << boost::beast::buffers(response->body().data());
+        EXPECT_EQ(ss.str(), "ack8:k1-value\nerr\nack8:k2-value\n");
+    }
+
+
+    TEST(http_connection, test_that_batch_read_on_a_follower_frames_redirects_empty_and_multiline_values)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
+
+        bzn::beast::read_handler rh;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                rh = handler;
+            }));
+
+        // a follower redirects keys it doesn't hold...
+        EXPECT_CALL(*mock_crud, handle_read(_, _, _)).Times(3).WillRepeatedly(Invoke(
+            [](auto, const database_msg& request, database_response& response)
+            {
+                if (request.read().key() == "missing")
+                {
+                    response.mutable_redirect()->set_leader_host("127.0.0.1");
+                    response.mutable_redirect()->set_leader_http_port(8080);
+                    return;
+                }
+
+                response.mutable_resp()->set_version("1");
+                response.mutable_resp()->set_value(request.read().key() == "empty" ? "" : "two\nlines");
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        con->request.method(boost::beast::http::verb::post);
+        con->request.target("/batch-read/uuid");
+        con->request.keep_alive(false);
+        boost::beast::ostream(con->request.body()) << "missing\nempty\nmultiline";
+
+        rh(boost::beast::error_code(), 0);
+
+        ASSERT_NE(response, nullptr);
+
+        std::stringstream ss;
+        ss << boost::beast::buffers(response->body().data());
+        EXPECT_EQ(ss.str(), "err\nack0:\nack9:two\nlines\n");
+    }
+
+
+    TEST(http_connection, test_that_batch_write_submits_a_single_crud_batch)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        std::vector<std::string> written;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillRepeatedly(Invoke(
+            [&](auto& response, auto)
+            {
+                std::stringstream ss;
+                ss << boost::beast::buffers(response.body().data());
+                written.push_back(ss.str());
+            }));
+
+        bzn::beast::read_handler rh;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                rh = handler;
+            }));
+
+        EXPECT_CALL(*mock_crud, handle_batch(_, _, _)).WillOnce(Invoke(
+            [](auto, const database_msg& request, bzn::crud_base::response_handler handler)
+            {
+                EXPECT_EQ(request.header().db_uuid(), "uuid");
+                EXPECT_EQ(request.batch().ops_size(), 2);
+                EXPECT_EQ(request.batch().ops(0).put().key(), "k1");
+                EXPECT_EQ(request.batch().ops(0).put().value(), "v1");
+                EXPECT_EQ(request.batch().ops(1).put().key(), "k2");
+                EXPECT_EQ(request.batch().ops(1).put().value(), "v 2\tx");
+                handler(database_response());
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        con->request.method(boost::beast::http::verb::post);
+        con->request.target("/batch-write/uuid");
+        con->request.keep_alive(false);
+
+        // split the body across buffers to exercise lines spanning them...
+        boost::beast::ostream(con->request.body()) << "k1\tv1\nk2\tv ";
+        con->request.body().commit(boost::asio::buffer_copy(con->request.body().prepare(4), boost::asio::buffer("2\tx\n", 4)));
+
+        rh(boost::beast::error_code(), 0);
 
-        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud);
+        EXPECT_EQ(written, std::vector<std::string>({"ack"}));
+    }
+
+
+    TEST(http_connection, test_that_a_batch_write_over_the_op_limit_is_rejected)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
+
+        bzn::beast::read_handler rh;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                rh = handler;
+            }));
+
+        EXPECT_CALL(*mock_crud, handle_batch(_, _, _)).Times(0);
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
         con->start();
 
-        wh(boost::system::error_code());
+        con->request.method(boost::beast::http::verb::post);
+        con->request.target("/batch-write/uuid");
+        con->request.keep_alive(false);
+
+        auto os = boost::beast::ostream(con->request.body());
+        for (size_t i = 0; i <= bzn::MAX_BATCH_OPS; ++i)
+        {
+            os << "k" << i << "\tv\n";
+        }
+        os.flush();
+
+        rh(boost::beast::error_code(), 0);
+
+        ASSERT_NE(response, nullptr);
+        EXPECT_EQ(response->result(), boost::beast::http::status::payload_too_large);
+
+        std::stringstream ss;
+        ss << boost::beast::buffers(response->body().data());
+        EXPECT_EQ(ss.str(), "err");
+    }
+
+
+    TEST(http_connection, test_that_metrics_are_served_in_the_prometheus_format)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        bzn::metrics::registry::global().get_counter("http_test_total", "Test counter.").increment();
+
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
+
+        bzn::beast::read_handler rh;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                rh = handler;
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        con->request.method(boost::beast::http::verb::get);
+        con->request.target("/metrics");
+        con->request.keep_alive(false);
+
+        rh(boost::beast::error_code(), 0);
+
+        ASSERT_NE(response, nullptr);
+        EXPECT_EQ(std::string((*response)[boost::beast::http::field::content_type]), "text/plain; version=0.0.4");
+
+        std::stringstream ss;
+        ss << boost::beast::buffers(response->body().data());
+        EXPECT_NE(ss.str().find("# TYPE http_test_total counter\nhttp_test_total 1\n"), std::string::npos);
+    }
+
+
+    TEST(http_connection, test_that_conditional_get_returns_not_modified_for_a_matching_etag)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_http_socket = std::make_unique<bzn::beast::Mockhttp_socket_base>();
+        auto mock_crud = std::make_shared<bzn::Mockcrud_base>();
+        auto mock_idle_timer_wheel = make_mock_idle_timer_wheel();
+
+        http_response* response = nullptr;
+        EXPECT_CALL(*mock_http_socket, async_write(_, _)).WillOnce(Invoke(
+            [&](auto& written, auto)
+            {
+                response = &written;
+            }));
+
+        bzn::beast::read_handler rh;
+        EXPECT_CALL(*mock_http_socket, async_read(_, _, _)).WillOnce(Invoke(
+            [&](auto, auto, auto handler)
+            {
+                rh = handler;
+            }));
+
+        EXPECT_CALL(*mock_crud, handle_read(_, _, _)).WillOnce(Invoke(
+            [](auto, const database_msg& request, database_response& response)
+            {
+                ASSERT_EQ(request.read().if_none_match_size(), 2);
+                EXPECT_EQ(request.read().if_none_match(0), "old");
+                EXPECT_EQ(request.read().if_none_match(1), "v1");
+
+                response.mutable_resp()->set_version("v1");
+                response.mutable_resp()->set_not_modified(true);
+            }));
+
+        auto con = std::make_shared<bzn::http::connection>(mock_io_context, std::move(mock_http_socket), mock_crud, mock_idle_timer_wheel, TEST_IDLE_TIMEOUT, 0);
+        con->start();
+
+        con->request.method(boost::beast::http::verb::get);
+        con->request.target("/read/uuid/key");
+        con->request.set(boost::beast::http::field::if_none_match, "\"old\", W/\"v1\"");
+        con->request.keep_alive(false);
+
+        rh(boost::beast::error_code(), 0);
+
+        ASSERT_NE(response, nullptr);
+        EXPECT_EQ(response->result(), boost::beast::http::status::not_modified);
+        EXPECT_EQ(std::string((*response)[boost::beast::http::field::etag]), "\"v1\"");
+        EXPECT_EQ(response->body().size(), size_t(0));
     }
 }
@@ -14,6 +14,7 @@
 
 #include <http/server.hpp>
 #include <mocks/mock_boost_asio_beast.hpp>
+#include <mocks/mock_idle_timer_wheel_base.hpp>
 
 #include <gmock/gmock.h>
 
@@ -27,7 +28,7 @@ namespace bzn::http
         auto mock_tcp_acceptor = std::make_unique<bzn::asio::Mocktcp_acceptor_base>();
         auto mock_tcp_socket = std::make_unique<bzn::asio::Mocktcp_socket_base>();
         auto ep = boost::asio::ip::tcp::endpoint{boost::asio::ip::address::from_string("127.0.0.1"),8080};
-        auto mock_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = std::make_shared<bzn::Mockidle_timer_wheel_base>();
 
         bzn::asio::accept_handler ah;
         EXPECT_CALL(*mock_tcp_acceptor, async_accept(_,_)).WillRepeatedly(Invoke(
@@ -48,13 +49,11 @@ namespace bzn::http
                 return std::move(mock_tcp_acceptor);
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_timer);
-            }));
+        // the new connection registers with the idle timer wheel...
+        EXPECT_CALL(*mock_idle_timer_wheel, add(_, _)).WillOnce(Return(
+            std::make_shared<bzn::idle_timer_entry>(std::make_shared<std::atomic<uint64_t>>(0), 100, []{})));
 
-        auto server = std::make_shared<bzn::http::server>(mock_io_context, nullptr, ep);
+        auto server = std::make_shared<bzn::http::server>(mock_io_context, nullptr, mock_idle_timer_wheel, ep, std::chrono::seconds(10), 100);
 
         EXPECT_CALL(*mock_io_context, make_unique_tcp_socket()).Times(2).WillRepeatedly(Invoke(
             [&]()
@@ -15,7 +15,10 @@
 #pragma once
 
 #include <boost/log/trivial.hpp>
+#include <boost/log/utility/manipulators/add_value.hpp>
+#include <memory>
 #include <string_view>
+#include <vector>
 #include <json/json.h>
 #include <swarm_version.hpp>
 
@@ -27,6 +30,9 @@ namespace bzn
 {
     using message = Json::Value;
 
+    // a serialized message in pieces written back to back, a piece may be shared by several messages...
+    using encoded_message = std::vector<std::shared_ptr<const std::string>>;
+
     using uuid_t = std::string;
 
 } // bzn
@@ -43,8 +49,15 @@ namespace bzn::utils
     {
         return path.substr(path.rfind('/') + 1);
     }
+
+    // attached to every record and formatted by the sink...
+    struct log_location
+    {
+        std::string_view file;
+        unsigned int line;
+    };
 } // bzn::utils
 
 
 // logging
-#define LOG(x) BOOST_LOG_TRIVIAL(x) << "(" << bzn::utils::basename(__FILE__) << ":"  << __LINE__ << ") - "
+#define LOG(x) BOOST_LOG_TRIVIAL(x) << boost::log::add_value("Location", bzn::utils::log_location{__FILE__, __LINE__})
@@ -28,6 +28,7 @@ namespace bzn::asio
     using connect_handler = std::function<void(const boost::system::error_code& ec)>;
     using   close_handler = std::function<void(const boost::system::error_code& ec)>;
     using    wait_handler = std::function<void(const boost::system::error_code& ec)>;
+    using    post_handler = std::function<void()>;
 
     ///////////////////////////////////////////////////////////////////////////
     // mockable interfaces...
@@ -83,6 +84,9 @@ namespace bzn::asio
 
         virtual bzn::asio::close_handler wrap(close_handler handler) = 0;
 
+        // runs the handler on the strand, never inside the caller...
+        virtual void post(post_handler handler) = 0;
+
         virtual boost::asio::io_context::strand& get_strand() = 0;
     };
 
@@ -216,6 +220,11 @@ namespace bzn::asio
             return this->s.wrap(std::move(handler));
         }
 
+        void post(post_handler handler) override
+        {
+            boost::asio::post(this->s, std::move(handler));
+        }
+
         boost::asio::io_context::strand& get_strand() override
         {
             return this->s;
@@ -280,6 +289,9 @@ namespace bzn::beast
     using write_handler = std::function<void(const boost::beast::error_code& ec, std::size_t bytes_transferred)>;
     using close_handler = std::function<void(const boost::system::error_code& ec)>;
 
+    // large enough for batch requests...
+    const uint64_t HTTP_BODY_LIMIT = 64 * 1024 * 1024;
+
     ///////////////////////////////////////////////////////////////////////////
     // mockable interfaces...
 
@@ -312,7 +324,20 @@ namespace bzn::beast
 
         void async_read(boost::beast::flat_buffer& buffer, boost::beast::http::request<boost::beast::http::dynamic_body>& request, bzn::beast::read_handler handler) override
         {
-            boost::beast::http::async_read(this->socket, buffer, request, std::move(handler));
+            // the default parser limits bodies to 8MB...
+            auto parser = std::make_shared<boost::beast::http::request_parser<boost::beast::http::dynamic_body>>();
+            parser->body_limit(HTTP_BODY_LIMIT);
+
+            boost::beast::http::async_read(this->socket, buffer, *parser,
+                [parser, &request, handler = std::move(handler)](const boost::beast::error_code& ec, std::size_t bytes_transferred)
+                {
+                    if (!ec)
+                    {
+                        request = parser->release();
+                    }
+
+                    handler(ec, bytes_transferred);
+                });
         }
 
         void async_write(boost::beast::http::response<boost::beast::http::dynamic_body>& response, bzn::beast::write_handler handler) override
@@ -342,7 +367,7 @@ namespace bzn::beast
 
         virtual void async_read(boost::beast::multi_buffer& buffer, bzn::asio::read_handler handler) = 0;
 
-        virtual void async_write(const boost::asio::mutable_buffers_1& buffer, bzn::asio::write_handler handler) = 0;
+        virtual void async_write(const std::vector<boost::asio::const_buffer>& buffers, bzn::asio::write_handler handler) = 0;
 
         virtual void async_close(boost::beast::websocket::close_code reason, bzn::beast::close_handler handler) = 0;
 
@@ -376,9 +401,9 @@ namespace bzn::beast
             this->websocket.async_read(buffer, handler);
         }
 
-        void async_write(const boost::asio::mutable_buffers_1& buffer, bzn::asio::write_handler handler) override
+        void async_write(const std::vector<boost::asio::const_buffer>& buffers, bzn::asio::write_handler handler) override
         {
-            this->websocket.async_write(buffer, handler);
+            this->websocket.async_write(buffers, handler);
         }
 
         void async_close(boost::beast::websocket::close_code reason, bzn::beast::close_handler handler) override
@@ -0,0 +1,324 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <metrics/metrics.hpp>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    std::string format_labels(const bzn::metrics::labels_t& labels)
+    {
+        if (labels.empty())
+        {
+            return {};
+        }
+
+        std::string result = "{";
+
+        for (const auto& label : labels)
+        {
+            if (result.size() > 1)
+            {
+                result += ",";
+            }
+
+            result += label.first + "=\"";
+
+            for (char c : label.second)
+            {
+                switch (c)
+                {
+                    case '\\': result += "\\\\"; break;
+                    case '"':  result += "\\\""; break;
+                    case '\n': result += "\\n";  break;
+                    default:   result += c;      break;
+                }
+            }
+
+            result += "\"";
+        }
+
+        return result + "}";
+    }
+
+    // the label text is stored without braces so that "le" can be appended to it...
+    std::string strip_braces(const std::string& labels)
+    {
+        return (labels.empty()) ? labels : labels.substr(1, labels.size() - 2);
+    }
+}
+
+using namespace bzn::metrics;
+
+
+uint64_t
+counter::value() const
+{
+    uint64_t total = 0;
+
+    for (const auto& stripe : this->stripes)
+    {
+        total += stripe.value.load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+
+size_t
+histogram::bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    const size_t exponent = 63 - __builtin_clzll(value);
+
+    if (exponent > MAX_EXPONENT)
+    {
+        return BUCKETS - 1;
+    }
+
+    const size_t shift = exponent - SUB_BUCKET_BITS;
+
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+}
+
+
+uint64_t
+histogram::bucket_upper_bound(size_t index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    const size_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    const size_t shift = exponent - SUB_BUCKET_BITS;
+
+    return ((SUB_BUCKETS + index % SUB_BUCKETS) << shift) + (uint64_t(1) << shift) - 1;
+}
+
+
+histogram::snapshot
+histogram::get_snapshot() const
+{
+    snapshot result;
+    result.counts.resize(BUCKETS);
+
+    for (const auto& stripe : this->stripes)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            const auto count = stripe.counts[i].load(std::memory_order_relaxed);
+
+            result.counts[i] += count;
+            result.count += count;
+        }
+
+        result.sum += stripe.sum.load(std::memory_order_relaxed);
+    }
+
+    return result;
+}
+
+
+uint64_t
+histogram::snapshot::quantile(double q) const
+{
+    if (!this->count)
+    {
+        return 0;
+    }
+
+    const auto target = std::max<uint64_t>(1, uint64_t(q * this->count + 0.5));
+
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < this->counts.size(); ++i)
+    {
+        seen += this->counts[i];
+
+        if (seen >= target)
+        {
+            return histogram::bucket_upper_bound(i);
+        }
+    }
+
+    return histogram::bucket_upper_bound(this->counts.size() - 1);
+}
+
+
+registry&
+registry::global()
+{
+    static registry instance;
+    return instance;
+}
+
+
+registry::family&
+registry::get_family(const std::string& name, const std::string& help, metric_type type)
+{
+    auto it = this->families.find(name);
+
+    if (it == this->families.end())
+    {
+        it = this->families.emplace(name, family{type, help, {}, {}, {}}).first;
+    }
+
+    if (it->second.type != type)
+    {
+        throw std::runtime_error("metric registered with a different type: " + name);
+    }
+
+    return it->second;
+}
+
+
+counter&
+registry::get_counter(const std::string& name, const std::string& help, const labels_t& labels)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    auto& metric = this->get_family(name, help, metric_type::counter).counters[format_labels(labels)];
+
+    if (!metric)
+    {
+        metric = std::make_unique<counter>();
+    }
+
+    return *metric;
+}
+
+
+gauge&
+registry::get_gauge(const std::string& name, const std::string& help, const labels_t& labels)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    auto& metric = this->get_family(name, help, metric_type::gauge).gauges[format_labels(labels)];
+
+    if (!metric)
+    {
+        metric = std::make_unique<gauge>();
+    }
+
+    return *metric;
+}
+
+
+histogram&
+registry::get_histogram(const std::string& name, const std::string& help, const labels_t& labels)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    auto& metric = this->get_family(name, help, metric_type::histogram).histograms[format_labels(labels)];
+
+    if (!metric)
+    {
+        metric = std::make_unique<histogram>();
+    }
+
+    return *metric;
+}
+
+
+std::string
+registry::to_prometheus() const
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    std::stringstream ss;
+
+    for (const auto& [name, family] : this->families)
+    {
+        ss << "# HELP " << name << " " << family.help << "\n";
+
+        switch (family.type)
+        {
+            case metric_type::counter:
+            {
+                ss << "# TYPE " << name << " counter\n";
+
+                for (const auto& [labels, metric] : family.counters)
+                {
+                    ss << name << labels << " " << metric->value() << "\n";
+                }
+                break;
+            }
+
+            case metric_type::gauge:
+            {
+                ss << "# TYPE " << name << " gauge\n";
+
+                for (const auto& [labels, metric] : family.gauges)
+                {
+                    ss << name << labels << " " << metric->value() << "\n";
+                }
+                break;
+            }
+
+            case metric_type::histogram:
+            {
+                ss << "# TYPE " << name << " histogram\n";
+
+                for (const auto& [labels, metric] : family.histograms)
+                {
+                    const auto snapshot = metric->get_snapshot();
+                    const auto label_text = strip_braces(labels);
+
+                    // the fine grained buckets are folded into one bucket per power of two...
+                    size_t last = 0;
+                    for (size_t i = 0; i < snapshot.counts.size(); ++i)
+                    {
+                        if (snapshot.counts[i])
+                        {
+                            last = i;
+                        }
+                    }
+
+                    uint64_t cumulative = 0;
+                    for (size_t i = 0; i < snapshot.counts.size() && snapshot.count; ++i)
+                    {
+                        cumulative += snapshot.counts[i];
+
+                        const auto bound = histogram::bucket_upper_bound(i);
+
+                        if (((bound + 1) & bound) == 0)
+                        {
+                            ss << name << "_bucket{" << label_text << (label_text.empty() ? "" : ",") << "le=\"" << bound << "\"} " << cumulative << "\n";
+
+                            if (i >= last)
+                            {
+                                break;
+                            }
+                        }
+                    }
+
+                    ss << name << "_bucket{" << label_text << (label_text.empty() ? "" : ",") << "le=\"+Inf\"} " << snapshot.count << "\n";
+                    ss << name << "_sum" << labels << " " << snapshot.sum << "\n";
+                    ss << name << "_count" << labels << " " << snapshot.count << "\n";
+                }
+                break;
+            }
+        }
+    }
+
+    return ss.str();
+}
@@ -0,0 +1,220 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace bzn::metrics
+{
+    using labels_t = std::vector<std::pair<std::string, std::string>>;
+
+    const size_t METRIC_STRIPES = 16;
+    const size_t HISTOGRAM_STRIPES = 4;
+
+    // each thread sticks to one stripe so concurrent updates rarely share a cache line...
+    inline size_t thread_stripe()
+    {
+        static std::atomic<size_t> next_stripe{0};
+        thread_local const size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed);
+        return stripe;
+    }
+
+
+    class counter final
+    {
+    public:
+        void increment(uint64_t n = 1)
+        {
+            this->stripes[thread_stripe() % METRIC_STRIPES].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const;
+
+    private:
+        struct alignas(64) stripe
+        {
+            std::atomic<uint64_t> value{0};
+        };
+
+        std::array<stripe, METRIC_STRIPES> stripes;
+    };
+
+
+    class gauge final
+    {
+    public:
+        void set(int64_t value) { this->current.store(value, std::memory_order_relaxed); }
+
+        void add(int64_t n) { this->current.fetch_add(n, std::memory_order_relaxed); }
+
+        int64_t value() const { return this->current.load(std::memory_order_relaxed); }
+
+    private:
+        alignas(64) std::atomic<int64_t> current{0};
+    };
+
+
+    // HDR style log-linear histogram: every power of two is split into SUB_BUCKETS linear buckets so
+    // recorded values keep ~6% precision from 1 up to 2^MAX_EXPONENT.
+    class histogram final
+    {
+    public:
+        static constexpr size_t SUB_BUCKET_BITS = 4;
+        static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+        static constexpr size_t MAX_EXPONENT = 40;
+        static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+        struct snapshot
+        {
+            std::vector<uint64_t> counts;
+            uint64_t count = 0;
+            uint64_t sum = 0;
+
+            // upper bound of the bucket holding the q'th quantile...
+            uint64_t quantile(double q) const;
+        };
+
+        void record(uint64_t value)
+        {
+            auto& stripe = this->stripes[thread_stripe() % HISTOGRAM_STRIPES];
+
+            stripe.counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+            stripe.sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        snapshot get_snapshot() const;
+
+        static size_t bucket_index(uint64_t value);
+        static uint64_t bucket_upper_bound(size_t index);
+
+    private:
+        struct alignas(64) stripe
+        {
+            std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+            std::atomic<uint64_t> sum{0};
+        };
+
+        std::array<stripe, HISTOGRAM_STRIPES> stripes;
+    };
+
+
+    // records the lifetime of the timer in microseconds...
+    class scoped_timer final
+    {
+    public:
+        explicit scoped_timer(histogram& target)
+            : target(target)
+            , start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~scoped_timer()
+        {
+            this->target.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->start).count());
+        }
+
+    private:
+        histogram& target;
+        const std::chrono::steady_clock::time_point start;
+    };
+
+
+    // Times one call in TIMER_SAMPLE_RATE for paths where two clock reads per call would be
+    // noticeable. Histogram counts are sampled while counters stay exact.
+    class sampled_timer final
+    {
+    public:
+        static constexpr uint32_t TIMER_SAMPLE_RATE = 64;
+
+        explicit sampled_timer(histogram& target)
+            : target(sample() ? &target : nullptr)
+        {
+            if (this->target)
+            {
+                this->start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~sampled_timer()
+        {
+            if (this->target)
+            {
+                this->target->record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->start).count());
+            }
+        }
+
+    private:
+        static bool sample()
+        {
+            thread_local uint32_t calls = 0;
+            return ++calls % TIMER_SAMPLE_RATE == 0;
+        }
+
+        histogram* const target;
+        std::chrono::steady_clock::time_point start;
+    };
+
+
+    // Process wide set of metrics exported in the Prometheus text format. Lookups take a lock
+    // so hot paths should keep the returned reference, which stays valid for the life of the process.
+    class registry final
+    {
+    public:
+        static registry& global();
+
+        counter& get_counter(const std::string& name, const std::string& help, const labels_t& labels = {});
+
+        gauge& get_gauge(const std::string& name, const std::string& help, const labels_t& labels = {});
+
+        histogram& get_histogram(const std::string& name, const std::string& help, const labels_t& labels = {});
+
+        std::string to_prometheus() const;
+
+    private:
+        enum class metric_type
+        {
+            counter,
+            gauge,
+            histogram
+        };
+
+        struct family
+        {
+            metric_type type;
+            std::string help;
+
+            // keyed by the formatted label set...
+            std::map<std::string, std::unique_ptr<counter>> counters;
+            std::map<std::string, std::unique_ptr<gauge>> gauges;
+            std::map<std::string, std::unique_ptr<histogram>> histograms;
+        };
+
+        family& get_family(const std::string& name, const std::string& help, metric_type type);
+
+        std::map<std::string, family> families;
+
+        mutable std::mutex lock;
+    };
+
+} // bzn::metrics
@@ -0,0 +1,189 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <metrics/metrics.hpp>
+
+#include <gmock/gmock.h>
+#include <iostream>
+#include <thread>
+
+using namespace ::testing;
+
+
+namespace bzn::metrics
+{
+    TEST(metrics, test_that_counters_sum_increments_from_every_thread)
+    {
+        counter requests;
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 8; ++i)
+        {
+            threads.emplace_back([&]()
+                {
+                    for (size_t j = 0; j < 10000; ++j)
+                    {
+                        requests.increment();
+                    }
+                });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        EXPECT_EQ(requests.value(), uint64_t(80000));
+    }
+
+
+    TEST(metrics, test_that_histogram_buckets_keep_their_precision)
+    {
+        for (uint64_t value : {uint64_t(0), uint64_t(1), uint64_t(15), uint64_t(16), uint64_t(17), uint64_t(1000), uint64_t(123456789), uint64_t(1) << 40})
+        {
+            const auto index = histogram::bucket_index(value);
+            const auto upper = histogram::bucket_upper_bound(index);
+
+            EXPECT_LT(index, histogram::BUCKETS);
+            EXPECT_GE(upper, value);
+            EXPECT_LE(upper - value, value / histogram::SUB_BUCKETS);
+
+            // buckets are contiguous...
+            if (index)
+            {
+                EXPECT_LT(histogram::bucket_upper_bound(index - 1), value);
+            }
+        }
+
+        // anything larger lands in the last bucket...
+        EXPECT_EQ(histogram::bucket_index(uint64_t(1) << 60), histogram::BUCKETS - 1);
+    }
+
+
+    TEST(metrics, test_that_histogram_quantiles_are_taken_from_the_recorded_values)
+    {
+        histogram latency;
+
+        for (uint64_t i = 1; i <= 1000; ++i)
+        {
+            latency.record(i);
+        }
+
+        auto snapshot = latency.get_snapshot();
+
+        EXPECT_EQ(snapshot.count, uint64_t(1000));
+        EXPECT_EQ(snapshot.sum, uint64_t(500500));
+        EXPECT_NEAR(double(snapshot.quantile(0.5)), 500.0, 500.0 / histogram::SUB_BUCKETS);
+        EXPECT_NEAR(double(snapshot.quantile(0.99)), 990.0, 990.0 / histogram::SUB_BUCKETS);
+        EXPECT_EQ(histogram().get_snapshot().quantile(0.5), uint64_t(0));
+    }
+
+
+    TEST(metrics, test_that_registry_returns_the_same_metric_for_the_same_labels)
+    {
+        registry metrics;
+
+        auto& a = metrics.get_counter("requests_total", "requests", {{"type", "read"}});
+        auto& b = metrics.get_counter("requests_total", "requests", {{"type", "read"}});
+        auto& c = metrics.get_counter("requests_total", "requests", {{"type", "create"}});
+
+        EXPECT_EQ(&a, &b);
+        EXPECT_NE(&a, &c);
+
+        EXPECT_THROW(metrics.get_gauge("requests_total", "requests"), std::runtime_error);
+    }
+
+
+    TEST(metrics, test_that_registry_exports_the_prometheus_text_format)
+    {
+        registry metrics;
+
+        metrics.get_counter("requests_total", "Requests handled.", {{"type", "read"}}).increment(3);
+        metrics.get_gauge("sessions", "Open sessions.").set(2);
+        metrics.get_gauge("peer_lag", "Peer lag.", {{"peer", "a\"b"}}).set(-1);
+
+        auto& latency = metrics.get_histogram("latency_microseconds", "Latency.", {{"op", "read"}});
+        latency.record(1);
+        latency.record(5);
+        latency.record(100);
+
+        EXPECT_EQ(metrics.to_prometheus(),
+            "# HELP latency_microseconds Latency.\n"
+            "# TYPE latency_microseconds histogram\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"0\"} 0\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"1\"} 1\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"3\"} 1\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"7\"} 2\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"15\"} 2\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"31\"} 2\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"63\"} 2\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"127\"} 3\n"
+            "latency_microseconds_bucket{op=\"read\",le=\"+Inf\"} 3\n"
+            "latency_microseconds_sum{op=\"read\"} 106\n"
+            "latency_microseconds_count{op=\"read\"} 3\n"
+            "# HELP peer_lag Peer lag.\n"
+            "# TYPE peer_lag gauge\n"
+            "peer_lag{peer=\"a\\\"b\"} -1\n"
+            "# HELP requests_total Requests handled.\n"
+            "# TYPE requests_total counter\n"
+            "requests_total{type=\"read\"} 3\n"
+            "# HELP sessions Open sessions.\n"
+            "# TYPE sessions gauge\n"
+            "sessions 2\n");
+    }
+
+
+    // Instrumented hot paths pay for a counter increment and a timer. Storage operations use the
+    // sampled timer to stay within 1% of a read, the scoped timer is for requests and commits
+    // that take microseconds to milliseconds:
+    // ./metrics_tests --gtest_also_run_disabled_tests --gtest_filter=metrics.DISABLED_benchmark_instrumentation_overhead
+    TEST(metrics, DISABLED_benchmark_instrumentation_overhead)
+    {
+        const size_t ITERATIONS = 10000000;
+
+        counter requests;
+        histogram latency;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; ++i)
+        {
+            requests.increment();
+        }
+        const auto counter_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / double(ITERATIONS);
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; ++i)
+        {
+            scoped_timer timer(latency);
+        }
+        const auto timer_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / double(ITERATIONS);
+
+        histogram sampled_latency;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; ++i)
+        {
+            sampled_timer timer(sampled_latency);
+        }
+        const auto sampled_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / double(ITERATIONS);
+
+        std::cout << "counter increment: " << counter_ns << "ns, scoped timer: " << timer_ns << "ns, sampled timer: " << sampled_ns << "ns\n";
+
+        EXPECT_EQ(requests.value(), ITERATIONS);
+        EXPECT_EQ(latency.get_snapshot().count, ITERATIONS);
+        EXPECT_EQ(sampled_latency.get_snapshot().count, ITERATIONS / sampled_timer::TIMER_SAMPLE_RATE);
+    }
+
+} // bzn::metrics
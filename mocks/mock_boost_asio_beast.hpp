@@ -73,6 +73,8 @@ namespace bzn::asio {
             bzn::asio::write_handler(write_handler handler));
         MOCK_METHOD1(wrap,
             bzn::asio::close_handler(close_handler handler));
+        MOCK_METHOD1(post,
+            void(post_handler handler));
         MOCK_METHOD0(get_strand,
             boost::asio::io_context::strand&());
     };
@@ -131,7 +133,7 @@ namespace bzn::beast {
         MOCK_METHOD2(async_read,
             void(boost::beast::multi_buffer& buffer, bzn::asio::read_handler handler));
         MOCK_METHOD2(async_write,
-            void(const boost::asio::mutable_buffers_1& buffer, bzn::asio::write_handler handler));
+            void(const std::vector<boost::asio::const_buffer>& buffers, bzn::asio::write_handler handler));
         MOCK_METHOD2(async_close,
             void(boost::beast::websocket::close_code reason, bzn::beast::close_handler handler));
         MOCK_METHOD3(async_handshake,
@@ -0,0 +1,31 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <node/idle_timer_wheel_base.hpp>
+#include <gmock/gmock.h>
+
+
+// gmock_gen.py generated...
+
+namespace bzn {
+    class Mockidle_timer_wheel_base : public idle_timer_wheel_base {
+    public:
+        MOCK_METHOD2(add,
+            std::shared_ptr<bzn::idle_timer_entry>(const std::chrono::milliseconds& timeout, bzn::idle_timer_entry::expiry_handler handler));
+        MOCK_METHOD0(start,
+            void());
+    };
+}  // namespace bzn
@@ -30,6 +30,10 @@ class Mocknode_base : public node_base {
       void());
   MOCK_METHOD2(send_message,
       void(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::message> msg));
+  MOCK_METHOD2(send_message,
+      void(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg));
+  MOCK_METHOD2(send_on_channel,
+      void(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg));
 };
 
 }  // namespace bzn
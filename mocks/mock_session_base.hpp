@@ -29,7 +29,19 @@ namespace bzn {
             void(std::shared_ptr<bzn::message> msg, bool end_session));
         MOCK_METHOD2(send_message,
             void(std::shared_ptr<std::string> msg, bool end_session));
+        MOCK_METHOD2(send_message,
+            void(std::shared_ptr<bzn::encoded_message> msg, bool end_session));
+        MOCK_METHOD2(send_notification,
+            void(const std::string& coalesce_key, std::shared_ptr<std::string> msg));
+        MOCK_METHOD0(hold_idle,
+            void());
+        MOCK_METHOD0(release_idle,
+            void());
         MOCK_METHOD0(close,
             void());
+        MOCK_METHOD0(get_session_id,
+            bzn::session_id());
+        MOCK_METHOD1(add_shutdown_handler,
+            void(const bzn::session_shutdown_handler& handler));
     };
 }  // namespace bzn
@@ -29,8 +29,16 @@ namespace bzn {
                      storage_base::result(const bzn::uuid_t& uuid, const std::string& key, const std::string& value));
         MOCK_METHOD2(remove,
                      storage_base::result(const bzn::uuid_t& uuid, const std::string& key));
+        MOCK_METHOD2(apply,
+                     storage_base::result(const bzn::uuid_t& uuid, const std::vector<operation>& operations));
         MOCK_METHOD0(start,
                      storage_base::result());
+        MOCK_METHOD1(set_commit_index,
+                     void(uint64_t log_index));
+        MOCK_METHOD1(set_commit_time,
+                     void(std::chrono::seconds now));
+        MOCK_METHOD2(get_expired,
+                     std::vector<std::pair<bzn::uuid_t, std::string>>(std::chrono::seconds now, std::size_t limit));
         MOCK_METHOD1(save,
                      storage_base::result(const std::string& path));
         MOCK_METHOD1(load,
@@ -39,6 +47,8 @@ namespace bzn {
                      std::string(storage_base::result error_id));
         MOCK_METHOD1(get_keys,
                      std::vector<std::string>(const bzn::uuid_t& uuid));
+        MOCK_METHOD5(scan,
+                     storage_base::scan_result(const bzn::uuid_t& uuid, const std::string& start, const std::string& end, const std::string& prefix, std::size_t limit));
         MOCK_METHOD2(has,
                      bool(const bzn::uuid_t& uuid, const std::string& key));
         MOCK_METHOD1(get_size,
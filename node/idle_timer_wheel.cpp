@@ -0,0 +1,161 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <node/idle_timer_wheel.hpp>
+
+namespace
+{
+    const size_t WHEEL_SIZE = 1024;
+}
+
+
+using namespace bzn;
+
+
+idle_timer_wheel::idle_timer_wheel(std::shared_ptr<bzn::asio::io_context_base> io_context, const std::chrono::milliseconds& resolution)
+    : tick_timer(io_context->make_unique_steady_timer())
+    , resolution(std::max(resolution, std::chrono::milliseconds(1)))
+    , clock(std::make_shared<std::atomic<uint64_t>>(0))
+    , buckets(WHEEL_SIZE)
+{
+}
+
+
+void
+idle_timer_wheel::start()
+{
+    std::call_once(this->start_once,
+        [this]()
+        {
+            this->epoch = std::chrono::steady_clock::now();
+            this->start_tick_timer();
+        });
+}
+
+
+uint64_t
+idle_timer_wheel::to_ticks(const std::chrono::milliseconds& timeout) const
+{
+    // round up so an entry never expires early...
+    return std::max<uint64_t>(1, (timeout.count() + this->resolution.count() - 1) / this->resolution.count());
+}
+
+
+std::shared_ptr<bzn::idle_timer_entry>
+idle_timer_wheel::add(const std::chrono::milliseconds& timeout, bzn::idle_timer_entry::expiry_handler handler)
+{
+    auto entry = std::make_shared<bzn::idle_timer_entry>(this->clock, this->to_ticks(timeout), std::move(handler));
+
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    this->buckets[entry->get_deadline() % WHEEL_SIZE].emplace_back(entry);
+    ++this->entry_count;
+
+    return entry;
+}
+
+
+size_t
+idle_timer_wheel::size()
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    return this->entry_count;
+}
+
+
+void
+idle_timer_wheel::start_tick_timer()
+{
+    this->tick_timer->expires_from_now(this->resolution);
+
+    this->tick_timer->async_wait(std::bind(&idle_timer_wheel::handle_tick_timeout, shared_from_this(), std::placeholders::_1));
+}
+
+
+void
+idle_timer_wheel::handle_tick_timeout(const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        LOG(debug) << "idle timer wheel tick canceled: " << ec.message();
+        return;
+    }
+
+    // catch up on any ticks we were late for...
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->epoch);
+    const uint64_t target = elapsed.count() / this->resolution.count();
+
+    if (target > *this->clock)
+    {
+        this->advance(target - *this->clock);
+    }
+
+    this->start_tick_timer();
+}
+
+
+void
+idle_timer_wheel::advance(uint64_t ticks)
+{
+    for (; ticks; --ticks)
+    {
+        std::vector<std::shared_ptr<bzn::idle_timer_entry>> due;
+        std::vector<std::shared_ptr<bzn::idle_timer_entry>> expired;
+
+        {
+            std::lock_guard<std::mutex> lock(this->lock);
+
+            const uint64_t now = ++(*this->clock);
+
+            due.swap(this->buckets[now % WHEEL_SIZE]);
+
+            for (auto& entry : due)
+            {
+                if (entry->is_cancelled())
+                {
+                    --this->entry_count;
+                    continue;
+                }
+
+                const uint64_t deadline = entry->get_deadline();
+
+                if (deadline <= now)
+                {
+                    --this->entry_count;
+                    expired.emplace_back(std::move(entry));
+                    continue;
+                }
+
+                // reset or suspended since it was bucketed -- look again at the new deadline, or one
+                // timeout from now if suspended so a later reset is never noticed late...
+                const uint64_t next = (deadline == bzn::idle_timer_entry::NEVER) ? now + entry->get_timeout_ticks() : deadline;
+
+                this->buckets[next % WHEEL_SIZE].emplace_back(std::move(entry));
+            }
+        }
+
+        if (!expired.empty())
+        {
+            LOG(debug) << "reaping " << expired.size() << " idle entries";
+        }
+
+        // handlers run outside of the lock so they may add new entries...
+        for (auto& entry : expired)
+        {
+            entry->cancel();
+            entry->handler();
+        }
+    }
+}
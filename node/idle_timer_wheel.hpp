@@ -0,0 +1,67 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <include/boost_asio_beast.hpp>
+#include <node/idle_timer_wheel_base.hpp>
+#include <mutex>
+#include <vector>
+
+#include <gtest/gtest_prod.h>
+
+
+namespace bzn
+{
+    // Hashed timer wheel shared by every websocket session and http connection.
+    // One steady timer drives the whole wheel instead of one per connection.
+    class idle_timer_wheel final : public bzn::idle_timer_wheel_base, public std::enable_shared_from_this<idle_timer_wheel>
+    {
+    public:
+        idle_timer_wheel(std::shared_ptr<bzn::asio::io_context_base> io_context, const std::chrono::milliseconds& resolution);
+
+        std::shared_ptr<bzn::idle_timer_entry> add(const std::chrono::milliseconds& timeout, bzn::idle_timer_entry::expiry_handler handler) override;
+
+        void start() override;
+
+        size_t size();
+
+    private:
+        FRIEND_TEST(idle_timer_wheel, test_that_idle_entries_expire_in_a_batch);
+        FRIEND_TEST(idle_timer_wheel, test_that_reset_entries_are_rescheduled_instead_of_expired);
+        FRIEND_TEST(idle_timer_wheel, test_that_cancelled_and_suspended_entries_do_not_expire);
+        FRIEND_TEST(idle_timer_wheel, test_that_timeouts_longer_than_a_revolution_expire_on_time);
+        FRIEND_TEST(idle_timer_wheel, DISABLED_benchmark_50k_connections);
+
+        void start_tick_timer();
+
+        void handle_tick_timeout(const boost::system::error_code& ec);
+
+        void advance(uint64_t ticks);
+
+        uint64_t to_ticks(const std::chrono::milliseconds& timeout) const;
+
+        std::unique_ptr<bzn::asio::steady_timer_base> tick_timer;
+        const std::chrono::milliseconds resolution;
+        std::chrono::steady_clock::time_point epoch;
+
+        std::shared_ptr<std::atomic<uint64_t>> clock;
+        std::vector<std::vector<std::shared_ptr<bzn::idle_timer_entry>>> buckets;
+        size_t entry_count = 0;
+
+        std::mutex lock;
+        std::once_flag start_once;
+    };
+
+} // bzn
@@ -0,0 +1,114 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <include/bluzelle.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
+
+
+namespace bzn
+{
+    // An idle deadline tracked by a timer wheel. Resetting only stores a new
+    // deadline; the wheel notices when it next visits the entry's bucket.
+    class idle_timer_entry
+    {
+    public:
+        using expiry_handler = std::function<void()>;
+
+        static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+        idle_timer_entry(std::shared_ptr<const std::atomic<uint64_t>> clock, uint64_t timeout_ticks, expiry_handler handler)
+            : clock(std::move(clock))
+            , timeout_ticks(timeout_ticks)
+            , deadline(*this->clock + timeout_ticks)
+            , handler(std::move(handler))
+        {
+        }
+
+        /**
+         * Push the deadline out by the entry's timeout
+         */
+        void reset()
+        {
+            this->deadline = *this->clock + this->timeout_ticks;
+        }
+
+        /**
+         * Do not expire until the next reset (i.e. while a write is in progress)
+         */
+        void suspend()
+        {
+            this->deadline = NEVER;
+        }
+
+        /**
+         * The handler will not be called. The wheel drops the entry on its next visit.
+         */
+        void cancel()
+        {
+            this->cancelled = true;
+        }
+
+        bool is_cancelled() const
+        {
+            return this->cancelled;
+        }
+
+        uint64_t get_deadline() const
+        {
+            return this->deadline;
+        }
+
+        uint64_t get_timeout_ticks() const
+        {
+            return this->timeout_ticks;
+        }
+
+    private:
+        friend class idle_timer_wheel;
+
+        const std::shared_ptr<const std::atomic<uint64_t>> clock;
+        const uint64_t        timeout_ticks;
+        std::atomic<uint64_t> deadline;
+        std::atomic<bool>     cancelled{false};
+        expiry_handler        handler;
+    };
+
+
+    class idle_timer_wheel_base
+    {
+    public:
+        virtual ~idle_timer_wheel_base() = default;
+
+        /**
+         * Track a new idle deadline. The handler is called once from the wheel's
+         * tick if the entry is neither reset nor cancelled within the timeout.
+         * @param timeout   idle period
+         * @param handler   callback executed on expiry
+         * @return entry used to reset, suspend or cancel the deadline
+         */
+        virtual std::shared_ptr<bzn::idle_timer_entry> add(const std::chrono::milliseconds& timeout, bzn::idle_timer_entry::expiry_handler handler) = 0;
+
+        /**
+         * Start ticking
+         */
+        virtual void start() = 0;
+    };
+
+} // bzn
@@ -21,14 +21,18 @@ using namespace bzn;
 namespace
 {
     const std::string BZN_API_KEY = "bzn-api";
+
+    // a channel that cannot connect does not hold on to more than this...
+    const size_t MAX_PENDING_CHANNEL_MESSAGES = 64;
 }
 
 
-node::node(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_base> websocket, const std::chrono::milliseconds& ws_idle_timeout,
-    const boost::asio::ip::tcp::endpoint& ep)
+node::node(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_base> websocket,
+    std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel, const std::chrono::milliseconds& ws_idle_timeout, const boost::asio::ip::tcp::endpoint& ep)
     : tcp_acceptor(io_context->make_unique_tcp_acceptor(ep))
     , io_context(std::move(io_context))
     , websocket(std::move(websocket))
+    , idle_timer_wheel(std::move(idle_timer_wheel))
     , ws_idle_timeout(ws_idle_timeout)
 {
 }
@@ -86,7 +90,7 @@ node::do_accept()
                 auto ws = self->websocket->make_unique_websocket_stream(
                     self->acceptor_socket->get_tcp_socket());
 
-                std::make_shared<bzn::session>(self->io_context, std::move(ws), self->ws_idle_timeout)->start(
+                std::make_shared<bzn::session>(self->io_context, std::move(ws), self->idle_timer_wheel, self->ws_idle_timeout)->start(
                     std::bind(&node::priv_msg_handler, self, std::placeholders::_1, std::placeholders::_2));
             }
 
@@ -117,16 +121,95 @@ node::priv_msg_handler(const Json::Value& msg, std::shared_ptr<bzn::session_base
 
 void
 node::send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::message> msg)
+{
+    this->send_message(ep, std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(msg->toStyledString())));
+}
+
+
+void
+node::send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg)
+{
+    this->connect(ep,
+        [msg](std::shared_ptr<bzn::session> session)
+        {
+            if (session)
+            {
+                // send the message requested...
+                session->send_message(msg, false);
+            }
+        });
+}
+
+
+void
+node::send_on_channel(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg)
+{
+    std::lock_guard<std::mutex> lock(this->channels_lock);
+
+    auto& channel = this->channels[ep];
+
+    if (channel.session && channel.session->is_open())
+    {
+        channel.session->send_message(msg, false);
+        return;
+    }
+
+    channel.session.reset();
+
+    if (channel.pending.size() >= MAX_PENDING_CHANNEL_MESSAGES)
+    {
+        channel.pending.pop_front();
+    }
+    channel.pending.push_back(std::move(msg));
+
+    if (channel.connecting)
+    {
+        return;
+    }
+
+    channel.connecting = true;
+
+    this->connect(ep,
+        [weak_self = std::weak_ptr<node>(shared_from_this()), ep](std::shared_ptr<bzn::session> session)
+        {
+            auto self = weak_self.lock();
+            if (!self)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(self->channels_lock);
+
+            auto& channel = self->channels[ep];
+            channel.connecting = false;
+            channel.session = session;
+
+            // messages for a peer that is down are dropped rather than kept for its return...
+            for (auto& msg : channel.pending)
+            {
+                if (session)
+                {
+                    session->send_message(std::move(msg), false);
+                }
+            }
+            channel.pending.clear();
+        });
+}
+
+
+void
+node::connect(const boost::asio::ip::tcp::endpoint& ep, std::function<void(std::shared_ptr<bzn::session>)> on_connect)
 {
     std::shared_ptr<bzn::asio::tcp_socket_base> socket = this->io_context->make_unique_tcp_socket();
 
     socket->async_connect(ep,
-        [self = shared_from_this(), socket, ep, msg](const boost::system::error_code& ec)
+        [self = shared_from_this(), socket, ep, on_connect](const boost::system::error_code& ec)
         {
             if (ec)
             {
                 LOG(error) << "failed to connect to: " << ep.address().to_string() << ":" << ep.port() << " - " << ec.message();
 
+                on_connect(nullptr);
                 return;
             }
 
@@ -134,21 +217,21 @@ node::send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn
             std::shared_ptr<bzn::beast::websocket_stream_base> ws = self->websocket->make_unique_websocket_stream(socket->get_tcp_socket());
 
             ws->async_handshake(ep.address().to_string(), "/",
-                [self, ws, msg](const boost::system::error_code& ec)
+                [self, ws, on_connect](const boost::system::error_code& ec)
                 {
                     if (ec)
                     {
                         LOG(error) << "handshake failed: " << ec.message();
 
+                        on_connect(nullptr);
                         return;
                     }
 
-                    auto session = std::make_shared<bzn::session>(self->io_context, ws, self->ws_idle_timeout);
+                    auto session = std::make_shared<bzn::session>(self->io_context, ws, self->idle_timer_wheel, self->ws_idle_timeout);
 
                     session->start(std::bind(&node::priv_msg_handler, self, std::placeholders::_1, std::placeholders::_2));
 
-                    // send the message requested...
-                    session->send_message(msg, false);
+                    on_connect(session);
                 });
         });
 }
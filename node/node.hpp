@@ -16,7 +16,11 @@
 
 #include <include/boost_asio_beast.hpp>
 #include <node/node_base.hpp>
+#include <node/idle_timer_wheel_base.hpp>
 #include <json/json.h>
+#include <functional>
+#include <list>
+#include <map>
 #include <mutex>
 
 #include <gtest/gtest_prod.h>
@@ -24,11 +28,13 @@
 
 namespace bzn
 {
+    class session;
+
     class node final : public bzn::node_base, public std::enable_shared_from_this<node>
     {
     public:
-        node(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_base> websocket, const std::chrono::milliseconds& ws_idle_timeout,
-            const boost::asio::ip::tcp::endpoint& ep);
+        node(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_base> websocket,
+            std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel, const std::chrono::milliseconds& ws_idle_timeout, const boost::asio::ip::tcp::endpoint& ep);
 
         bool register_for_message(const std::string& msg_type, bzn::message_handler msg_handler) override;
 
@@ -36,22 +42,40 @@ namespace bzn
 
         void send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::message> msg) override;
 
+        void send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg) override;
+
+        void send_on_channel(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg) override;
+
     private:
         FRIEND_TEST(node, test_that_registered_message_handler_is_invoked);
 
+        struct channel
+        {
+            std::shared_ptr<bzn::session> session;
+            std::list<std::shared_ptr<bzn::encoded_message>> pending;
+            bool connecting = false;
+        };
+
         void do_accept();
 
+        // connects and completes the handshake, the session is null if either failed...
+        void connect(const boost::asio::ip::tcp::endpoint& ep, std::function<void(std::shared_ptr<bzn::session>)> on_connect);
+
         void priv_msg_handler(const bzn::message& msg, std::shared_ptr<bzn::session_base> session);
 
         std::unique_ptr<bzn::asio::tcp_acceptor_base> tcp_acceptor;
         std::shared_ptr<bzn::asio::io_context_base>   io_context;
         std::unique_ptr<bzn::asio::tcp_socket_base>   acceptor_socket;
         std::shared_ptr<bzn::beast::websocket_base>   websocket;
+        std::shared_ptr<bzn::idle_timer_wheel_base>   idle_timer_wheel;
         const std::chrono::milliseconds               ws_idle_timeout;
 
         std::unordered_map<std::string, bzn::message_handler> message_map;
         std::mutex message_map_mutex;
 
+        std::map<boost::asio::ip::tcp::endpoint, channel> channels;
+        std::mutex channels_lock;
+
         std::once_flag start_once;
     };
 
@@ -45,6 +45,21 @@ namespace bzn
          * @param msg           message to send
          */
         virtual void send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::message> msg) = 0;
+
+        /**
+         * Convenience method to connect and send a message serialized in pieces to a node
+         * @param ep            host to send the message to
+         * @param msg           pieces written back to back
+         */
+        virtual void send_message(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg) = 0;
+
+        /**
+         * Send a message over a connection to the node that is kept open between sends and
+         * reopened once it closes. Messages sent while it is opening are written once it is.
+         * @param ep            host to send the message to
+         * @param msg           pieces written back to back
+         */
+        virtual void send_on_channel(const boost::asio::ip::tcp::endpoint& ep, std::shared_ptr<bzn::encoded_message> msg) = 0;
     };
 
 } // bzn
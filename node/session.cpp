@@ -13,29 +13,63 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <node/session.hpp>
+#include <metrics/metrics.hpp>
 #include <sstream>
 
 namespace
 {
     const std::chrono::seconds DEFAULT_WS_TIMEOUT_MS{10};
+
+    // slow consumers lose their oldest notifications beyond this point...
+    const size_t MAX_PENDING_NOTIFICATIONS = 1024;
+
+    struct session_metrics
+    {
+        bzn::metrics::gauge& open = bzn::metrics::registry::global().get_gauge("session_open", "Websocket sessions in flight.");
+        bzn::metrics::counter& bytes_in = bzn::metrics::registry::global().get_counter("session_bytes_received_total", "Websocket message bytes received.");
+        bzn::metrics::counter& bytes_out = bzn::metrics::registry::global().get_counter("session_bytes_sent_total", "Websocket message bytes sent.");
+    };
+
+    session_metrics& get_metrics()
+    {
+        static session_metrics metrics;
+        return metrics;
+    }
+
+    bzn::session_id next_session_id()
+    {
+        static std::atomic<bzn::session_id> ids{0};
+        return ++ids;
+    }
 }
 
 
 using namespace bzn;
 
 
-session::session(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_stream_base> websocket, const std::chrono::milliseconds& ws_idle_timeout)
+session::session(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_stream_base> websocket,
+    std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel, const std::chrono::milliseconds& ws_idle_timeout)
     : strand(io_context->make_unique_strand())
     , websocket(std::move(websocket))
-    , idle_timer(io_context->make_unique_steady_timer())
+    , idle_timer_wheel(std::move(idle_timer_wheel))
     , ws_idle_timeout(ws_idle_timeout.count() ? ws_idle_timeout : DEFAULT_WS_TIMEOUT_MS)
+    , session_id(next_session_id())
 {
+    get_metrics().open.add(1);
 }
 
 
 session::~session()
 {
-    this->idle_timer->cancel();
+    get_metrics().open.add(-1);
+
+    this->closed = true;
+    this->run_shutdown_handlers();
+
+    if (this->idle_entry)
+    {
+        this->idle_entry->cancel();
+    }
 
     if (this->websocket->is_open())
     {
@@ -56,6 +90,19 @@ session::start(bzn::message_handler handler)
 {
     this->handler = std::move(handler);
 
+    LOG(debug) << "starting " << this->ws_idle_timeout.count() << "ms idle timeout";
+
+    // the wheel must not keep the session alive...
+    this->idle_entry = this->idle_timer_wheel->add(this->ws_idle_timeout,
+        [weak_self = std::weak_ptr<session>(shared_from_this())]()
+        {
+            if (auto self = weak_self.lock())
+            {
+                LOG(info) << "reached idle timeout -- closing session";
+                self->close();
+            }
+        });
+
     // If we haven't completed a handshake then we are accepting one...
     if (!this->websocket->is_open())
     {
@@ -69,7 +116,11 @@ session::start(bzn::message_handler handler)
                 }
 
                 // schedule read...
-                self->do_read();
+                self->strand->post(
+                    [self]()
+                    {
+                        self->do_read();
+                    });
             }
         );
     }
@@ -79,21 +130,39 @@ session::start(bzn::message_handler handler)
 void
 session::do_read()
 {
+    // websocket allows a single outstanding read...
+    if (this->reading.exchange(true))
+    {
+        return;
+    }
+
     this->buffer.consume(this->buffer.size());
 
     this->start_idle_timeout();
 
     this->websocket->async_read(this->buffer,
         this->strand->wrap(
-        [self = shared_from_this()](boost::system::error_code ec, auto /*bytes_transferred*/)
+        [self = shared_from_this()](boost::system::error_code ec, auto bytes_transferred)
         {
+            self->reading = false;
+
             if (ec)
             {
-                LOG(error) << "websocket read failed: " << ec.message();
+                if (ec == boost::beast::websocket::error::closed || ec == boost::asio::error::operation_aborted)
+                {
+                    LOG(debug) << "websocket closed: " << ec.message();
+                }
+                else
+                {
+                    LOG(error) << "websocket read failed: " << ec.message();
+                }
+
                 self->close();
                 return;
             }
 
+            get_metrics().bytes_in.increment(bytes_transferred);
+
             // get the message...
             std::stringstream ss;
             ss << boost::beast::buffers(self->buffer.data());
@@ -115,6 +184,9 @@ session::do_read()
 
             // call subscriber...
             self->handler(msg, self);
+
+            // keep reading whether or not the handler replies (peer channels never do)...
+            self->do_read();
         }));
 }
 
@@ -129,14 +201,118 @@ session::send_message(std::shared_ptr<bzn::message> msg, const bool end_session)
 void
 session::send_message(std::shared_ptr<std::string> msg, const bool end_session)
 {
-    this->idle_timer->cancel(); // kill timer for duration of write...
+    this->send_message(std::make_shared<bzn::encoded_message>(1, std::move(msg)), end_session);
+}
+
+
+void
+session::send_message(std::shared_ptr<bzn::encoded_message> msg, const bool end_session)
+{
+    // don't expire for the duration of the write...
+    if (this->idle_entry)
+    {
+        this->idle_entry->suspend();
+    }
+
+    // callers are on crud, raft or http threads -- the websocket is only touched on the strand...
+    this->strand->post(
+        [self = shared_from_this(), msg = std::move(msg), end_session]()
+        {
+            self->write_queue.push_back(queued_write{*msg, end_session, true, {}});
+
+            if (!self->writing)
+            {
+                self->do_write();
+            }
+        });
+}
+
+
+void
+session::send_notification(const std::string& coalesce_key, std::shared_ptr<std::string> msg)
+{
+    this->strand->post(
+        [self = shared_from_this(), coalesce_key, msg = std::move(msg)]()
+        {
+            self->queue_notification(coalesce_key, msg);
+        });
+}
+
+
+void
+session::queue_notification(const std::string& coalesce_key, std::shared_ptr<std::string> msg)
+{
+    // a newer notification for the same key supersedes the pending one...
+    if (auto it = this->pending_notifications.find(coalesce_key); it != this->pending_notifications.end())
+    {
+        it->second->msg = {std::move(msg)};
+        return;
+    }
+
+    if (this->pending_notifications.size() >= MAX_PENDING_NOTIFICATIONS)
+    {
+        // never touch the write in progress at the front of the queue...
+        auto it = this->write_queue.begin();
+        if (this->writing)
+        {
+            ++it;
+        }
+
+        for (; it != this->write_queue.end(); ++it)
+        {
+            if (!it->resume_read)
+            {
+                LOG(debug) << "session is behind -- dropping notification: " << it->coalesce_key;
+
+                this->pending_notifications.erase(it->coalesce_key);
+                this->write_queue.erase(it);
+                break;
+            }
+        }
+    }
+
+    this->pending_notifications[coalesce_key] = this->write_queue.insert(this->write_queue.end(), queued_write{{std::move(msg)}, false, false, coalesce_key});
+
+    if (!this->writing)
+    {
+        this->do_write();
+    }
+}
+
+
+void
+session::do_write()
+{
+    if (this->write_queue.empty())
+    {
+        this->writing = false;
+        return;
+    }
+
+    this->writing = true;
+
+    const queued_write& next = this->write_queue.front();
+
+    if (!next.resume_read)
+    {
+        this->pending_notifications.erase(next.coalesce_key);
+    }
 
     this->websocket->get_websocket().binary(true);
 
+    // the pieces go out as one frame without being joined...
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.reserve(next.msg.size());
+
+    for (const auto& piece : next.msg)
+    {
+        buffers.emplace_back(boost::asio::buffer(*piece));
+    }
+
     this->websocket->async_write(
-        boost::asio::buffer(*msg),
+        buffers,
         this->strand->wrap(
-            [self = shared_from_this(), msg, end_session](auto ec, auto bytes_transferred)
+            [self = shared_from_this(), msg = next.msg, end_session = next.end_session, resume_read = next.resume_read](auto ec, auto bytes_transferred)
             {
                 if (ec)
                 {
@@ -146,35 +322,89 @@ session::send_message(std::shared_ptr<std::string> msg, const bool end_session)
                     return;
                 }
 
+                get_metrics().bytes_out.increment(bytes_transferred);
+
+                self->write_queue.pop_front();
+
                 if (end_session)
                 {
+                    self->write_queue.clear();
+                    self->pending_notifications.clear();
+                    self->writing = false;
                     self->close();
                     return;
                 }
 
-                self->do_read();
+                self->start_idle_timeout();
+
+                if (resume_read)
+                {
+                    self->do_read();
+                }
+
+                self->do_write();
             }));
 }
 
 
+bool
+session::is_open()
+{
+    // asked from any thread so it can't look at the websocket...
+    return !this->closed;
+}
+
+
 void
 session::close()
 {
-    this->idle_timer->cancel();
+    this->closed = true;
+    this->run_shutdown_handlers();
 
-    if (this->websocket->is_open())
+    if (this->idle_entry)
     {
-        LOG(info) << "closing session";
+        this->idle_entry->cancel();
+    }
 
-        this->websocket->async_close(boost::beast::websocket::close_code::normal,
-            this->strand->wrap(
-                [self = shared_from_this()](auto ec)
-                {
-                    if (ec)
-                    {
-                        LOG(error) << "failed to close websocket: " << ec.message();
-                    }
-                }));
+    this->strand->post(
+        [self = shared_from_this()]()
+        {
+            if (self->websocket->is_open())
+            {
+                LOG(info) << "closing session";
+
+                self->websocket->async_close(boost::beast::websocket::close_code::normal,
+                    self->strand->wrap(
+                        [self](auto ec)
+                        {
+                            if (ec)
+                            {
+                                LOG(error) << "failed to close websocket: " << ec.message();
+                            }
+                        }));
+            }
+        });
+}
+
+
+void
+session::hold_idle()
+{
+    ++this->idle_holds;
+
+    if (this->idle_entry)
+    {
+        this->idle_entry->suspend();
+    }
+}
+
+
+void
+session::release_idle()
+{
+    if (--this->idle_holds == 0)
+    {
+        this->start_idle_timeout();
     }
 }
 
@@ -182,20 +412,56 @@ session::close()
 void
 session::start_idle_timeout()
 {
-    this->idle_timer->cancel();
+    if (this->idle_entry)
+    {
+        // a request still waiting on its response keeps the session open...
+        if (this->idle_holds)
+        {
+            this->idle_entry->suspend();
+            return;
+        }
+
+        this->idle_entry->reset();
+    }
+}
+
+
+bzn::session_id
+session::get_session_id()
+{
+    return this->session_id;
+}
 
-    LOG(debug) << "resetting " << this->ws_idle_timeout.count() << "ms idle timer";
 
-    this->idle_timer->expires_from_now(this->ws_idle_timeout);
+void
+session::add_shutdown_handler(const bzn::session_shutdown_handler& handler)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->shutdown_lock);
 
-    this->idle_timer->async_wait(
-        [self = shared_from_this()](auto ec)
+        if (!this->closed)
         {
-            if (!ec)
-            {
-                LOG(info) << "reached idle timeout -- closing session";
-                self->close();
-                return;
-            }
-        });
-}
\ No newline at end of file
+            this->shutdown_handlers.push_back(handler);
+            return;
+        }
+    }
+
+    handler();
+}
+
+
+void
+session::run_shutdown_handlers()
+{
+    std::vector<bzn::session_shutdown_handler> handlers;
+
+    {
+        std::lock_guard<std::mutex> lock(this->shutdown_lock);
+        handlers.swap(this->shutdown_handlers);
+    }
+
+    for (const auto& handler : handlers)
+    {
+        handler();
+    }
+}
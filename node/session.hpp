@@ -17,8 +17,14 @@
 #include <include/boost_asio_beast.hpp>
 #include <node/node_base.hpp>
 #include <node/session_base.hpp>
+#include <node/idle_timer_wheel_base.hpp>
 #include <options/options_base.hpp>
+#include <atomic>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <gtest/gtest_prod.h>
 
@@ -28,7 +34,8 @@ namespace bzn
     class session : public bzn::session_base, public std::enable_shared_from_this<session>
     {
     public:
-        session(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_stream_base> websocket, const std::chrono::milliseconds& ws_idle_timeout);
+        session(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_ptr<bzn::beast::websocket_stream_base> websocket,
+            std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel, const std::chrono::milliseconds& ws_idle_timeout);
 
         ~session();
 
@@ -38,23 +45,67 @@ namespace bzn
 
         void send_message(std::shared_ptr<std::string> msg, bool end_session) override;
 
+        void send_message(std::shared_ptr<bzn::encoded_message> msg, bool end_session) override;
+
+        void send_notification(const std::string& coalesce_key, std::shared_ptr<std::string> msg) override;
+
+        void hold_idle() override;
+
+        void release_idle() override;
+
         void close() override;
 
+        bzn::session_id get_session_id() override;
+
+        void add_shutdown_handler(const bzn::session_shutdown_handler& handler) override;
+
+        // false once the websocket has closed or failed...
+        bool is_open();
+
     private:
         FRIEND_TEST(node_session, test_that_when_message_arrives_registered_callback_is_executed);
 
+        struct queued_write
+        {
+            bzn::encoded_message msg;
+            bool        end_session;
+            bool        resume_read; // responses start reading on a session we opened, notifications do not
+            std::string coalesce_key;
+        };
+
         void do_read();
 
+        // everything below touches the websocket or the write queue and runs on the strand...
+        void queue_notification(const std::string& coalesce_key, std::shared_ptr<std::string> msg);
+
+        void do_write();
+
         void start_idle_timeout();
 
+        void run_shutdown_handlers();
+
         std::unique_ptr<bzn::asio::strand_base> strand;
         std::shared_ptr<bzn::beast::websocket_stream_base> websocket;
-        std::unique_ptr<bzn::asio::steady_timer_base> idle_timer;
+        std::shared_ptr<bzn::idle_timer_wheel_base> idle_timer_wheel;
+        std::shared_ptr<bzn::idle_timer_entry> idle_entry;
 
         const std::chrono::milliseconds ws_idle_timeout;
+        std::atomic<size_t> idle_holds{0};
 
         bzn::message_handler       handler;
         boost::beast::multi_buffer buffer;
+        std::atomic<bool>          reading{false};
+
+        // websocket allows a single outstanding write so everything goes through this queue...
+        std::list<queued_write> write_queue;
+        std::unordered_map<std::string, std::list<queued_write>::iterator> pending_notifications;
+        bool writing = false;
+
+        std::atomic<bool> closed{false};
+
+        const bzn::session_id session_id;
+        std::vector<bzn::session_shutdown_handler> shutdown_handlers;
+        std::mutex shutdown_lock;
 
         const bool ignore_json_errors = false;
     };
@@ -25,6 +25,9 @@ namespace bzn
 
     using message_handler = std::function<void(const bzn::message& msg, std::shared_ptr<bzn::session_base> session)>;
 
+    using session_id = uint64_t;
+    using session_shutdown_handler = std::function<void()>;
+
     class session_base
     {
     public:
@@ -52,10 +55,51 @@ namespace bzn
         virtual void send_message(std::shared_ptr<std::string> msg, bool end_session) = 0;
 
 
+        /**
+         * Send a message serialized in pieces as a single frame
+         * @param msg       pieces written back to back
+         * @param end_session close connection after send
+         */
+        virtual void send_message(std::shared_ptr<bzn::encoded_message> msg, bool end_session) = 0;
+
+
+        /**
+         * Push an unsolicited message to the connected node. Pending notifications
+         * sharing the same coalesce key are replaced by the newest one and the oldest
+         * are dropped if the peer falls too far behind.
+         * @param coalesce_key  notifications with equal keys supersede each other
+         * @param msg           message
+         */
+        virtual void send_notification(const std::string& coalesce_key, std::shared_ptr<std::string> msg) = 0;
+
+
+        /**
+         * Keep the session from idling out while one of its requests waits on something other than the
+         * connection (i.e. a write waiting for its commit). Every hold is matched by a release.
+         */
+        virtual void hold_idle() = 0;
+
+
+        virtual void release_idle() = 0;
+
+
         /**
          * Perform an orderly shutdown of the websocket.
          */
         virtual void close() = 0;
+
+
+        /**
+         * Identifies the session for the life of the process, unlike its address which may be reused.
+         */
+        virtual bzn::session_id get_session_id() = 0;
+
+
+        /**
+         * Run a handler once the session closes or is destroyed, or right away if it already has
+         * @param handler   called at most once on any thread
+         */
+        virtual void add_shutdown_handler(const bzn::session_shutdown_handler& handler) = 0;
     };
 
 } // bzn
@@ -0,0 +1,202 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <node/idle_timer_wheel.hpp>
+#include <mocks/mock_boost_asio_beast.hpp>
+
+#include <gmock/gmock.h>
+
+using namespace ::testing;
+
+namespace
+{
+    const std::chrono::milliseconds TEST_RESOLUTION{100};
+
+    std::shared_ptr<bzn::idle_timer_wheel> make_wheel()
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+
+        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
+            []()
+            {
+                return std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+            }));
+
+        return std::make_shared<bzn::idle_timer_wheel>(mock_io_context, TEST_RESOLUTION);
+    }
+}
+
+
+namespace bzn
+{
+    TEST(idle_timer_wheel, test_that_start_schedules_tick_timer_once)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_steady_timer = std::make_unique<bzn::asio::Mocksteady_timer_base>();
+
+        EXPECT_CALL(*mock_steady_timer, expires_from_now(TEST_RESOLUTION));
+
+        bzn::asio::wait_handler wh;
+        EXPECT_CALL(*mock_steady_timer, async_wait(_)).WillOnce(Invoke(
+            [&](auto handler)
+            {
+                wh = handler;
+            }));
+
+        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_steady_timer);
+            }));
+
+        auto wheel = std::make_shared<bzn::idle_timer_wheel>(mock_io_context, TEST_RESOLUTION);
+
+        wheel->start();
+        wheel->start();
+
+        // a canceled tick does not reschedule...
+        wh(boost::asio::error::operation_aborted);
+    }
+
+
+    TEST(idle_timer_wheel, test_that_idle_entries_expire_in_a_batch)
+    {
+        auto wheel = make_wheel();
+
+        size_t expired = 0;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            wheel->add(std::chrono::milliseconds(500), [&](){ ++expired; });
+        }
+
+        EXPECT_EQ(wheel->size(), 1000u);
+
+        wheel->advance(4);
+        EXPECT_EQ(expired, 0u);
+
+        wheel->advance(1);
+        EXPECT_EQ(expired, 1000u);
+        EXPECT_EQ(wheel->size(), 0u);
+
+        // handlers are only called once...
+        wheel->advance(2048);
+        EXPECT_EQ(expired, 1000u);
+    }
+
+
+    TEST(idle_timer_wheel, test_that_reset_entries_are_rescheduled_instead_of_expired)
+    {
+        auto wheel = make_wheel();
+
+        bool expired = false;
+        auto entry = wheel->add(std::chrono::milliseconds(300), [&](){ expired = true; });
+
+        wheel->advance(2);
+        entry->reset();
+
+        // original deadline passes...
+        wheel->advance(1);
+        EXPECT_FALSE(expired);
+        EXPECT_EQ(wheel->size(), 1u);
+
+        wheel->advance(1);
+        EXPECT_FALSE(expired);
+
+        wheel->advance(1);
+        EXPECT_TRUE(expired);
+        EXPECT_TRUE(entry->is_cancelled());
+    }
+
+
+    TEST(idle_timer_wheel, test_that_cancelled_and_suspended_entries_do_not_expire)
+    {
+        auto wheel = make_wheel();
+
+        bool cancelled_expired = false;
+        auto cancelled = wheel->add(std::chrono::milliseconds(100), [&](){ cancelled_expired = true; });
+        cancelled->cancel();
+
+        bool suspended_expired = false;
+        auto suspended = wheel->add(std::chrono::milliseconds(100), [&](){ suspended_expired = true; });
+        suspended->suspend();
+
+        wheel->advance(10);
+        EXPECT_FALSE(cancelled_expired);
+        EXPECT_FALSE(suspended_expired);
+
+        // the cancelled entry is dropped...
+        EXPECT_EQ(wheel->size(), 1u);
+
+        // a suspended entry expires once reset and idle again...
+        suspended->reset();
+        wheel->advance(1);
+        EXPECT_TRUE(suspended_expired);
+        EXPECT_EQ(wheel->size(), 0u);
+    }
+
+
+    TEST(idle_timer_wheel, test_that_timeouts_longer_than_a_revolution_expire_on_time)
+    {
+        auto wheel = make_wheel();
+
+        // 1500 ticks is more than one trip around the wheel...
+        bool expired = false;
+        wheel->add(std::chrono::milliseconds(150000), [&](){ expired = true; });
+
+        wheel->advance(1499);
+        EXPECT_FALSE(expired);
+
+        wheel->advance(1);
+        EXPECT_TRUE(expired);
+    }
+
+
+    // ./node_tests --gtest_also_run_disabled_tests --gtest_filter=idle_timer_wheel.DISABLED_benchmark_50k_connections
+    TEST(idle_timer_wheel, DISABLED_benchmark_50k_connections)
+    {
+        const size_t CONNECTIONS = 50000;
+        const size_t TICKS = 600; // one minute at 100ms
+
+        auto wheel = make_wheel();
+
+        size_t expired = 0;
+        std::vector<std::shared_ptr<bzn::idle_timer_entry>> entries;
+        for (size_t i = 0; i < CONNECTIONS; ++i)
+        {
+            entries.emplace_back(wheel->add(std::chrono::seconds(10), [&](){ ++expired; }));
+        }
+
+        // half of the connections are active and see a message every tick...
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t tick = 0; tick < TICKS; ++tick)
+        {
+            for (size_t i = 0; i < CONNECTIONS; i += 2)
+            {
+                entries[i]->reset();
+            }
+
+            wheel->advance(1);
+        }
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        std::cout << CONNECTIONS << " connections, " << TICKS << " ticks: " << elapsed.count() << "us ("
+                  << elapsed.count() * 1000 / (TICKS * CONNECTIONS / 2) << "ns per reset + amortized tick)\n";
+
+        EXPECT_EQ(expired, CONNECTIONS / 2);
+        EXPECT_EQ(wheel->size(), CONNECTIONS / 2);
+    }
+
+} // bzn
@@ -13,11 +13,14 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <node/node.hpp>
+#include <node/idle_timer_wheel.hpp>
 #include <mocks/mock_boost_asio_beast.hpp>
 
 #include <gmock/gmock.h>
+#include <boost/beast/core/buffers_to_string.hpp>
 #include <include/bluzelle.hpp>
 #include <mocks/mock_session_base.hpp>
+#include <mocks/mock_idle_timer_wheel_base.hpp>
 
 using namespace ::testing;
 
@@ -36,7 +39,7 @@ namespace  bzn
         auto io_context = std::make_shared<bzn::asio::io_context>();
 
         EXPECT_THROW(
-            bzn::node(io_context, nullptr, std::chrono::milliseconds(0),
+            bzn::node(io_context, nullptr, nullptr, std::chrono::milliseconds(0),
                 boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string("8.8.8.8"), 8080}),
             std::exception
         );
@@ -48,7 +51,7 @@ namespace  bzn
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_tcp_acceptor = std::make_unique<bzn::asio::Mocktcp_acceptor_base>();
         auto mock_websocket = std::make_shared<bzn::beast::Mockwebsocket_base>();
-        auto mock_steady_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+        auto mock_idle_timer_wheel = std::make_shared<bzn::Mockidle_timer_wheel_base>();
 
         // start expectations... (here we are returning a real socket)
         EXPECT_CALL(*mock_io_context, make_unique_tcp_socket()).WillRepeatedly(Invoke(
@@ -63,11 +66,8 @@ namespace  bzn
 
         EXPECT_CALL(*mock_io_context, make_unique_strand());
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_steady_timer);
-            }));
+        // the session registers with the idle timer wheel...
+        EXPECT_CALL(*mock_idle_timer_wheel, add(_, _));
 
         // intercept the handler...
         bzn::asio::accept_handler accept_handler;
@@ -91,7 +91,7 @@ namespace  bzn
                 return std::make_unique<bzn::beast::websocket_stream>(std::move(socket));
             }));
 
-        auto node = std::make_shared<bzn::node>(mock_io_context, mock_websocket, std::chrono::milliseconds(0), TEST_ENDPOINT);
+        auto node = std::make_shared<bzn::node>(mock_io_context, mock_websocket, mock_idle_timer_wheel, std::chrono::milliseconds(0), TEST_ENDPOINT);
         node->start();
 
         // call the handler to test do_accept() is not called on error and do_accept() is called again...
@@ -108,7 +108,7 @@ namespace  bzn
     TEST(node, test_that_registering_message_handler_can_only_be_done_once)
     {
         auto mock_io_context = std::make_shared<NiceMock<bzn::asio::Mockio_context_base>>();
-        auto node = std::make_shared<bzn::node>(mock_io_context, nullptr, std::chrono::milliseconds(0), TEST_ENDPOINT);
+        auto node = std::make_shared<bzn::node>(mock_io_context, nullptr, nullptr, std::chrono::milliseconds(0), TEST_ENDPOINT);
 
         // test that nulls are rejected...
         ASSERT_FALSE(node->register_for_message("asdf", nullptr));
@@ -124,7 +124,7 @@ namespace  bzn
     TEST(node, test_that_registered_message_handler_is_invoked)
     {
         auto mock_io_context = std::make_shared<NiceMock<bzn::asio::Mockio_context_base>>();
-        auto node = std::make_shared<bzn::node>(mock_io_context, nullptr, std::chrono::milliseconds(0), TEST_ENDPOINT);
+        auto node = std::make_shared<bzn::node>(mock_io_context, nullptr, nullptr, std::chrono::milliseconds(0), TEST_ENDPOINT);
 
         // Add our test callback...
         bool callback_execute = false;
@@ -161,7 +161,7 @@ namespace  bzn
 
         // satisfy constructor...
         EXPECT_CALL(*mock_io_context, make_unique_tcp_acceptor(_));
-        auto node = std::make_shared<bzn::node>(mock_io_context, mock_websocket, std::chrono::milliseconds(0), TEST_ENDPOINT);
+        auto node = std::make_shared<bzn::node>(mock_io_context, mock_websocket, nullptr, std::chrono::milliseconds(0), TEST_ENDPOINT);
 
         // setup expectations for connect...
         bzn::asio::connect_handler connect_handler;
@@ -204,6 +204,185 @@ namespace  bzn
     }
 
 
+    TEST(node, test_that_a_channel_connects_once_and_sends_everything_over_it)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_websocket = std::make_shared<bzn::beast::Mockwebsocket_base>();
+        auto mock_idle_timer_wheel = std::make_shared<NiceMock<bzn::Mockidle_timer_wheel_base>>();
+        auto mock_socket = std::make_unique<bzn::asio::Mocktcp_socket_base>();
+        auto mock_websocket_stream = std::make_unique<bzn::beast::Mockwebsocket_stream_base>();
+        auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
+
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
+            {
+                handler();
+            }));
+
+        // the open channel and its session keep each other alive past the test...
+        Mock::AllowLeak(mock_websocket_stream.get());
+        Mock::AllowLeak(mock_strand.get());
+        Mock::AllowLeak(mock_io_context.get());
+        Mock::AllowLeak(mock_websocket.get());
+
+        EXPECT_CALL(*mock_io_context, make_unique_tcp_acceptor(_));
+        auto node = std::make_shared<bzn::node>(mock_io_context, mock_websocket, mock_idle_timer_wheel, std::chrono::milliseconds(0), TEST_ENDPOINT);
+
+        bzn::asio::connect_handler connect_handler;
+        EXPECT_CALL(*mock_socket, async_connect(TEST_ENDPOINT, _)).WillOnce(Invoke(
+           [&](const auto& /*ep*/, auto handler)
+           {
+               connect_handler = handler;
+           }));
+
+        static boost::asio::io_context io;
+        static boost::asio::ip::tcp::socket socket(io);
+        EXPECT_CALL(*mock_socket, get_tcp_socket()).WillRepeatedly(ReturnRef(socket));
+
+        // a single connection...
+        EXPECT_CALL(*mock_io_context, make_unique_tcp_socket()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_socket);
+            }));
+
+        bzn::beast::handshake_handler handshake_handler;
+        EXPECT_CALL(*mock_websocket_stream, async_handshake(_,_,_)).WillOnce(Invoke(
+           [&](const auto&, const auto& , auto handler)
+           {
+                handshake_handler = handler;
+           }));
+
+        boost::beast::websocket::stream<boost::asio::ip::tcp::socket> stream(io);
+        EXPECT_CALL(*mock_websocket_stream, get_websocket()).WillRepeatedly(ReturnRef(stream));
+        EXPECT_CALL(*mock_websocket_stream, is_open()).WillRepeatedly(Return(true));
+        EXPECT_CALL(*mock_websocket_stream, async_read(_,_)).Times(AnyNumber());
+
+        std::vector<std::string> written;
+        bzn::asio::write_handler write_handler;
+        EXPECT_CALL(*mock_websocket_stream, async_write(An<const std::vector<boost::asio::const_buffer>&>(),_)).WillRepeatedly(Invoke(
+            [&](const std::vector<boost::asio::const_buffer>& buffers, auto handler)
+            {
+                written.push_back(boost::beast::buffers_to_string(buffers));
+                write_handler = handler;
+            }));
+
+        EXPECT_CALL(*mock_websocket, make_unique_websocket_stream(_)).WillOnce(Invoke(
+            [&](auto& /*socket*/)
+            {
+                return std::move(mock_websocket_stream);
+            }));
+
+        EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::write_handler>())).WillRepeatedly(Invoke(
+            [&](bzn::asio::write_handler handler)
+            {
+                return handler;
+            }));
+
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_strand);
+            }));
+
+        auto make_message = [](const std::string& text)
+        {
+            return std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(text));
+        };
+
+        // sends made while connecting wait for the connection...
+        node->send_on_channel(TEST_ENDPOINT, make_message("1"));
+        node->send_on_channel(TEST_ENDPOINT, make_message("2"));
+        EXPECT_TRUE(written.empty());
+
+        connect_handler(boost::system::error_code());
+        handshake_handler(boost::system::error_code());
+        write_handler(boost::system::error_code(), 1);
+
+        // later sends reuse the open session...
+        node->send_on_channel(TEST_ENDPOINT, make_message("3"));
+        write_handler(boost::system::error_code(), 1);
+
+        EXPECT_EQ((std::vector<std::string>{"1", "2", "3"}), written);
+    }
+
+
+    TEST(node, test_that_every_message_sent_over_a_real_channel_is_handled)
+    {
+        auto io_context = std::make_shared<bzn::asio::io_context>();
+
+        // find a free port...
+        boost::asio::ip::tcp::endpoint ep;
+        {
+            boost::asio::ip::tcp::acceptor probe(io_context->get_io_context(), TEST_ENDPOINT);
+            ep = probe.local_endpoint();
+        }
+
+        auto idle_timer_wheel = std::make_shared<bzn::idle_timer_wheel>(io_context, std::chrono::milliseconds(100));
+        idle_timer_wheel->start();
+
+        auto node = std::make_shared<bzn::node>(io_context, std::make_shared<bzn::beast::websocket>(), idle_timer_wheel, std::chrono::milliseconds(5000), ep);
+
+        const size_t MESSAGES = 5;
+
+        // closing the receiving end lets both sessions shut down before the test tears them down...
+        std::shared_ptr<bzn::session_base> receiver;
+        boost::asio::steady_timer stop(io_context->get_io_context());
+        auto finish = [&]()
+        {
+            if (receiver)
+            {
+                receiver->close();
+            }
+
+            stop.expires_after(std::chrono::milliseconds(100));
+            stop.async_wait([&](auto){ io_context->stop(); });
+        };
+
+        // nothing is sent back, as with audit traffic...
+        std::vector<int> received;
+        ASSERT_TRUE(node->register_for_message("channel", [&](const auto& msg, auto session)
+        {
+            receiver = session;
+            received.push_back(msg["n"].asInt());
+
+            if (received.size() == MESSAGES)
+            {
+                finish();
+            }
+        }));
+
+        node->start();
+
+        auto make_message = [](size_t n)
+        {
+            return std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(
+                "{\"bzn-api\":\"channel\",\"n\":" + std::to_string(n) + "}"));
+        };
+
+        // the first few wait for the connection, the rest go over the open session...
+        node->send_on_channel(ep, make_message(0));
+        node->send_on_channel(ep, make_message(1));
+
+        boost::asio::steady_timer later(io_context->get_io_context(), std::chrono::milliseconds(200));
+        later.async_wait([&](auto)
+        {
+            for (size_t n = 2; n < MESSAGES; ++n)
+            {
+                node->send_on_channel(ep, make_message(n));
+            }
+        });
+
+        boost::asio::steady_timer give_up(io_context->get_io_context(), std::chrono::seconds(5));
+        give_up.async_wait([&](auto){ finish(); });
+
+        io_context->run();
+
+        EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4}), received);
+    }
+
+
     // ./node_tests --gtest_also_run_disabled_tests --gtest_filter=node.DISABLED_test_node
     TEST(node, DISABLED_test_node)
     {
@@ -212,7 +391,10 @@ namespace  bzn
 
         boost::asio::ip::tcp::endpoint ep{boost::asio::ip::address_v4::from_string("127.0.0.1"), 8080};
 
-        auto node = std::make_shared<bzn::node>(io_context, websocket, std::chrono::milliseconds(0), ep);
+        auto idle_timer_wheel = std::make_shared<bzn::idle_timer_wheel>(io_context, std::chrono::milliseconds(100));
+        idle_timer_wheel->start();
+
+        auto node = std::make_shared<bzn::node>(io_context, websocket, idle_timer_wheel, std::chrono::milliseconds(0), ep);
 
         node->register_for_message("crud",
             [](const bzn::message& msg, std::shared_ptr<bzn::session_base> session)
@@ -13,7 +13,9 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <node/session.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
 #include <mocks/mock_boost_asio_beast.hpp>
+#include <mocks/mock_idle_timer_wheel_base.hpp>
 
 #include <gmock/gmock.h>
 
@@ -25,9 +27,16 @@ namespace bzn
     {
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_websocket_stream = std::make_shared<bzn::beast::Mockwebsocket_stream_base>();
-        auto mock_steady_timer = std::make_unique<bzn::asio::Mocksteady_timer_base>();
+        auto mock_idle_timer_wheel = std::make_shared<bzn::Mockidle_timer_wheel_base>();
         auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
 
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
+            {
+                handler();
+            }));
+
         EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
             [&]()
             {
@@ -40,24 +49,15 @@ namespace bzn
                 return handler;
             }));
 
-        EXPECT_CALL(*mock_steady_timer, expires_from_now(std::chrono::milliseconds(1000)));
-
-        bzn::asio::wait_handler wh;
-        EXPECT_CALL(*mock_steady_timer, async_wait(_)).WillOnce(Invoke(
-            [&](auto handler)
+        bzn::idle_timer_entry::expiry_handler expiry_handler;
+        EXPECT_CALL(*mock_idle_timer_wheel, add(std::chrono::milliseconds(1000), _)).WillOnce(Invoke(
+            [&](auto, auto handler)
             {
-                wh = handler;
+                expiry_handler = handler;
+                return std::make_shared<bzn::idle_timer_entry>(std::make_shared<std::atomic<uint64_t>>(0), 10, handler);
             }));
 
-        EXPECT_CALL(*mock_steady_timer, cancel()).Times(3);
-
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_steady_timer);
-            }));
-
-        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, std::chrono::milliseconds(1000));
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, mock_idle_timer_wheel, std::chrono::milliseconds(1000));
 
         bzn::asio::accept_handler accept_handler;
         EXPECT_CALL(*mock_websocket_stream, async_accept(_)).WillRepeatedly(Invoke(
@@ -81,7 +81,7 @@ namespace bzn
 
         // expire idle timer (will close connection)
         EXPECT_CALL(*mock_websocket_stream, async_close(_,_));
-        wh(boost::system::error_code());
+        expiry_handler();
     }
 
 
@@ -89,19 +89,19 @@ namespace bzn
     {
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto websocket_stream = std::make_shared<NiceMock<bzn::beast::Mockwebsocket_stream_base>>();
-        auto mock_steady_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
         auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
 
-        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
-            [&]()
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
             {
-                return std::move(mock_strand);
+                handler();
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
             [&]()
             {
-                return std::move(mock_steady_timer);
+                return std::move(mock_strand);
             }));
 
         EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::read_handler>())).WillRepeatedly(Invoke(
@@ -110,7 +110,7 @@ namespace bzn
                 return handler;
             }));
 
-        auto session = std::make_shared<bzn::session>(mock_io_context, websocket_stream, std::chrono::milliseconds(0));
+        auto session = std::make_shared<bzn::session>(mock_io_context, websocket_stream, std::make_shared<NiceMock<bzn::Mockidle_timer_wheel_base>>(), std::chrono::milliseconds(0));
 
         bzn::asio::accept_handler accept_handler;
         EXPECT_CALL(*websocket_stream, async_accept(_)).WillRepeatedly(Invoke(
@@ -159,7 +159,13 @@ namespace bzn
     {
         auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
         auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
-        auto mock_steady_timer = std::make_unique<NiceMock<bzn::asio::Mocksteady_timer_base>>();
+
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
+            {
+                handler();
+            }));
 
         EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::write_handler>())).WillRepeatedly(Invoke(
             [&](bzn::asio::write_handler handler)
@@ -179,17 +185,16 @@ namespace bzn
                 return std::move(mock_strand);
             }));
 
-        EXPECT_CALL(*mock_io_context, make_unique_steady_timer()).WillOnce(Invoke(
-            [&]()
-            {
-                return std::move(mock_steady_timer);
-            }));
-
         auto mock_websocket_stream = std::make_shared<bzn::beast::Mockwebsocket_stream_base>();
-        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, std::chrono::milliseconds(0));
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, nullptr, std::chrono::milliseconds(0));
 
-        EXPECT_CALL(*mock_websocket_stream, async_write(_,_));
-        EXPECT_CALL(*mock_websocket_stream, is_open()).WillOnce(Return(true)).WillOnce(Return(false));
+        bzn::asio::write_handler write_handler;
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).WillOnce(Invoke(
+            [&](auto& /*buffer*/, auto handler)
+            {
+                write_handler = handler;
+            }));
+        EXPECT_CALL(*mock_websocket_stream, is_open()).WillOnce(Return(false)).WillOnce(Return(true)).WillOnce(Return(false));
 
         // expect a call to binary!
         boost::asio::io_context io;
@@ -198,9 +203,9 @@ namespace bzn
 
         // no read exepected...
         session->send_message(std::make_shared<bzn::message>("asdf"), true);
+        write_handler(boost::system::error_code(), 0);
 
         // read should be setup...
-        bzn::asio::write_handler write_handler;
         EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).WillOnce(Invoke(
             [&](auto& /*buffer*/, auto handler)
             {
@@ -211,9 +216,281 @@ namespace bzn
         session->send_message(std::make_shared<bzn::message>("asdf"), false);
         write_handler(boost::system::error_code(), 0);
 
+        // a write that fails closes the session...
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).WillOnce(Invoke(
+            [&](auto& /*buffer*/, auto handler)
+            {
+                write_handler = handler;
+            }));
+        session->send_message(std::make_shared<bzn::message>("asdf"), false);
+
         // error no read should be setup...
         EXPECT_CALL(*mock_websocket_stream, async_close(_,_));
         write_handler(boost::asio::error::operation_aborted, 0);
     }
 
+
+
+    TEST(node_session, test_that_a_held_session_does_not_idle_out_until_released)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
+
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
+            {
+                handler();
+            }));
+        auto mock_idle_timer_wheel = std::make_shared<bzn::Mockidle_timer_wheel_base>();
+
+        EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::write_handler>())).WillRepeatedly(Invoke(
+            [&](bzn::asio::write_handler handler)
+            {
+                return handler;
+            }));
+
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_strand);
+            }));
+
+        std::shared_ptr<bzn::idle_timer_entry> entry;
+        EXPECT_CALL(*mock_idle_timer_wheel, add(_, _)).WillOnce(Invoke(
+            [&](auto, auto handler)
+            {
+                entry = std::make_shared<bzn::idle_timer_entry>(std::make_shared<std::atomic<uint64_t>>(0), 10, handler);
+                return entry;
+            }));
+
+        auto mock_websocket_stream = std::make_shared<NiceMock<bzn::beast::Mockwebsocket_stream_base>>();
+        EXPECT_CALL(*mock_websocket_stream, is_open()).WillRepeatedly(Return(true));
+
+        boost::asio::io_context io;
+        boost::beast::websocket::stream<boost::asio::ip::tcp::socket> socket(io);
+        EXPECT_CALL(*mock_websocket_stream, get_websocket()).WillRepeatedly(ReturnRef(socket));
+
+        bzn::asio::write_handler write_handler;
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).WillRepeatedly(Invoke(
+            [&](auto& /*buffer*/, auto handler)
+            {
+                write_handler = handler;
+            }));
+
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, mock_idle_timer_wheel, std::chrono::milliseconds(1000));
+        session->start([](auto&, auto){});
+        EXPECT_EQ(uint64_t(10), entry->get_deadline());
+
+        // two writes wait for their commits...
+        session->hold_idle();
+        session->hold_idle();
+        EXPECT_EQ(bzn::idle_timer_entry::NEVER, entry->get_deadline());
+
+        // answering the first one leaves the session held...
+        session->send_message(std::make_shared<std::string>("response"), false);
+        write_handler(boost::system::error_code(), 0);
+        session->release_idle();
+        EXPECT_EQ(bzn::idle_timer_entry::NEVER, entry->get_deadline());
+
+        session->release_idle();
+        EXPECT_EQ(uint64_t(10), entry->get_deadline());
+    }
+
+
+    TEST(node_session, test_that_pending_notifications_are_coalesced_and_do_not_schedule_reads)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
+
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
+            {
+                handler();
+            }));
+
+        EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::write_handler>())).WillRepeatedly(Invoke(
+            [&](bzn::asio::write_handler handler)
+            {
+                return handler;
+            }));
+
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_strand);
+            }));
+
+        auto mock_websocket_stream = std::make_shared<NiceMock<bzn::beast::Mockwebsocket_stream_base>>();
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, nullptr, std::chrono::milliseconds(0));
+
+        boost::asio::io_context io;
+        boost::beast::websocket::stream<boost::asio::ip::tcp::socket> socket(io);
+        EXPECT_CALL(*mock_websocket_stream, get_websocket()).WillRepeatedly(ReturnRef(socket));
+
+        std::vector<std::string> written;
+        bzn::asio::write_handler write_handler;
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).WillRepeatedly(Invoke(
+            [&](const std::vector<boost::asio::const_buffer>& buffers, auto handler)
+            {
+                written.emplace_back(boost::beast::buffers_to_string(buffers));
+                write_handler = handler;
+            }));
+
+        // notifications never schedule a read...
+        EXPECT_CALL(*mock_websocket_stream, async_read(_,_)).Times(0);
+
+        session->send_notification("a", std::make_shared<std::string>("a1"));
+        session->send_notification("a", std::make_shared<std::string>("a2"));
+        session->send_notification("b", std::make_shared<std::string>("b1"));
+        session->send_notification("a", std::make_shared<std::string>("a3"));
+
+        // first one was in flight, a2 was replaced by a3...
+        write_handler(boost::system::error_code(), 0);
+        write_handler(boost::system::error_code(), 0);
+        write_handler(boost::system::error_code(), 0);
+
+        EXPECT_EQ(written, std::vector<std::string>({"a1", "a3", "b1"}));
+    }
+
+
+    TEST(node_session, test_that_an_encoded_message_is_written_in_one_write)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
+
+        // run posted work inline...
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [](bzn::asio::post_handler handler)
+            {
+                handler();
+            }));
+
+        EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::write_handler>())).WillRepeatedly(Invoke(
+            [&](bzn::asio::write_handler handler)
+            {
+                return handler;
+            }));
+
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_strand);
+            }));
+
+        auto mock_websocket_stream = std::make_shared<NiceMock<bzn::beast::Mockwebsocket_stream_base>>();
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, nullptr, std::chrono::milliseconds(0));
+
+        boost::asio::io_context io;
+        boost::beast::websocket::stream<boost::asio::ip::tcp::socket> socket(io);
+        EXPECT_CALL(*mock_websocket_stream, get_websocket()).WillRepeatedly(ReturnRef(socket));
+
+        std::vector<std::string> written;
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).WillOnce(Invoke(
+            [&](const std::vector<boost::asio::const_buffer>& buffers, auto /*handler*/)
+            {
+                EXPECT_EQ(size_t(3), buffers.size());
+                written.emplace_back(boost::beast::buffers_to_string(buffers));
+            }));
+
+        // the shared piece is written as is between the others...
+        auto shared = std::make_shared<const std::string>("\"payload\"");
+        session->send_message(std::make_shared<bzn::encoded_message>(bzn::encoded_message{
+            std::make_shared<const std::string>("{\"a\":"), shared, std::make_shared<const std::string>("}")}), false);
+
+        EXPECT_EQ(written, std::vector<std::string>({"{\"a\":\"payload\"}"}));
+    }
+
+
+    TEST(node_session, test_that_sends_touch_the_websocket_only_on_the_strand)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+        auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
+
+        // hold posted work until the strand would run it...
+        std::vector<bzn::asio::post_handler> posted;
+        EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+            [&](bzn::asio::post_handler handler)
+            {
+                posted.emplace_back(std::move(handler));
+            }));
+
+        EXPECT_CALL(*mock_strand, wrap(An<bzn::asio::write_handler>())).WillRepeatedly(Invoke(
+            [&](bzn::asio::write_handler handler)
+            {
+                return handler;
+            }));
+
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillOnce(Invoke(
+            [&]()
+            {
+                return std::move(mock_strand);
+            }));
+
+        auto mock_websocket_stream = std::make_shared<NiceMock<bzn::beast::Mockwebsocket_stream_base>>();
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, nullptr, std::chrono::milliseconds(0));
+
+        boost::asio::io_context io;
+        boost::beast::websocket::stream<boost::asio::ip::tcp::socket> socket(io);
+
+        EXPECT_CALL(*mock_websocket_stream, get_websocket()).Times(0);
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_)).Times(0);
+
+        session->send_message(std::make_shared<std::string>("response"), false);
+        session->send_notification("a", std::make_shared<std::string>("a1"));
+
+        ASSERT_EQ(posted.size(), 2u);
+        Mock::VerifyAndClearExpectations(mock_websocket_stream.get());
+
+        // once on the strand the first write starts and the notification queues behind it...
+        EXPECT_CALL(*mock_websocket_stream, get_websocket()).WillRepeatedly(ReturnRef(socket));
+        EXPECT_CALL(*mock_websocket_stream, async_write(_,_));
+
+        for (auto& handler : posted)
+        {
+            handler();
+        }
+    }
+
+
+    TEST(node_session, test_that_shutdown_handlers_run_once_when_the_session_closes)
+    {
+        auto mock_io_context = std::make_shared<bzn::asio::Mockio_context_base>();
+
+        EXPECT_CALL(*mock_io_context, make_unique_strand()).WillRepeatedly(Invoke(
+            []()
+            {
+                auto mock_strand = std::make_unique<bzn::asio::Mockstrand_base>();
+
+                EXPECT_CALL(*mock_strand, post(_)).WillRepeatedly(Invoke(
+                    [](bzn::asio::post_handler handler)
+                    {
+                        handler();
+                    }));
+
+                return std::unique_ptr<bzn::asio::strand_base>(std::move(mock_strand));
+            }));
+
+        auto mock_websocket_stream = std::make_shared<NiceMock<bzn::beast::Mockwebsocket_stream_base>>();
+        auto session = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, nullptr, std::chrono::milliseconds(0));
+        auto other = std::make_shared<bzn::session>(mock_io_context, mock_websocket_stream, nullptr, std::chrono::milliseconds(0));
+
+        EXPECT_NE(session->get_session_id(), other->get_session_id());
+
+        size_t ran = 0;
+        session->add_shutdown_handler([&](){ ++ran; });
+
+        session->close();
+        session->close();
+        EXPECT_EQ(ran, size_t(1));
+
+        // added after the close it runs right away...
+        session->add_shutdown_handler([&](){ ++ran; });
+        EXPECT_EQ(ran, size_t(2));
+
+        session.reset();
+        EXPECT_EQ(ran, size_t(2));
+    }
+
 } // bzn
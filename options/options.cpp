@@ -32,7 +32,18 @@ namespace
     const std::string BOOTSTRAP_PEERS_URL_KEY    = "bootstrap_url";
     const std::string DEBUG_LOGGING_KEY          = "debug_logging";
     const std::string LOG_TO_STDOUT_KEY          = "log_to_stdout";
+    const std::string LOG_DROP_ON_OVERFLOW_KEY   = "log_drop_on_overflow";
     const std::string WS_IDLE_TIMEOUT_KEY        = "ws_idle_timeout";
+    const std::string HTTP_IDLE_TIMEOUT_KEY      = "http_idle_timeout";
+    const std::string HTTP_MAX_REQUESTS_KEY      = "http_max_requests";
+    const std::string FORWARD_WRITES_KEY         = "forward_writes";
+    const std::string MEMORY_BUDGET_MB_KEY       = "memory_budget_mb";
+    const std::string CHECKPOINT_COMMITS_KEY     = "checkpoint_commits";
+    const std::string CHECKPOINT_INTERVAL_KEY    = "checkpoint_interval";
+
+    const size_t DEFAULT_HTTP_MAX_REQUESTS = 1000;
+    const size_t DEFAULT_CHECKPOINT_COMMITS = 10000;
+    const std::chrono::seconds DEFAULT_CHECKPOINT_INTERVAL{300};
 
     // https://stackoverflow.com/questions/8899069
     bool is_hex_notation(std::string const& s)
@@ -220,6 +231,19 @@ options::get_log_to_stdout() const
 }
 
 
+bool
+options::get_log_drop_on_overflow() const
+{
+    if (this->config_data.isMember(LOG_DROP_ON_OVERFLOW_KEY))
+    {
+        return this->config_data[LOG_DROP_ON_OVERFLOW_KEY].asBool();
+    }
+
+    // losing records is opt-in...
+    return false;
+}
+
+
 std::chrono::seconds
 options::get_ws_idle_timeout() const
 {
@@ -227,6 +251,73 @@ options::get_ws_idle_timeout() const
 }
 
 
+std::chrono::seconds
+options::get_http_idle_timeout() const
+{
+    return std::chrono::seconds(this->config_data[HTTP_IDLE_TIMEOUT_KEY].asUInt64());
+}
+
+
+size_t
+options::get_http_max_requests() const
+{
+    if (this->config_data.isMember(HTTP_MAX_REQUESTS_KEY))
+    {
+        return this->config_data[HTTP_MAX_REQUESTS_KEY].asUInt64();
+    }
+
+    return DEFAULT_HTTP_MAX_REQUESTS;
+}
+
+
+bool
+options::get_forward_writes() const
+{
+    if (this->config_data.isMember(FORWARD_WRITES_KEY))
+    {
+        return this->config_data[FORWARD_WRITES_KEY].asBool();
+    }
+
+    return true;
+}
+
+
+size_t
+options::get_memory_budget() const
+{
+    if (this->config_data.isMember(MEMORY_BUDGET_MB_KEY))
+    {
+        return this->config_data[MEMORY_BUDGET_MB_KEY].asUInt64() * 1024 * 1024;
+    }
+
+    return 0;
+}
+
+
+size_t
+options::get_checkpoint_commits() const
+{
+    if (this->config_data.isMember(CHECKPOINT_COMMITS_KEY))
+    {
+        return this->config_data[CHECKPOINT_COMMITS_KEY].asUInt64();
+    }
+
+    return DEFAULT_CHECKPOINT_COMMITS;
+}
+
+
+std::chrono::seconds
+options::get_checkpoint_interval() const
+{
+    if (this->config_data.isMember(CHECKPOINT_INTERVAL_KEY))
+    {
+        return std::chrono::seconds(this->config_data[CHECKPOINT_INTERVAL_KEY].asUInt64());
+    }
+
+    return DEFAULT_CHECKPOINT_INTERVAL;
+}
+
+
 bool
 options::parse(int argc, const char* argv[])
 {
@@ -39,10 +39,24 @@ namespace bzn
 
         bool get_log_to_stdout() const override;
 
+        bool get_log_drop_on_overflow() const override;
+
         bzn::uuid_t get_uuid() const override;
 
         std::chrono::seconds get_ws_idle_timeout() const override;
 
+        std::chrono::seconds get_http_idle_timeout() const override;
+
+        size_t get_http_max_requests() const override;
+
+        bool get_forward_writes() const override;
+
+        size_t get_memory_budget() const override;
+
+        size_t get_checkpoint_commits() const override;
+
+        std::chrono::seconds get_checkpoint_interval() const override;
+
     private:
         bool parse(int argc, const char* argv[]);
 
@@ -69,6 +69,12 @@ namespace bzn
          */
         virtual bool get_log_to_stdout() const = 0;
 
+        /**
+         * Drop log records below error instead of blocking the caller when the log writer falls behind.
+         * @return true if records may be dropped
+         */
+        virtual bool get_log_drop_on_overflow() const = 0;
+
         /**
          * Get the peer's unique id
          * @return uuid
@@ -82,6 +88,42 @@ namespace bzn
          */
          virtual std::chrono::seconds get_ws_idle_timeout() const = 0;
 
+        /**
+         * Get the http keep-alive connection activity timeout
+         * @return seconds
+         */
+        virtual std::chrono::seconds get_http_idle_timeout() const = 0;
+
+        /**
+         * Get the number of requests served on a keep-alive http connection before it is closed
+         * @return request count (0 is unlimited)
+         */
+        virtual size_t get_http_max_requests() const = 0;
+
+        /**
+         * Should followers forward writes to the leader instead of redirecting the client?
+         * @return true to forward
+         */
+        virtual bool get_forward_writes() const = 0;
+
+        /**
+         * Get the bytes of values kept in memory before the least recently read move to disk
+         * @return bytes (0 is unlimited)
+         */
+        virtual size_t get_memory_budget() const = 0;
+
+        /**
+         * Get the number of commits after which storage is checkpointed
+         * @return commit count (0 disables the commit trigger)
+         */
+        virtual size_t get_checkpoint_commits() const = 0;
+
+        /**
+         * Get the time after which storage is checkpointed
+         * @return seconds (0 disables the time trigger)
+         */
+        virtual std::chrono::seconds get_checkpoint_interval() const = 0;
+
     };
 
 } // bzn
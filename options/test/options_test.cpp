@@ -35,7 +35,14 @@ namespace
         "  \"bootstrap_file\" : \"peers.json\",\n"
         "  \"bootstrap_url\"  : \"example.org/peers.json\",\n"
         "  \"debug_logging\" : true,"
-        "  \"log_to_stdout\" : true"
+        "  \"log_to_stdout\" : true,"
+        "  \"log_drop_on_overflow\" : true,"
+        "  \"http_idle_timeout\" : 30,"
+        "  \"http_max_requests\" : 50,"
+        "  \"forward_writes\" : false,"
+        "  \"memory_budget_mb\" : 64,"
+        "  \"checkpoint_commits\" : 500,"
+        "  \"checkpoint_interval\" : 60"
         "}";
 
     const auto DEFAULT_LISTENER = boost::asio::ip::tcp::endpoint{boost::asio::ip::address::from_string("0.0.0.0"), 49152};
@@ -72,6 +79,13 @@ TEST_F(options_file_test, test_that_loading_of_default_config_file)
     EXPECT_EQ(DEFAULT_LISTENER, options.get_listener());
     ASSERT_EQ(true, options.get_debug_logging());
     ASSERT_EQ(true, options.get_log_to_stdout());
+    ASSERT_EQ(true, options.get_log_drop_on_overflow());
+    EXPECT_EQ(std::chrono::seconds(30), options.get_http_idle_timeout());
+    EXPECT_EQ(50u, options.get_http_max_requests());
+    ASSERT_EQ(false, options.get_forward_writes());
+    EXPECT_EQ(size_t(64 * 1024 * 1024), options.get_memory_budget());
+    EXPECT_EQ(500u, options.get_checkpoint_commits());
+    EXPECT_EQ(std::chrono::seconds(60), options.get_checkpoint_interval());
     //EXPECT_EQ("peers.json", options.get_bootstrap_peers_file());
     //EXPECT_EQ("example.org/peers.json", options.get_bootstrap_peers_url());
 }
@@ -0,0 +1,122 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <raft/log_arena.hpp>
+#include <algorithm>
+
+using namespace bzn;
+
+namespace
+{
+    const size_t SEGMENT_SIZE = 1024 * 1024;
+}
+
+
+void
+log_arena::emplace_back(const bzn::log_entry& entry)
+{
+    this->emplace_back(entry.entry_type, entry.log_index, entry.term, entry.json_to_string(entry.msg));
+}
+
+
+void
+log_arena::emplace_back(bzn::log_entry_type entry_type, uint32_t log_index, uint32_t term, std::string_view msg)
+{
+    // an entry larger than a segment gets one of its own...
+    if (this->segments.empty() || this->segments.back().capacity() - this->segments.back().size() < msg.size())
+    {
+        this->segments.emplace_back();
+        this->segments.back().reserve(std::max(SEGMENT_SIZE, msg.size()));
+    }
+
+    auto& segment = this->segments.back();
+
+    this->index.push_back(index_entry{log_index, term, uint32_t(this->segments.size() - 1), uint32_t(segment.size()), uint32_t(msg.size()), entry_type});
+    segment.insert(segment.end(), msg.begin(), msg.end());
+}
+
+
+void
+log_arena::pop_back()
+{
+    const auto entry = this->index.back();
+    this->index.pop_back();
+
+    auto& segment = this->segments[entry.segment];
+    segment.resize(entry.offset);
+
+    if (segment.empty())
+    {
+        this->segments.pop_back();
+    }
+}
+
+
+void
+log_arena::clear()
+{
+    this->index.clear();
+    this->segments.clear();
+}
+
+
+bzn::log_entry
+log_arena::operator[](size_t i) const
+{
+    const auto& entry = this->index[i];
+    const auto msg = this->encoded(i);
+
+    bzn::log_entry log_entry{entry.entry_type, entry.log_index, entry.term, {}};
+
+    Json::Reader reader;
+    if (!reader.parse(msg.data(), msg.data() + msg.size(), log_entry.msg))
+    {
+        throw std::runtime_error(bzn::MSG_ERROR_ENCOUNTERED_INVALID_ENTRY_IN_LOG + ":" + reader.getFormattedErrorMessages());
+    }
+
+    return log_entry;
+}
+
+
+std::string_view
+log_arena::encoded(size_t i) const
+{
+    const auto& entry = this->index[i];
+
+    return std::string_view(this->segments[entry.segment].data() + entry.offset, entry.length);
+}
+
+
+size_t
+log_arena::find(uint32_t log_index) const
+{
+    auto it = std::lower_bound(this->index.begin(), this->index.end(), log_index,
+        [](const index_entry& entry, uint32_t log_index){ return entry.log_index < log_index; });
+
+    return (it != this->index.end() && it->log_index == log_index) ? size_t(it - this->index.begin()) : npos;
+}
+
+
+size_t
+log_arena::capacity() const
+{
+    size_t bytes = this->index.capacity() * sizeof(index_entry);
+
+    for (const auto& segment : this->segments)
+    {
+        bytes += segment.capacity();
+    }
+
+    return bytes;
+}
@@ -0,0 +1,81 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <raft/log_entry.hpp>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+
+namespace bzn
+{
+    // raft log entries kept as serialized messages in large segments with a small index beside them,
+    // a message is only decoded when an entry is read...
+    class log_arena final
+    {
+    public:
+        static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+        void emplace_back(const bzn::log_entry& entry);
+
+        // msg is the entry's message as written by log_entry::json_to_string...
+        void emplace_back(bzn::log_entry_type entry_type, uint32_t log_index, uint32_t term, std::string_view msg);
+
+        void pop_back();
+
+        void clear();
+
+        bool empty() const { return this->index.empty(); }
+
+        size_t size() const { return this->index.size(); }
+
+        // decodes the entry at position i...
+        bzn::log_entry operator[](size_t i) const;
+
+        bzn::log_entry front() const { return (*this)[0]; }
+
+        bzn::log_entry back() const { return (*this)[this->index.size() - 1]; }
+
+        // entry fields without decoding its message...
+        uint32_t log_index(size_t i) const { return this->index[i].log_index; }
+        uint32_t term(size_t i) const { return this->index[i].term; }
+        bzn::log_entry_type entry_type(size_t i) const { return this->index[i].entry_type; }
+        std::string_view encoded(size_t i) const;
+
+        // position of the entry with the log index or npos, the log is in index order...
+        size_t find(uint32_t log_index) const;
+
+        // segment bytes allocated, for memory accounting...
+        size_t capacity() const;
+
+    private:
+        struct index_entry
+        {
+            uint32_t log_index;
+            uint32_t term;
+            uint32_t segment;
+            uint32_t offset;
+            uint32_t length;
+            bzn::log_entry_type entry_type;
+        };
+
+        std::vector<index_entry> index;
+
+        // a segment is never grown past its capacity so views of it stay valid...
+        std::vector<std::vector<char>> segments;
+    };
+
+} // bzn
@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <include/bluzelle.hpp>
+#include <limits>
 #include <ostream>
 #include <boost/beast/core/detail/base64.hpp>
 #include <string>
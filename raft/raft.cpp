@@ -13,12 +13,15 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <raft/raft.hpp>
-#include <boost/range/adaptor/reversed.hpp>
+#include <metrics/metrics.hpp>
 #include <string>
 #include <random>
 #include <algorithm>
 #include <boost/filesystem.hpp>
 #include <proto/bluzelle.pb.h>
+#include <future>
+#include <sstream>
+#include <thread>
 
 namespace
 {
@@ -32,6 +35,48 @@ namespace
     const std::chrono::milliseconds  DEFAULT_ELECTION_TIMER_LEN{std::chrono::milliseconds(5000)};
 
     const std::string RAFT_TIMEOUT_SCALE = "RAFT_TIMEOUT_SCALE";
+
+    const size_t LOAD_CHUNK_ENTRIES = 4096;
+    const size_t APPEND_PAYLOAD_CACHE_ENTRIES = 64;
+    const size_t REPLAY_PROGRESS_ENTRIES = 1024;
+    const std::chrono::seconds REPLAY_PROGRESS_INTERVAL{5};
+
+    const std::chrono::milliseconds AUDIT_BATCH_INTERVAL{1000};
+    const int AUDIT_BATCH_MAX_COMMITS = 4096;
+
+    // 64 bit FNV-1a, every node must arrive at the same digest for the same entry...
+    uint64_t commit_digest(std::string_view operation)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for (const auto c : operation)
+        {
+            hash = (hash ^ uint8_t(c)) * 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    std::shared_ptr<bzn::encoded_message> make_audit_message(const audit_message& msg)
+    {
+        return std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(
+            R"({"bzn-api":"audit","audit-data":")" + boost::beast::detail::base64_encode(msg.SerializeAsString()) + R"("})"));
+    }
+
+    struct raft_metrics
+    {
+        bzn::metrics::counter& elections = bzn::metrics::registry::global().get_counter("raft_elections_total", "Elections started by this node.");
+        bzn::metrics::histogram& commit_latency = bzn::metrics::registry::global().get_histogram("raft_commit_latency_microseconds", "Time from append to commit on the leader.");
+        bzn::metrics::histogram& commit_batch = bzn::metrics::registry::global().get_histogram("raft_commit_batch_size", "Entries committed by a single AppendEntries response.");
+        bzn::metrics::gauge& replay_remaining = bzn::metrics::registry::global().get_gauge("raft_replay_remaining_entries", "Log entries left to replay at startup.");
+        bzn::metrics::gauge& replay_rate = bzn::metrics::registry::global().get_gauge("raft_replay_entries_per_second", "Rate of the last startup replay.");
+    };
+
+    raft_metrics& get_metrics()
+    {
+        static raft_metrics metrics;
+        return metrics;
+    }
 }
 
 
@@ -50,10 +95,11 @@ raft::raft(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_p
         throw std::runtime_error(NO_PEERS_ERRORS_MGS);
     }
 
-    // setup peer tracking...
+    // setup peer tracking, the lag gauges are looked up once rather than on every response...
     for (const auto& peer : this->peers)
     {
         this->peer_match_index[peer.uuid] = 0;
+        this->peer_match_lag[peer.uuid] = &bzn::metrics::registry::global().get_gauge("raft_peer_match_lag", "Log entries a peer is behind the leader.", {{"peer", peer.uuid}});
     }
 
     this->get_raft_timeout_scale();
@@ -63,8 +109,8 @@ raft::raft(std::shared_ptr<bzn::asio::io_context_base> io_context, std::shared_p
         this->load_state();
         this->load_log_entries();
 
-        const auto& last_entry = this->log_entries.back();
-        if (last_entry.log_index!=this->last_log_index || last_entry.term!=this->current_term)
+        const auto last = this->log_entries.size() - 1;
+        if (this->log_entries.log_index(last)!=this->last_log_index || this->log_entries.term(last)!=this->current_term)
         {
             throw std::runtime_error(MSG_ERROR_INVALID_LOG_ENTRY_FILE);
         }
@@ -167,6 +213,8 @@ raft::request_vote_request()
 {
     std::lock_guard<std::mutex> lock(this->raft_lock);
 
+    get_metrics().elections.increment();
+
     // update raft state...
     this->voted_for = this->uuid;
     this->yes_votes = 1;
@@ -317,8 +365,10 @@ raft::handle_ws_append_entries(const bzn::message& msg, std::shared_ptr<bzn::ses
     }
     else
     {
-        if (this->log_entries.back().log_index == leader_prev_index &&
-            this->log_entries.back().term == leader_prev_term)
+        const auto last = this->log_entries.size() - 1;
+
+        if (this->log_entries.log_index(last) == leader_prev_index &&
+            this->log_entries.term(last) == leader_prev_term)
         {
             success = true;
 
@@ -367,6 +417,9 @@ raft::handle_ws_append_entries(const bzn::message& msg, std::shared_ptr<bzn::ses
     // update leader's peer index
     this->peer_match_index[this->leader] = msg["data"]["commitIndex"].asUInt();
 
+    // followers batch their commits on the leader's heartbeats...
+    this->send_commit_batch(false);
+
     this->start_election_timer();
 }
 
@@ -478,6 +531,7 @@ raft::handle_heartbeat_timeout(const boost::system::error_code& ec)
 
     this->request_append_entries();
     this->notify_leader_status();
+    this->send_commit_batch(false);
 }
 
 void
@@ -492,38 +546,61 @@ raft::notify_leader_status()
     msg.mutable_leader_status()->set_term(this->current_term);
     msg.mutable_leader_status()->set_leader(this->uuid);
 
-    auto json_ptr = std::make_shared<bzn::message>();
-    (*json_ptr)["bzn-api"] = "audit";
-    (*json_ptr)["audit-data"] = boost::beast::detail::base64_encode(msg.SerializeAsString());
+    auto encoded = make_audit_message(msg);
 
     for (const auto& peer : this->peers)
     {
         auto ep = boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string(peer.host), peer.port};
-        this->node->send_message(ep, json_ptr);
+        this->node->send_on_channel(ep, encoded);
     }
 }
 
 void
-raft::notify_commit(size_t log_index, const std::string& operation)
+raft::notify_commit(size_t log_index, uint32_t term, std::string_view operation)
 {
     if(!this->enable_audit)
     {
         return;
     }
 
-    audit_message msg;
-    msg.mutable_commit()->set_log_index(log_index);
-    msg.mutable_commit()->set_operation(operation);
+    auto commit = this->pending_commits.add_commits();
+    commit->set_log_index(log_index);
+    commit->set_term(term);
+    commit->set_digest(commit_digest(operation));
+
+    if (this->pending_commits.commits_size() >= AUDIT_BATCH_MAX_COMMITS)
+    {
+        this->send_commit_batch(true);
+    }
+}
+
+void
+raft::send_commit_batch(bool force)
+{
+    if (this->pending_commits.commits().empty())
+    {
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if (!force && now - this->last_commit_batch < AUDIT_BATCH_INTERVAL)
+    {
+        return;
+    }
+
+    this->last_commit_batch = now;
 
-    auto json_ptr = std::make_shared<bzn::message>();
-    (*json_ptr)["bzn-api"] = "audit";
-    (*json_ptr)["audit-data"] = boost::beast::detail::base64_encode(msg.SerializeAsString());
+    audit_message msg;
+    this->pending_commits.set_sender_uuid(this->uuid);
+    msg.mutable_commits()->Swap(&this->pending_commits);
 
+    auto encoded = make_audit_message(msg);
 
-    for (const auto& peer : this->peers) 
+    for (const auto& peer : this->peers)
     {
         auto ep = boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string(peer.host), peer.port};
-        this->node->send_message(ep, json_ptr);
+        this->node->send_on_channel(ep, encoded);
     }
 }
 
@@ -540,41 +617,40 @@ raft::request_append_entries()
 
         try
         {
-            bzn::message msg;
+            static const auto no_entries = std::make_shared<const std::string>("null");
+            static const auto suffix = std::make_shared<const std::string>("}}");
+
+            auto entries = no_entries;
             uint32_t prev_index{};
             uint32_t prev_term{};
             uint32_t entry_term{};
 
             if (this->peer_match_index[peer.uuid] == 0 && !this->log_entries.empty())
             {
-                msg = this->log_entries.front().msg;
-                entry_term = this->log_entries.front().term;
+                entries = this->append_payload(0);
+                entry_term = this->log_entries.term(0);
             }
-            else
+            else if (const auto i = this->log_entries.find(this->peer_match_index[peer.uuid]); i != bzn::log_arena::npos)
             {
-                for (const log_entry& entry : boost::adaptors::reverse(this->log_entries))
-                {
-                    if (entry.log_index == this->peer_match_index[peer.uuid])
-                    {
-                        prev_index = entry.log_index;
-                        prev_term  = entry.term;
+                prev_index = this->log_entries.log_index(i);
+                prev_term  = this->log_entries.term(i);
 
-                        if (entry.log_index < this->log_entries.size())
-                        {
-                            msg = this->log_entries[entry.log_index].msg;
-                            entry_term = this->log_entries[entry.log_index].term;
-                        }
-                        break;
-                    }
+                if (prev_index < this->log_entries.size())
+                {
+                    entries = this->append_payload(prev_index);
+                    entry_term = this->log_entries.term(prev_index);
                 }
             }
 
             // todo: use resolver on hostname...
             auto ep = boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string(peer.host), peer.port};
 
-            auto req = std::make_shared<bzn::message>(bzn::create_append_entries_request(this->uuid, this->current_term, this->commit_index, prev_index, prev_term, entry_term, msg));
+            // only the header is built per peer...
+            auto req = std::make_shared<bzn::encoded_message>(bzn::encoded_message{std::make_shared<const std::string>(
+                bzn::create_append_entries_request_header(this->uuid, this->current_term, this->commit_index, prev_index, prev_term, entry_term)),
+                entries, suffix});
 
-            LOG(debug) << "Sending request:\n" << req->toStyledString().substr(0, 60) << "...";
+            LOG(debug) << "Sending request:\n" << req->front()->substr(0, 60) << "...";
 
             this->node->send_message(ep, req);
         }
@@ -589,6 +665,28 @@ raft::request_append_entries()
 }
 
 
+std::shared_ptr<const std::string>
+raft::append_payload(size_t i)
+{
+    const auto key = std::make_pair(this->log_entries.log_index(i), this->log_entries.term(i));
+
+    if (auto it = this->append_payloads.find(key); it != this->append_payloads.end())
+    {
+        return it->second;
+    }
+
+    // peers close behind the leader ask for the same few entries...
+    if (this->append_payloads.size() >= APPEND_PAYLOAD_CACHE_ENTRIES)
+    {
+        this->append_payloads.erase(this->append_payloads.begin());
+    }
+
+    const auto encoded = this->log_entries.encoded(i);
+
+    return this->append_payloads[key] = std::make_shared<const std::string>(encoded.data(), encoded.size());
+}
+
+
 void
 raft::handle_request_append_entries_response(const bzn::message& msg, std::shared_ptr<bzn::session_base> /*session*/)
 {
@@ -606,7 +704,14 @@ raft::handle_request_append_entries_response(const bzn::message& msg, std::share
         return;
     }
 
-    this->peer_match_index[msg["data"]["from"].asString()] = msg["data"]["matchIndex"].asUInt();
+    const auto from = msg["data"]["from"].asString();
+
+    this->peer_match_index[from] = msg["data"]["matchIndex"].asUInt();
+
+    if (auto lag = this->peer_match_lag.find(from); lag != this->peer_match_lag.end())
+    {
+        lag->second->set(int64_t(this->last_log_index) - msg["data"]["matchIndex"].asUInt());
+    }
 
     if (!msg["data"]["success"].asBool())
     {
@@ -623,6 +728,11 @@ raft::handle_request_append_entries_response(const bzn::message& msg, std::share
     std::sort(match_indexes.begin(), match_indexes.end());
     size_t consensus_commit_index = match_indexes[uint32_t(std::ceil(match_indexes.size()/2.0))];
 
+    if (this->commit_index < consensus_commit_index)
+    {
+        get_metrics().commit_batch.record(consensus_commit_index - this->commit_index);
+    }
+
     while (this->commit_index < consensus_commit_index)
     {
         this->perform_commit(this->commit_index, this->log_entries[this->commit_index]);
@@ -631,7 +741,7 @@ raft::handle_request_append_entries_response(const bzn::message& msg, std::share
 
 
 bool
-raft::append_log(const bzn::message& msg)
+raft::append_log(const bzn::message& msg, uint32_t& log_index)
 {
     std::lock_guard<std::mutex> lock(this->raft_lock);
 
@@ -643,6 +753,10 @@ raft::append_log(const bzn::message& msg)
 
     this->log_entries.emplace_back(log_entry{bzn::log_entry_type::log_entry, ++this->last_log_index, this->current_term, msg});
 
+    log_index = this->last_log_index;
+
+    this->append_times[log_index] = std::chrono::steady_clock::now();
+
     return true;
 }
 
@@ -660,6 +774,12 @@ raft::update_raft_state(uint32_t term, bzn::raft_state state)
     this->current_state = state;
     this->current_term  = term;
 
+    // only the leader measures commit latency...
+    if (state != bzn::raft_state::leader)
+    {
+        this->append_times.clear();
+    }
+
     switch (this->current_state)
     {
         case bzn::raft_state::leader:
@@ -697,27 +817,65 @@ raft::get_leader()
 
 
 void
-raft::initialize_storage_from_log(std::shared_ptr<bzn::storage_base> storage)
+raft::initialize_storage_from_log(uint64_t after_index)
 {
+    const auto started = std::chrono::steady_clock::now();
+    auto reported = started;
 
-    for (const auto& log_entry : this->log_entries)
+    // position of the first entry whose log index is past the given one...
+    auto position_after = [this](uint64_t log_index)
     {
-        const auto command = log_entry.msg["cmd"].asString();
-        const auto db_uuid = log_entry.msg["db-uuid"].asString();
-        const auto key = log_entry.msg["data"]["key"].asString();
-        if (command == "create")
-        {
-            storage->create(db_uuid, key, log_entry.msg["data"]["value"].asString());
-        }
-        else if (command == "update")
+        size_t first = 0, count = this->log_entries.size();
+
+        while (count)
         {
-            storage->update(db_uuid, key, log_entry.msg["data"]["value"].asString());
+            const auto step = count / 2;
+
+            if (this->log_entries.log_index(first + step) <= log_index)
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+            {
+                count = step;
+            }
         }
-        else if (command == "delete")
+        return first;
+    };
+
+    // log indexes start at 1 and commit_index counts the entries committed, so it is also the log index of the
+    // last one. Entries after_index < log index <= commit_index are replayed, any later ones were never applied
+    // and the leader commits them again...
+    const auto first = position_after(after_index);
+    const auto last = std::max(first, position_after(this->commit_index));
+
+    const size_t total = last - first;
+    size_t replayed = 0;
+
+    LOG(info) << "replaying " << total << " log entries after index " << after_index;
+
+    for (auto i = first; i != last; ++i)
+    {
+        const auto entry = this->log_entries[i];
+        this->commit_handler(entry.msg, entry.log_index);
+
+        if (++replayed % REPLAY_PROGRESS_ENTRIES == 0 && std::chrono::steady_clock::now() - reported >= REPLAY_PROGRESS_INTERVAL)
         {
-            storage->remove(db_uuid, key);
+            reported = std::chrono::steady_clock::now();
+            const auto rate = replayed / std::chrono::duration<double>(reported - started).count();
+
+            LOG(info) << "replayed " << replayed << " of " << total << " log entries (" << size_t(rate) << " entries/s)";
+            get_metrics().replay_remaining.set(total - replayed);
         }
     }
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    get_metrics().replay_remaining.set(0);
+    get_metrics().replay_rate.set(int64_t((elapsed > 0) ? replayed / elapsed : 0));
+
+    LOG(info) << "replayed " << replayed << " log entries in " << elapsed << "s";
 }
 
 
@@ -791,13 +949,84 @@ void
 raft::load_log_entries()
 {
     std::ifstream is(this->entries_log_path(), std::ios::in | std::ios::binary);
-    bzn::log_entry log_entry;
-    while (is >> log_entry)
+
+    const auto started = std::chrono::steady_clock::now();
+    const size_t decoders = std::max(1u, std::thread::hardware_concurrency());
+
+    // entries are read a window of chunks at a time and each chunk is decoded on its own thread...
+    std::vector<std::vector<std::string>> chunks(decoders);
+    bool done = false;
+
+    while (!done)
     {
-        this->log_entries.emplace_back(log_entry);
+        for (auto& chunk : chunks)
+        {
+            chunk.clear();
+
+            std::string line;
+            while (chunk.size() < LOAD_CHUNK_ENTRIES && std::getline(is, line))
+            {
+                chunk.emplace_back(std::move(line));
+            }
+        }
+
+        done = chunks.back().size() < LOAD_CHUNK_ENTRIES;
+
+        struct decoded_entry
+        {
+            uint32_t log_index;
+            uint32_t term;
+            std::string msg;
+        };
+
+        std::vector<std::future<std::vector<decoded_entry>>> decoded;
+
+        for (const auto& chunk : chunks)
+        {
+            decoded.emplace_back(std::async(std::launch::async, [&chunk]()
+                {
+                    std::vector<decoded_entry> entries;
+                    entries.reserve(chunk.size());
+
+                    // the message is checked here but kept as text, the arena decodes it when read...
+                    bzn::log_entry log_entry;
+                    for (const auto& line : chunk)
+                    {
+                        std::istringstream in(line);
+                        if (!(in >> log_entry))
+                        {
+                            break;
+                        }
+                        entries.push_back(decoded_entry{log_entry.log_index, log_entry.term, log_entry.json_to_string(log_entry.msg)});
+                    }
+                    return entries;
+                }));
+        }
+
+        // a chunk that fails to decode throws here, as a bad entry always has...
+        for (size_t i = 0; i < decoded.size(); ++i)
+        {
+            auto entries = decoded[i].get();
+            const bool short_chunk = entries.size() < chunks[i].size();
+
+            for (const auto& entry : entries)
+            {
+                this->log_entries.emplace_back(bzn::log_entry_type::log_entry, entry.log_index, entry.term, entry.msg);
+            }
+
+            // the first entry that does not read ends the log...
+            if (short_chunk)
+            {
+                done = true;
+                break;
+            }
+        }
     }
     is.close();
 
+    LOG(info) << "loaded " << this->log_entries.size() << " log entries in "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() << "s";
+
     if (this->log_entries.empty())
     {
         throw std::runtime_error(MSG_ERROR_EMPTY_LOG_ENTRY_FILE);
@@ -808,8 +1037,15 @@ raft::load_log_entries()
 void
 raft::perform_commit(uint32_t& commit_index, const bzn::log_entry& log_entry)
 {
-    this->notify_commit(commit_index, log_entry.json_to_string(log_entry.msg));
-    this->commit_handler(log_entry.msg);
+    this->notify_commit(log_entry.log_index, log_entry.term, log_entry.json_to_string(log_entry.msg));
+
+    if (auto it = this->append_times.find(log_entry.log_index); it != this->append_times.end())
+    {
+        get_metrics().commit_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - it->second).count());
+        this->append_times.erase(it);
+    }
+
+    this->commit_handler(log_entry.msg, log_entry.log_index);
     this->append_entry_to_log(log_entry);
     commit_index++;
     this->save_state();
@@ -820,17 +1056,14 @@ bzn::log_entry
 raft::last_quorum()
 {
     // TODO: Speed this up by not doing a search, when a quorum entry is added, simply store the index. Perhaps only do the search if the index is wrong.
-    auto result = std::find_if(
-            this->log_entries.crbegin(),
-            this->log_entries.crend(),
-            [](const auto& entry)
-            {
-                return entry.entry_type != bzn::log_entry_type::log_entry;
-            });
-    if(result == this->log_entries.crend())
+    for (size_t i = this->log_entries.size(); i > 0; --i)
     {
-        throw std::runtime_error(MSG_NO_PEERS_IN_LOG);
+        if (this->log_entries.entry_type(i - 1) != bzn::log_entry_type::log_entry)
+        {
+            return this->log_entries[i - 1];
+        }
     }
-    return *result;
+
+    throw std::runtime_error(MSG_NO_PEERS_IN_LOG);
 }
 
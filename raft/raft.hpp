@@ -18,9 +18,14 @@
 #include <bootstrap/bootstrap_peers.hpp>
 #include <raft/raft_base.hpp>
 #include <raft/log_entry.hpp>
-#include <storage/storage.hpp>
+#include <raft/log_arena.hpp>
+#include <metrics/metrics.hpp>
+#include <node/node_base.hpp>
+#include <proto/bluzelle.pb.h>
 #include <gtest/gtest_prod.h>
 #include <fstream>
+#include <map>
+#include <unordered_map>
 
 #ifndef __APPLE__
 #include <optional>
@@ -40,7 +45,7 @@ namespace bzn
 
         bzn::raft_state get_state() override;
 
-        bool append_log(const bzn::message& msg) override;
+        bool append_log(const bzn::message& msg, uint32_t& log_index) override;
 
         void register_commit_handler(commit_handler handler) override;
 
@@ -48,7 +53,8 @@ namespace bzn
 
         void start() override;
 
-        void initialize_storage_from_log(std::shared_ptr<bzn::storage_base> storage);
+        // applies the committed entries after the last index a loaded checkpoint covers through the commit handler...
+        void initialize_storage_from_log(uint64_t after_index);
 
         bzn::uuid_t get_uuid() { return this->uuid; }
 
@@ -64,11 +70,15 @@ namespace bzn
         FRIEND_TEST(raft, test_that_raft_bails_on_bad_rehydrate);
         FRIEND_TEST(raft, test_raft_can_find_last_quorum_log_entry);
         FRIEND_TEST(raft, test_raft_throws_exception_when_no_quorum_can_be_found_in_log);
+        FRIEND_TEST(raft, test_that_commits_are_sent_to_peers_in_batches);
 
         void start_heartbeat_timer();
         void handle_heartbeat_timeout(const boost::system::error_code& ec);
 
         void request_append_entries();
+
+        // the serialized entry at position i, shared by every request that carries it...
+        std::shared_ptr<const std::string> append_payload(size_t i);
         void handle_request_append_entries_response(const bzn::message& msg, std::shared_ptr<bzn::session_base> session);
 
         void start_election_timer();
@@ -98,7 +108,10 @@ namespace bzn
         bzn::log_entry last_quorum();
 
         void notify_leader_status();
-        void notify_commit(size_t log_index, const std::string& operation);
+        void notify_commit(size_t log_index, uint32_t term, std::string_view operation);
+
+        // sends the commits made since the last batch once an interval has passed or force is set...
+        void send_commit_batch(bool force);
 
         // raft state...
         bzn::raft_state current_state = raft_state::follower;
@@ -118,11 +131,16 @@ namespace bzn
         uint32_t commit_index   = 0;
         uint32_t timeout_scale  = 1;
 
-        std::vector<log_entry> log_entries;
+        bzn::log_arena log_entries;
+        std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<const std::string>> append_payloads; // by log index and term
         bzn::raft_base::commit_handler commit_handler;
 
         // track peer's match index...
         std::map<bzn::uuid_t, uint32_t> peer_match_index;
+        std::unordered_map<bzn::uuid_t, bzn::metrics::gauge*> peer_match_lag;
+
+        // when our own entries were appended, for commit latency...
+        std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> append_times;
 
         // misc...
         const bzn::peers_list_t peers;
@@ -137,5 +155,9 @@ namespace bzn
         std::ofstream log_entry_out_stream;
 
         bool enable_audit = true;
+
+        // commit digests waiting for the next audit batch...
+        commit_batch pending_commits;
+        std::chrono::steady_clock::time_point last_commit_batch = std::chrono::steady_clock::now();
     };
 } // bzn
@@ -84,6 +84,21 @@ namespace bzn
     }
 
 
+    // the request up to its entries, which are followed by a closing "}}", so peers at the same index can share them...
+    inline std::string
+    create_append_entries_request_header(const bzn::uuid_t& uuid, uint32_t current_term, uint32_t commit_index, uint32_t prev_index,
+        uint32_t prev_term, uint32_t entry_term)
+    {
+        return R"({"bzn-api":"raft","cmd":"AppendEntries","data":{"from":)" + Json::valueToQuotedString(uuid.c_str())
+            + R"(,"term":)" + std::to_string(current_term)
+            + R"(,"prevIndex":)" + std::to_string(prev_index)
+            + R"(,"prevTerm":)" + std::to_string(prev_term)
+            + R"(,"entryTerm":)" + std::to_string(entry_term)
+            + R"(,"commitIndex":)" + std::to_string(commit_index)
+            + R"(,"entries":)";
+    }
+
+
     inline bzn::message
     create_append_entries_response(const bzn::uuid_t& uuid, uint32_t current_term, bool success, uint32_t match_index)
     {
@@ -105,7 +120,7 @@ namespace bzn
     class raft_base
     {
     public:
-        using commit_handler = std::function<bool(const bzn::message& msg)>;
+        using commit_handler = std::function<bool(const bzn::message& msg, uint32_t log_index)>;
 
         virtual ~raft_base() = default;
 
@@ -129,12 +144,13 @@ namespace bzn
         /**
          * Appends entry to leader's log via CRUD
          * @param msg message received
+         * @param log_index set to the entry's index on success
          */
-        virtual bool append_log(const bzn::message& msg) = 0;
+        virtual bool append_log(const bzn::message& msg, uint32_t& log_index) = 0;
 
         /**
          * Storage commit handler called once concensus has been achieved
-         * @param handler callback
+         * @param handler callback with the entry and its log index
          */
         virtual void register_commit_handler(bzn::raft_base::commit_handler handler) = 0;
 
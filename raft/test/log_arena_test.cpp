@@ -0,0 +1,188 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <raft/log_arena.hpp>
+#include <gtest/gtest.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <malloc.h>
+
+
+namespace
+{
+    bzn::log_entry make_entry(uint32_t log_index, uint32_t term, const std::string& value)
+    {
+        bzn::message msg;
+        msg["bzn-api"] = "database";
+        msg["msg"] = value;
+
+        return bzn::log_entry{bzn::log_entry_type::log_entry, log_index, term, msg};
+    }
+}
+
+
+TEST(log_arena, test_that_entries_are_decoded_as_they_were_appended)
+{
+    bzn::log_arena log;
+
+    EXPECT_TRUE(log.empty());
+    EXPECT_EQ(bzn::log_arena::npos, log.find(1));
+
+    log.emplace_back(make_entry(1, 1, "a"));
+    log.emplace_back(bzn::log_entry{bzn::log_entry_type::single_quorum, 2, 1, bzn::message("peers")});
+    log.emplace_back(make_entry(3, 2, "c"));
+
+    EXPECT_EQ(size_t(3), log.size());
+    EXPECT_EQ("a", log.front().msg["msg"].asString());
+    EXPECT_EQ("c", log.back().msg["msg"].asString());
+    EXPECT_EQ(uint32_t(3), log.back().log_index);
+    EXPECT_EQ(uint32_t(2), log.term(2));
+    EXPECT_EQ(bzn::log_entry_type::single_quorum, log.entry_type(1));
+    EXPECT_EQ("peers", log[1].msg.asString());
+
+    // the stored bytes are the message as the log file holds it...
+    EXPECT_EQ(make_entry(1, 1, "a").json_to_string(make_entry(1, 1, "a").msg), std::string(log.encoded(0)));
+
+    EXPECT_EQ(size_t(1), log.find(2));
+    EXPECT_EQ(bzn::log_arena::npos, log.find(4));
+
+    log.pop_back();
+    log.emplace_back(make_entry(3, 3, "d"));
+
+    EXPECT_EQ("d", log.back().msg["msg"].asString());
+    EXPECT_EQ(uint32_t(3), log.back().term);
+
+    log.clear();
+    EXPECT_TRUE(log.empty());
+}
+
+
+TEST(log_arena, test_that_entries_span_segments_and_large_entries_get_their_own)
+{
+    bzn::log_arena log;
+
+    const std::string value(100 * 1024, 'x');
+    const std::string large(3 * 1024 * 1024, 'y');
+
+    for (uint32_t i = 1; i <= 30; ++i)
+    {
+        log.emplace_back(make_entry(i, 1, (i == 15) ? large : value));
+    }
+
+    EXPECT_EQ(size_t(30), log.size());
+
+    for (uint32_t i = 1; i <= 30; ++i)
+    {
+        EXPECT_EQ((i == 15) ? large : value, log[i - 1].msg["msg"].asString());
+        EXPECT_EQ(size_t(i - 1), log.find(i));
+    }
+
+    // popping back past the large entry releases its segment...
+    while (log.size() > 14)
+    {
+        log.pop_back();
+    }
+
+    EXPECT_LT(log.capacity(), large.size());
+    EXPECT_EQ(value, log.back().msg["msg"].asString());
+}
+
+
+namespace
+{
+    // heap bytes in use, from the allocator itself so freed memory that is kept around is not counted...
+    size_t heap_in_use()
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        const auto info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+    }
+}
+
+
+// ./raft_tests --gtest_also_run_disabled_tests --gtest_filter=log_arena.DISABLED_benchmark_bytes_per_entry_and_send_lookup
+TEST(log_arena, DISABLED_benchmark_bytes_per_entry_and_send_lookup)
+{
+    const size_t ENTRIES = 1000000;
+    const size_t SENDS = 1000000;
+
+    // a database request is about this long once base64 encoded...
+    const std::string value(160, 'v');
+
+    std::mt19937 gen(std::random_device{}());
+    // peers lag the leader by up to a few thousand entries...
+    std::uniform_int_distribution<uint32_t> dist(ENTRIES - 5000, ENTRIES);
+
+    std::vector<uint32_t> sends(SENDS);
+    for (auto& index : sends)
+    {
+        index = dist(gen);
+    }
+
+    auto report = [&](const std::string& layout, size_t bytes, auto&& send)
+    {
+        size_t total = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto index : sends)
+        {
+            total += send(index);
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << layout << ": " << double(bytes) / ENTRIES << " bytes per entry, " << elapsed / double(SENDS) << "ns per send lookup (" << total << ")\n";
+    };
+
+    {
+        const auto start = heap_in_use();
+
+        std::vector<bzn::log_entry> log;
+        for (uint32_t i = 1; i <= ENTRIES; ++i)
+        {
+            log.emplace_back(make_entry(i, 1, value));
+        }
+
+        // what request_append_entries did: walk back to the peer's match index and copy the message out...
+        report("json entries", heap_in_use() - start, [&](uint32_t match_index)
+            {
+                for (auto it = log.rbegin(); it != log.rend(); ++it)
+                {
+                    if (it->log_index == match_index)
+                    {
+                        bzn::message msg = it->msg;
+                        return msg.size();
+                    }
+                }
+                return Json::ArrayIndex(0);
+            });
+    }
+
+    {
+        const auto start = heap_in_use();
+
+        bzn::log_arena log;
+        for (uint32_t i = 1; i <= ENTRIES; ++i)
+        {
+            log.emplace_back(make_entry(i, 1, value));
+        }
+
+        report("log arena", heap_in_use() - start, [&](uint32_t match_index)
+            {
+                return log[log.find(match_index)].msg.size();
+            });
+    }
+}
@@ -19,6 +19,8 @@
 #include <raft/log_entry.hpp>
 #include <storage/storage.hpp>
 #include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
 #include <vector>
 #include <random>
 #include <stdlib.h>
@@ -57,6 +59,22 @@ namespace
     }
 
 
+    // joins the pieces of a message the way they go out on the wire...
+    bzn::message
+    decode(const bzn::encoded_message& msg)
+    {
+        std::string text;
+        for (const auto& piece : msg)
+        {
+            text += *piece;
+        }
+
+        bzn::message json;
+        EXPECT_TRUE(Json::Reader().parse(text, json));
+        return json;
+    }
+
+
     void
     save_entries_to_path(const std::string& path, const std::vector<bzn::log_entry>& entries)
     {
@@ -128,7 +146,8 @@ namespace bzn
         raft->start();
 
         // we should see requests for votes... and then the Append Requests
-        EXPECT_CALL(*mock_node, send_message(_, _)).Times((TEST_PEER_LIST.size() - 1) * 2);
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::message>>())).Times(TEST_PEER_LIST.size() - 1);
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::encoded_message>>())).Times(TEST_PEER_LIST.size() - 1);
 
         // expire timer...
         wh(boost::system::error_code());
@@ -178,7 +197,7 @@ namespace bzn
         raft->start();
 
         // don't care about the handler...
-        EXPECT_CALL(*mock_node, send_message(_, _)).Times(TEST_PEER_LIST.size() - 1);
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::message>>())).Times(TEST_PEER_LIST.size() - 1);
 
         // expire timer...
         wh(boost::system::error_code());
@@ -231,8 +250,8 @@ namespace bzn
 
         // we should see requests for votes...
         std::vector<bzn::message_handler> mh_req;
-        EXPECT_CALL(*mock_node, send_message(_, _)).Times(TEST_PEER_LIST.size() - 1).WillRepeatedly(Invoke(
-            [&](const auto&, const auto& msg)
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::message>>())).Times(TEST_PEER_LIST.size() - 1).WillRepeatedly(Invoke(
+            [&](const auto&, const std::shared_ptr<bzn::message>& msg)
             {
                 EXPECT_EQ((*msg)["cmd"].asString(), "RequestVote");
             }));
@@ -242,10 +261,10 @@ namespace bzn
 
         // heartbeat timer expired and we should be sending requests...
         std::vector<bzn::message_handler> mh_resp;
-        EXPECT_CALL(*mock_node, send_message(_, _)).Times((TEST_PEER_LIST.size() - 1) * 2).WillRepeatedly(Invoke(
-            [&](const auto&, const auto& msg)
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::encoded_message>>())).Times((TEST_PEER_LIST.size() - 1) * 2).WillRepeatedly(Invoke(
+            [&](const auto&, const std::shared_ptr<bzn::encoded_message>& msg)
             {
-                EXPECT_EQ((*msg)["cmd"].asString(), "AppendEntries");
+                EXPECT_EQ(decode(*msg)["cmd"].asString(), "AppendEntries");
             }));
 
         // now send in each vote...
@@ -338,12 +357,20 @@ namespace bzn
         EXPECT_EQ(raft->get_leader().uuid, "");
 
         // try to append a log. It will fail since we are not the leader...
-        ASSERT_FALSE(raft->append_log(bzn::message()));
+        uint32_t log_index = 0;
+        ASSERT_FALSE(raft->append_log(bzn::message(), log_index));
 
         EXPECT_EQ(raft->get_state(), bzn::raft_state::follower);
 
         // we should see requests...
-        EXPECT_CALL(*mock_node, send_message(_, _)).Times(10);
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::message>>())).Times(2);
+
+        std::vector<bzn::message> append_requests;
+        EXPECT_CALL(*mock_node, send_message(_, An<std::shared_ptr<bzn::encoded_message>>())).Times(8).WillRepeatedly(Invoke(
+            [&](const auto&, const std::shared_ptr<bzn::encoded_message>& msg)
+            {
+                append_requests.push_back(decode(*msg));
+            }));
 
         // expire election timer...
         wh(boost::system::error_code());
@@ -363,7 +390,7 @@ namespace bzn
         bool commit_handler_called = false;
         int commit_handler_times_called = 0;
         raft->register_commit_handler(
-            [&](const bzn::message& msg)
+            [&](const bzn::message& msg, uint32_t /*log_index*/)
             {
                 LOG(info) << "commit:\n" << msg.toStyledString().substr(0, 60) << "...";
 
@@ -376,9 +403,11 @@ namespace bzn
         bzn::message msg;
         msg["bzn-api"] = "crud";
         msg["data"] = "utests_1";
-        ASSERT_TRUE(raft->append_log(msg));
+        ASSERT_TRUE(raft->append_log(msg, log_index));
+        const uint32_t first_log_index = log_index;
         msg["data"] = "utests_2";
-        ASSERT_TRUE(raft->append_log(msg));
+        ASSERT_TRUE(raft->append_log(msg, log_index));
+        EXPECT_EQ(log_index, first_log_index + 1);
 
         // next heartbeat...
         wh(boost::system::error_code());
@@ -405,10 +434,19 @@ namespace bzn
         EXPECT_EQ(commit_handler_times_called, 1);
         ASSERT_TRUE(commit_handler_called);
 
+        // each peer's lag is reported on the gauge resolved for it...
+        EXPECT_EQ(raft->peer_match_lag.at("uuid2"), &bzn::metrics::registry::global().get_gauge("raft_peer_match_lag", "", {{"peer", "uuid2"}}));
+        EXPECT_EQ(raft->peer_match_lag.at("uuid2")->value(), int64_t(raft->last_log_index) - 2);
+
         // expire heart beat
         wh(boost::system::error_code());
 
-        // todo: verify append entry contents
+        // the first heartbeat after the appends carried the first entry to both peers...
+        ASSERT_EQ(size_t(8), append_requests.size());
+        EXPECT_EQ("utests_1", append_requests[2]["data"]["entries"]["data"].asString());
+        EXPECT_EQ("utests_1", append_requests[3]["data"]["entries"]["data"].asString());
+        EXPECT_EQ(TEST_NODE_UUID, append_requests[3]["data"]["from"].asString());
+        EXPECT_TRUE(append_requests[0]["data"]["entries"].isNull());
 
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".dat");
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".state");
@@ -451,7 +489,8 @@ namespace bzn
         EXPECT_EQ(raft->get_leader().uuid, "");
 
         // try to append a log. It will fail since we are not the leader...
-        ASSERT_FALSE(raft->append_log(bzn::message()));
+        uint32_t log_index = 0;
+        ASSERT_FALSE(raft->append_log(bzn::message(), log_index));
 
         EXPECT_EQ(raft->get_state(), bzn::raft_state::follower);
 
@@ -466,7 +505,7 @@ namespace bzn
 
         int commit_handler_times_called = 0;
         raft->register_commit_handler(
-            [&](const bzn::message& msg)
+            [&](const bzn::message& msg, uint32_t /*log_index*/)
             {
                 LOG(info) << "commit:\n" << msg.toStyledString().substr(0, 60) << "...";
                 ++commit_handler_times_called;
@@ -512,6 +551,54 @@ namespace bzn
     }
 
 
+    TEST(raft, test_that_commits_are_sent_to_peers_in_batches)
+    {
+        auto mock_io_context = std::make_shared<NiceMock<bzn::asio::Mockio_context_base>>();
+        auto mock_node = std::make_shared<bzn::Mocknode_base>();
+
+        auto raft = std::make_shared<bzn::raft>(mock_io_context, mock_node, TEST_PEER_LIST, TEST_NODE_UUID);
+
+        raft->notify_commit(1, 1, "a");
+        raft->notify_commit(2, 1, "b");
+        raft->notify_commit(3, 2, "a");
+
+        // nothing goes out before the interval has passed...
+        EXPECT_CALL(*mock_node, send_on_channel(_, _)).Times(0);
+        raft->send_commit_batch(false);
+        Mock::VerifyAndClearExpectations(mock_node.get());
+
+        std::vector<std::shared_ptr<bzn::encoded_message>> sent;
+        EXPECT_CALL(*mock_node, send_on_channel(_, _)).Times(TEST_PEER_LIST.size()).WillRepeatedly(Invoke(
+            [&](const auto&, auto msg)
+            {
+                sent.push_back(msg);
+            }));
+
+        raft->send_commit_batch(true);
+
+        // every peer is sent the same batch...
+        ASSERT_EQ(TEST_PEER_LIST.size(), sent.size());
+        EXPECT_EQ(sent[0], sent[1]);
+
+        audit_message msg;
+        ASSERT_TRUE(msg.ParseFromString(boost::beast::detail::base64_decode(decode(*sent[0])["audit-data"].asString())));
+        ASSERT_TRUE(msg.has_commits());
+        EXPECT_EQ(TEST_NODE_UUID, msg.commits().sender_uuid());
+        ASSERT_EQ(3, msg.commits().commits_size());
+        EXPECT_EQ(3u, msg.commits().commits(2).log_index());
+        EXPECT_EQ(2u, msg.commits().commits(2).term());
+
+        // the digest depends on the entry alone...
+        EXPECT_EQ(msg.commits().commits(0).digest(), msg.commits().commits(2).digest());
+        EXPECT_NE(msg.commits().commits(0).digest(), msg.commits().commits(1).digest());
+
+        // and the batch starts over...
+        Mock::VerifyAndClearExpectations(mock_node.get());
+        EXPECT_CALL(*mock_node, send_on_channel(_, _)).Times(0);
+        raft->send_commit_batch(true);
+    }
+
+
     TEST(raft, test_raft_timeout_scale_can_get_set)
     {
         // none set
@@ -576,20 +663,23 @@ namespace bzn
         auto mock_session = std::make_shared<bzn::Mocksession_base>();
         auto raft_source = std::make_shared<bzn::raft>(std::make_shared<NiceMock<bzn::asio::Mockio_context_base>>(), nullptr, TEST_PEER_LIST, TEST_NODE_UUID);
 
-        size_t number_of_entries = 300;
+        // enough entries to load in more than one window of chunks...
+        size_t number_of_entries = 10000;
 
-        fill_entries_with_test_data(number_of_entries, raft_source->log_entries);
+        std::vector<bzn::log_entry> entries;
+        fill_entries_with_test_data(number_of_entries, entries);
 
         // TODO: this should be done via RAFT, not by cheating. That is, I'd like to simulate the append entry process to ensure that append_entry_to_log gets called
-        for(const auto& log_entry : raft_source->log_entries)
+        for(const auto& log_entry : entries)
         {
+            raft_source->log_entries.emplace_back(log_entry);
             raft_source->append_entry_to_log(log_entry);
         }
 
         raft_source->last_log_index = number_of_entries;
-        raft_source->last_log_term = 60;
+        raft_source->last_log_term = number_of_entries / 5;
         raft_source->commit_index = number_of_entries - 22;
-        raft_source->current_term = 60;
+        raft_source->current_term = number_of_entries / 5;
 
         // TODO: This should be done via RAFT, not by cheating.
         raft_source->save_state();
@@ -604,23 +694,17 @@ namespace bzn
         EXPECT_EQ(raft_target->current_term, raft_source->current_term);
 
 
-        auto source_entries = raft_source->log_entries;
-        auto target_entries = raft_target->log_entries;
+        const auto& target_entries = raft_target->log_entries;
 
         EXPECT_TRUE(target_entries.size()>0);
-        EXPECT_EQ(target_entries.size(),source_entries.size());
+        EXPECT_EQ(target_entries.size(),entries.size());
 
-        EXPECT_TRUE(std::equal(
-                std::begin(target_entries), std::end(target_entries),
-                std::begin(source_entries),
-                [](const bzn::log_entry &rhs, const bzn::log_entry &lhs) -> bool
-                {
-                    return (rhs.log_index == lhs.log_index
-                            && rhs.term == lhs.term
-                            && rhs.msg.toStyledString() == lhs.msg.toStyledString()
-                    );
-                }
-        ));
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            EXPECT_EQ(entries[i].log_index, target_entries.log_index(i));
+            EXPECT_EQ(entries[i].term, target_entries.term(i));
+            EXPECT_EQ(entries[i].msg.toStyledString(), target_entries[i].msg.toStyledString());
+        }
 
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".dat");
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".state");
@@ -650,6 +734,8 @@ namespace bzn
 
         raft_source->current_state = bzn::raft_state::leader;
 
+        uint32_t log_index = 0;
+
         while (storage_source->get_keys(TEST_NODE_UUID).size() < number_of_entries)
         {
             uint8_t command = dis(gen);
@@ -668,7 +754,7 @@ namespace bzn
                            + R"(","request-id":"0"}")";
 
                 reader.parse(crud_msg, message);
-                raft_source->append_log(message);
+                raft_source->append_log(message, log_index);
                 storage_source->create(TEST_NODE_UUID, key, value);
             }
             else if (command < 5)
@@ -690,7 +776,7 @@ namespace bzn
                                + R"(","request-id":"0"}")";
 
                     reader.parse(crud_msg, message);
-                    raft_source->append_log(message);
+                    raft_source->append_log(message, log_index);
                     storage_source->update(TEST_NODE_UUID, key, value);
                 }
             }
@@ -710,7 +796,7 @@ namespace bzn
                                + R"(","request-id":"0"}")";
 
                     reader.parse(crud_msg, message);
-                    raft_source->append_log(message);
+                    raft_source->append_log(message, log_index);
                     storage_source->remove(TEST_NODE_UUID, key);
                 }
             }
@@ -721,7 +807,30 @@ namespace bzn
 
         auto storage_target = std::make_shared<bzn::storage>();
 
-        raft_source->initialize_storage_from_log(storage_target);
+        // replay applies the entries through the commit handler...
+        raft_source->commit_index = log_index;
+        raft_source->register_commit_handler(
+            [&](const bzn::message& msg, uint32_t /*log_index*/)
+            {
+                const auto command = msg["cmd"].asString();
+                const auto key = msg["data"]["key"].asString();
+
+                if (command == "create")
+                {
+                    storage_target->create(TEST_NODE_UUID, key, msg["data"]["value"].asString());
+                }
+                else if (command == "update")
+                {
+                    storage_target->update(TEST_NODE_UUID, key, msg["data"]["value"].asString());
+                }
+                else if (command == "delete")
+                {
+                    storage_target->remove(TEST_NODE_UUID, key);
+                }
+                return true;
+            });
+
+        raft_source->initialize_storage_from_log(0);
 
         EXPECT_TRUE(storage_target->get_keys(TEST_NODE_UUID).size() > 0);
         EXPECT_EQ(storage_source->get_keys(TEST_NODE_UUID).size(), storage_target->get_keys(TEST_NODE_UUID).size());
@@ -733,11 +842,78 @@ namespace bzn
             EXPECT_EQ(rec_1->value, rec_2->value);
         }
 
+        // only committed entries after a checkpoint's index are replayed...
+        std::vector<uint32_t> replayed;
+        raft_source->register_commit_handler(
+            [&](const bzn::message& /*msg*/, uint32_t log_index)
+            {
+                replayed.push_back(log_index);
+                return true;
+            });
+
+        raft_source->commit_index = log_index - 1;
+        raft_source->initialize_storage_from_log(log_index - 3);
+
+        EXPECT_EQ(std::vector<uint32_t>({log_index - 2, log_index - 1}), replayed);
+
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".dat");
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".state");
     }
 
 
+    TEST(raft, test_that_a_persisted_uncommitted_tail_is_not_replayed)
+    {
+        boost::filesystem::path log_path{"./.state/" + TEST_NODE_UUID + ".dat"};
+        boost::filesystem::path state_path{"./.state/" + TEST_NODE_UUID + ".state"};
+
+        boost::filesystem::create_directory(log_path.parent_path());
+
+        // five entries on disk, the first three committed...
+        {
+            std::ofstream out(log_path.string(), std::ios::out | std::ios::binary);
+
+            for (uint32_t log_index = 1; log_index <= 5; ++log_index)
+            {
+                bzn::message msg;
+                msg["data"]["key"] = "key" + std::to_string(log_index);
+
+                out << log_entry{bzn::log_entry_type::log_entry, log_index, 1, msg};
+            }
+        }
+
+        {
+            std::ofstream out(state_path.string(), std::ios::out | std::ios::binary);
+            out << "5 1 3 1";
+        }
+
+        auto raft = std::make_shared<bzn::raft>(std::make_shared<NiceMock<bzn::asio::Mockio_context_base>>(), nullptr, TEST_PEER_LIST, TEST_NODE_UUID);
+
+        std::vector<uint32_t> replayed;
+        raft->register_commit_handler(
+            [&](const bzn::message& /*msg*/, uint32_t log_index)
+            {
+                replayed.push_back(log_index);
+                return true;
+            });
+
+        raft->initialize_storage_from_log(0);
+        EXPECT_EQ(std::vector<uint32_t>({1, 2, 3}), replayed);
+
+        // after a checkpoint only the committed entries past it...
+        replayed.clear();
+        raft->initialize_storage_from_log(2);
+        EXPECT_EQ(std::vector<uint32_t>({3}), replayed);
+
+        // nothing past a checkpoint at the commit index...
+        replayed.clear();
+        raft->initialize_storage_from_log(3);
+        EXPECT_TRUE(replayed.empty());
+
+        boost::filesystem::remove(log_path);
+        boost::filesystem::remove(state_path);
+    }
+
+
     TEST(raft, test_that_raft_bails_on_bad_rehydrate)
     {
         std::string good_state{"1 0 1 4"};
@@ -855,4 +1031,73 @@ namespace bzn
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".dat");
         boost::filesystem::remove("./.state/" + TEST_NODE_UUID + ".state");
     }
+
+
+    TEST(raft, test_that_an_append_entries_header_and_payload_decode_as_the_request)
+    {
+        bzn::message entry;
+        entry["bzn-api"] = "crud";
+        entry["msg"] = "c29tZSBcImRhdGFcIg==";
+
+        bzn::message expected = bzn::create_append_entries_request("uuid\"1", 3, 10, 11, 2, 3, entry);
+
+        bzn::encoded_message msg{std::make_shared<const std::string>(bzn::create_append_entries_request_header("uuid\"1", 3, 10, 11, 2, 3)),
+            std::make_shared<const std::string>(bzn::log_entry{}.json_to_string(entry)), std::make_shared<const std::string>("}}")};
+
+        EXPECT_EQ(expected.toStyledString(), decode(msg).toStyledString());
+    }
+
+
+    // ./raft_tests --gtest_also_run_disabled_tests --gtest_filter=raft.DISABLED_benchmark_heartbeat_cost_by_peer_count
+    TEST(raft, DISABLED_benchmark_heartbeat_cost_by_peer_count)
+    {
+        const size_t HEARTBEATS = 2000;
+
+        bzn::log_arena log;
+        for (uint32_t i = 1; i <= 100; ++i)
+        {
+            bzn::message msg;
+            msg["bzn-api"] = "crud";
+            msg["msg"] = std::string(1024, 'v');
+            log.emplace_back(bzn::log_entry{bzn::log_entry_type::log_entry, i, 1, msg});
+        }
+
+        for (const size_t peers : {2, 4, 8, 16, 32})
+        {
+            size_t bytes = 0;
+
+            // what request_append_entries did: decode the entry and serialize a request for every peer...
+            auto start = std::chrono::steady_clock::now();
+            for (size_t h = 0; h < HEARTBEATS; ++h)
+            {
+                for (size_t p = 0; p < peers; ++p)
+                {
+                    const auto entry = log[99];
+                    bytes += bzn::create_append_entries_request("uuid", 1, 99, 99, 1, 1, entry.msg).toStyledString().size();
+                }
+            }
+            const auto per_peer = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            // the entry is copied out once per heartbeat and only a header is built per peer...
+            start = std::chrono::steady_clock::now();
+            for (size_t h = 0; h < HEARTBEATS; ++h)
+            {
+                const auto encoded = log.encoded(99);
+                const auto payload = std::make_shared<const std::string>(encoded.data(), encoded.size());
+                const auto suffix = std::make_shared<const std::string>("}}");
+
+                for (size_t p = 0; p < peers; ++p)
+                {
+                    bzn::encoded_message msg{std::make_shared<const std::string>(bzn::create_append_entries_request_header("uuid", 1, 99, 99, 1, 1)),
+                        payload, suffix};
+                    bytes += msg.size();
+                }
+            }
+            const auto shared = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << peers << " peers: " << per_peer / 1000.0 / HEARTBEATS << "us per heartbeat serialized per peer, "
+                << shared / 1000.0 / HEARTBEATS << "us shared (" << bytes << ")\n";
+        }
+    }
+
 } // bzn
@@ -0,0 +1,510 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <repair/repair.hpp>
+#include <boost/beast/core/detail/base64.hpp>
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace bzn;
+
+namespace
+{
+    // a database is compared this many levels of its hash tree at a time...
+    const uint8_t DESCENT_LEVELS = 4;
+
+    const std::chrono::seconds IMAGE_TIMEOUT{60};
+    const size_t MAX_IMAGES = 4;
+
+    // a repair that has heard nothing from its source for this long is given up on...
+    const std::chrono::seconds REPAIR_TIMEOUT{60};
+
+    const size_t RECORDS_CHUNK_BYTES = 1024 * 1024;
+}
+
+
+repair::repair(std::shared_ptr<bzn::node_base> node, std::shared_ptr<bzn::storage> storage)
+    : node(std::move(node))
+    , storage(std::move(storage))
+{
+}
+
+
+void
+repair::start()
+{
+    std::call_once(this->start_once, [this]()
+    {
+        this->node->register_for_message("repair", std::bind(&repair::handle, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    });
+}
+
+
+void
+repair::repair_from(const boost::asio::ip::tcp::endpoint& ep)
+{
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    if (this->current && std::chrono::steady_clock::now() - this->current->last_progress < REPAIR_TIMEOUT)
+    {
+        LOG(debug) << "repair already under way";
+        return;
+    }
+
+    std::random_device rd;
+    this->current.emplace();
+    this->current->repair_id = (uint64_t(rd()) << 32) | rd();
+    this->current->last_progress = std::chrono::steady_clock::now();
+
+    repair_message msg;
+    msg.mutable_summary_request()->set_repair_id(this->current->repair_id);
+
+    LOG(info) << "repairing storage from " << ep.address().to_string() << ":" << ep.port();
+
+    // the rest of the repair follows the replies back over the same connection...
+    this->node->send_message(ep, repair::encode(msg));
+}
+
+
+void
+repair::handle(const bzn::message& json, std::shared_ptr<bzn::session_base> session)
+{
+    repair_message message;
+
+    if (!message.ParseFromString(boost::beast::detail::base64_decode(json["repair-data"].asString())))
+    {
+        LOG(error) << "Got an invalid repair message";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    switch (message.msg_case())
+    {
+        case repair_message::kSummaryRequest:
+            this->handle_summary_request(message.summary_request(), std::move(session));
+            break;
+
+        case repair_message::kNodesRequest:
+            this->handle_nodes_request(message.nodes_request(), std::move(session));
+            break;
+
+        case repair_message::kRecordsRequest:
+            this->handle_records_request(message.records_request(), std::move(session));
+            break;
+
+        case repair_message::kSummary:
+            this->handle_summary(message.summary(), std::move(session));
+            break;
+
+        case repair_message::kNodes:
+            this->handle_nodes(message.nodes(), std::move(session));
+            break;
+
+        case repair_message::kRecords:
+            this->handle_records(message.records(), std::move(session));
+            break;
+
+        default:
+            LOG(error) << "Got an empty repair message?";
+    }
+}
+
+
+void
+repair::handle_summary_request(const summary_request& request, std::shared_ptr<bzn::session_base> session)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    for (auto it = this->images.begin(); it != this->images.end();)
+    {
+        it = (now - it->second.last_used > IMAGE_TIMEOUT) ? this->images.erase(it) : std::next(it);
+    }
+
+    // an image keeps writers copying the databases, so only a few are held...
+    if (this->images.size() >= MAX_IMAGES)
+    {
+        this->images.erase(std::min_element(this->images.begin(), this->images.end(),
+            [](const auto& a, const auto& b){ return a.second.last_used < b.second.last_used; }));
+    }
+
+    const auto image = this->storage->capture_state();
+    this->images[request.repair_id()] = {image, now};
+
+    repair_message msg;
+    auto summary = msg.mutable_summary();
+    summary->set_repair_id(request.repair_id());
+    summary->set_log_index(image->commit_index());
+
+    for (const auto& uuid : image->databases())
+    {
+        const auto nodes = image->digest(uuid, bzn::merkle_tree::MIN_DEPTH);
+
+        auto db = summary->add_databases();
+        db->set_uuid(uuid);
+        db->set_tree_depth(image->depth(uuid));
+        db->set_depth(bzn::merkle_tree::MIN_DEPTH);
+        *db->mutable_nodes() = {nodes.begin(), nodes.end()};
+    }
+
+    LOG(info) << "sending the state of " << summary->databases_size() << " databases as of commit index " << image->commit_index() << " for repair";
+
+    session->send_message(repair::encode(msg), false);
+}
+
+
+void
+repair::handle_nodes_request(const nodes_request& request, std::shared_ptr<bzn::session_base> session)
+{
+    const auto image = this->find_image(request.repair_id());
+
+    if (!image)
+    {
+        return;
+    }
+
+    const auto tree_depth = image->depth(request.uuid());
+    const uint8_t depth = uint8_t(std::min<uint32_t>(request.depth(), tree_depth));
+    const uint8_t child_depth = uint8_t(std::clamp<uint32_t>(request.child_depth(), depth, tree_depth));
+    const auto level = image->digest(request.uuid(), child_depth);
+
+    repair_message msg;
+    msg.mutable_nodes()->set_repair_id(request.repair_id());
+
+    auto db = msg.mutable_nodes()->mutable_database();
+    db->set_uuid(request.uuid());
+    db->set_tree_depth(tree_depth);
+    db->set_depth(child_depth);
+
+    for (const auto bucket : request.buckets())
+    {
+        // the children of a bucket are the buckets that begin with its bits...
+        for (size_t child = bucket << (child_depth - depth); child < (bucket + 1) << (child_depth - depth) && child < level.size(); ++child)
+        {
+            db->add_buckets(child);
+            db->add_nodes(level[child]);
+        }
+    }
+
+    session->send_message(repair::encode(msg), false);
+}
+
+
+void
+repair::handle_records_request(const records_request& request, std::shared_ptr<bzn::session_base> session)
+{
+    const auto image = this->find_image(request.repair_id());
+
+    if (!image)
+    {
+        return;
+    }
+
+    const auto records = this->storage->image_records(*image, request.uuid(), uint8_t(request.depth()),
+        std::set<size_t>(request.buckets().begin(), request.buckets().end()));
+
+    repair_message msg;
+    size_t bytes = 0;
+    uint64_t sequence = 0;
+
+    auto next_chunk = [&]()
+    {
+        msg.mutable_records()->Clear();
+        msg.mutable_records()->set_repair_id(request.repair_id());
+        msg.mutable_records()->set_uuid(request.uuid());
+        msg.mutable_records()->set_sequence(sequence++);
+        bytes = 0;
+    };
+
+    next_chunk();
+
+    for (const auto& record : records)
+    {
+        // only the last chunk answers the request, the others are pushed ahead of it...
+        if (bytes >= RECORDS_CHUNK_BYTES)
+        {
+            session->send_notification("repair/" + std::to_string(request.repair_id()) + "/" + std::to_string(msg.records().sequence()),
+                std::make_shared<std::string>(repair::encode_text(msg)));
+            next_chunk();
+        }
+
+        auto out = msg.mutable_records()->add_records();
+        out->set_key(record.first);
+        out->set_value(record.second->value);
+        out->set_transaction_id(std::string(record.second->transaction_id.begin(), record.second->transaction_id.end()));
+        out->set_expires(record.second->expires.count());
+        out->set_timestamp(record.second->timestamp.count());
+
+        bytes += record.first.size() + record.second->value.size();
+    }
+
+    msg.mutable_records()->set_last(true);
+
+    session->send_message(repair::encode(msg), false);
+}
+
+
+std::shared_ptr<const bzn::storage::state_image>
+repair::find_image(uint64_t repair_id)
+{
+    auto it = this->images.find(repair_id);
+
+    if (it == this->images.end())
+    {
+        LOG(warning) << "no image held for repair " << repair_id;
+        return nullptr;
+    }
+
+    it->second.last_used = std::chrono::steady_clock::now();
+
+    return it->second.image;
+}
+
+
+void
+repair::handle_summary(const state_summary& summary, std::shared_ptr<bzn::session_base> session)
+{
+    if (!this->current || this->current->repair_id != summary.repair_id())
+    {
+        return;
+    }
+
+    this->current->last_progress = std::chrono::steady_clock::now();
+    this->current->log_index = summary.log_index();
+    this->current->local = this->storage->capture_state();
+
+    // writes made here after the source's image would be lost...
+    if (this->current->local->commit_index() > summary.log_index())
+    {
+        LOG(warning) << "not repairing from a source at commit index " << summary.log_index() << " behind our " << this->current->local->commit_index();
+
+        this->current.reset();
+        session->close();
+        return;
+    }
+
+    std::set<bzn::uuid_t> theirs;
+
+    for (const auto& db : summary.databases())
+    {
+        theirs.insert(db.uuid());
+
+        // a bucket is no smaller than the shallower of the two trees...
+        this->current->depths[db.uuid()] = uint8_t(std::clamp<uint32_t>(
+            std::min<uint32_t>(db.tree_depth(), this->current->local->depth(db.uuid())), bzn::merkle_tree::MIN_DEPTH, bzn::merkle_tree::MAX_DEPTH));
+
+        this->compare(db);
+    }
+
+    // the source has no records in the databases it left out...
+    for (const auto& uuid : this->current->local->databases())
+    {
+        if (!theirs.count(uuid))
+        {
+            auto& repaired = this->current->repaired[uuid];
+            repaired.depth = bzn::merkle_tree::MIN_DEPTH;
+
+            for (size_t bucket = 0; bucket < (size_t(1) << bzn::merkle_tree::MIN_DEPTH); ++bucket)
+            {
+                repaired.buckets.insert(bucket);
+            }
+        }
+    }
+
+    this->send_next(std::move(session));
+}
+
+
+void
+repair::handle_nodes(const tree_nodes& nodes, std::shared_ptr<bzn::session_base> session)
+{
+    if (!this->current || this->current->repair_id != nodes.repair_id())
+    {
+        return;
+    }
+
+    this->current->last_progress = std::chrono::steady_clock::now();
+
+    this->compare(nodes.database());
+    this->send_next(std::move(session));
+}
+
+
+void
+repair::handle_records(const repair_records& records, std::shared_ptr<bzn::session_base> session)
+{
+    if (!this->current || this->current->repair_id != records.repair_id())
+    {
+        return;
+    }
+
+    this->current->last_progress = std::chrono::steady_clock::now();
+
+    // a session that fell behind drops notifications, which would leave a hole in the bucket...
+    if (records.sequence() != this->current->next_sequence)
+    {
+        LOG(warning) << "repair " << records.repair_id() << " missed a chunk of records -- giving up";
+
+        this->current.reset();
+        session->close();
+        return;
+    }
+
+    ++this->current->next_sequence;
+
+    auto& repaired = this->current->repaired[records.uuid()];
+
+    for (const auto& record : records.records())
+    {
+        bzn::transaction_id_t transaction_id{};
+
+        if (record.transaction_id().size() == transaction_id.size())
+        {
+            std::copy(record.transaction_id().begin(), record.transaction_id().end(), transaction_id.begin());
+        }
+
+        repaired.records.emplace_back(record.key(), std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+            std::chrono::seconds(record.timestamp()), record.value(), transaction_id, std::chrono::seconds(record.expires())}));
+    }
+
+    this->current->record_count += records.records_size();
+
+    // the session keeps reading, so the chunks before the last arrive without being asked for...
+    if (records.last())
+    {
+        this->current->next_sequence = 0;
+        this->send_next(std::move(session));
+    }
+}
+
+
+void
+repair::compare(const database_nodes& nodes)
+{
+    const auto depth = uint8_t(std::min<uint32_t>(nodes.depth(), bzn::merkle_tree::MAX_DEPTH));
+    const auto target_depth = this->current->depths[nodes.uuid()];
+
+    if (depth > target_depth)
+    {
+        LOG(error) << "repair source sent nodes below the depth asked for";
+        return;
+    }
+
+    const auto ours = this->current->local->digest(nodes.uuid(), depth);
+
+    std::vector<uint64_t> differing;
+
+    for (int i = 0; i < nodes.nodes_size(); ++i)
+    {
+        const auto bucket = nodes.buckets_size() ? nodes.buckets(i) : uint64_t(i);
+
+        if (bucket < ours.size() && nodes.nodes(i) != ours[bucket])
+        {
+            differing.push_back(bucket);
+        }
+    }
+
+    if (differing.empty())
+    {
+        return;
+    }
+
+    repair_message msg;
+
+    if (depth == target_depth)
+    {
+        auto& repaired = this->current->repaired[nodes.uuid()];
+        repaired.depth = depth;
+        repaired.buckets.insert(differing.begin(), differing.end());
+
+        auto request = msg.mutable_records_request();
+        request->set_repair_id(this->current->repair_id);
+        request->set_uuid(nodes.uuid());
+        request->set_depth(depth);
+        *request->mutable_buckets() = {differing.begin(), differing.end()};
+    }
+    else
+    {
+        auto request = msg.mutable_nodes_request();
+        request->set_repair_id(this->current->repair_id);
+        request->set_uuid(nodes.uuid());
+        request->set_depth(depth);
+        *request->mutable_buckets() = {differing.begin(), differing.end()};
+        request->set_child_depth(std::min<uint32_t>(depth + DESCENT_LEVELS, target_depth));
+    }
+
+    this->current->requests.push_back(std::move(msg));
+}
+
+
+void
+repair::send_next(std::shared_ptr<bzn::session_base> session)
+{
+    if (this->current->requests.empty())
+    {
+        this->finish(std::move(session));
+        return;
+    }
+
+    auto msg = std::move(this->current->requests.front());
+    this->current->requests.pop_front();
+
+    session->send_message(repair::encode(msg), false);
+}
+
+
+void
+repair::finish(std::shared_ptr<bzn::session_base> session)
+{
+    auto& state = *this->current;
+    state.local.reset();
+
+    size_t buckets = 0;
+    for (const auto& db : state.repaired)
+    {
+        buckets += db.second.buckets.size();
+    }
+
+    if (state.repaired.empty())
+    {
+        LOG(info) << "storage already matches the repair source as of commit index " << state.log_index;
+    }
+    else if (this->storage->repair(state.log_index, state.repaired) == bzn::storage_base::result::ok)
+    {
+        LOG(info) << "repaired " << buckets << " buckets in " << state.repaired.size() << " databases with " << state.record_count
+                  << " records as of commit index " << state.log_index;
+    }
+    else
+    {
+        LOG(warning) << "storage moved past commit index " << state.log_index << " before it could be repaired";
+    }
+
+    this->current.reset();
+    session->close();
+}
+
+
+std::shared_ptr<bzn::encoded_message>
+repair::encode(const repair_message& msg)
+{
+    return std::make_shared<bzn::encoded_message>(1, std::make_shared<const std::string>(repair::encode_text(msg)));
+}
+
+
+std::string
+repair::encode_text(const repair_message& msg)
+{
+    return R"({"bzn-api":"repair","repair-data":")" + boost::beast::detail::base64_encode(msg.SerializeAsString()) + R"("})";
+}
@@ -0,0 +1,99 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <repair/repair_base.hpp>
+#include <node/node_base.hpp>
+#include <storage/storage.hpp>
+#include <proto/repair.pb.h>
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+
+
+namespace bzn
+{
+    class repair : public bzn::repair_base, public std::enable_shared_from_this<repair>
+    {
+    public:
+        repair(std::shared_ptr<bzn::node_base> node, std::shared_ptr<bzn::storage> storage);
+
+        void start() override;
+
+        void repair_from(const boost::asio::ip::tcp::endpoint& ep) override;
+
+        void handle(const bzn::message& msg, std::shared_ptr<bzn::session_base> session) override;
+
+    private:
+        // source side...
+        void handle_summary_request(const summary_request& request, std::shared_ptr<bzn::session_base> session);
+        void handle_nodes_request(const nodes_request& request, std::shared_ptr<bzn::session_base> session);
+        void handle_records_request(const records_request& request, std::shared_ptr<bzn::session_base> session);
+        std::shared_ptr<const bzn::storage::state_image> find_image(uint64_t repair_id);
+
+        // repairing side...
+        void handle_summary(const state_summary& summary, std::shared_ptr<bzn::session_base> session);
+        void handle_nodes(const tree_nodes& nodes, std::shared_ptr<bzn::session_base> session);
+        void handle_records(const repair_records& records, std::shared_ptr<bzn::session_base> session);
+
+        // queues requests for the buckets of the nodes that differ from ours, or takes our records out of them...
+        void compare(const database_nodes& nodes);
+        void send_next(std::shared_ptr<bzn::session_base> session);
+        void finish(std::shared_ptr<bzn::session_base> session);
+
+        static std::shared_ptr<bzn::encoded_message> encode(const repair_message& msg);
+        static std::string encode_text(const repair_message& msg);
+
+        const std::shared_ptr<bzn::node_base> node;
+        const std::shared_ptr<bzn::storage> storage;
+
+        struct source_image
+        {
+            std::shared_ptr<const bzn::storage::state_image> image;
+            std::chrono::steady_clock::time_point last_used;
+        };
+
+        // images held for the nodes repairing from this one...
+        std::map<uint64_t, source_image> images;
+
+        struct repair_state
+        {
+            uint64_t repair_id;
+            std::chrono::steady_clock::time_point last_progress;
+            uint64_t log_index = 0;
+
+            // our storage as the buckets are compared, dropped once they all are...
+            std::shared_ptr<const bzn::storage::state_image> local;
+
+            // the depth each database is compared down to...
+            std::map<bzn::uuid_t, uint8_t> depths;
+
+            std::list<repair_message> requests;
+            std::map<bzn::uuid_t, bzn::storage::repaired_database> repaired;
+            size_t record_count = 0;
+
+            // the chunk of records expected next for the request in flight...
+            uint64_t next_sequence = 0;
+        };
+
+        std::optional<repair_state> current;
+
+        std::mutex lock;
+        std::once_flag start_once;
+    };
+
+} // bzn
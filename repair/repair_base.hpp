@@ -0,0 +1,51 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <include/bluzelle.hpp>
+#include <node/node_base.hpp>
+#include <node/session_base.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <memory>
+
+
+namespace bzn
+{
+    class repair_base
+    {
+    public:
+        virtual ~repair_base() = default;
+
+        /**
+         * Register for repair messages
+         */
+        virtual void start() = 0;
+
+        /**
+         * Bring this node's storage to a source node's by walking down the hash trees of both and replacing
+         * only the buckets that differ. A repair already under way is left to finish.
+         * @param ep            the source node
+         */
+        virtual void repair_from(const boost::asio::ip::tcp::endpoint& ep) = 0;
+
+        /**
+         * Handle a repair message from a source or from a node repairing from this one
+         * @param msg           message
+         * @param session       session it arrived on
+         */
+        virtual void handle(const bzn::message& msg, std::shared_ptr<bzn::session_base> session) = 0;
+    };
+
+} // bzn
@@ -0,0 +1,310 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <repair/repair.hpp>
+#include <mocks/mock_node_base.hpp>
+#include <mocks/mock_session_base.hpp>
+#include <boost/beast/core/detail/base64.hpp>
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <iostream>
+#include <list>
+
+using namespace ::testing;
+
+namespace
+{
+    const bzn::uuid_t DB_UUID{"b4e3f1c2-0a6d-4e8b-9c17-5d2f8a3e6b90"};
+    const bzn::uuid_t SMALL_DB_UUID{"3f9a7c21-6b4e-4d0f-8e25-a1c9d7b0e34f"};
+    const bzn::uuid_t SOURCE_ONLY_DB_UUID{"e07d5b93-2c8f-41a6-b3e9-6f0a4d17c85e"};
+    const bzn::uuid_t TARGET_ONLY_DB_UUID{"91c2e6a8-5f3b-4c7d-a0e4-2b8d6f19c73a"};
+
+    const boost::asio::ip::tcp::endpoint SOURCE_EP{boost::asio::ip::address_v4::loopback(), 49152};
+
+    bzn::message decode(const bzn::encoded_message& msg)
+    {
+        std::string encoded;
+        for (const auto& piece : msg)
+        {
+            encoded += *piece;
+        }
+
+        bzn::message json;
+        Json::Reader().parse(encoded, json);
+        return json;
+    }
+
+
+    // a replica and its source wired to each other, messages are delivered one at a time as by the io context...
+    class repair_test : public Test
+    {
+    public:
+        repair_test()
+        {
+            EXPECT_CALL(*this->target_node, send_message(SOURCE_EP, An<std::shared_ptr<bzn::encoded_message>>())).WillRepeatedly(Invoke(
+                [this](const auto& /*ep*/, auto msg)
+                {
+                    this->deliver(this->source_repair, msg, this->source_session);
+                }));
+
+            EXPECT_CALL(*this->target_session, send_message(An<std::shared_ptr<bzn::encoded_message>>(), false)).WillRepeatedly(Invoke(
+                [this](auto msg, bool /*end_session*/)
+                {
+                    this->deliver(this->source_repair, msg, this->source_session);
+                }));
+
+            EXPECT_CALL(*this->source_session, send_message(An<std::shared_ptr<bzn::encoded_message>>(), false)).WillRepeatedly(Invoke(
+                [this](auto msg, bool /*end_session*/)
+                {
+                    this->count_records(*msg);
+                    this->deliver(this->target_repair, msg, this->target_session);
+                }));
+
+            EXPECT_CALL(*this->source_session, send_notification(_, _)).WillRepeatedly(Invoke(
+                [this](const auto& /*coalesce_key*/, auto text)
+                {
+                    auto msg = std::make_shared<bzn::encoded_message>(1, std::move(text));
+
+                    ++this->chunks_pushed;
+                    this->count_records(*msg);
+
+                    if (this->drop_pushed_chunk != this->chunks_pushed)
+                    {
+                        this->deliver(this->target_repair, msg, this->target_session);
+                    }
+                }));
+        }
+
+        ~repair_test()
+        {
+            this->source.reset();
+            boost::filesystem::remove(VALUE_FILE);
+        }
+
+        void deliver(std::shared_ptr<bzn::repair> repair, std::shared_ptr<bzn::encoded_message> msg, std::shared_ptr<bzn::session_base> session)
+        {
+            this->deliveries.emplace_back([=](){ repair->handle(decode(*msg), session); });
+        }
+
+        void count_records(const bzn::encoded_message& msg)
+        {
+            repair_message message;
+            message.ParseFromString(boost::beast::detail::base64_decode(decode(msg)["repair-data"].asString()));
+            this->records_streamed += message.records().records_size();
+        }
+
+        void run()
+        {
+            while (!this->deliveries.empty())
+            {
+                auto delivery = std::move(this->deliveries.front());
+                this->deliveries.pop_front();
+                delivery();
+            }
+        }
+
+        // both replicas apply a write at the next commit index...
+        void write(const bzn::uuid_t& uuid, const std::string& key, const std::string& value, bool target = true)
+        {
+            ++this->commit_index;
+            this->source->set_commit_index(this->commit_index);
+            EXPECT_EQ(bzn::storage_base::result::ok, this->source->create(uuid, key, value));
+
+            if (target)
+            {
+                this->target->set_commit_index(this->commit_index);
+                EXPECT_EQ(bzn::storage_base::result::ok, this->target->create(uuid, key, value));
+            }
+        }
+
+        const std::string VALUE_FILE{"repair_test.values"};
+
+        // the source spills most of its values...
+        std::shared_ptr<bzn::storage> source = std::make_shared<bzn::storage>(1000, VALUE_FILE);
+        std::shared_ptr<bzn::storage> target = std::make_shared<bzn::storage>();
+
+        std::shared_ptr<bzn::Mocknode_base> source_node = std::make_shared<NiceMock<bzn::Mocknode_base>>();
+        std::shared_ptr<bzn::Mocknode_base> target_node = std::make_shared<NiceMock<bzn::Mocknode_base>>();
+        std::shared_ptr<bzn::Mocksession_base> source_session = std::make_shared<NiceMock<bzn::Mocksession_base>>();
+        std::shared_ptr<bzn::Mocksession_base> target_session = std::make_shared<NiceMock<bzn::Mocksession_base>>();
+
+        std::shared_ptr<bzn::repair> source_repair = std::make_shared<bzn::repair>(source_node, source);
+        std::shared_ptr<bzn::repair> target_repair = std::make_shared<bzn::repair>(target_node, target);
+
+        std::list<std::function<void()>> deliveries;
+        uint64_t commit_index = 0;
+        size_t records_streamed = 0;
+        size_t chunks_pushed = 0;
+        size_t drop_pushed_chunk = 0;
+    };
+}
+
+
+TEST_F(repair_test, test_that_a_replica_is_repaired_by_streaming_only_the_differing_buckets)
+{
+    for (size_t i = 0; i < 3000; ++i)
+    {
+        this->write(DB_UUID, "key" + std::to_string(i), "value" + std::to_string(i));
+    }
+
+    for (size_t i = 0; i < 100; ++i)
+    {
+        this->write(SMALL_DB_UUID, "key" + std::to_string(i), "value" + std::to_string(i));
+    }
+
+    // writes the target missed...
+    for (size_t i = 0; i < 20; ++i)
+    {
+        this->write(SOURCE_ONLY_DB_UUID, "key" + std::to_string(i), "value" + std::to_string(i), false);
+    }
+
+    // and ones it made that it should not have...
+    this->target->set_commit_index(this->commit_index);
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->remove(DB_UUID, "key5"));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->remove(DB_UUID, "key1234"));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->update(DB_UUID, "key17", "changed"));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->update(SMALL_DB_UUID, "key3", "changed"));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->create(DB_UUID, "extra", "value"));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->create(TARGET_ONLY_DB_UUID, "extra", "value"));
+
+    EXPECT_NE(this->source->state_digest(DB_UUID, 8), this->target->state_digest(DB_UUID, 8));
+
+    EXPECT_CALL(*this->target_session, close());
+
+    this->target_repair->repair_from(SOURCE_EP);
+    this->run();
+
+    for (const auto& uuid : {DB_UUID, SMALL_DB_UUID, SOURCE_ONLY_DB_UUID, TARGET_ONLY_DB_UUID})
+    {
+        EXPECT_EQ(this->source->state_digest(uuid, bzn::merkle_tree::MIN_DEPTH), this->target->state_digest(uuid, bzn::merkle_tree::MIN_DEPTH)) << uuid;
+    }
+
+    EXPECT_EQ(this->source->state_digest(DB_UUID, 8), this->target->state_digest(DB_UUID, 8));
+    EXPECT_EQ("value5", this->target->read(DB_UUID, "key5")->value);
+    EXPECT_EQ("value17", this->target->read(DB_UUID, "key17")->value);
+    EXPECT_FALSE(this->target->has(DB_UUID, "extra"));
+    EXPECT_TRUE(this->target->get_keys(TARGET_ONLY_DB_UUID).empty());
+    EXPECT_EQ(size_t(20), this->target->get_keys(SOURCE_ONLY_DB_UUID).size());
+
+    // only the buckets holding a difference were sent...
+    EXPECT_LT(this->records_streamed, size_t(200));
+
+    // the repair covers the writes of the indexes up to the source's...
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->create(DB_UUID, "late", "value"));
+    EXPECT_FALSE(this->target->has(DB_UUID, "late"));
+
+    this->target->set_commit_index(this->commit_index + 1);
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->create(DB_UUID, "late", "value"));
+    EXPECT_TRUE(this->target->has(DB_UUID, "late"));
+}
+
+
+TEST_F(repair_test, test_that_a_replica_ahead_of_its_source_is_not_repaired)
+{
+    this->write(DB_UUID, "key", "value");
+
+    this->target->set_commit_index(this->commit_index + 1);
+    EXPECT_EQ(bzn::storage_base::result::ok, this->target->update(DB_UUID, "key", "newer"));
+
+    EXPECT_CALL(*this->target_session, close());
+
+    this->target_repair->repair_from(SOURCE_EP);
+    this->run();
+
+    EXPECT_EQ(size_t(0), this->records_streamed);
+    EXPECT_EQ("newer", this->target->read(DB_UUID, "key")->value);
+}
+
+
+TEST_F(repair_test, test_that_a_repair_already_under_way_is_left_to_finish)
+{
+    this->write(DB_UUID, "key", "value");
+
+    EXPECT_CALL(*this->target_node, send_message(SOURCE_EP, An<std::shared_ptr<bzn::encoded_message>>())).Times(1);
+
+    this->target_repair->repair_from(SOURCE_EP);
+    this->target_repair->repair_from(SOURCE_EP);
+}
+
+
+TEST_F(repair_test, test_that_records_larger_than_a_chunk_are_streamed_in_several)
+{
+    const std::string value(4096, 'v');
+
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        this->write(SOURCE_ONLY_DB_UUID, "key" + std::to_string(i), value, false);
+    }
+
+    EXPECT_CALL(*this->target_session, close());
+
+    this->target_repair->repair_from(SOURCE_EP);
+    this->run();
+
+    EXPECT_GT(this->chunks_pushed, size_t(1));
+    EXPECT_EQ(size_t(1000), this->records_streamed);
+    EXPECT_EQ(size_t(1000), this->target->get_keys(SOURCE_ONLY_DB_UUID).size());
+    EXPECT_EQ(this->source->state_digest(SOURCE_ONLY_DB_UUID, 8), this->target->state_digest(SOURCE_ONLY_DB_UUID, 8));
+}
+
+
+TEST_F(repair_test, test_that_a_repair_missing_a_chunk_is_given_up)
+{
+    const std::string value(4096, 'v');
+
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        this->write(SOURCE_ONLY_DB_UUID, "key" + std::to_string(i), value, false);
+    }
+
+    this->drop_pushed_chunk = 1;
+
+    EXPECT_CALL(*this->target_session, close());
+
+    this->target_repair->repair_from(SOURCE_EP);
+    this->run();
+
+    EXPECT_TRUE(this->target->get_keys(SOURCE_ONLY_DB_UUID).empty());
+}
+
+
+// ./repair_tests --gtest_also_run_disabled_tests --gtest_filter=repair_test.DISABLED_benchmark_repair_with_little_drift
+TEST_F(repair_test, DISABLED_benchmark_repair_with_little_drift)
+{
+    const size_t KEYS = 1000000;
+    const size_t DRIFT = KEYS / 1000;
+
+    const std::string value(100, 'v');
+
+    for (size_t i = 0; i < KEYS; ++i)
+    {
+        this->write(DB_UUID, "key" + std::to_string(i), value);
+    }
+
+    for (size_t i = 0; i < DRIFT; ++i)
+    {
+        this->target->update(DB_UUID, "key" + std::to_string(i * 997 % KEYS), "drifted");
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    this->target_repair->repair_from(SOURCE_EP);
+    this->run();
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(this->source->state_digest(DB_UUID, 16), this->target->state_digest(DB_UUID, 16));
+
+    std::cout << KEYS << " keys with " << DRIFT << " drifted repaired in " << elapsed << "s streaming " << this->records_streamed << " records\n";
+}
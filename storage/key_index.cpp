@@ -0,0 +1,128 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/key_index.hpp>
+#include <algorithm>
+
+using namespace bzn;
+
+namespace
+{
+    // a full block is split in two, so an insert or erase moves at most this many views...
+    const std::size_t MAX_BLOCK_SIZE = 256;
+}
+
+
+key_index::const_iterator&
+key_index::const_iterator::operator++()
+{
+    if (++this->pos == (*this->blocks)[this->block].size())
+    {
+        ++this->block;
+        this->pos = 0;
+    }
+
+    return *this;
+}
+
+
+std::size_t
+key_index::find_block(std::string_view key) const
+{
+    // the first block ending at or after the key, or the last block for a key after every other...
+    auto block = std::lower_bound(this->blocks.begin(), this->blocks.end(), key,
+        [](const auto& block, std::string_view key) { return block.back() < key; });
+
+    return std::min(std::size_t(block - this->blocks.begin()), this->blocks.size() - 1);
+}
+
+
+key_index::const_iterator
+key_index::lower_bound(std::string_view key) const
+{
+    if (this->blocks.empty())
+    {
+        return this->end();
+    }
+
+    const auto block = this->find_block(key);
+    const auto& keys = this->blocks[block];
+    const auto pos = std::size_t(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+
+    return (pos == keys.size()) ? this->end() : const_iterator(&this->blocks, block, pos);
+}
+
+
+bool
+key_index::insert(std::string_view key)
+{
+    if (this->blocks.empty())
+    {
+        this->blocks.emplace_back(1, key);
+        ++this->count;
+        return true;
+    }
+
+    const auto block = this->find_block(key);
+    auto& keys = this->blocks[block];
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+
+    if (it != keys.end() && *it == key)
+    {
+        return false;
+    }
+
+    keys.insert(it, key);
+    ++this->count;
+
+    if (keys.size() > MAX_BLOCK_SIZE)
+    {
+        std::vector<std::string_view> upper(keys.begin() + keys.size() / 2, keys.end());
+        keys.resize(keys.size() / 2);
+        keys.shrink_to_fit();
+
+        this->blocks.insert(this->blocks.begin() + block + 1, std::move(upper));
+    }
+
+    return true;
+}
+
+
+bool
+key_index::erase(std::string_view key)
+{
+    if (this->blocks.empty())
+    {
+        return false;
+    }
+
+    const auto block = this->find_block(key);
+    auto& keys = this->blocks[block];
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+
+    if (it == keys.end() || *it != key)
+    {
+        return false;
+    }
+
+    keys.erase(it);
+    --this->count;
+
+    if (keys.empty())
+    {
+        this->blocks.erase(this->blocks.begin() + block);
+    }
+
+    return true;
+}
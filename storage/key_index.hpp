@@ -0,0 +1,74 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+
+namespace bzn
+{
+    // keys in order for range scans, kept as views in sorted blocks so a key costs its view rather
+    // than a tree node. The key's bytes must outlive its entry...
+    class key_index final
+    {
+    public:
+        class const_iterator
+        {
+        public:
+            std::string_view operator*() const { return (*this->blocks)[this->block][this->pos]; }
+
+            const_iterator& operator++();
+
+            bool operator==(const const_iterator& other) const { return this->block == other.block && this->pos == other.pos; }
+            bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+        private:
+            friend class key_index;
+
+            const_iterator(const std::vector<std::vector<std::string_view>>* blocks, std::size_t block, std::size_t pos)
+                : blocks(blocks), block(block), pos(pos)
+            {
+            }
+
+            const std::vector<std::vector<std::string_view>>* blocks;
+            std::size_t block;
+            std::size_t pos;
+        };
+
+        const_iterator begin() const { return {&this->blocks, 0, 0}; }
+        const_iterator end() const { return {&this->blocks, this->blocks.size(), 0}; }
+
+        // the first key not before the given one...
+        const_iterator lower_bound(std::string_view key) const;
+
+        // returns false if the key exists...
+        bool insert(std::string_view key);
+
+        // returns false if the key is not in the index...
+        bool erase(std::string_view key);
+
+        std::size_t size() const { return this->count; }
+
+    private:
+        // the block the key is in or belongs in...
+        std::size_t find_block(std::string_view key) const;
+
+        // never empty...
+        std::vector<std::vector<std::string_view>> blocks;
+        std::size_t count = 0;
+    };
+
+} // bzn
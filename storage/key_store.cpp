@@ -0,0 +1,64 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/key_store.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace bzn;
+
+namespace
+{
+    // chunks double from the first so a database with a few keys stays small...
+    const std::size_t MIN_CHUNK_SIZE = 256;
+    const std::size_t MAX_CHUNK_SIZE = 64 * 1024;
+}
+
+
+std::string_view
+key_store::add(std::string_view key)
+{
+    if (this->chunks.empty() || this->chunk_size - this->chunk_used < key.size())
+    {
+        // a key larger than a chunk gets one of its own...
+        const auto next = std::min(MAX_CHUNK_SIZE, std::max(MIN_CHUNK_SIZE, this->chunk_size * 2));
+
+        this->chunk_size = std::max(next, key.size());
+        this->chunk_used = 0;
+        this->chunks.emplace_back(std::make_unique<char[]>(this->chunk_size));
+    }
+
+    auto bytes = this->chunks.back().get() + this->chunk_used;
+    std::memcpy(bytes, key.data(), key.size());
+
+    this->chunk_used += key.size();
+    this->live += key.size();
+
+    return {bytes, key.size()};
+}
+
+
+void
+key_store::remove(std::string_view key)
+{
+    this->live -= key.size();
+    this->garbage += key.size();
+}
+
+
+bool
+key_store::wants_compaction() const
+{
+    return this->garbage > MIN_CHUNK_SIZE && this->garbage > this->live;
+}
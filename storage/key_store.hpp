@@ -0,0 +1,49 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+
+namespace bzn
+{
+    // the bytes of a database's keys packed into a few chunks rather than a string per key. A view of
+    // an added key stays valid until the store is destroyed, removed keys are only counted so the owner
+    // can copy the live ones into a fresh store once most of the bytes are garbage...
+    class key_store final
+    {
+    public:
+        std::string_view add(std::string_view key);
+
+        void remove(std::string_view key);
+
+        // more than half of the bytes held belong to removed keys...
+        bool wants_compaction() const;
+
+        // bytes held by live keys...
+        std::size_t size() const { return this->live; }
+
+    private:
+        std::vector<std::unique_ptr<char[]>> chunks;
+        std::size_t chunk_size = 0;
+        std::size_t chunk_used = 0;
+
+        std::size_t live = 0;
+        std::size_t garbage = 0;
+    };
+
+} // bzn
@@ -0,0 +1,154 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/merkle_tree.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace bzn;
+
+namespace
+{
+    const uint64_t PRIME_1 = 0x9e3779b97f4a7c15ull;
+    const uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4full;
+
+    // a tree grows once its leaves average more records than this...
+    const size_t RECORDS_PER_LEAF = 16;
+
+    inline uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t load(const char* p)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        return word;
+    }
+
+    inline uint64_t mix(uint64_t acc, uint64_t word)
+    {
+        return rotl(acc + word * PRIME_2, 31) * PRIME_1;
+    }
+
+    inline uint64_t finalize(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+
+merkle_tree::merkle_tree(uint8_t depth)
+    : tree_depth(std::min(std::max(depth, MIN_DEPTH), MAX_DEPTH))
+    , nodes(size_t(2) << this->tree_depth)
+{
+}
+
+
+uint64_t
+merkle_tree::hash(std::string_view data, uint64_t seed)
+{
+    const char* p = data.data();
+    size_t n = data.size();
+
+    uint64_t h = seed + PRIME_1 * (n + 1);
+
+    // four independent lanes keep the multipliers busy and vectorize where the target allows...
+    if (n >= 32)
+    {
+        uint64_t lanes[4] = {h + PRIME_1 + PRIME_2, h + PRIME_2, h, h - PRIME_1};
+
+        for (; n >= 32; p += 32, n -= 32)
+        {
+            for (size_t i = 0; i < 4; ++i)
+            {
+                lanes[i] = mix(lanes[i], load(p + 8 * i));
+            }
+        }
+
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    }
+
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        h = rotl(h ^ mix(0, load(p)), 27) * PRIME_1 + PRIME_2;
+    }
+
+    if (n)
+    {
+        uint64_t tail = 0;
+        std::memcpy(&tail, p, n);
+        h = rotl(h ^ mix(0, tail), 27) * PRIME_1 + PRIME_2;
+    }
+
+    return finalize(h);
+}
+
+
+void
+merkle_tree::add(uint64_t key_hash, uint64_t digest)
+{
+    this->toggle(key_hash, digest);
+    ++this->count;
+}
+
+
+void
+merkle_tree::remove(uint64_t key_hash, uint64_t digest)
+{
+    this->toggle(key_hash, digest);
+    --this->count;
+}
+
+
+void
+merkle_tree::toggle(uint64_t key_hash, uint64_t digest)
+{
+    // from the leaf up to the root...
+    for (size_t i = (size_t(1) << this->tree_depth) + merkle_tree::bucket(key_hash, this->tree_depth); i; i >>= 1)
+    {
+        this->nodes[i] ^= digest;
+    }
+}
+
+
+std::vector<uint64_t>
+merkle_tree::level(uint8_t depth) const
+{
+    depth = std::min(depth, this->tree_depth);
+
+    const auto first = this->nodes.begin() + (size_t(1) << depth);
+
+    return std::vector<uint64_t>(first, first + (size_t(1) << depth));
+}
+
+
+uint8_t
+merkle_tree::wanted_depth() const
+{
+    uint8_t depth = this->tree_depth;
+
+    while (depth < MAX_DEPTH && this->count > (RECORDS_PER_LEAF << depth))
+    {
+        depth += 2;
+    }
+
+    return std::min(depth, MAX_DEPTH);
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+
+namespace bzn
+{
+    // hash tree over the records of a database bucketed by the leading bits of their key hash. A node is
+    // the xor of the record digests below it, so node i at depth d covers the keys whose hash begins
+    // with the d bits of i however deep a replica's tree has grown...
+    class merkle_tree final
+    {
+    public:
+        static constexpr uint8_t MIN_DEPTH = 4;
+        static constexpr uint8_t MAX_DEPTH = 16;
+
+        explicit merkle_tree(uint8_t depth = MIN_DEPTH);
+
+        // 64 bit hash of data, every replica must arrive at the same value...
+        static uint64_t hash(std::string_view data, uint64_t seed = 0);
+
+        // bucket of a key hash at the depth...
+        static size_t bucket(uint64_t key_hash, uint8_t depth) { return depth ? size_t(key_hash >> (64 - depth)) : 0; }
+
+        void add(uint64_t key_hash, uint64_t digest);
+
+        void remove(uint64_t key_hash, uint64_t digest);
+
+        uint64_t root() const { return this->nodes[1]; }
+
+        uint8_t depth() const { return this->tree_depth; }
+
+        // records in the tree...
+        size_t size() const { return this->count; }
+
+        // the nodes at a depth no deeper than the tree's, in bucket order...
+        std::vector<uint64_t> level(uint8_t depth) const;
+
+        // the depth the tree should be rebuilt at to keep its leaves small, never less than its own...
+        uint8_t wanted_depth() const;
+
+    private:
+        void toggle(uint64_t key_hash, uint64_t digest);
+
+        uint8_t tree_depth;
+        size_t count = 0;
+
+        // heap order with the root at 1 and the leaves last...
+        std::vector<uint64_t> nodes;
+    };
+
+} // bzn
@@ -0,0 +1,170 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/record_table.hpp>
+#include <algorithm>
+#include <functional>
+
+using namespace bzn;
+
+namespace
+{
+    const std::size_t MIN_CAPACITY = 8;
+}
+
+
+uint32_t
+record_table::hash(std::string_view key)
+{
+    const auto hash = uint32_t(std::hash<std::string_view>()(key));
+
+    return hash ? hash : 1;
+}
+
+
+std::size_t
+record_table::probe(std::string_view key, uint32_t hash) const
+{
+    const std::size_t mask = this->hashes.size() - 1;
+
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        if (!this->hashes[i] || (this->hashes[i] == hash && this->slots[i].key == key))
+        {
+            return i;
+        }
+    }
+}
+
+
+record_table::record_ptr*
+record_table::find(std::string_view key)
+{
+    if (!this->count)
+    {
+        return nullptr;
+    }
+
+    const auto i = this->probe(key, record_table::hash(key));
+
+    return this->hashes[i] ? &this->slots[i].record : nullptr;
+}
+
+
+const record_table::record_ptr*
+record_table::find(std::string_view key) const
+{
+    return const_cast<record_table*>(this)->find(key);
+}
+
+
+bool
+record_table::insert(std::string_view key, record_ptr record)
+{
+    // keep the load under 3/4 so misses stay short...
+    if ((this->count + 1) * 4 > this->hashes.size() * 3)
+    {
+        this->grow();
+    }
+
+    const auto hash = record_table::hash(key);
+    const auto i = this->probe(key, hash);
+
+    if (this->hashes[i])
+    {
+        return false;
+    }
+
+    this->hashes[i] = hash;
+    this->slots[i] = {key, std::move(record)};
+    ++this->count;
+
+    return true;
+}
+
+
+bool
+record_table::erase(std::string_view key)
+{
+    if (!this->count)
+    {
+        return false;
+    }
+
+    const std::size_t mask = this->hashes.size() - 1;
+    auto i = this->probe(key, record_table::hash(key));
+
+    if (!this->hashes[i])
+    {
+        return false;
+    }
+
+    // shift the rest of the run back instead of leaving a tombstone...
+    for (auto j = (i + 1) & mask; this->hashes[j]; j = (j + 1) & mask)
+    {
+        // an entry may only move back if that does not take it before its home slot...
+        if (((j - (this->hashes[j] & mask)) & mask) >= ((j - i) & mask))
+        {
+            this->hashes[i] = this->hashes[j];
+            this->slots[i] = std::move(this->slots[j]);
+            i = j;
+        }
+    }
+
+    this->hashes[i] = 0;
+    this->slots[i] = {};
+    --this->count;
+
+    return true;
+}
+
+
+void
+record_table::clear()
+{
+    this->hashes.clear();
+    this->slots.clear();
+    this->count = 0;
+}
+
+
+void
+record_table::grow()
+{
+    auto hashes = std::move(this->hashes);
+    auto slots = std::move(this->slots);
+
+    const auto capacity = std::max(MIN_CAPACITY, hashes.size() * 2);
+    this->hashes.assign(capacity, 0);
+    this->slots.clear();
+    this->slots.resize(capacity);
+
+    const std::size_t mask = capacity - 1;
+
+    for (std::size_t i = 0; i < hashes.size(); ++i)
+    {
+        if (hashes[i])
+        {
+            auto j = hashes[i] & mask;
+
+            while (this->hashes[j])
+            {
+                j = (j + 1) & mask;
+            }
+
+            this->hashes[j] = hashes[i];
+            this->slots[j] = std::move(slots[i]);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <storage/storage_base.hpp>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+
+namespace bzn
+{
+    // open addressing (linear probing) table of records keyed by views of keys owned by the caller...
+    class record_table final
+    {
+    public:
+        using record_ptr = std::shared_ptr<bzn::storage_base::record>;
+
+        // nullptr if the key is not in the table...
+        record_ptr* find(std::string_view key);
+        const record_ptr* find(std::string_view key) const;
+
+        // the key's bytes must outlive its entry, returns false if the key exists...
+        bool insert(std::string_view key, record_ptr record);
+
+        bool erase(std::string_view key);
+
+        void clear();
+
+        std::size_t size() const { return this->count; }
+
+        // slots allocated, for memory accounting...
+        std::size_t capacity() const { return this->hashes.size(); }
+
+    private:
+        struct slot
+        {
+            std::string_view key;
+            record_ptr       record;
+        };
+
+        static uint32_t hash(std::string_view key);
+
+        // index of the key or of the empty slot where it would go...
+        std::size_t probe(std::string_view key, uint32_t hash) const;
+
+        void grow();
+
+        // 0 marks an empty slot so a probe compares keys only on a hash match...
+        std::vector<uint32_t> hashes;
+        std::vector<slot>     slots;
+        std::size_t           count = 0;
+    };
+
+} // bzn
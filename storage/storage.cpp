@@ -13,235 +13,1639 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <storage/storage.hpp>
+#include <metrics/metrics.hpp>
 #include "storage_base.hpp"
 
+#include <charconv>
 #include <chrono>
 #include <iostream>
 #include <fstream>
 #include <boost/uuid/uuid_io.hpp>
-#include <boost/uuid/random_generator.hpp>
-#include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/serialization/map.hpp>
 
 using namespace bzn;
 
 namespace
 {
+    // pending writes folded into the databases by each write once the views are gone...
+    const size_t MERGE_STEP = 16;
+
     // todo: replace with protobuf definition...
+
+    struct storage_metrics
+    {
+        bzn::metrics::histogram& create_latency = get_latency("create");
+        bzn::metrics::histogram& read_latency = get_latency("read");
+        bzn::metrics::histogram& update_latency = get_latency("update");
+        bzn::metrics::histogram& remove_latency = get_latency("remove");
+        bzn::metrics::histogram& apply_latency = get_latency("apply");
+
+        bzn::metrics::counter& bytes_written = bzn::metrics::registry::global().get_counter("storage_bytes_written_total", "Value bytes written by creates and updates.");
+        bzn::metrics::counter& bytes_read = bzn::metrics::registry::global().get_counter("storage_bytes_read_total", "Value bytes returned by reads.");
+        bzn::metrics::gauge& keys = bzn::metrics::registry::global().get_gauge("storage_keys", "Keys held across all databases.");
+
+        bzn::metrics::counter& value_hits = bzn::metrics::registry::global().get_counter("storage_value_hits_total", "Reads served from memory under a memory budget.");
+        bzn::metrics::counter& value_misses = bzn::metrics::registry::global().get_counter("storage_value_misses_total", "Reads faulted in from the value file.");
+        bzn::metrics::counter& values_spilled = bzn::metrics::registry::global().get_counter("storage_values_spilled_total", "Values moved to the value file.");
+        bzn::metrics::gauge& resident_bytes = bzn::metrics::registry::global().get_gauge("storage_resident_value_bytes", "Value bytes held in memory.");
+
+        bzn::metrics::histogram& checkpoint_pause = bzn::metrics::registry::global().get_histogram("storage_checkpoint_pause_microseconds", "Time writers wait while a checkpoint is captured.");
+        bzn::metrics::histogram& checkpoint_duration = bzn::metrics::registry::global().get_histogram("storage_checkpoint_duration_microseconds", "Time to write a checkpoint in the background.");
+        bzn::metrics::counter& checkpoint_databases_written = bzn::metrics::registry::global().get_counter("storage_checkpoint_databases_written_total", "Changed databases written by checkpoints.");
+
+        static bzn::metrics::histogram& get_latency(const std::string& op)
+        {
+            return bzn::metrics::registry::global().get_histogram("storage_operation_latency_microseconds", "Storage operation latency, sampled.", {{"op", op}});
+        }
+    };
+
+    storage_metrics& get_metrics()
+    {
+        static storage_metrics metrics;
+        return metrics;
+    }
 }
 
 
-bzn::uuid_t
-storage::generate_random_uuid()
+storage::storage(size_t memory_budget, std::string value_file)
+    : memory_budget(memory_budget)
+    , value_file_path(std::move(value_file))
 {
-    boost::uuids::basic_random_generator<boost::mt19937> gen;
-    return boost::lexical_cast<bzn::uuid_t>(gen());
 }
 
 
-storage_base::result
-storage::create(const bzn::uuid_t& uuid, const std::string& key, const std::string& value)
+bzn::transaction_id_t
+storage::generate_transaction_id()
+{
+    bzn::transaction_id_t id;
+
+    ++this->commit_slot;
+
+    // big endian so the string form of a later id sorts after an earlier one, slots start at 1 so no id is nil...
+    for (size_t i = 0; i < 8; ++i)
+    {
+        id.data[i] = uint8_t(this->commit_index >> (56 - 8 * i));
+        id.data[8 + i] = uint8_t(this->commit_slot >> (56 - 8 * i));
+    }
+
+    return id;
+}
+
+
+void
+storage::set_commit_index(uint64_t log_index)
 {
     std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
 
-    if(value.size() > bzn::MAX_VALUE_SIZE)
+    this->grow_trees();
+
+    // the log is the same on every replica so the first index of a block is too...
+    const bool block_entered = this->checkpoint_commits && this->commit_index / this->checkpoint_commits > this->state_index / this->checkpoint_commits;
+
+    if (block_entered)
     {
-        return storage_base::result::value_too_large;
+        this->state_index = this->commit_index;
+
+        if (this->state_reporter)
+        {
+            std::map<bzn::uuid_t, std::vector<uint64_t>> buckets;
+
+            for (const auto& tree : this->trees)
+            {
+                if (tree.second.size())
+                {
+                    buckets[tree.first] = tree.second.level(bzn::merkle_tree::MIN_DEPTH);
+                }
+            }
+
+            this->state_reporter(this->commit_index, buckets);
+        }
     }
 
-    auto search = this->kv_store.find(uuid);
+    // every write of the previous index has been applied so this is the place to take a consistent image...
+    if (!this->checkpoint_dir.empty() && this->commit_index > this->checkpoint_index && (block_entered ||
+        (this->checkpoint_interval.count() && std::chrono::steady_clock::now() - this->checkpoint_time >= this->checkpoint_interval)))
+    {
+        std::lock_guard<std::mutex> checkpoint_lock(this->checkpoint_lock);
+
+        // a checkpoint still being written is not queued behind, the next commit tries again...
+        if (!this->checkpoint_running && !this->next_checkpoint)
+        {
+            this->next_checkpoint = this->capture_checkpoint();
+            this->checkpoint_ready.notify_all();
+        }
+    }
+
+    this->commit_index = log_index;
+    this->commit_slot = 0;
+}
+
+
+void
+storage::set_commit_time(std::chrono::seconds now)
+{
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+    this->commit_time = now;
+}
+
+
+bzn::storage::record_ptr
+storage::find_live(const bzn::uuid_t& uuid, const std::string& key) const
+{
+    auto record = this->find(uuid, key);
 
-    if(search != this->kv_store.end())
+    return (record && this->expired_at_commit(*record)) ? nullptr : record;
+}
+
+
+bool
+storage::expired_at_commit(const bzn::storage_base::record& record) const
+{
+    return this->commit_time.count() && record.is_expired(this->commit_time);
+}
+
+
+bzn::storage::record_ptr
+storage::find(const bzn::uuid_t& uuid, const std::string& key) const
+{
+    if (auto db = this->pending.find(uuid); db != this->pending.end())
     {
-        if(search->second.find(key)!= search->second.end() )
+        if (auto write = db->second->find(key); write != db->second->end())
         {
-            return storage_base::result::exists;
+            return write->second;
         }
     }
 
-    auto& inner_db =  this->kv_store[uuid];
+    auto db = this->databases->find(uuid);
+
+    if (db == this->databases->end())
+    {
+        return nullptr;
+    }
+
+    auto record = db->second.records.find(key);
+
+    return (record) ? *record : nullptr;
+}
+
 
-    if(inner_db.find(key) == inner_db.end())
+void
+storage::put(const bzn::uuid_t& uuid, const std::string& key, record_ptr record)
+{
+    // a view is reading the databases without the lock...
+    if (this->open_views->load(std::memory_order_acquire))
     {
-        auto record = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
-            std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()),
-            value,
-            this->generate_random_uuid()});
+        auto& writes = this->pending[uuid];
+        auto& stamped = this->pending_epochs[uuid];
+
+        // views are opened under the shared lock so the epoch is current here...
+        const uint64_t epoch = this->view_epoch.load(std::memory_order_relaxed);
+
+        // copied once for the views opened since, not for every view opened...
+        if (!writes)
+        {
+            writes = std::make_shared<pending_writes>();
+            stamped = epoch;
+        }
+        else if (stamped != epoch)
+        {
+            writes = std::make_shared<pending_writes>(*writes);
+            stamped = epoch;
+        }
 
-        // todo: test if insert failed?
-        inner_db.insert(std::make_pair(key,std::move(record)));
+        (*writes)[key] = std::move(record);
+        return;
     }
-    else
+
+    // no view holds the pending writes, this one replaces the key's and the rest are merged a few at a time...
+    if (auto db = this->pending.find(uuid); db != this->pending.end())
     {
-        return storage_base::result::exists;
+        db->second->erase(key);
+
+        if (db->second->empty())
+        {
+            this->pending.erase(db);
+        }
     }
-    return storage_base::result::ok;
+
+    this->write_record(uuid, key, std::move(record));
+    this->merge_pending(MERGE_STEP);
 }
 
 
-// Note: Returns nullptr if the key does not exist.
-std::shared_ptr<bzn::storage_base::record>
-storage::read(const bzn::uuid_t& uuid, const std::string& key)
+void
+storage::write_record(const bzn::uuid_t& uuid, const std::string& key, record_ptr record)
 {
-    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+    if (!record)
+    {
+        if (auto db = this->databases->find(uuid); db != this->databases->end())
+        {
+            this->erase(db->second, key);
+        }
+        return;
+    }
 
-    auto search = this->kv_store.find(uuid);
-    if(search == this->kv_store.end())
+    auto& db = (*this->databases)[uuid];
+
+    if (auto current = db.records.find(key))
     {
-        return nullptr;
+        *current = std::move(record);
+        return;
     }
 
-    // we have the db, let's see if the key exists
-    auto& inner_db = search->second;
-    auto inner_search = inner_db.find(key);
-    if(inner_search == inner_db.end())
+    const auto stored = db.key_bytes.add(key);
+    db.keys.insert(stored);
+    db.records.insert(stored, std::move(record));
+}
+
+
+void
+storage::merge_pending(size_t limit)
+{
+    while (limit && !this->pending.empty())
     {
-        return nullptr;
+        auto db = this->pending.begin();
+        auto& writes = *db->second;
+
+        for (; limit && !writes.empty(); --limit)
+        {
+            auto write = writes.extract(writes.begin());
+            this->write_record(db->first, write.key(), std::move(write.mapped()));
+        }
+
+        if (writes.empty())
+        {
+            this->pending.erase(db);
+        }
     }
-    return inner_search->second;
 }
 
 
-storage_base::result
-storage::update(const bzn::uuid_t& uuid, const std::string& key, const std::string& value)
+storage::view_lease::view_lease(std::shared_ptr<std::atomic<size_t>> open_views)
+    : open_views(std::move(open_views))
 {
-    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+    this->open_views->fetch_add(1, std::memory_order_relaxed);
+}
 
-    if(value.size() > bzn::MAX_VALUE_SIZE)
+
+storage::view_lease::view_lease(const view_lease& other)
+    : open_views(other.open_views)
+{
+    if (this->open_views)
     {
-        return storage_base::result::value_too_large;
+        this->open_views->fetch_add(1, std::memory_order_relaxed);
     }
+}
+
+
+storage::view_lease&
+storage::view_lease::operator=(view_lease other) noexcept
+{
+    std::swap(this->open_views, other.open_views);
+    return *this;
+}
 
-    auto search = this->kv_store.find(uuid);
-    if(search == this->kv_store.end())
+
+storage::view_lease::~view_lease()
+{
+    // the view's reads are done before a writer sees the count drop...
+    if (this->open_views)
     {
-        return bzn::storage_base::result::not_found;
+        this->open_views->fetch_sub(1, std::memory_order_release);
     }
+}
+
+
+storage::view
+storage::open_view(const bzn::uuid_t* uuid)
+{
+    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
 
+    // the lease keeps writers off the databases until the view is dropped...
+    storage::view view{this->databases, {}, this->commit_index, view_lease(this->open_views)};
+    ++this->view_epoch;
 
-    // we have the db, let's see if the key exists
-    auto& inner_db = search->second;
-    auto inner_search = inner_db.find(key);
-    if(inner_search == inner_db.end())
+    if (!uuid)
     {
-        return bzn::storage_base::result::not_found;
+        view.pending = this->pending;
+    }
+    else if (auto db = this->pending.find(*uuid); db != this->pending.end())
+    {
+        view.pending.emplace(*db);
     }
 
-    inner_search->second->timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
-    inner_search->second->transaction_id = this->generate_random_uuid();
-    inner_search->second->value = value;
-    return storage_base::result::ok;
+    return view;
+}
+
+
+void
+storage::erase(bzn::storage::database& db, const std::string& key)
+{
+    if (db.keys.erase(key))
+    {
+        db.records.erase(key);
+        db.key_bytes.remove(key);
+
+        if (db.key_bytes.wants_compaction())
+        {
+            storage::compact(db);
+        }
+    }
+}
+
+
+void
+storage::compact(bzn::storage::database& db)
+{
+    // only called by writers, so no view is reading the database...
+    bzn::storage::database compacted;
+
+    for (const auto& key : db.keys)
+    {
+        const auto stored = compacted.key_bytes.add(key);
+        compacted.keys.insert(stored);
+        compacted.records.insert(stored, std::move(*db.records.find(key)));
+    }
+
+    db = std::move(compacted);
 }
 
 
 storage_base::result
-storage::remove(const bzn::uuid_t& uuid, const std::string& key)
+storage::create(const bzn::uuid_t& uuid, const std::string& key, const std::string& value)
 {
+    bzn::metrics::sampled_timer timer(get_metrics().create_latency);
+
     std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
 
-    auto search = this->kv_store.find(uuid);
+    if (!this->begin_write())
+    {
+        return storage_base::result::ok;
+    }
 
-    if(search == this->kv_store.end())
+    if(value.size() > bzn::MAX_VALUE_SIZE)
     {
-        return storage_base::result::not_found;
+        return storage_base::result::value_too_large;
     }
 
-    auto record = search->second.find(key);
-    if(record == search->second.end())
+    // an expired record that has not been swept yet is replaced...
+    auto previous = this->find(uuid, key);
+    if(previous && !this->expired_at_commit(*previous))
     {
-        return storage_base::result::not_found;
+        return storage_base::result::exists;
+    }
+
+    auto record = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()),
+        value,
+        this->generate_transaction_id()});
+
+    this->index_record(uuid, key, previous, record);
+    this->put(uuid, key, std::move(record));
+    this->enforce_memory_budget();
+
+    if (!previous)
+    {
+        get_metrics().keys.add(1);
     }
+    get_metrics().bytes_written.increment(value.size());
 
-    search->second.erase(record);
     return storage_base::result::ok;
 }
 
 
-storage_base::result
-storage::save(const std::string& path)
+// Note: Returns nullptr if the key does not exist.
+std::shared_ptr<bzn::storage_base::record>
+storage::read(const bzn::uuid_t& uuid, const std::string& key)
 {
-    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+    bzn::metrics::sampled_timer timer(get_metrics().read_latency);
 
-    try
     {
-        std::ofstream ofs(path);
-        boost::archive::text_oarchive oa(ofs);
-        oa << this->kv_store;
+        std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+
+        auto record = this->find(uuid, key);
+        if(!record || record->is_expired())
+        {
+            return nullptr;
+        }
+
+        if (record->spill_offset < 0)
+        {
+            this->touch(*record);
+            get_metrics().bytes_read.increment(record->value.size());
+
+            return record;
+        }
     }
-    catch (...)
+
+    // the value was spilled, fault it back in...
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+    auto record = this->find(uuid, key);
+    if(!record || record->is_expired())
     {
-        return storage_base::result::not_saved;
+        return nullptr;
     }
-    return storage_base::result::ok;
+
+    if (record->spill_offset >= 0)
+    {
+        record = this->fault(uuid, key);
+    }
+
+    get_metrics().bytes_read.increment(record->value.size());
+
+    return record;
 }
 
 
 storage_base::result
-storage::load(const std::string& path)
+storage::update(const bzn::uuid_t& uuid, const std::string& key, const std::string& value)
 {
+    bzn::metrics::sampled_timer timer(get_metrics().update_latency);
+
     std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
 
-    if(!boost::filesystem::exists(path))
+    if (!this->begin_write())
     {
-        return storage_base::result::not_found;
+        return storage_base::result::ok;
     }
-    std::ifstream ifs(path);
-    boost::archive::text_iarchive ia(ifs);
-    ia >> this->kv_store;
+
+    if(value.size() > bzn::MAX_VALUE_SIZE)
+    {
+        return storage_base::result::value_too_large;
+    }
+
+    auto current = this->find_live(uuid, key);
+    if(!current)
+    {
+        return bzn::storage_base::result::not_found;
+    }
+
+    // readers holding the previous record keep a consistent copy, an update without a ttl keeps the record forever...
+    auto record = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()),
+        value,
+        this->generate_transaction_id()});
+
+    this->index_record(uuid, key, current, record);
+    this->put(uuid, key, std::move(record));
+    this->enforce_memory_budget();
+
+    get_metrics().bytes_written.increment(value.size());
+
     return storage_base::result::ok;
 }
 
 
-std::vector<std::string>
-storage::get_keys(const bzn::uuid_t& uuid)
+storage_base::result
+storage::remove(const bzn::uuid_t& uuid, const std::string& key)
 {
-    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+    bzn::metrics::sampled_timer timer(get_metrics().remove_latency);
 
-    std::vector<std::string> keys;
-    auto inner_db = this->kv_store.find(uuid);
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
 
-    if(inner_db == this->kv_store.end())
+    if (!this->begin_write())
     {
-        return keys;
+        return storage_base::result::ok;
     }
 
-    for(const auto& p : inner_db->second)
+    auto record = this->find_live(uuid, key);
+    if(!record)
     {
-        keys.emplace_back(p.first);
+        return storage_base::result::not_found;
     }
-    return keys;
-}
 
+    this->index_record(uuid, key, record, nullptr);
+    this->put(uuid, key, nullptr);
 
-bool
-storage::has(const bzn::uuid_t& uuid, const std::string& key)
-{
-    auto v = this->get_keys(uuid);
-    return std::find(v.begin(), v.end(), key) != v.end();
+    get_metrics().keys.add(-1);
+
+    return storage_base::result::ok;
 }
 
 
-// todo: optimize! Track size as it grows and not iterate over every value!
-std::size_t
-storage::get_size(const bzn::uuid_t& uuid)
+storage_base::result
+storage::apply(const bzn::uuid_t& uuid, const std::vector<operation>& operations)
 {
-    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+    bzn::metrics::sampled_timer timer(get_metrics().apply_latency);
 
-    auto it = this->kv_store.find(uuid);
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
 
-    if (it == this->kv_store.end())
+    if (!this->begin_write())
     {
-        // database not found...
-        return 0;
+        return storage_base::result::ok;
     }
 
-    std::size_t usage{};
+    // stage the new records so that a failure leaves the database untouched (nullptr marks a removal)...
+    std::unordered_map<std::string, std::shared_ptr<bzn::storage_base::record>> staged;
 
-    for(const auto& record : it->second)
+    // an eviction looks at the expired record itself, every other operation finds it absent...
+    auto current = [&](const operation& item) -> std::shared_ptr<bzn::storage_base::record>
     {
-        usage += record.second->value.size();
-    }
+        if (auto it = staged.find(item.key); it != staged.end())
+        {
+            return it->second;
+        }
+
+        return (item.precondition == operation::condition::expired) ? this->find(uuid, item.key) : this->find_live(uuid, item.key);
+    };
+
+    auto value_of = [this](const bzn::storage_base::record& record)
+    {
+        return (record.spill_offset < 0) ? record.value : this->read_value(record);
+    };
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+
+    for (const auto& item : operations)
+    {
+        auto record = current(item);
+
+        switch (item.precondition)
+        {
+            case operation::condition::exists:
+                if (!record)
+                {
+                    return storage_base::result::precondition_failed;
+                }
+                break;
+
+            case operation::condition::absent:
+                if (record)
+                {
+                    return storage_base::result::precondition_failed;
+                }
+                break;
+
+            case operation::condition::version:
+                if (!record || record->version() != item.version)
+                {
+                    return storage_base::result::precondition_failed;
+                }
+                break;
+
+            case operation::condition::expired:
+                // compared with the cutoff rather than the clock so every replica agrees...
+                if (!record || !record->expires.count() || record->expires > item.expires)
+                {
+                    return storage_base::result::precondition_failed;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        switch (item.op)
+        {
+            case operation::type::create:
+            case operation::type::update:
+            case operation::type::put:
+                if (item.value.size() > bzn::MAX_VALUE_SIZE)
+                {
+                    return storage_base::result::value_too_large;
+                }
+
+                if (item.op == operation::type::create && record)
+                {
+                    return storage_base::result::exists;
+                }
+
+                if (item.op == operation::type::update && !record)
+                {
+                    return storage_base::result::not_found;
+                }
+
+                staged[item.key] = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{now, item.value, this->generate_transaction_id(), item.expires});
+                break;
+
+            case operation::type::increment:
+            {
+                // a missing record counts as zero...
+                int64_t number = 0;
+
+                if (record)
+                {
+                    const auto value = value_of(*record);
+                    const auto end = value.data() + value.size();
+
+                    if (auto [ptr, ec] = std::from_chars(value.data(), end, number); ec != std::errc() || ptr != end)
+                    {
+                        return storage_base::result::not_a_number;
+                    }
+                }
+
+                if (__builtin_add_overflow(number, item.delta, &number))
+                {
+                    return storage_base::result::not_a_number;
+                }
+
+                staged[item.key] = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{now, std::to_string(number), this->generate_transaction_id(),
+                    (record) ? record->expires : std::chrono::seconds(0)});
+                break;
+            }
+
+            case operation::type::append:
+            {
+                auto value = (record) ? value_of(*record) + item.value : item.value;
+
+                if (value.size() > bzn::MAX_VALUE_SIZE)
+                {
+                    return storage_base::result::value_too_large;
+                }
+
+                staged[item.key] = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{now, std::move(value), this->generate_transaction_id(),
+                    (record) ? record->expires : std::chrono::seconds(0)});
+                break;
+            }
+
+            case operation::type::remove:
+                if (!record)
+                {
+                    return storage_base::result::not_found;
+                }
+
+                staged[item.key] = nullptr;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    for (auto& entry : staged)
+    {
+        auto previous = this->find(uuid, entry.first);
+
+        this->index_record(uuid, entry.first, previous, entry.second);
+
+        if (!entry.second)
+        {
+            if (previous)
+            {
+                this->put(uuid, entry.first, nullptr);
+                get_metrics().keys.add(-1);
+            }
+            continue;
+        }
+
+        get_metrics().bytes_written.increment(entry.second->value.size());
+
+        if (!previous)
+        {
+            get_metrics().keys.add(1);
+        }
+
+        this->put(uuid, entry.first, std::move(entry.second));
+    }
+
+    this->enforce_memory_budget();
+
+    return storage_base::result::ok;
+}
+
+
+std::set<bzn::uuid_t>
+storage::list_databases(const view& view)
+{
+    std::set<bzn::uuid_t> uuids;
+
+    for (const auto& db : *view.databases)
+    {
+        uuids.insert(db.first);
+    }
+
+    for (const auto& db : view.pending)
+    {
+        uuids.insert(db.first);
+    }
+
+    return uuids;
+}
+
+
+std::unordered_map<std::string, bzn::storage::record_ptr>
+storage::copy_database(const view& view, const bzn::uuid_t& uuid)
+{
+    auto db = view.databases->find(uuid);
+    auto pending = view.pending.find(uuid);
+
+    std::unordered_map<std::string, record_ptr> records;
+
+    storage::visit_records((db == view.databases->end()) ? nullptr : &db->second, (pending == view.pending.end()) ? nullptr : pending->second.get(), {},
+        [&](std::string_view key, const record_ptr& record)
+        {
+            // the archive holds every value so spilled ones are read back...
+            records.emplace(key, (record->spill_offset < 0) ? record : std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+                record->timestamp, this->read_value(*record), record->transaction_id, record->expires}));
+            return true;
+        });
+
+    return records;
+}
+
+
+storage_base::result
+storage::save(const std::string& path)
+{
+    // serialized from a view so writers are not held up...
+    const auto view = this->open_view(nullptr);
+
+    try
+    {
+        std::ofstream ofs(path);
+        boost::archive::text_oarchive oa(ofs);
+
+        // the archive keeps the map of maps layout so older snapshots still load...
+        std::unordered_map<bzn::uuid_t, std::unordered_map<std::string, std::shared_ptr<bzn::storage_base::record>>> kv_store;
+
+        for (const auto& uuid : storage::list_databases(view))
+        {
+            kv_store[uuid] = this->copy_database(view, uuid);
+        }
+
+        oa << kv_store;
+    }
+    catch (...)
+    {
+        return storage_base::result::not_saved;
+    }
+
+    LOG(debug) << "saved state as of commit index " << view.commit_index << " to: " << path;
+
+    return storage_base::result::ok;
+}
+
+
+storage_base::result
+storage::load(const std::string& path)
+{
+    if(!boost::filesystem::exists(path))
+    {
+        return storage_base::result::not_found;
+    }
+
+    std::unordered_map<bzn::uuid_t, std::unordered_map<std::string, std::shared_ptr<bzn::storage_base::record>>> kv_store;
+
+    std::ifstream ifs(path);
+    boost::archive::text_iarchive ia(ifs);
+    ia >> kv_store;
+
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+    this->replace_databases(kv_store);
+
+    return storage_base::result::ok;
+}
+
+
+void
+storage::replace_databases(std::unordered_map<bzn::uuid_t, std::unordered_map<std::string, record_ptr>>& kv_store)
+{
+    auto count_keys = [this]()
+    {
+        int64_t keys = 0;
+        for (const auto& db : *this->databases)
+        {
+            keys += db.second.records.size();
+        }
+
+        // pending writes add keys the databases lack and remove ones they have...
+        for (const auto& db : this->pending)
+        {
+            auto base = this->databases->find(db.first);
+
+            for (const auto& write : *db.second)
+            {
+                const bool existed = base != this->databases->end() && base->second.records.find(write.first);
+                keys += int64_t(bool(write.second)) - int64_t(existed);
+            }
+        }
+        return keys;
+    };
+
+    const auto previous_keys = count_keys();
+
+    // open views keep the databases they were reading...
+    this->databases = std::make_shared<database_map>();
+    this->pending.clear();
+    this->sizes.clear();
+    this->trees.clear();
+    this->growing.clear();
+    this->expiry_index.clear();
+    this->lru.clear();
+    this->lru_index.clear();
+    this->resident_bytes = 0;
+
+    for (auto& inner_db : kv_store)
+    {
+        this->databases->try_emplace(inner_db.first);
+        this->dirty.insert(inner_db.first);
+
+        for (auto& record : inner_db.second)
+        {
+            this->index_record(inner_db.first, record.first, nullptr, record.second);
+            this->put(inner_db.first, record.first, std::move(record.second));
+        }
+
+        inner_db.second.clear();
+    }
+
+    this->grow_trees();
+    this->enforce_memory_budget();
+
+    get_metrics().keys.add(count_keys() - previous_keys);
+}
+
+
+void
+storage::start_checkpoints(const std::string& dir, uint64_t every_commits, std::chrono::seconds every)
+{
+    {
+        std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+        this->checkpoint_dir = dir;
+        this->checkpoint_commits = every_commits;
+        this->checkpoint_interval = every;
+        this->checkpoint_time = std::chrono::steady_clock::now();
+    }
+
+    if (!this->checkpoint_thread.joinable())
+    {
+        this->checkpoint_thread = std::thread([this]{ this->run_checkpoints(); });
+    }
+}
+
+
+storage::~storage()
+{
+    if (this->checkpoint_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->checkpoint_lock);
+            this->stopping = true;
+        }
+
+        this->checkpoint_ready.notify_all();
+        this->checkpoint_thread.join();
+    }
+}
+
+
+storage::checkpoint_image
+storage::capture_checkpoint()
+{
+    bzn::metrics::scoped_timer timer(get_metrics().checkpoint_pause);
+
+    // the view keeps writers off the databases until the image is written...
+    checkpoint_image image{{this->databases, this->pending, this->commit_index, view_lease(this->open_views)}, std::move(this->dirty)};
+    ++this->view_epoch;
+
+    this->dirty.clear();
+    this->checkpoint_index = this->commit_index;
+    this->checkpoint_time = std::chrono::steady_clock::now();
+
+    return image;
+}
+
+
+void
+storage::run_checkpoints()
+{
+    std::unique_lock<std::mutex> lock(this->checkpoint_lock);
+
+    while (true)
+    {
+        this->checkpoint_ready.wait(lock, [this]{ return this->stopping || this->next_checkpoint; });
+
+        if (this->stopping)
+        {
+            return;
+        }
+
+        auto image = std::move(*this->next_checkpoint);
+        this->next_checkpoint.reset();
+        this->checkpoint_running = true;
+
+        lock.unlock();
+
+        if (this->write_checkpoint(this->checkpoint_dir, image) != storage_base::result::ok)
+        {
+            LOG(error) << "failed to write checkpoint as of commit index " << image.view.commit_index << " to: " << this->checkpoint_dir;
+
+            // the previous checkpoint still holds these databases as they were...
+            std::lock_guard<std::shared_mutex> storage_lock(this->lock); // lock for write access
+            this->dirty.insert(image.dirty.begin(), image.dirty.end());
+        }
+
+        image = {}; // let writers back onto the databases
+
+        lock.lock();
+        this->checkpoint_running = false;
+        this->checkpoint_ready.notify_all();
+    }
+}
+
+
+storage_base::result
+storage::checkpoint(const std::string& dir)
+{
+    {
+        std::unique_lock<std::mutex> lock(this->checkpoint_lock);
+        this->checkpoint_ready.wait(lock, [this]{ return !this->checkpoint_running && !this->next_checkpoint; });
+        this->checkpoint_running = true;
+    }
+
+    checkpoint_image image;
+    {
+        std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+        image = this->capture_checkpoint();
+    }
+
+    auto result = this->write_checkpoint(dir, image);
+
+    if (result != storage_base::result::ok)
+    {
+        std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+        this->dirty.insert(image.dirty.begin(), image.dirty.end());
+    }
+
+    image = {};
+
+    {
+        std::lock_guard<std::mutex> lock(this->checkpoint_lock);
+        this->checkpoint_running = false;
+    }
+
+    this->checkpoint_ready.notify_all();
+
+    return result;
+}
+
+
+storage_base::result
+storage::write_checkpoint(const std::string& dir, const checkpoint_image& image)
+{
+    bzn::metrics::scoped_timer timer(get_metrics().checkpoint_duration);
+
+    const boost::filesystem::path path{dir};
+    const auto databases = storage::list_databases(image.view);
+
+    // the manifest names the file holding each database, clean ones keep the file of an earlier checkpoint...
+    auto files = this->checkpoint_files;
+
+    for (auto it = files.begin(); it != files.end();)
+    {
+        it = (databases.count(it->first)) ? std::next(it) : files.erase(it);
+    }
+
+    try
+    {
+        boost::filesystem::create_directories(path);
+
+        size_t sequence = 0;
+
+        for (const auto& uuid : image.dirty)
+        {
+            if (!databases.count(uuid))
+            {
+                continue;
+            }
+
+            // never overwrite a file the current manifest may name...
+            std::string name;
+            do
+            {
+                name = std::to_string(image.view.commit_index) + "-" + std::to_string(sequence++) + ".dat";
+            }
+            while (boost::filesystem::exists(path / name));
+
+            std::ofstream ofs((path / name).string());
+            {
+                boost::archive::text_oarchive oa(ofs);
+                oa << this->copy_database(image.view, uuid);
+            }
+            ofs.close();
+
+            if (!ofs)
+            {
+                return storage_base::result::not_saved;
+            }
+
+            files[uuid] = name;
+            get_metrics().checkpoint_databases_written.increment();
+        }
+
+        // the checkpoint moves forward only when the manifest is replaced...
+        std::ofstream ofs((path / "checkpoint.tmp").string());
+        {
+            boost::archive::text_oarchive oa(ofs);
+            oa << image.view.commit_index << files;
+        }
+        ofs.close();
+
+        if (!ofs)
+        {
+            return storage_base::result::not_saved;
+        }
+
+        boost::filesystem::rename(path / "checkpoint.tmp", path / "checkpoint");
+
+        std::set<std::string> referenced;
+        for (const auto& file : files)
+        {
+            referenced.insert(file.second);
+        }
+
+        for (const auto& entry : boost::filesystem::directory_iterator(path))
+        {
+            if (entry.path().extension() == ".dat" && !referenced.count(entry.path().filename().string()))
+            {
+                boost::filesystem::remove(entry.path());
+            }
+        }
+    }
+    catch (...)
+    {
+        return storage_base::result::not_saved;
+    }
+
+    this->checkpoint_files = std::move(files);
+
+    LOG(debug) << "checkpointed " << image.dirty.size() << " of " << databases.size() << " databases as of commit index " << image.view.commit_index << " to: " << dir;
+
+    return storage_base::result::ok;
+}
+
+
+storage_base::result
+storage::load_checkpoint(const std::string& dir, uint64_t& log_index)
+{
+    const boost::filesystem::path path{dir};
+
+    if (!boost::filesystem::exists(path / "checkpoint"))
+    {
+        return storage_base::result::not_found;
+    }
+
+    std::map<bzn::uuid_t, std::string> files;
+    std::unordered_map<bzn::uuid_t, std::unordered_map<std::string, record_ptr>> kv_store;
+
+    try
+    {
+        std::ifstream ifs((path / "checkpoint").string());
+        boost::archive::text_iarchive ia(ifs);
+        ia >> log_index >> files;
+
+        for (const auto& file : files)
+        {
+            std::ifstream db_ifs((path / file.second).string());
+            boost::archive::text_iarchive db_ia(db_ifs);
+            db_ia >> kv_store[file.first];
+        }
+    }
+    catch (...)
+    {
+        return storage_base::result::not_found;
+    }
+
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+    this->replace_databases(kv_store);
+
+    // what was loaded is already on disk...
+    this->dirty.clear();
+    this->checkpoint_files = std::move(files);
+    this->checkpoint_index = log_index;
+    this->state_index = log_index;
+    this->commit_index = log_index;
+    this->commit_slot = 0;
+
+    return storage_base::result::ok;
+}
+
+
+void
+storage::set_state_handler(state_handler handler)
+{
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+    this->state_reporter = std::move(handler);
+}
+
+
+std::vector<uint64_t>
+storage::state_digest(const bzn::uuid_t& uuid, uint8_t depth)
+{
+    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+
+    auto tree = this->trees.find(uuid);
+
+    return (tree != this->trees.end() && tree->second.size()) ? tree->second.level(depth) : std::vector<uint64_t>();
+}
+
+
+std::vector<std::string>
+storage::get_keys(const bzn::uuid_t& uuid)
+{
+    // listed from a view so writers are not held up...
+    const auto view = this->open_view(&uuid);
+
+    auto db = view.databases->find(uuid);
+    auto pending = view.pending.find(uuid);
+
+    std::vector<std::string> keys;
+
+    if (db != view.databases->end())
+    {
+        keys.reserve(db->second.keys.size());
+    }
+
+    storage::visit_records((db == view.databases->end()) ? nullptr : &db->second, (pending == view.pending.end()) ? nullptr : pending->second.get(), {},
+        [&](std::string_view key, const record_ptr& record)
+        {
+            if (!record->is_expired())
+            {
+                keys.emplace_back(key);
+            }
+            return true;
+        });
+
+    return keys;
+}
+
+
+storage_base::scan_result
+storage::scan(const bzn::uuid_t& uuid, const std::string& start, const std::string& end, const std::string& prefix, std::size_t limit)
+{
+    // walked from a view so a long page does not hold up writers...
+    const auto view = this->open_view(&uuid);
+
+    storage_base::scan_result records;
+
+    auto db = view.databases->find(uuid);
+    auto pending = view.pending.find(uuid);
+
+    // keys with the prefix are contiguous so the walk stops at the first one without it...
+    storage::visit_records((db == view.databases->end()) ? nullptr : &db->second, (pending == view.pending.end()) ? nullptr : pending->second.get(),
+        std::max(start, prefix),
+        [&](std::string_view key, const record_ptr& record)
+        {
+            if (records.size() >= limit || (!end.empty() && key >= end) || key.compare(0, prefix.size(), prefix) != 0)
+            {
+                return false;
+            }
+
+            // expired records read as missing until their eviction commits...
+            if (!record->is_expired())
+            {
+                // spilled values are read without making them resident so a scan does not flush the hot set...
+                records.emplace_back(key, (record->spill_offset < 0) ? record : std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+                    record->timestamp, this->read_value(*record), record->transaction_id, record->expires}));
+            }
+            return true;
+        });
+
+    return records;
+}
+
+
+bool
+storage::has(const bzn::uuid_t& uuid, const std::string& key)
+{
+    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+
+    auto record = this->find(uuid, key);
+
+    return record && !record->is_expired();
+}
+
+
+std::vector<std::pair<bzn::uuid_t, std::string>>
+storage::get_expired(std::chrono::seconds now, std::size_t limit)
+{
+    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+
+    std::vector<std::pair<bzn::uuid_t, std::string>> expired;
+
+    for (auto it = this->expiry_index.begin(); it != this->expiry_index.end() && std::get<0>(*it) <= now && expired.size() < limit; ++it)
+    {
+        expired.emplace_back(std::get<1>(*it), std::get<2>(*it));
+    }
+
+    return expired;
+}
+
+
+void
+storage::index_record(const bzn::uuid_t& uuid, const std::string& key, const std::shared_ptr<bzn::storage_base::record>& previous,
+    const std::shared_ptr<bzn::storage_base::record>& current)
+{
+    // value bytes of each database, spilled or not...
+    auto& size = this->sizes[uuid];
+
+    if (previous)
+    {
+        size -= (previous->spill_offset < 0) ? previous->value.size() : previous->spill_size;
+    }
+
+    if (current)
+    {
+        size += (current->spill_offset < 0) ? current->value.size() : current->spill_size;
+    }
+
+    // moving a value to or from the value file leaves the record as it was...
+    if (!previous || !current || previous->transaction_id != current->transaction_id)
+    {
+        this->dirty.insert(uuid);
+
+        auto& tree = this->trees[uuid];
+        const auto key_hash = bzn::merkle_tree::hash(key);
+
+        if (previous)
+        {
+            tree.remove(key_hash, previous->digest);
+        }
+
+        if (current)
+        {
+            current->digest = storage::record_digest(key_hash, *current);
+            tree.add(key_hash, current->digest);
+        }
+
+        if (tree.wanted_depth() != tree.depth())
+        {
+            this->growing.insert(uuid);
+        }
+    }
+    else
+    {
+        current->digest = previous->digest;
+    }
+
+    if (previous && previous->expires.count())
+    {
+        this->expiry_index.erase(std::make_tuple(previous->expires, uuid, key));
+    }
+
+    if (current && current->expires.count())
+    {
+        this->expiry_index.emplace(current->expires, uuid, key);
+    }
+
+    if (!this->memory_budget)
+    {
+        return;
+    }
+
+    if (previous && previous->spill_offset < 0)
+    {
+        this->resident_bytes -= previous->value.size();
+
+        if (auto it = this->lru_index.find(previous.get()); it != this->lru_index.end())
+        {
+            this->lru.erase(it->second);
+            this->lru_index.erase(it);
+        }
+    }
+
+    if (current && current->spill_offset < 0)
+    {
+        this->resident_bytes += current->value.size();
+        this->lru.emplace_front(uuid, key);
+        this->lru_index[current.get()] = this->lru.begin();
+    }
+}
+
+
+bool
+storage::begin_write()
+{
+    this->applied_index = this->commit_index;
+
+    return !this->commit_index || this->commit_index > this->repaired_index;
+}
+
+
+uint64_t
+storage::applied_through() const
+{
+    // the write of the commit index may not have been made yet...
+    return (this->applied_index == this->commit_index || !this->commit_index) ? this->commit_index : this->commit_index - 1;
+}
+
+
+uint64_t
+storage::record_digest(uint64_t key_hash, const bzn::storage_base::record& record)
+{
+    const auto digest = bzn::merkle_tree::hash(record.value, key_hash ^ uint64_t(record.expires.count()));
+
+    return bzn::merkle_tree::hash(std::string_view(reinterpret_cast<const char*>(record.transaction_id.data), record.transaction_id.size()), digest);
+}
+
+
+void
+storage::grow_trees()
+{
+    for (const auto& uuid : this->growing)
+    {
+        bzn::merkle_tree tree(this->trees[uuid].wanted_depth());
+
+        auto db = this->databases->find(uuid);
+        auto pending = this->pending.find(uuid);
+
+        // every record is visited once so the cost is spread over the writes that grew the database...
+        storage::visit_records((db != this->databases->end()) ? &db->second : nullptr, (pending != this->pending.end()) ? pending->second.get() : nullptr, "",
+            [&](std::string_view key, const record_ptr& record)
+            {
+                tree.add(bzn::merkle_tree::hash(key), record->digest);
+                return true;
+            });
+
+        this->trees[uuid] = std::move(tree);
+    }
+
+    this->growing.clear();
+}
+
+
+std::shared_ptr<const storage::state_image>
+storage::capture_state()
+{
+    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+
+    auto image = std::make_shared<state_image>();
+
+    // the lease keeps writers off the databases until the image is dropped...
+    image->view = view{this->databases, this->pending, this->applied_through(), view_lease(this->open_views)};
+    ++this->view_epoch;
+
+    for (const auto& tree : this->trees)
+    {
+        if (tree.second.size())
+        {
+            image->trees.emplace(tree);
+        }
+    }
+
+    return image;
+}
+
+
+std::vector<bzn::uuid_t>
+storage::state_image::databases() const
+{
+    std::vector<bzn::uuid_t> uuids;
+
+    for (const auto& tree : this->trees)
+    {
+        uuids.push_back(tree.first);
+    }
+
+    return uuids;
+}
+
+
+uint8_t
+storage::state_image::depth(const bzn::uuid_t& uuid) const
+{
+    auto tree = this->trees.find(uuid);
+
+    return (tree != this->trees.end()) ? tree->second.depth() : bzn::merkle_tree::MIN_DEPTH;
+}
+
+
+std::vector<uint64_t>
+storage::state_image::digest(const bzn::uuid_t& uuid, uint8_t depth) const
+{
+    auto tree = this->trees.find(uuid);
+
+    return (tree != this->trees.end()) ? tree->second.level(depth) : bzn::merkle_tree(depth).level(depth);
+}
+
+
+bzn::storage_base::scan_result
+storage::image_records(const state_image& image, const bzn::uuid_t& uuid, uint8_t depth, const std::set<size_t>& buckets)
+{
+    const auto& view = image.view;
+
+    auto db = view.databases->find(uuid);
+    auto pending = view.pending.find(uuid);
+
+    scan_result records;
+
+    storage::visit_records((db != view.databases->end()) ? &db->second : nullptr, (pending != view.pending.end()) ? pending->second.get() : nullptr, "",
+        [&](std::string_view key, const record_ptr& record)
+        {
+            if (buckets.count(bzn::merkle_tree::bucket(bzn::merkle_tree::hash(key), depth)))
+            {
+                records.emplace_back(key, record);
+            }
+            return true;
+        });
+
+    // spilled values are read without making them resident, the value file is only appended to...
+    for (auto& record : records)
+    {
+        if (record.second->spill_offset >= 0)
+        {
+            record.second = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+                record.second->timestamp, this->read_value(*record.second), record.second->transaction_id, record.second->expires});
+        }
+    }
+
+    return records;
+}
+
+
+storage_base::result
+storage::repair(uint64_t log_index, std::map<bzn::uuid_t, repaired_database>& databases)
+{
+    std::lock_guard<std::shared_mutex> lock(this->lock); // lock for write access
+
+    // writes after the source's index would be lost...
+    if (this->applied_through() > log_index)
+    {
+        return storage_base::result::precondition_failed;
+    }
+
+    int64_t keys = 0;
+
+    for (auto& db : databases)
+    {
+        const auto& uuid = db.first;
+        auto& repaired = db.second;
+
+        std::vector<std::string> removed;
+
+        {
+            auto base = this->databases->find(uuid);
+            auto pending = this->pending.find(uuid);
+
+            storage::visit_records((base != this->databases->end()) ? &base->second : nullptr, (pending != this->pending.end()) ? pending->second.get() : nullptr, "",
+                [&](std::string_view key, const record_ptr& /*record*/)
+                {
+                    if (repaired.buckets.count(bzn::merkle_tree::bucket(bzn::merkle_tree::hash(key), repaired.depth)))
+                    {
+                        removed.emplace_back(key);
+                    }
+                    return true;
+                });
+        }
+
+        for (const auto& key : removed)
+        {
+            this->index_record(uuid, key, this->find(uuid, key), nullptr);
+            this->put(uuid, key, nullptr);
+        }
+
+        keys -= removed.size();
+
+        for (auto& record : repaired.records)
+        {
+            // a source only sends the buckets asked for...
+            if (!repaired.buckets.count(bzn::merkle_tree::bucket(bzn::merkle_tree::hash(record.first), repaired.depth)) || this->find(uuid, record.first))
+            {
+                continue;
+            }
+
+            this->index_record(uuid, record.first, nullptr, record.second);
+            this->put(uuid, record.first, std::move(record.second));
+            ++keys;
+        }
+    }
+
+    this->repaired_index = std::max(this->repaired_index, log_index);
+    this->grow_trees();
+    this->enforce_memory_budget();
+
+    get_metrics().keys.add(keys);
+
+    return storage_base::result::ok;
+}
+
+
+void
+storage::touch(const bzn::storage_base::record& record)
+{
+    if (!this->memory_budget)
+    {
+        return;
+    }
+
+    get_metrics().value_hits.increment();
+
+    std::lock_guard<std::mutex> lock(this->lru_lock);
+
+    if (auto it = this->lru_index.find(&record); it != this->lru_index.end())
+    {
+        this->lru.splice(this->lru.begin(), this->lru, it->second);
+    }
+}
+
+
+void
+storage::enforce_memory_budget()
+{
+    if (!this->memory_budget)
+    {
+        return;
+    }
+
+    while (this->resident_bytes > this->memory_budget && !this->lru.empty())
+    {
+        const auto [uuid, key] = this->lru.back();
+        const auto record = this->find(uuid, key);
+
+        std::lock_guard<std::mutex> lock(this->value_file_lock);
+
+        if (!this->value_file.is_open())
+        {
+            boost::filesystem::path path{this->value_file_path};
+
+            if (path.has_parent_path() && !boost::filesystem::exists(path.parent_path()))
+            {
+                boost::filesystem::create_directories(path.parent_path());
+            }
+
+            // values are only valid for the life of the process...
+            this->value_file.open(this->value_file_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        }
+
+        this->value_file.seekp(this->value_file_size);
+        this->value_file.write(record->value.data(), record->value.size());
+
+        if (!this->value_file)
+        {
+            LOG(error) << "failed to write value file: " << this->value_file_path << " -- exceeding the memory budget";
+            this->value_file.clear();
+            break;
+        }
+
+        // the metadata stays in memory, readers holding the resident record keep its value...
+        auto spilled = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+            record->timestamp, {}, record->transaction_id, record->expires, this->value_file_size, uint32_t(record->value.size())});
+
+        this->value_file_size += record->value.size();
+
+        this->index_record(uuid, key, record, spilled);
+        this->put(uuid, key, std::move(spilled));
+
+        get_metrics().values_spilled.increment();
+    }
+
+    get_metrics().resident_bytes.set(this->resident_bytes);
+}
+
+
+std::string
+storage::read_value(const bzn::storage_base::record& record)
+{
+    std::string value(record.spill_size, 0);
+
+    std::lock_guard<std::mutex> lock(this->value_file_lock);
+
+    this->value_file.seekg(record.spill_offset);
+    this->value_file.read(&value[0], value.size());
+
+    if (!this->value_file)
+    {
+        LOG(error) << "failed to read value file: " << this->value_file_path;
+        this->value_file.clear();
+    }
+
+    return value;
+}
+
+
+std::shared_ptr<bzn::storage_base::record>
+storage::fault(const bzn::uuid_t& uuid, const std::string& key)
+{
+    get_metrics().value_misses.increment();
+
+    const auto record = this->find(uuid, key);
+
+    auto resident = std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{
+        record->timestamp, this->read_value(*record), record->transaction_id, record->expires});
+
+    this->index_record(uuid, key, record, resident);
+    this->put(uuid, key, resident);
+
+    this->enforce_memory_budget();
+
+    return resident;
+}
+
+
+std::size_t
+storage::get_size(const bzn::uuid_t& uuid)
+{
+    std::shared_lock<std::shared_mutex> lock(this->lock); // lock for read access
+
+    auto size = this->sizes.find(uuid);
 
-    return usage;
+    return (size == this->sizes.end()) ? 0 : size->second;
 }
 
@@ -16,17 +16,101 @@
 
 #include <include/bluzelle.hpp>
 #include <storage/storage_base.hpp>
+#include <storage/key_index.hpp>
+#include <storage/key_store.hpp>
+#include <storage/merkle_tree.hpp>
+#include <storage/record_table.hpp>
 #include <node/node_base.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <shared_mutex>
 #include <boost/serialization/unordered_map.hpp>
 
+#include <gtest/gtest_prod.h>
+
 
 namespace bzn
 {
     class storage : public bzn::storage_base
     {
     public:
+        // hash tree buckets of each database as of a commit index...
+        using state_handler = std::function<void(uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& buckets)>;
+
+        storage() = default;
+
+        /**
+         * @param memory_budget  bytes of values kept in memory, 0 for no limit
+         * @param value_file     append-only file receiving the least recently read values over the budget
+         */
+        storage(size_t memory_budget, std::string value_file);
+
+        ~storage();
+
+        /**
+         * Checkpoint in the background once either trigger is reached, only databases changed since the
+         * previous checkpoint are rewritten.
+         * @param dir            directory holding the checkpoint
+         * @param every_commits  commits between checkpoints, 0 disables the trigger
+         * @param every          time between checkpoints, 0 disables the trigger
+         */
+        void start_checkpoints(const std::string& dir, uint64_t every_commits, std::chrono::seconds every);
+
+        // checkpoints the databases as of the last commit index and waits for it to be written...
+        storage_base::result checkpoint(const std::string& dir);
+
+        /**
+         * Replace the databases with the checkpoint in dir
+         * @param dir        directory holding the checkpoint
+         * @param log_index  set to the last commit index the checkpoint covers
+         */
+        storage_base::result load_checkpoint(const std::string& dir, uint64_t& log_index);
+
+        /**
+         * Report the state of every database each time the commit index enters a new block of checkpoint
+         * commits, every replica reports at the same indexes. Called holding the storage lock.
+         * @param handler  receives the hash tree buckets at merkle_tree::MIN_DEPTH of each database
+         */
+        void set_state_handler(state_handler handler);
+
+        // the hash tree nodes of a database at a depth, empty if it has no records...
+        std::vector<uint64_t> state_digest(const bzn::uuid_t& uuid, uint8_t depth);
+
+        // the databases and their hash trees as of a commit index, for a replica to repair from...
+        class state_image;
+
+        // taken between the writes of two commit indexes...
+        std::shared_ptr<const state_image> capture_state();
+
+        // the records of an image whose keys hash into the buckets at a depth, with their values...
+        scan_result image_records(const state_image& image, const bzn::uuid_t& uuid, uint8_t depth, const std::set<size_t>& buckets);
+
+        // the source's records of some buckets of a database...
+        struct repaired_database
+        {
+            uint8_t depth;
+            std::set<size_t> buckets;
+            scan_result records;
+        };
+
+        /**
+         * Replace the records in the buckets with a source's as of its commit index. The writes of the indexes up to
+         * it are skipped as the databases now hold them.
+         * @param log_index  commit index of the source's image, not behind the commit index here
+         * @param databases  the buckets and records of each database to replace
+         */
+        storage_base::result repair(uint64_t log_index, std::map<bzn::uuid_t, repaired_database>& databases);
+
 
         storage_base::result create(const bzn::uuid_t& uuid, const std::string& key, const std::string& value) override;
 
@@ -36,12 +120,22 @@ namespace bzn
 
         storage_base::result remove(const bzn::uuid_t& uuid, const std::string& key) override;
 
+        storage_base::result apply(const bzn::uuid_t& uuid, const std::vector<operation>& operations) override;
+
+        void set_commit_index(uint64_t log_index) override;
+
+        void set_commit_time(std::chrono::seconds now) override;
+
+        std::vector<std::pair<bzn::uuid_t, std::string>> get_expired(std::chrono::seconds now, std::size_t limit) override;
+
         storage_base::result save(const std::string& path) override;
 
         storage_base::result load(const std::string& path) override;
 
         std::vector<std::string> get_keys(const bzn::uuid_t& uuid) override;
 
+        storage_base::scan_result scan(const bzn::uuid_t& uuid, const std::string& start, const std::string& end, const std::string& prefix, std::size_t limit) override;
+
         bool has(const bzn::uuid_t& uuid, const  std::string& key) override;
 
         std::size_t get_size(const bzn::uuid_t& uuid) override;
@@ -49,11 +143,244 @@ namespace bzn
     private:
         friend class boost::serialization::access;
 
-        bzn::uuid_t generate_random_uuid();
+        FRIEND_TEST(storageTest, test_that_a_view_is_not_changed_by_later_writes);
+        FRIEND_TEST(storageTest, test_that_views_share_pending_writes_and_they_are_merged_a_few_at_a_time);
+
+        using record_ptr = std::shared_ptr<bzn::storage_base::record>;
+
+        // keys in order for range scans, they and the table are views of the key store's bytes...
+        struct database
+        {
+            bzn::key_store    key_bytes;
+            bzn::key_index    keys;
+            bzn::record_table records;
+        };
+
+        using database_map = std::unordered_map<bzn::uuid_t, database>;
+
+        // writes made while a view holds the databases, nullptr marks a removal...
+        using pending_writes = std::map<std::string, record_ptr>;
+
+        // views share the writes of each database, a writer copies them before changing ones a view holds...
+        using pending_map = std::unordered_map<bzn::uuid_t, std::shared_ptr<pending_writes>>;
+
+        // counted among the open views while it or a copy lives, writers acquire the count so a view's reads happen before their writes...
+        class view_lease
+        {
+        public:
+            view_lease() = default;
+            explicit view_lease(std::shared_ptr<std::atomic<size_t>> open_views);
+            view_lease(const view_lease& other);
+            view_lease(view_lease&& other) noexcept = default;
+            view_lease& operator=(view_lease other) noexcept;
+            ~view_lease();
+
+        private:
+            std::shared_ptr<std::atomic<size_t>> open_views;
+        };
+
+        // the databases as of a commit index, read without the lock...
+        struct view
+        {
+            std::shared_ptr<const database_map> databases;
+            pending_map pending;
+            uint64_t commit_index;
+            view_lease lease;
+        };
+
+        // a view of the databases and the ones changed since the previous checkpoint...
+        struct checkpoint_image
+        {
+            storage::view view;
+            std::set<bzn::uuid_t> dirty;
+        };
+
+        bzn::transaction_id_t generate_transaction_id();
+
+        // pending writes of the given database only, or of all of them for nullptr...
+        view open_view(const bzn::uuid_t* uuid);
+
+        record_ptr find(const bzn::uuid_t& uuid, const std::string& key) const;
+
+        // the record as the write being applied sees it, one expired at the commit time is absent...
+        record_ptr find_live(const bzn::uuid_t& uuid, const std::string& key) const;
+        bool expired_at_commit(const bzn::storage_base::record& record) const;
+        void put(const bzn::uuid_t& uuid, const std::string& key, record_ptr record);
+        void write_record(const bzn::uuid_t& uuid, const std::string& key, record_ptr record);
+        void erase(bzn::storage::database& db, const std::string& key);
+
+        // copies the live keys into a fresh key store...
+        static void compact(bzn::storage::database& db);
+
+        // folds up to limit pending writes into the databases, call once no view holds them...
+        void merge_pending(size_t limit);
+
+        // databases in the view and the records of one with every value resident...
+        static std::set<bzn::uuid_t> list_databases(const view& view);
+        std::unordered_map<std::string, record_ptr> copy_database(const view& view, const bzn::uuid_t& uuid);
+
+        // call holding the lock for write access...
+        void replace_databases(std::unordered_map<bzn::uuid_t, std::unordered_map<std::string, record_ptr>>& kv_store);
+
+        // records in key order from start until visit returns false, keys are passed as views...
+        template <typename Visit>
+        static void visit_records(const database* db, const pending_writes* pending, const std::string& start, Visit&& visit);
+
+        void index_record(const bzn::uuid_t& uuid, const std::string& key, const std::shared_ptr<bzn::storage_base::record>& previous,
+            const std::shared_ptr<bzn::storage_base::record>& current);
+
+        // call holding the lock for write access before a write of the commit index, false if a repair already covers it...
+        bool begin_write();
 
-        std::unordered_map<bzn::uuid_t, std::unordered_map<std::string, std::shared_ptr<bzn::storage_base::record>>> kv_store;
+        // call holding the lock, the commit index the databases hold all the writes of...
+        uint64_t applied_through() const;
+
+        // what a replica that applied the same write holds, the timestamp is local so it is left out...
+        static uint64_t record_digest(uint64_t key_hash, const bzn::storage_base::record& record);
+
+        // call holding the lock for write access once the writes of a commit index are in...
+        void grow_trees();
+
+        // call holding the lock for write access...
+        checkpoint_image capture_checkpoint();
+        storage_base::result write_checkpoint(const std::string& dir, const checkpoint_image& image);
+        void run_checkpoints();
+
+        void touch(const bzn::storage_base::record& record);
+        void enforce_memory_budget();
+        std::string read_value(const bzn::storage_base::record& record);
+        std::shared_ptr<bzn::storage_base::record> fault(const bzn::uuid_t& uuid, const std::string& key);
+
+        // shared with open views, writers leave it alone while they hold it...
+        std::shared_ptr<database_map> databases = std::make_shared<database_map>();
+        pending_map pending;
+
+        // views holding the databases, shared so a view may outlive the storage...
+        std::shared_ptr<std::atomic<size_t>> open_views = std::make_shared<std::atomic<size_t>>(0);
+
+        // bumped by every view opened, a database's pending writes are copied before a write if a view was opened since
+        // they were stamped...
+        std::atomic<uint64_t> view_epoch{0};
+        std::unordered_map<bzn::uuid_t, uint64_t> pending_epochs;
+
+        std::unordered_map<bzn::uuid_t, size_t> sizes; // value bytes of each database
+
+        // kept up to date by every write, a tree is rebuilt deeper as its database grows...
+        std::unordered_map<bzn::uuid_t, bzn::merkle_tree> trees;
+        std::set<bzn::uuid_t> growing;
+
+        state_handler state_reporter;
+        uint64_t state_index = 0;
+
+        // the last commit index that had its write applied and the last one a repair brought the databases to...
+        uint64_t applied_index = 0;
+        uint64_t repaired_index = 0;
+
+        // every replica applies the same writes for an index so they derive the same ids...
+        uint64_t commit_index = 0;
+        uint64_t commit_slot = 0;
+
+        // and decide which records have expired by the time stamped into the entry, not their clocks...
+        std::chrono::seconds commit_time{0};
+
+        // databases changed since the last checkpoint was captured...
+        std::set<bzn::uuid_t> dirty;
+
+        // the checkpoint files of each database as of the last checkpoint written, rewritten only when dirty...
+        std::map<bzn::uuid_t, std::string> checkpoint_files;
+        uint64_t checkpoint_index = 0;
+        std::chrono::steady_clock::time_point checkpoint_time = std::chrono::steady_clock::now();
+
+        // a single writer thread so a checkpoint never waits on the disk under the lock...
+        std::string checkpoint_dir;
+        uint64_t checkpoint_commits = 0;
+        std::chrono::seconds checkpoint_interval{0};
+        std::optional<checkpoint_image> next_checkpoint;
+        bool checkpoint_running = false;
+        bool stopping = false;
+        std::mutex checkpoint_lock;
+        std::condition_variable checkpoint_ready;
+        std::thread checkpoint_thread;
+
+        // records carrying a ttl ordered by expiry so a sweep only visits expired keys...
+        std::set<std::tuple<std::chrono::seconds, bzn::uuid_t, std::string>> expiry_index;
+
+        // resident values from most to least recently read, tracked only with a budget...
+        const size_t memory_budget = 0;
+        const std::string value_file_path;
+        size_t resident_bytes = 0;
+        std::list<std::pair<bzn::uuid_t, std::string>> lru;
+        std::unordered_map<const bzn::storage_base::record*, std::list<std::pair<bzn::uuid_t, std::string>>::iterator> lru_index;
+        std::mutex lru_lock; // readers reorder the lru under the shared lock
+
+        std::fstream value_file;
+        int64_t value_file_size = 0;
+        std::mutex value_file_lock; // scans read spilled values under the shared lock
 
         std::shared_mutex lock; // for multi-reader and single writer access
     };
 
+
+    class storage::state_image
+    {
+    public:
+        uint64_t commit_index() const { return this->view.commit_index; }
+
+        // databases with records...
+        std::vector<bzn::uuid_t> databases() const;
+
+        uint8_t depth(const bzn::uuid_t& uuid) const;
+
+        // the hash tree nodes of a database at a depth no deeper than its tree...
+        std::vector<uint64_t> digest(const bzn::uuid_t& uuid, uint8_t depth) const;
+
+    private:
+        friend class storage;
+
+        storage::view view;
+        std::unordered_map<bzn::uuid_t, bzn::merkle_tree> trees;
+    };
+
+
+    template <typename Visit>
+    void
+    storage::visit_records(const database* db, const pending_writes* pending, const std::string& start, Visit&& visit)
+    {
+        static const bzn::key_index no_keys;
+        static const pending_writes no_writes;
+
+        const auto& keys = (db) ? db->keys : no_keys;
+        const auto& writes = (pending) ? *pending : no_writes;
+
+        auto key = keys.lower_bound(start);
+        auto write = writes.lower_bound(start);
+
+        while (key != keys.end() || write != writes.end())
+        {
+            // a pending write replaces the database's record...
+            if (write != writes.end() && (key == keys.end() || write->first <= *key))
+            {
+                if (key != keys.end() && *key == write->first)
+                {
+                    ++key;
+                }
+
+                if (write->second && !visit(write->first, write->second))
+                {
+                    return;
+                }
+
+                ++write;
+                continue;
+            }
+
+            if (!visit(*key, *db->records.find(*key)))
+            {
+                return;
+            }
+
+            ++key;
+        }
+    }
+
 } // bzn
@@ -17,15 +17,23 @@
 #include <include/bluzelle.hpp>
 #include <memory>
 #include <string>
+#include <vector>
 #include <chrono>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/serialization/shared_ptr.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/uuid/string_generator.hpp>
 
 namespace bzn
 {
     const size_t MAX_VALUE_SIZE = 307200;
 
+    // log index and write slot (16 bytes), its string form is the version seen by clients and kept in snapshots...
+    using transaction_id_t = boost::uuids::uuid;
+
     class storage_base
     {
     public:
@@ -35,22 +43,79 @@ namespace bzn
             friend class boost::serialization::access;
             std::chrono::seconds timestamp;
             std::string          value;
-            bzn::uuid_t          transaction_id;
+            bzn::transaction_id_t transaction_id{};
+            std::chrono::seconds expires{0}; // since the epoch, 0 never expires
+
+            // set by storage when the value was moved to its value file (not serialized)...
+            int64_t              spill_offset = -1;
+            uint32_t             spill_size = 0;
+
+            // set by storage from the key and contents for its hash trees (not serialized)...
+            uint64_t             digest = 0;
 
             template <class Archive>
             void
-            serialize(Archive& ar, const unsigned int /*version*/)
+            serialize(Archive& ar, const unsigned int version)
             {
                 auto ts = this->timestamp.count();
+                auto expires = this->expires.count();
+
+                auto transaction_id = boost::uuids::to_string(this->transaction_id);
 
-                ar & this->value & this->transaction_id & ts;
+                ar & this->value & transaction_id & ts;
+
+                if (version > 0)
+                {
+                    ar & expires;
+                }
 
                 this->timestamp = std::chrono::seconds(ts);
+                this->expires = std::chrono::seconds(expires);
+
+                if constexpr (Archive::is_loading::value)
+                {
+                    this->transaction_id = boost::uuids::string_generator()(transaction_id);
+                }
+            }
+
+            std::string version() const
+            {
+                return boost::uuids::to_string(this->transaction_id);
+            }
+
+            bool is_expired() const
+            {
+                return this->is_expired(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()));
+            }
+
+            bool is_expired(std::chrono::seconds now) const
+            {
+                return this->expires.count() && this->expires <= now;
             }
         };
 
+        using scan_result = std::vector<std::pair<std::string, std::shared_ptr<bzn::storage_base::record>>>;
+
         enum class result : uint8_t
-        { ok=0, not_found, exists, not_saved, value_too_large };
+        { ok=0, not_found, exists, not_saved, value_too_large, precondition_failed, not_a_number };
+
+        // one step of an all-or-nothing apply...
+        struct operation
+        {
+            enum class type : uint8_t
+            { check=0, create, update, remove, increment, append, put };
+
+            enum class condition : uint8_t
+            { none=0, exists, absent, version, expired };
+
+            type         op = type::check;
+            condition    precondition = condition::none;
+            std::string  key;
+            std::string  value;
+            bzn::uuid_t  version; // compared when precondition is condition::version
+            int64_t      delta = 0;
+            std::chrono::seconds expires{0}; // of the written record, or the cutoff for condition::expired
+        };
 
         virtual ~storage_base() = default;
 
@@ -62,14 +127,31 @@ namespace bzn
 
         virtual storage_base::result remove(const bzn::uuid_t& uuid, const std::string& key) = 0;
 
+        // applies every operation in order or, on the first failure, none of them...
+        virtual storage_base::result apply(const bzn::uuid_t& uuid, const std::vector<operation>& operations) = 0;
+
+        // transaction ids of the writes that follow are numbered from this committed raft log index...
+        virtual void set_commit_index(uint64_t log_index) = 0;
+
+        // the writes that follow treat records expired at this time (stamped into the entry by the leader) as absent, 0 for none...
+        virtual void set_commit_time(std::chrono::seconds now) = 0;
+
+        // keys whose expiry has passed in expiry order, across all databases...
+        virtual std::vector<std::pair<bzn::uuid_t, std::string>> get_expired(std::chrono::seconds now, std::size_t limit) = 0;
+
         virtual storage_base::result save(const std::string& path) = 0;
 
         virtual storage_base::result load(const std::string& path) = 0;
 
         virtual std::vector<std::string> get_keys(const bzn::uuid_t& uuid) = 0;
+
+        // at most limit records in key order from start up to, not including, end (empty for no bound) that begin with prefix...
+        virtual scan_result scan(const bzn::uuid_t& uuid, const std::string& start, const std::string& end, const std::string& prefix, std::size_t limit) = 0;
         
         virtual bool has(const bzn::uuid_t& uuid, const  std::string& key) = 0;
 
         virtual std::size_t get_size(const bzn::uuid_t& uuid) = 0;
     };
 } // bzn
+
+BOOST_CLASS_VERSION(bzn::storage_base::record, 1)
@@ -0,0 +1,94 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/key_index.hpp>
+#include <gtest/gtest.h>
+#include <random>
+#include <set>
+#include <string>
+
+
+namespace
+{
+    std::vector<std::string> list(const bzn::key_index& index, const std::string& start = {})
+    {
+        std::vector<std::string> keys;
+        for (auto it = index.lower_bound(start); it != index.end(); ++it)
+        {
+            keys.emplace_back(*it);
+        }
+        return keys;
+    }
+}
+
+
+TEST(key_index, test_that_keys_are_listed_in_order_from_a_start)
+{
+    const std::vector<std::string> keys{"b", "d", "a", "c"};
+    bzn::key_index index;
+
+    EXPECT_EQ(index.begin(), index.end());
+    EXPECT_EQ(index.lower_bound("a"), index.end());
+    EXPECT_FALSE(index.erase("a"));
+
+    for (const auto& key : keys)
+    {
+        EXPECT_TRUE(index.insert(key));
+    }
+
+    EXPECT_FALSE(index.insert(keys[0]));
+    EXPECT_EQ(size_t(4), index.size());
+
+    EXPECT_EQ(std::vector<std::string>({"a", "b", "c", "d"}), list(index));
+    EXPECT_EQ(std::vector<std::string>({"c", "d"}), list(index, "bb"));
+    EXPECT_EQ(index.lower_bound("e"), index.end());
+
+    EXPECT_TRUE(index.erase("b"));
+    EXPECT_FALSE(index.erase("b"));
+    EXPECT_EQ(std::vector<std::string>({"a", "c", "d"}), list(index));
+}
+
+
+TEST(key_index, test_that_the_index_matches_an_ordered_set_across_many_blocks)
+{
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<size_t> dist(0, 5000);
+
+    // the index only holds views so the set owns the bytes...
+    std::set<std::string> owned;
+    std::set<std::string> expected;
+    bzn::key_index index;
+
+    for (size_t i = 0; i < 20000; ++i)
+    {
+        const auto key = "key." + std::to_string(dist(gen));
+
+        if (i % 3 == 2)
+        {
+            EXPECT_EQ(expected.erase(key) == 1, index.erase(key));
+            continue;
+        }
+
+        const auto& stored = *owned.insert(key).first;
+        EXPECT_EQ(expected.insert(key).second, index.insert(stored));
+    }
+
+    EXPECT_EQ(expected.size(), index.size());
+    EXPECT_EQ(std::vector<std::string>(expected.begin(), expected.end()), list(index));
+
+    for (const auto& start : {"key.1", "key.25", "key.4999", "key.9"})
+    {
+        EXPECT_EQ(std::vector<std::string>(expected.lower_bound(start), expected.end()), list(index, start));
+    }
+}
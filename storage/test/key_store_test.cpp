@@ -0,0 +1,70 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/key_store.hpp>
+#include <gtest/gtest.h>
+#include <string>
+
+
+TEST(key_store, test_that_added_keys_stay_valid_as_the_store_grows)
+{
+    bzn::key_store store;
+
+    std::vector<std::string_view> views;
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        views.push_back(store.add("key." + std::to_string(i)));
+    }
+
+    // a key larger than any chunk...
+    const std::string large(100000, 'x');
+    const auto large_view = store.add(large);
+
+    for (size_t i = 0; i < views.size(); ++i)
+    {
+        EXPECT_EQ("key." + std::to_string(i), views[i]);
+    }
+
+    EXPECT_EQ(large, large_view);
+    EXPECT_NE(large.data(), large_view.data());
+}
+
+
+TEST(key_store, test_that_compaction_is_wanted_once_most_bytes_are_removed)
+{
+    bzn::key_store store;
+
+    std::vector<std::string_view> views;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        views.push_back(store.add("key." + std::to_string(i)));
+    }
+
+    const auto bytes = store.size();
+
+    for (size_t i = 0; i < 500; ++i)
+    {
+        store.remove(views[i]);
+    }
+
+    EXPECT_FALSE(store.wants_compaction());
+
+    for (size_t i = 500; i < 600; ++i)
+    {
+        store.remove(views[i]);
+    }
+
+    EXPECT_TRUE(store.wants_compaction());
+    EXPECT_LT(store.size(), bytes / 2);
+}
@@ -0,0 +1,136 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/merkle_tree.hpp>
+#include <gtest/gtest.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+
+TEST(merkle_tree, test_that_the_hash_covers_every_byte)
+{
+    const std::string data(100, 'x');
+
+    EXPECT_EQ(bzn::merkle_tree::hash(data), bzn::merkle_tree::hash(std::string(100, 'x')));
+    EXPECT_NE(bzn::merkle_tree::hash(data), bzn::merkle_tree::hash(data, 1));
+    EXPECT_NE(bzn::merkle_tree::hash(""), bzn::merkle_tree::hash(std::string(1, '\0')));
+
+    // a change in any lane or in the tail...
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        auto changed = data;
+        changed[i] = 'y';
+        EXPECT_NE(bzn::merkle_tree::hash(data), bzn::merkle_tree::hash(changed)) << i;
+    }
+}
+
+
+TEST(merkle_tree, test_that_the_tree_depends_on_its_records_and_not_their_order)
+{
+    bzn::merkle_tree a, b;
+
+    for (uint64_t i = 1; i <= 100; ++i)
+    {
+        a.add(bzn::merkle_tree::hash(std::to_string(i)), i);
+        b.add(bzn::merkle_tree::hash(std::to_string(101 - i)), 101 - i);
+    }
+
+    EXPECT_EQ(a.root(), b.root());
+    EXPECT_EQ(size_t(100), a.size());
+
+    // a changed record shows in one bucket only...
+    const auto key_hash = bzn::merkle_tree::hash("7");
+    b.remove(key_hash, 7);
+    b.add(key_hash, 8);
+
+    const auto before = a.level(bzn::merkle_tree::MIN_DEPTH);
+    const auto after = b.level(bzn::merkle_tree::MIN_DEPTH);
+
+    for (size_t i = 0; i < before.size(); ++i)
+    {
+        EXPECT_EQ(i != bzn::merkle_tree::bucket(key_hash, bzn::merkle_tree::MIN_DEPTH), before[i] == after[i]) << i;
+    }
+
+    // and removing everything leaves an empty tree...
+    for (uint64_t i = 1; i <= 100; ++i)
+    {
+        a.remove(bzn::merkle_tree::hash(std::to_string(i)), i);
+    }
+
+    EXPECT_EQ(uint64_t(0), a.root());
+    EXPECT_EQ(size_t(0), a.size());
+}
+
+
+TEST(merkle_tree, test_that_trees_of_any_depth_agree_on_their_shared_levels)
+{
+    bzn::merkle_tree shallow;
+    bzn::merkle_tree deep(10);
+
+    for (uint64_t i = 0; i < 5000; ++i)
+    {
+        shallow.add(bzn::merkle_tree::hash(std::to_string(i)), i * 7919);
+        deep.add(bzn::merkle_tree::hash(std::to_string(i)), i * 7919);
+    }
+
+    EXPECT_EQ(uint8_t(10), deep.depth());
+    EXPECT_EQ(shallow.root(), deep.root());
+    EXPECT_EQ(shallow.level(4), deep.level(4));
+    EXPECT_EQ(size_t(1024), deep.level(12).size());
+
+    // the shallow tree has outgrown its leaves...
+    EXPECT_EQ(uint8_t(4), shallow.depth());
+    EXPECT_EQ(uint8_t(10), shallow.wanted_depth());
+}
+
+
+// ./storage_tests --gtest_also_run_disabled_tests --gtest_filter=merkle_tree.DISABLED_benchmark_update_and_hash
+TEST(merkle_tree, DISABLED_benchmark_update_and_hash)
+{
+    const size_t UPDATES = 10000000;
+
+    std::mt19937_64 gen(std::random_device{}());
+
+    for (const uint8_t depth : {bzn::merkle_tree::MIN_DEPTH, bzn::merkle_tree::MAX_DEPTH})
+    {
+        bzn::merkle_tree tree(depth);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < UPDATES; ++i)
+        {
+            tree.add(gen(), gen());
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "depth " << int(depth) << ": " << elapsed / double(UPDATES) << "ns per update (" << tree.root() << ")\n";
+    }
+
+    for (const size_t size : {16, 100, 1024, 300 * 1024})
+    {
+        const std::string value(size, 'v');
+        const size_t rounds = (1024 * 1024 * 1024) / size;
+
+        uint64_t digest = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            digest = bzn::merkle_tree::hash(value, digest);
+        }
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << size << " byte values: " << (rounds * size) / elapsed / (1024 * 1024 * 1024) << "GiB/s (" << digest << ")\n";
+    }
+}
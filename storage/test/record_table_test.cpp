@@ -0,0 +1,95 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <storage/record_table.hpp>
+#include <gtest/gtest.h>
+#include <set>
+
+
+namespace
+{
+    std::shared_ptr<bzn::storage_base::record> make_record(const std::string& value)
+    {
+        return std::make_shared<bzn::storage_base::record>(bzn::storage_base::record{std::chrono::seconds(0), value});
+    }
+}
+
+
+TEST(record_table, test_that_records_can_be_inserted_found_and_erased)
+{
+    std::set<std::string> keys{"a", "b"};
+    bzn::record_table table;
+
+    EXPECT_EQ(nullptr, table.find("a"));
+    EXPECT_FALSE(table.erase("a"));
+
+    EXPECT_TRUE(table.insert(*keys.find("a"), make_record("1")));
+    EXPECT_FALSE(table.insert(*keys.find("a"), make_record("2")));
+    EXPECT_TRUE(table.insert(*keys.find("b"), make_record("3")));
+
+    EXPECT_EQ(size_t(2), table.size());
+    ASSERT_NE(nullptr, table.find("a"));
+    EXPECT_EQ("1", (*table.find("a"))->value);
+
+    // found through any view of the same bytes...
+    *table.find(std::string("b")) = make_record("4");
+    EXPECT_EQ("4", (*table.find("b"))->value);
+
+    EXPECT_TRUE(table.erase("a"));
+    EXPECT_EQ(nullptr, table.find("a"));
+    EXPECT_EQ(size_t(1), table.size());
+
+    table.clear();
+    EXPECT_EQ(nullptr, table.find("b"));
+    EXPECT_EQ(size_t(0), table.size());
+}
+
+
+TEST(record_table, test_that_erasing_keeps_the_rest_of_a_probe_run_reachable)
+{
+    std::set<std::string> keys;
+    bzn::record_table table;
+
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        const auto& key = *keys.insert("key." + std::to_string(i)).first;
+        ASSERT_TRUE(table.insert(key, make_record(key)));
+    }
+
+    // load stays under 3/4...
+    EXPECT_LE(table.size() * 4, table.capacity() * 3);
+
+    for (size_t i = 0; i < 10000; i += 3)
+    {
+        ASSERT_TRUE(table.erase("key." + std::to_string(i)));
+    }
+
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        const auto key = "key." + std::to_string(i);
+        auto record = table.find(key);
+
+        if (i % 3)
+        {
+            ASSERT_NE(nullptr, record);
+            EXPECT_EQ(key, (*record)->value);
+        }
+        else
+        {
+            EXPECT_EQ(nullptr, record);
+        }
+    }
+
+    EXPECT_EQ(size_t(6666), table.size());
+}
@@ -13,6 +13,7 @@
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <storage/storage.hpp>
+#include <metrics/metrics.hpp>
 #include <mocks/mock_node_base.hpp>
 #include <storage/storage_base.hpp>
 #include <boost/chrono.hpp>
@@ -22,6 +23,13 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <set>
+#include <thread>
+#include <malloc.h>
 
 using namespace ::testing;
 
@@ -88,7 +96,7 @@ TEST_F(storageTest, test_that_storage_can_create_a_record_and_read_the_same_reco
 
     const auto returned_record = this->storage->read(USER_UUID, KEY);
 
-    EXPECT_TRUE(returned_record->transaction_id.size()>0); // todo: maybe check for valid uuid?
+    EXPECT_FALSE(returned_record->transaction_id.is_nil());
 
     EXPECT_EQ(returned_record->value.size(), this->storage->get_size(USER_UUID));
 
@@ -309,3 +317,902 @@ TEST_F(storageTest, test_that_storage_fails_to_update_with_a_value_that_exceeds_
     EXPECT_EQ(expected_value, this->storage->read(USER_UUID, KEY)->value);
 }
 
+
+
+TEST_F(storageTest, test_that_storage_applies_operations_all_or_nothing)
+{
+    using operation = bzn::storage_base::operation;
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, "a", "1"));
+    const auto version = this->storage->read(USER_UUID, "a")->version();
+
+    // a failed precondition leaves everything as it was...
+    EXPECT_EQ(bzn::storage_base::result::precondition_failed, this->storage->apply(USER_UUID, {
+        {operation::type::create, operation::condition::none, "b", "2", {}},
+        {operation::type::update, operation::condition::version, "a", "3", "stale"}}));
+
+    EXPECT_FALSE(this->storage->has(USER_UUID, "b"));
+    EXPECT_EQ("1", this->storage->read(USER_UUID, "a")->value);
+
+    // later operations see earlier ones...
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::create, operation::condition::absent, "b", "2", {}},
+        {operation::type::update, operation::condition::exists, "b", "4", {}},
+        {operation::type::update, operation::condition::version, "a", "3", version},
+        {operation::type::remove, operation::condition::none, "a", {}, {}},
+        {operation::type::check, operation::condition::absent, "a", {}, {}}}));
+
+    EXPECT_FALSE(this->storage->has(USER_UUID, "a"));
+    EXPECT_EQ("4", this->storage->read(USER_UUID, "b")->value);
+
+    // an operation failure is reported like its single op counterpart...
+    EXPECT_EQ(bzn::storage_base::result::exists, this->storage->apply(USER_UUID, {
+        {operation::type::remove, operation::condition::none, "b", {}, {}},
+        {operation::type::create, operation::condition::none, "b", "5", {}},
+        {operation::type::create, operation::condition::none, "b", "6", {}}}));
+
+    EXPECT_EQ("4", this->storage->read(USER_UUID, "b")->value);
+
+    // a put creates or replaces...
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::put, operation::condition::none, "b", "7", {}},
+        {operation::type::put, operation::condition::none, "c", "8", {}}}));
+
+    EXPECT_EQ("7", this->storage->read(USER_UUID, "b")->value);
+    EXPECT_EQ("8", this->storage->read(USER_UUID, "c")->value);
+}
+
+
+TEST_F(storageTest, test_that_storage_increments_and_appends_values)
+{
+    using operation = bzn::storage_base::operation;
+
+    // a missing record counts as zero...
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {{operation::type::increment, operation::condition::none, "counter", {}, {}, 5}}));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {{operation::type::increment, operation::condition::none, "counter", {}, {}, -7}}));
+    EXPECT_EQ("-2", this->storage->read(USER_UUID, "counter")->value);
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, "text", "abc"));
+    EXPECT_EQ(bzn::storage_base::result::not_a_number, this->storage->apply(USER_UUID, {{operation::type::increment, operation::condition::none, "text", {}, {}, 1}}));
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, "max", std::to_string(std::numeric_limits<int64_t>::max())));
+    EXPECT_EQ(bzn::storage_base::result::not_a_number, this->storage->apply(USER_UUID, {{operation::type::increment, operation::condition::none, "max", {}, {}, 1}}));
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {{operation::type::append, operation::condition::none, "text", "def", {}}}));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {{operation::type::append, operation::condition::none, "list", "x", {}}}));
+    EXPECT_EQ("abcdef", this->storage->read(USER_UUID, "text")->value);
+    EXPECT_EQ("x", this->storage->read(USER_UUID, "list")->value);
+
+    std::string big(bzn::MAX_VALUE_SIZE, 'c');
+    EXPECT_EQ(bzn::storage_base::result::value_too_large, this->storage->apply(USER_UUID, {{operation::type::append, operation::condition::none, "text", big, {}}}));
+    EXPECT_EQ("abcdef", this->storage->read(USER_UUID, "text")->value);
+}
+
+
+TEST_F(storageTest, test_that_storage_scans_keys_in_order)
+{
+    for (const auto& key : {"b/2", "a/1", "b/1", "c/1", "b/3"})
+    {
+        EXPECT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, key, key));
+    }
+
+    auto keys = [](const bzn::storage_base::scan_result& records)
+    {
+        std::vector<std::string> keys;
+        for (const auto& record : records)
+        {
+            keys.emplace_back(record.first);
+        }
+        return keys;
+    };
+
+    const auto all = std::numeric_limits<size_t>::max();
+
+    EXPECT_EQ(keys(this->storage->scan(USER_UUID, "", "", "", all)), std::vector<std::string>({"a/1", "b/1", "b/2", "b/3", "c/1"}));
+    EXPECT_EQ(keys(this->storage->scan(USER_UUID, "", "", "b/", all)), std::vector<std::string>({"b/1", "b/2", "b/3"}));
+    EXPECT_EQ(keys(this->storage->scan(USER_UUID, "b/2", "", "b/", 1)), std::vector<std::string>({"b/2"}));
+    EXPECT_EQ(keys(this->storage->scan(USER_UUID, "a", "b/3", "", all)), std::vector<std::string>({"a/1", "b/1", "b/2"}));
+    EXPECT_TRUE(this->storage->scan("unknown", "", "", "", all).empty());
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->remove(USER_UUID, "b/2"));
+    EXPECT_EQ(keys(this->storage->scan(USER_UUID, "", "", "b/", all)), std::vector<std::string>({"b/1", "b/3"}));
+    EXPECT_EQ(this->storage->get_keys(USER_UUID), std::vector<std::string>({"a/1", "b/1", "b/3", "c/1"}));
+    EXPECT_EQ(this->storage->scan(USER_UUID, "", "", "", all).front().second->value, "a/1");
+}
+
+
+TEST_F(storageTest, test_that_expired_records_read_as_missing_until_evicted)
+{
+    using operation = bzn::storage_base::operation;
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::create, operation::condition::none, "old", "1", {}, 0, now - std::chrono::seconds(10)},
+        {operation::type::create, operation::condition::none, "stale", "2", {}, 0, now - std::chrono::seconds(5)},
+        {operation::type::create, operation::condition::none, "fresh", "3", {}, 0, now + std::chrono::seconds(60)}}));
+
+    EXPECT_EQ(nullptr, this->storage->read(USER_UUID, "old"));
+    EXPECT_FALSE(this->storage->has(USER_UUID, "stale"));
+    EXPECT_EQ("3", this->storage->read(USER_UUID, "fresh")->value);
+    EXPECT_EQ(this->storage->get_keys(USER_UUID), std::vector<std::string>({"fresh"}));
+    EXPECT_EQ(this->storage->scan(USER_UUID, "", "", "", 10).size(), size_t(1));
+
+    // oldest first and bounded...
+    EXPECT_EQ(this->storage->get_expired(now, 1), (std::vector<std::pair<bzn::uuid_t, std::string>>{{USER_UUID, "old"}}));
+    EXPECT_EQ(this->storage->get_expired(now, 10).size(), size_t(2));
+
+    // an update without a ttl keeps the record...
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->update(USER_UUID, "fresh", "4"));
+    EXPECT_EQ(this->storage->get_expired(now + std::chrono::seconds(120), 10).size(), size_t(2));
+
+    // eviction is decided by the cutoff, not the clock...
+    EXPECT_EQ(bzn::storage_base::result::precondition_failed, this->storage->apply(USER_UUID, {
+        {operation::type::remove, operation::condition::expired, "old", {}, {}, 0, now - std::chrono::seconds(20)}}));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::remove, operation::condition::expired, "old", {}, {}, 0, now}}));
+    EXPECT_EQ(bzn::storage_base::result::precondition_failed, this->storage->apply(USER_UUID, {
+        {operation::type::remove, operation::condition::expired, "fresh", {}, {}, 0, now}}));
+
+    EXPECT_EQ(this->storage->get_expired(now, 10), (std::vector<std::pair<bzn::uuid_t, std::string>>{{USER_UUID, "stale"}}));
+}
+
+
+TEST_F(storageTest, test_that_writes_find_records_expired_at_the_commit_time_absent)
+{
+    using operation = bzn::storage_base::operation;
+
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::create, operation::condition::none, "key", "1", {}, 0, now + std::chrono::seconds(10)},
+        {operation::type::create, operation::condition::none, "counter", "41", {}, 0, now + std::chrono::seconds(10)},
+        {operation::type::create, operation::condition::none, "stale", "2", {}, 0, now - std::chrono::seconds(10)}}));
+
+    // the entry's time decides, not the clock of the replica applying it...
+    this->storage->set_commit_time(now - std::chrono::seconds(20));
+    EXPECT_EQ(bzn::storage_base::result::exists, this->storage->create(USER_UUID, "stale", "3"));
+
+    this->storage->set_commit_time(now);
+    EXPECT_EQ(bzn::storage_base::result::exists, this->storage->create(USER_UUID, "key", "2"));
+
+    this->storage->set_commit_time(now + std::chrono::seconds(20));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, "key", "2"));
+    EXPECT_EQ("2", this->storage->read(USER_UUID, "key")->value);
+    EXPECT_EQ(0, this->storage->read(USER_UUID, "key")->expires.count());
+
+    // an expired counter starts over from zero...
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::increment, operation::condition::none, "counter", {}, {}, 5, {}}}));
+    EXPECT_EQ("5", this->storage->read(USER_UUID, "counter")->value);
+
+    EXPECT_EQ(bzn::storage_base::result::not_found, this->storage->update(USER_UUID, "stale", "4"));
+    EXPECT_EQ(this->storage->get_keys(USER_UUID), std::vector<std::string>({"counter", "key"}));
+
+    // only the stale record is left to evict...
+    EXPECT_EQ(this->storage->get_expired(now + std::chrono::seconds(20), 10), (std::vector<std::pair<bzn::uuid_t, std::string>>{{USER_UUID, "stale"}}));
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->apply(USER_UUID, {
+        {operation::type::remove, operation::condition::expired, "stale", {}, {}, 0, now}}));
+}
+
+
+TEST_F(storageTest, test_that_transaction_ids_are_derived_from_the_commit_index)
+{
+    auto replica = std::make_shared<bzn::storage>();
+
+    for (const auto& storage : {std::static_pointer_cast<bzn::storage_base>(this->storage), std::static_pointer_cast<bzn::storage_base>(replica)})
+    {
+        storage->set_commit_index(7);
+        storage->create(USER_UUID, "a", "1");
+        storage->create(USER_UUID, "b", "2");
+
+        storage->set_commit_index(8);
+        storage->update(USER_UUID, "a", "3");
+    }
+
+    // every replica applying the same entries agrees on every version...
+    EXPECT_EQ(this->storage->read(USER_UUID, "a")->version(), replica->read(USER_UUID, "a")->version());
+    EXPECT_EQ(this->storage->read(USER_UUID, "b")->version(), replica->read(USER_UUID, "b")->version());
+
+    EXPECT_EQ("00000000-0000-0008-0000-000000000001", this->storage->read(USER_UUID, "a")->version());
+    EXPECT_EQ("00000000-0000-0007-0000-000000000002", this->storage->read(USER_UUID, "b")->version());
+}
+
+
+// ./storage_tests --gtest_also_run_disabled_tests --gtest_filter=storageTest.DISABLED_benchmark_write_throughput
+TEST_F(storageTest, DISABLED_benchmark_write_throughput)
+{
+    const size_t WRITES = 1000000;
+    const size_t PREVIOUS_IDS = 10000; // slow enough that fewer give a stable rate
+
+    std::vector<std::string> keys(WRITES);
+    for (size_t i = 0; i < WRITES; ++i)
+    {
+        keys[i] = "key." + std::to_string(i);
+    }
+
+    auto rate = [&](size_t count, auto&& write)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            write(i);
+        }
+        return count / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // how ids were made before, a freshly seeded generator and a string per write...
+    std::string id;
+    const auto previous_ids = rate(PREVIOUS_IDS, [&](size_t)
+    {
+        boost::uuids::basic_random_generator<boost::mt19937> gen;
+        id = boost::lexical_cast<std::string>(gen());
+    });
+
+    const auto creates = rate(WRITES, [&](size_t i)
+    {
+        if (!(i % 100))
+        {
+            this->storage->set_commit_index(i);
+        }
+        this->storage->create(USER_UUID, keys[i], "value");
+    });
+
+    const auto updates = rate(WRITES, [&](size_t i){ this->storage->update(USER_UUID, keys[i], "value"); });
+
+    std::cout << "previous id generation: " << previous_ids << " ids/s\n"
+              << "creates: " << creates << " writes/s, with previous ids: " << 1 / (1 / creates + 1 / previous_ids) << " writes/s\n"
+              << "updates: " << updates << " writes/s, with previous ids: " << 1 / (1 / updates + 1 / previous_ids) << " writes/s\n";
+}
+
+
+namespace bzn
+{
+    TEST_F(storageTest, test_that_a_view_is_not_changed_by_later_writes)
+    {
+        auto storage = std::static_pointer_cast<bzn::storage>(this->storage);
+
+        storage->create(USER_UUID, "a", "1");
+        storage->create(USER_UUID, "b", "2");
+
+        auto values = [](const bzn::storage::view& view)
+        {
+            std::vector<std::string> values;
+            auto pending = view.pending.find(USER_UUID);
+
+            bzn::storage::visit_records(&view.databases->at(USER_UUID), (pending == view.pending.end()) ? nullptr : pending->second.get(), {},
+                [&](std::string_view key, const auto& record)
+                {
+                    values.emplace_back(std::string(key) + "=" + record->value);
+                    return true;
+                });
+
+            return values;
+        };
+
+        {
+            const auto view = storage->open_view(nullptr);
+
+            // writers do not wait for the view...
+            storage->update(USER_UUID, "a", "3");
+            storage->remove(USER_UUID, "b");
+            storage->create(USER_UUID, "c", "4");
+
+            EXPECT_EQ("3", storage->read(USER_UUID, "a")->value);
+            EXPECT_FALSE(storage->has(USER_UUID, "b"));
+            EXPECT_EQ(std::vector<std::string>({"a", "c"}), storage->get_keys(USER_UUID));
+            EXPECT_EQ(size_t(2), storage->get_size(USER_UUID));
+
+            // ...which still reads as it was when opened...
+            EXPECT_EQ(std::vector<std::string>({"a=1", "b=2"}), values(view));
+            EXPECT_FALSE(storage->pending.empty());
+
+            // ...while a later view sees those writes...
+            EXPECT_EQ(std::vector<std::string>({"a=3", "c=4"}), values(storage->open_view(&USER_UUID)));
+        }
+
+        // the next write once the views are gone folds the pending writes back in...
+        storage->create(USER_UUID, "d", "5");
+
+        EXPECT_TRUE(storage->pending.empty());
+        EXPECT_EQ(std::vector<std::string>({"a=3", "c=4", "d=5"}), values(storage->open_view(nullptr)));
+        EXPECT_EQ(size_t(3), storage->get_size(USER_UUID));
+    }
+
+
+    TEST_F(storageTest, test_that_views_share_pending_writes_and_they_are_merged_a_few_at_a_time)
+    {
+        auto storage = std::static_pointer_cast<bzn::storage>(this->storage);
+
+        storage->create(USER_UUID, "key", "value");
+
+        {
+            const auto first = storage->open_view(nullptr);
+
+            for (size_t i = 0; i < 100; ++i)
+            {
+                storage->create(USER_UUID, "pending" + std::to_string(i), "value");
+            }
+
+            // views opened between writes share the writes rather than copying them...
+            const auto second = storage->open_view(nullptr);
+            const auto third = storage->open_view(&USER_UUID);
+
+            EXPECT_EQ(second.pending.at(USER_UUID), third.pending.at(USER_UUID));
+            EXPECT_EQ(second.pending.at(USER_UUID), storage->pending.at(USER_UUID));
+
+            // ...until a writer changes them...
+            storage->update(USER_UUID, "key", "changed");
+
+            EXPECT_NE(second.pending.at(USER_UUID), storage->pending.at(USER_UUID));
+            EXPECT_EQ(size_t(100), second.pending.at(USER_UUID)->size());
+            EXPECT_EQ(size_t(101), storage->pending.at(USER_UUID)->size());
+        }
+
+        EXPECT_EQ(size_t(0), storage->open_views->load());
+
+        // a write once the views are gone only folds a few of them back in...
+        storage->create(USER_UUID, "next", "value");
+
+        ASSERT_FALSE(storage->pending.empty());
+        EXPECT_LT(storage->pending.at(USER_UUID)->size(), size_t(101));
+        EXPECT_EQ("changed", storage->read(USER_UUID, "key")->value);
+        EXPECT_EQ(size_t(102), storage->get_keys(USER_UUID).size());
+
+        // a later write replaces a pending one rather than being overwritten by it...
+        storage->update(USER_UUID, "pending99", "latest");
+
+        while (!storage->pending.empty())
+        {
+            storage->create(USER_UUID, "filler", "value");
+            storage->remove(USER_UUID, "filler");
+        }
+
+        EXPECT_EQ("latest", storage->read(USER_UUID, "pending99")->value);
+        EXPECT_EQ(size_t(102), storage->get_keys(USER_UUID).size());
+    }
+}
+
+
+TEST_F(storageTest, test_that_records_survive_their_database_compacting_its_keys)
+{
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        ASSERT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, "key." + std::to_string(i), std::to_string(i)));
+    }
+
+    // removing most of the keys moves the rest into a fresh key store...
+    std::vector<std::string> kept;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        const auto key = "key." + std::to_string(i);
+
+        if (i % 10)
+        {
+            ASSERT_EQ(bzn::storage_base::result::ok, this->storage->remove(USER_UUID, key));
+            continue;
+        }
+
+        kept.push_back(key);
+    }
+
+    std::sort(kept.begin(), kept.end());
+    EXPECT_EQ(kept, this->storage->get_keys(USER_UUID));
+
+    for (const auto& key : kept)
+    {
+        ASSERT_TRUE(this->storage->read(USER_UUID, key));
+        EXPECT_EQ(key.substr(4), this->storage->read(USER_UUID, key)->value);
+    }
+
+    EXPECT_EQ(size_t(11), this->storage->scan(USER_UUID, "key.5", "key.6", "key.", 100).size());
+
+    EXPECT_EQ(bzn::storage_base::result::ok, this->storage->create(USER_UUID, "key.1", "1"));
+    EXPECT_EQ("1", this->storage->read(USER_UUID, "key.1")->value);
+}
+
+
+// ./storage_tests --gtest_also_run_disabled_tests --gtest_filter=storageTest.DISABLED_benchmark_latency_while_saving
+TEST_F(storageTest, DISABLED_benchmark_latency_while_saving)
+{
+    const size_t KEYS = 1000000;
+    const size_t OPS = 200000;
+
+    for (size_t i = 0; i < KEYS; ++i)
+    {
+        this->storage->create(USER_UUID, "key." + std::to_string(i), generate_test_string(32));
+    }
+
+    boost::random::uniform_int_distribution<size_t> dist(0, KEYS - 1);
+
+    auto measure = [&](const std::string& label)
+    {
+        std::vector<double> reads, writes;
+        reads.reserve(OPS);
+        writes.reserve(OPS / 10);
+
+        for (size_t i = 0; i < OPS; ++i)
+        {
+            const auto key = "key." + std::to_string(dist(gen));
+            const auto start = std::chrono::steady_clock::now();
+
+            // one write for every ten reads...
+            if (i % 10)
+            {
+                this->storage->read(USER_UUID, key);
+                reads.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+            }
+            else
+            {
+                this->storage->update(USER_UUID, key, "value");
+                writes.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+
+        auto percentile = [](std::vector<double>& samples, double p)
+        {
+            std::nth_element(samples.begin(), samples.begin() + size_t(p * (samples.size() - 1)), samples.end());
+            return samples[size_t(p * (samples.size() - 1))];
+        };
+
+        std::cout << label << ": read p50 " << percentile(reads, 0.5) << "us p99 " << percentile(reads, 0.99) << "us max " << percentile(reads, 1.0)
+            << "us, write p50 " << percentile(writes, 0.5) << "us p99 " << percentile(writes, 0.99) << "us max " << percentile(writes, 1.0) << "us\n";
+    };
+
+    measure("idle");
+
+    std::atomic<bool> done{false};
+    size_t saves = 0;
+    std::thread saver([&]()
+    {
+        while (!done)
+        {
+            this->storage->save(path);
+            ++saves;
+        }
+    });
+
+    measure("saving");
+
+    done = true;
+    saver.join();
+    boost::filesystem::remove(path);
+
+    std::cout << saves << " saves completed\n";
+}
+
+
+
+namespace
+{
+    const std::string checkpoint_dir{"storage_test.checkpoint"};
+
+    std::set<std::string>
+    checkpoint_files()
+    {
+        std::set<std::string> files;
+
+        for (const auto& entry : boost::filesystem::directory_iterator(checkpoint_dir))
+        {
+            files.insert(entry.path().filename().string());
+        }
+        return files;
+    }
+}
+
+
+TEST_F(storageTest, test_that_a_checkpoint_only_rewrites_changed_databases)
+{
+    const bzn::uuid_t OTHER_UUID = "a0d9f4c5-2e0d-4e1b-9a43-3e6c1b9a5e10";
+    boost::filesystem::remove_all(checkpoint_dir);
+
+    auto storage = std::static_pointer_cast<bzn::storage>(this->storage);
+
+    storage->set_commit_index(1);
+    storage->create(USER_UUID, "a", "1");
+    storage->set_commit_index(2);
+    storage->create(OTHER_UUID, "b", "2");
+
+    EXPECT_EQ(bzn::storage_base::result::ok, storage->checkpoint(checkpoint_dir));
+    EXPECT_EQ(std::set<std::string>({"2-0.dat", "2-1.dat", "checkpoint"}), checkpoint_files());
+
+    // only the changed database gets a new file...
+    storage->set_commit_index(3);
+    storage->update(USER_UUID, "a", "3");
+
+    EXPECT_EQ(bzn::storage_base::result::ok, storage->checkpoint(checkpoint_dir));
+
+    auto files = checkpoint_files();
+    EXPECT_EQ(size_t(3), files.size());
+    EXPECT_EQ(size_t(1), files.count("3-0.dat"));
+
+    // writes after the checkpoint are left to the log...
+    storage->set_commit_index(4);
+    storage->create(OTHER_UUID, "c", "4");
+
+    bzn::storage restored;
+    uint64_t log_index = 0;
+
+    EXPECT_EQ(bzn::storage_base::result::ok, restored.load_checkpoint(checkpoint_dir, log_index));
+    EXPECT_EQ(uint64_t(3), log_index);
+    EXPECT_EQ("3", restored.read(USER_UUID, "a")->value);
+    EXPECT_EQ(storage->read(USER_UUID, "a")->version(), restored.read(USER_UUID, "a")->version());
+    EXPECT_EQ(std::vector<std::string>({"b"}), restored.get_keys(OTHER_UUID));
+
+    // a restored node carries on from the checkpoint without rewriting what it loaded...
+    restored.set_commit_index(4);
+    restored.create(OTHER_UUID, "c", "4");
+
+    EXPECT_EQ(bzn::storage_base::result::ok, restored.checkpoint(checkpoint_dir));
+
+    files = checkpoint_files();
+    EXPECT_EQ(size_t(1), files.count("3-0.dat"));
+    EXPECT_EQ(size_t(1), files.count("4-0.dat"));
+    EXPECT_EQ(size_t(3), files.size());
+
+    uint64_t missing_index = 0;
+    EXPECT_EQ(bzn::storage_base::result::not_found, bzn::storage().load_checkpoint("no_such_checkpoint", missing_index));
+
+    boost::filesystem::remove_all(checkpoint_dir);
+}
+
+
+TEST_F(storageTest, test_that_checkpoints_are_written_in_the_background_after_enough_commits)
+{
+    boost::filesystem::remove_all(checkpoint_dir);
+
+    auto storage = std::static_pointer_cast<bzn::storage>(this->storage);
+    storage->start_checkpoints(checkpoint_dir, 2, std::chrono::seconds(0));
+
+    storage->set_commit_index(1);
+    storage->create(USER_UUID, "a", "1");
+    storage->set_commit_index(2);
+    storage->create(USER_UUID, "b", "2");
+
+    EXPECT_FALSE(boost::filesystem::exists(checkpoint_dir + "/checkpoint"));
+
+    // the checkpoint is taken once the next commit shows the previous one was applied...
+    storage->set_commit_index(3);
+    storage->create(USER_UUID, "c", "3");
+
+    bzn::storage restored;
+    uint64_t log_index = 0;
+
+    for (size_t i = 0; i < 500 && restored.load_checkpoint(checkpoint_dir, log_index) != bzn::storage_base::result::ok; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    EXPECT_EQ(uint64_t(2), log_index);
+    EXPECT_EQ(std::vector<std::string>({"a", "b"}), restored.get_keys(USER_UUID));
+
+    this->storage.reset();
+    boost::filesystem::remove_all(checkpoint_dir);
+}
+
+
+TEST_F(storageTest, test_that_replicas_applying_the_same_writes_have_the_same_state_digest)
+{
+    const std::string value_file{"storage_test.values"};
+
+    auto a = std::static_pointer_cast<bzn::storage>(this->storage);
+    auto b = std::make_shared<bzn::storage>(1000, value_file);
+
+    // enough keys for the trees to grow, b spills most of its values...
+    for (uint64_t i = 1; i <= 2000; ++i)
+    {
+        a->set_commit_index(i);
+        b->set_commit_index(i);
+        EXPECT_EQ(bzn::storage_base::result::ok, a->create(USER_UUID, "key" + std::to_string(i), "value" + std::to_string(i)));
+        EXPECT_EQ(bzn::storage_base::result::ok, b->create(USER_UUID, "key" + std::to_string(i), "value" + std::to_string(i)));
+    }
+
+    a->set_commit_index(2001);
+    b->set_commit_index(2001);
+
+    EXPECT_EQ(a->state_digest(USER_UUID, 8), b->state_digest(USER_UUID, 8));
+    EXPECT_EQ(size_t(256), a->state_digest(USER_UUID, 8).size());
+    EXPECT_TRUE(a->state_digest("no such database", 4).empty());
+
+    // a replica loaded from a snapshot agrees...
+    EXPECT_EQ(bzn::storage_base::result::ok, b->save(path));
+    bzn::storage loaded;
+    EXPECT_EQ(bzn::storage_base::result::ok, loaded.load(path));
+    EXPECT_EQ(a->state_digest(USER_UUID, 8), loaded.state_digest(USER_UUID, 8));
+
+    // a write b missed shows in the bucket of its key only...
+    EXPECT_EQ(bzn::storage_base::result::ok, a->update(USER_UUID, "key7", "changed"));
+
+    const auto expected = a->state_digest(USER_UUID, 4);
+    const auto actual = b->state_digest(USER_UUID, 4);
+    const auto bucket = bzn::merkle_tree::bucket(bzn::merkle_tree::hash("key7"), 4);
+
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        EXPECT_EQ(i != bucket, expected[i] == actual[i]) << i;
+    }
+
+    b.reset();
+    boost::filesystem::remove(value_file);
+    boost::filesystem::remove(path);
+}
+
+
+TEST_F(storageTest, test_that_state_is_reported_as_each_block_of_checkpoint_commits_begins)
+{
+    boost::filesystem::remove_all(checkpoint_dir);
+
+    auto storage = std::static_pointer_cast<bzn::storage>(this->storage);
+
+    std::vector<std::pair<uint64_t, std::map<bzn::uuid_t, std::vector<uint64_t>>>> reports;
+    storage->set_state_handler(
+        [&](uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& buckets)
+        {
+            reports.emplace_back(log_index, buckets);
+        });
+
+    storage->start_checkpoints(checkpoint_dir, 10, std::chrono::seconds(0));
+
+    for (uint64_t i = 1; i <= 25; ++i)
+    {
+        storage->set_commit_index(i);
+        storage->create(USER_UUID, std::to_string(i), "value");
+
+        if (i == 20)
+        {
+            // the report for index 20 is made once its writes are in...
+            EXPECT_EQ(size_t(1), reports.size());
+            storage->set_commit_index(21);
+            EXPECT_EQ(storage->state_digest(USER_UUID, bzn::merkle_tree::MIN_DEPTH), reports.back().second[USER_UUID]);
+            ++i;
+            storage->create(USER_UUID, std::to_string(i), "value");
+        }
+    }
+
+    ASSERT_EQ(size_t(2), reports.size());
+    EXPECT_EQ(uint64_t(10), reports[0].first);
+    EXPECT_EQ(uint64_t(20), reports[1].first);
+    EXPECT_EQ(size_t(1), reports[0].second.size());
+    EXPECT_EQ(size_t(16), reports[0].second[USER_UUID].size());
+
+    this->storage.reset();
+    boost::filesystem::remove_all(checkpoint_dir);
+}
+
+
+// ./storage_tests --gtest_also_run_disabled_tests --gtest_filter=storageTest.DISABLED_benchmark_latency_while_checkpointing
+TEST_F(storageTest, DISABLED_benchmark_latency_while_checkpointing)
+{
+    const size_t KEYS = 1000000;
+    const size_t DATABASES = 100;
+    const size_t OPS = 200000;
+    boost::filesystem::remove_all(checkpoint_dir);
+
+    auto storage = std::static_pointer_cast<bzn::storage>(this->storage);
+
+    for (size_t i = 0; i < KEYS; ++i)
+    {
+        storage->create(std::to_string(i % DATABASES), "key." + std::to_string(i), generate_test_string(32));
+    }
+
+    storage->checkpoint(checkpoint_dir);
+    storage->start_checkpoints(checkpoint_dir, 10000, std::chrono::seconds(0));
+
+    // writes go to a few databases so a checkpoint rewrites only those...
+    boost::random::uniform_int_distribution<size_t> dist(0, KEYS / DATABASES - 1);
+    std::vector<double> writes;
+    writes.reserve(OPS);
+
+    for (size_t i = 0; i < OPS; ++i)
+    {
+        const auto db = i % 3;
+        const auto key = "key." + std::to_string(dist(gen) * DATABASES + db);
+        const auto start = std::chrono::steady_clock::now();
+
+        storage->set_commit_index(i + 1);
+        storage->update(std::to_string(db), key, "value");
+
+        writes.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    auto percentile = [&](double p)
+    {
+        std::nth_element(writes.begin(), writes.begin() + size_t(p * (writes.size() - 1)), writes.end());
+        return writes[size_t(p * (writes.size() - 1))];
+    };
+
+    const auto pause = bzn::metrics::registry::global().get_histogram("storage_checkpoint_pause_microseconds", "").get_snapshot();
+
+    std::cout << "write p50 " << percentile(0.5) << "us p99 " << percentile(0.99) << "us max " << percentile(1.0) << "us, "
+        << pause.count << " checkpoints paused writers for at most " << pause.quantile(1.0) << "us\n";
+
+    this->storage.reset();
+    boost::filesystem::remove_all(checkpoint_dir);
+}
+
+
+TEST(storage_budget, test_that_least_recently_read_values_spill_and_fault_back)
+{
+    using operation = bzn::storage_base::operation;
+
+    const std::string value_file{"storage_test.values"};
+    auto storage = std::make_shared<bzn::storage>(250, value_file);
+
+    for (const auto& key : {"a", "b", "c"})
+    {
+        EXPECT_EQ(bzn::storage_base::result::ok, storage->create(USER_UUID, key, std::string(100, key[0])));
+    }
+
+    // "a" was the least recently used and went to disk...
+    EXPECT_TRUE(boost::filesystem::exists(value_file));
+    EXPECT_EQ(size_t(300), storage->get_size(USER_UUID));
+
+    // ...reading it makes it resident again and spills "b"...
+    const auto version = storage->read(USER_UUID, "a")->version();
+    EXPECT_EQ(std::string(100, 'a'), storage->read(USER_UUID, "a")->value);
+    EXPECT_EQ(version, storage->read(USER_UUID, "a")->version());
+
+    // scans and read-modify-write see spilled values...
+    const auto records = storage->scan(USER_UUID, "", "", "", 10);
+    ASSERT_EQ(size_t(3), records.size());
+    EXPECT_EQ(std::string(100, 'b'), records[1].second->value);
+
+    EXPECT_EQ(bzn::storage_base::result::ok, storage->apply(USER_UUID, {{operation::type::append, operation::condition::none, "b", "!", {}}}));
+    EXPECT_EQ(std::string(100, 'b') + "!", storage->read(USER_UUID, "b")->value);
+
+    // saving writes every value...
+    EXPECT_EQ(bzn::storage_base::result::ok, storage->save(path));
+    auto loaded = std::make_shared<bzn::storage>();
+    EXPECT_EQ(bzn::storage_base::result::ok, loaded->load(path));
+    EXPECT_EQ(std::string(100, 'c'), loaded->read(USER_UUID, "c")->value);
+    EXPECT_EQ(size_t(301), loaded->get_size(USER_UUID));
+
+    storage.reset();
+    boost::filesystem::remove(value_file);
+    boost::filesystem::remove(path);
+}
+
+
+// ./storage_tests --gtest_also_run_disabled_tests --gtest_filter=storage_budget.DISABLED_benchmark_zipfian_reads_over_budget
+TEST(storage_budget, DISABLED_benchmark_zipfian_reads_over_budget)
+{
+    const size_t KEYS = 100000;
+    const size_t VALUE_SIZE = 1024;
+    const size_t READS = 1000000;
+    const double SKEW = 0.99;
+
+    const std::string value_file{"storage_benchmark.values"};
+
+    // the data set is five times the budget...
+    auto storage = std::make_shared<bzn::storage>(KEYS * VALUE_SIZE / 5, value_file);
+
+    for (size_t i = 0; i < KEYS; ++i)
+    {
+        storage->create(USER_UUID, "key." + std::to_string(i), generate_test_string(VALUE_SIZE));
+    }
+
+    std::vector<double> cdf(KEYS);
+    double sum = 0;
+    for (size_t i = 0; i < KEYS; ++i)
+    {
+        sum += 1.0 / std::pow(double(i + 1), SKEW);
+        cdf[i] = sum;
+    }
+
+    // shuffle ranks so hot keys are not the most recently written ones...
+    std::vector<size_t> rank(KEYS);
+    std::iota(rank.begin(), rank.end(), 0);
+    std::shuffle(rank.begin(), rank.end(), std::mt19937(std::random_device()()));
+
+    boost::random::uniform_real_distribution<> dist(0, sum);
+    std::vector<std::string> keys(READS);
+    for (auto& key : keys)
+    {
+        key = "key." + std::to_string(rank[std::lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin()]);
+    }
+
+    auto& hits = bzn::metrics::registry::global().get_counter("storage_value_hits_total", "");
+    auto& misses = bzn::metrics::registry::global().get_counter("storage_value_misses_total", "");
+    const auto start_hits = hits.value();
+    const auto start_misses = misses.value();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& key : keys)
+    {
+        ASSERT_TRUE(storage->read(USER_UUID, key));
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    const auto read_hits = hits.value() - start_hits;
+    const auto read_misses = misses.value() - start_misses;
+
+    std::cout << "zipfian reads: " << elapsed / double(READS) << "ns per read, hit ratio: "
+        << double(read_hits) / double(read_hits + read_misses) << "\n";
+
+    EXPECT_EQ(read_hits + read_misses, READS);
+
+    storage.reset();
+    boost::filesystem::remove(value_file);
+}
+
+
+namespace
+{
+    // heap bytes in use, from the allocator itself so freed memory that is kept around is not counted...
+    size_t heap_in_use()
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        const auto info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+    }
+}
+
+
+// ./storage_tests --gtest_also_run_disabled_tests --gtest_filter=storage_layout.DISABLED_benchmark_bytes_per_key_and_lookup_latency
+TEST(storage_layout, DISABLED_benchmark_bytes_per_key_and_lookup_latency)
+{
+    const size_t KEYS = 10000000;
+    const size_t LOOKUPS = 1000000;
+
+    std::vector<std::string> lookups(LOOKUPS);
+    boost::random::uniform_int_distribution<size_t> dist(0, KEYS - 1);
+    for (auto& key : lookups)
+    {
+        key = "key." + std::to_string(dist(gen));
+    }
+
+    auto report = [&](const std::string& layout, size_t bytes, auto&& lookup)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& key : lookups)
+        {
+            ASSERT_TRUE(lookup(key));
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << layout << ": " << double(bytes) / KEYS << " bytes per key, " << elapsed / double(LOOKUPS) << "ns per lookup\n";
+    };
+
+    {
+        // the layout storage used before: a map node per key, a copy of the key in the index and a string transaction id...
+        struct previous_record
+        {
+            std::chrono::seconds timestamp;
+            std::string          value;
+            std::string          transaction_id;
+            std::chrono::seconds expires{0};
+            int64_t              spill_offset = -1;
+            uint32_t             spill_size = 0;
+        };
+
+        const auto start = heap_in_use();
+
+        std::unordered_map<std::string, std::shared_ptr<previous_record>> records;
+        std::set<std::string> keys;
+
+        boost::uuids::basic_random_generator<boost::mt19937> generator;
+        for (size_t i = 0; i < KEYS; ++i)
+        {
+            const auto key = "key." + std::to_string(i);
+            records.emplace(key, std::make_shared<previous_record>(previous_record{std::chrono::seconds(0), "value", boost::lexical_cast<std::string>(generator())}));
+            keys.insert(key);
+        }
+
+        report("previous layout", heap_in_use() - start, [&](const auto& key){ return records.find(key) != records.end(); });
+    }
+
+    {
+        const auto start = heap_in_use();
+
+        bzn::storage storage;
+        for (size_t i = 0; i < KEYS; ++i)
+        {
+            storage.create(USER_UUID, "key." + std::to_string(i), "value");
+        }
+
+        report("compact layout", heap_in_use() - start, [&](const auto& key){ return storage.read(USER_UUID, key) != nullptr; });
+    }
+}
@@ -16,6 +16,7 @@
 #include <crud/crud.hpp>
 #include <ethereum/ethereum.hpp>
 #include <node/node.hpp>
+#include <node/idle_timer_wheel.hpp>
 #include <http/server.hpp>
 #include <options/options.hpp>
 #include <raft/raft.hpp>
@@ -23,44 +24,126 @@
 #include <boost/log/expressions.hpp>
 #include <boost/log/support/date_time.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
+#include <boost/log/utility/setup/console.hpp>
 #include <boost/log/utility/setup/file.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/text_file_backend.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <audit/audit.hpp>
+#include <metrics/metrics.hpp>
+#include <repair/repair.hpp>
+#include <utils/log_queue.hpp>
 #include <thread>
 
+namespace
+{
+    // granularity of websocket & http idle timeouts...
+    const std::chrono::milliseconds IDLE_TIMER_WHEEL_RESOLUTION{100};
+
+    // records each thread can have waiting for the log writer thread...
+    const size_t LOG_QUEUE_SIZE = 8 * 1024;
+
+    template<bool drop_below_error>
+    using async_file_sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_file_backend,
+        bzn::utils::per_thread_log_queue<LOG_QUEUE_SIZE, drop_below_error>>;
+
+    // flushes and stops the log writer thread on exit...
+    class logging_guard
+    {
+    public:
+        explicit logging_guard(std::function<void()> stop)
+            : stop(std::move(stop))
+        {
+        }
+
+        ~logging_guard()
+        {
+            if (this->stop)
+            {
+                this->stop();
+            }
+        }
+
+    private:
+        const std::function<void()> stop;
+    };
+}
+
 
 void
+format_location(const boost::log::record_view& rec, boost::log::formatting_ostream& os)
+{
+    if (auto location = boost::log::extract<bzn::utils::log_location>("Location", rec))
+    {
+        os << "(" << bzn::utils::basename(location.get().file) << ":" << location.get().line << ") - ";
+    }
+}
+
+
+// LOG() only attaches the source location, every sink formats the record the same way...
+boost::log::formatter
+make_log_formatter()
+{
+    return boost::log::expressions::stream
+        << boost::log::expressions::format_date_time< boost::posix_time::ptime >("TimeStamp", "[%Y-%m-%d %H:%M:%S.%f]")
+        << " [" << boost::log::expressions::attr< boost::log::attributes::current_thread_id::value_type >("ThreadID")
+        << "] [" << std::setw(5) << std::left << boost::log::trivial::severity << "] "
+        << boost::log::expressions::wrap_formatter(&format_location) << boost::log::expressions::smessage;
+}
+
+
+void
+init_console_logging()
+{
+    boost::log::add_console_log(std::clog, boost::log::keywords::format = make_log_formatter());
+    boost::log::add_common_attributes();
+}
+
+
+// The message is built by the caller, each thread then queues the record to its
+// own ring without taking a lock. A dedicated thread formats the timestamp and
+// location, formats the line and writes it, so LOG() on an io thread never
+// waits on the disk. When a thread's ring is full its records wait for the
+// writer to catch up or, for records below error, they are dropped.
+template<bool drop_below_error>
+std::unique_ptr<logging_guard>
 init_logging()
 {
     namespace keywords = boost::log::keywords;
 
-    auto sink = boost::log::add_file_log
+    auto backend = boost::make_shared<boost::log::sinks::text_file_backend>
         (
             keywords::file_name = "bluzelle-%5N.log",
             keywords::rotation_size = 1024 * 64, // 64K logs
             keywords::open_mode = std::ios_base::app,
-            keywords::auto_flush = true,
-            keywords::format =
-                (
-                    boost::log::expressions::stream
-                        << boost::log::expressions::format_date_time< boost::posix_time::ptime >("TimeStamp", "[%Y-%m-%d %H:%M:%S.%f]")
-                        << " [" << boost::log::expressions::attr< boost::log::attributes::current_thread_id::value_type >("ThreadID")
-                        << "] [" << std::setw(5) << std::left << boost::log::trivial::severity << "] " <<  boost::log::expressions::smessage
-                )
+            keywords::auto_flush = false
         );
 
-    boost::log::add_common_attributes();
-
-    sink->locked_backend()->set_file_collector(boost::log::sinks::file::make_collector
+    backend->set_file_collector(boost::log::sinks::file::make_collector
         (
             keywords::target = "logs/",
             keywords::max_size = 1024 * 512 // ~512K of logs
         ));
 
-    sink->locked_backend()->scan_for_files();
+    backend->scan_for_files();
+
+    auto sink = boost::make_shared<async_file_sink<drop_below_error>>(backend);
+
+    sink->set_formatter(make_log_formatter());
+
+    boost::log::add_common_attributes();
 
     boost::log::core::get()->add_sink(sink);
+
+    return std::make_unique<logging_guard>(
+        [sink]()
+        {
+            boost::log::core::get()->remove_sink(sink);
+
+            sink->stop();
+            sink->flush();
+        });
 }
 
 
@@ -148,9 +231,22 @@ main(int argc, const char* argv[])
             return 0;
         }
 
-        if (!options.get_log_to_stdout())
+        std::unique_ptr<logging_guard> logging;
+
+        if (options.get_log_to_stdout())
         {
-            init_logging();
+            init_console_logging();
+        }
+        else
+        {
+            if (options.get_log_drop_on_overflow())
+            {
+                logging = init_logging<true>();
+            }
+            else
+            {
+                logging = init_logging<false>();
+            }
         }
 
         set_logging_level(options);
@@ -205,13 +301,41 @@ main(int argc, const char* argv[])
             });
 
         // startup...
+        const auto startup = std::chrono::steady_clock::now();
         auto websocket = std::make_shared<bzn::beast::websocket>();
+        auto idle_timer_wheel = std::make_shared<bzn::idle_timer_wheel>(io_context, IDLE_TIMER_WHEEL_RESOLUTION);
 
-        auto node = std::make_shared<bzn::node>(io_context, websocket, options.get_ws_idle_timeout(), boost::asio::ip::tcp::endpoint{options.get_listener()});
+        auto node = std::make_shared<bzn::node>(io_context, websocket, idle_timer_wheel, options.get_ws_idle_timeout(), boost::asio::ip::tcp::endpoint{options.get_listener()});
         auto raft = std::make_shared<bzn::raft>(io_context, node, init_peers.get_peers(), options.get_uuid());
-        auto storage = std::make_shared<bzn::storage>();
-        auto crud = std::make_shared<bzn::crud>(node, raft, storage);
-        auto audit = std::make_shared<bzn::audit>(node);
+        auto storage = std::make_shared<bzn::storage>(options.get_memory_budget(), "./.state/" + options.get_uuid() + ".values");
+        auto crud = std::make_shared<bzn::crud>(io_context, node, raft, storage, options.get_forward_writes());
+        auto audit = std::make_shared<bzn::audit>(node, init_peers.get_peers(), options.get_uuid());
+
+        // replicas compare their storage at the same commit indexes...
+        storage->set_state_handler(
+            [audit](uint64_t log_index, const std::map<bzn::uuid_t, std::vector<uint64_t>>& buckets)
+            {
+                audit->report_state(log_index, buckets);
+            });
+
+        // a follower found to differ from the leader repairs its storage from the leader's...
+        auto repair = std::make_shared<bzn::repair>(node, storage);
+
+        audit->set_divergence_handler(
+            [raft, repair, uuid = options.get_uuid()](uint64_t /*log_index*/, const bzn::uuid_t& a, const bzn::uuid_t& b)
+            {
+                if (raft->get_state() == bzn::raft_state::leader)
+                {
+                    return;
+                }
+
+                const auto leader = raft->get_leader();
+
+                if ((a == uuid && b == leader.uuid) || (b == uuid && a == leader.uuid))
+                {
+                    repair->repair_from(boost::asio::ip::tcp::endpoint{boost::asio::ip::address_v4::from_string(leader.host), leader.port});
+                }
+            });
 
         // get our http listener port...
         uint16_t http_port;
@@ -224,11 +348,18 @@ main(int argc, const char* argv[])
         // create http server using our configured listener address & peer listen port number...
         auto ep = options.get_listener();
         ep.port(http_port);
-        auto http_server = std::make_shared<bzn::http::server>(io_context, crud, ep);
+        auto http_server = std::make_shared<bzn::http::server>(io_context, crud, idle_timer_wheel, ep, options.get_http_idle_timeout(), options.get_http_max_requests());
+
+        // load the last checkpoint and replay only the log after it...
+        const auto checkpoint_dir = "./.state/" + options.get_uuid() + ".checkpoint";
+        uint64_t checkpoint_index = 0;
+
+        if (storage->load_checkpoint(checkpoint_dir, checkpoint_index) == bzn::storage_base::result::ok)
+        {
+            LOG(info) << "loaded checkpoint as of commit index " << checkpoint_index;
+        }
+
 
-        
-        raft->initialize_storage_from_log(storage);
-        
         // todo: just for testing...
         node->register_for_message("ping",
             [](const bzn::message& msg, std::shared_ptr<bzn::session_base> session)
@@ -242,11 +373,19 @@ main(int argc, const char* argv[])
                 session->send_message(reply, false);
             });
 
-        node->start();
+        // crud registers the commit handler the replay goes through...
         crud->start();
+        raft->initialize_storage_from_log(checkpoint_index);
+        storage->start_checkpoints(checkpoint_dir, options.get_checkpoint_commits(), options.get_checkpoint_interval());
+
+        idle_timer_wheel->start();
+        node->start();
         raft->start();
         http_server->start();
         audit->start();
+        repair->start();
+
+        LOG(info) << "ready in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - startup).count() << "s";
 
         print_banner(options, eth_balance);
 
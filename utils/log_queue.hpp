@@ -0,0 +1,215 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <metrics/metrics.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+#include <boost/log/core/record_view.hpp>
+#include <boost/log/trivial.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+namespace bzn::utils
+{
+    /**
+     * Queueing strategy for boost::log::sinks::asynchronous_sink. Each logging thread fills a ring of its own
+     * so enqueueing never takes a lock, the sink's writer thread drains the rings in turn. Records keep their
+     * order within a thread.
+     * @tparam capacity          records buffered for each logging thread
+     * @tparam drop_below_error  a full ring drops records below error and counts them, otherwise every record waits for room
+     */
+    template<size_t capacity, bool drop_below_error>
+    class per_thread_log_queue
+    {
+    public:
+        ~per_thread_log_queue()
+        {
+            for (ring* next = this->rings.load(); next;)
+            {
+                std::unique_ptr<ring> current(next);
+                next = current->next;
+            }
+        }
+
+    protected:
+        per_thread_log_queue() = default;
+
+        template<typename ArgsT>
+        explicit per_thread_log_queue(const ArgsT&)
+        {
+        }
+
+        void enqueue(const boost::log::record_view& rec)
+        {
+            ring& local = this->local_ring();
+
+            while (!local.push(rec))
+            {
+                if (auto severity = boost::log::extract<boost::log::trivial::severity_level>("Severity", rec); drop_below_error && (!severity || *severity < boost::log::trivial::error))
+                {
+                    static auto& dropped = bzn::metrics::registry::global().get_counter("log_records_dropped_total", "Log records dropped because the log writer fell behind.");
+                    dropped.increment();
+                    return;
+                }
+
+                std::this_thread::yield();
+            }
+        }
+
+        bool try_enqueue(const boost::log::record_view& rec)
+        {
+            return this->local_ring().push(rec);
+        }
+
+        bool try_dequeue_ready(boost::log::record_view& rec)
+        {
+            return this->try_dequeue(rec);
+        }
+
+        bool try_dequeue(boost::log::record_view& rec)
+        {
+            // one record from each thread in turn so a busy thread does not hold back the others...
+            ring* const first = this->rings.load(std::memory_order_acquire);
+
+            if (!this->cursor)
+            {
+                this->cursor = first;
+            }
+
+            for (ring* start = this->cursor; this->cursor;)
+            {
+                ring* current = this->cursor;
+                this->cursor = current->next ? current->next : first;
+
+                if (current->pop(rec))
+                {
+                    return true;
+                }
+
+                if (this->cursor == start)
+                {
+                    break;
+                }
+            }
+
+            return false;
+        }
+
+        bool dequeue_ready(boost::log::record_view& rec)
+        {
+            // producers never signal the writer, it polls while the rings are empty...
+            while (!this->try_dequeue(rec))
+            {
+                if (this->interrupted.exchange(false, std::memory_order_acquire))
+                {
+                    return false;
+                }
+
+                std::this_thread::sleep_for(IDLE_POLL);
+            }
+
+            return true;
+        }
+
+        void interrupt_dequeue()
+        {
+            this->interrupted.store(true, std::memory_order_release);
+        }
+
+    private:
+        static constexpr std::chrono::milliseconds IDLE_POLL{1};
+
+        // filled by one logging thread and drained by the writer...
+        struct ring
+        {
+            bool push(const boost::log::record_view& rec)
+            {
+                const size_t t = this->tail.load(std::memory_order_relaxed);
+
+                if (t - this->head.load(std::memory_order_acquire) == capacity)
+                {
+                    return false;
+                }
+
+                this->records[t % capacity] = rec;
+                this->tail.store(t + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop(boost::log::record_view& rec)
+            {
+                const size_t h = this->head.load(std::memory_order_relaxed);
+
+                if (h == this->tail.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+
+                rec = std::move(this->records[h % capacity]);
+                this->records[h % capacity] = boost::log::record_view();
+                this->head.store(h + 1, std::memory_order_release);
+                return true;
+            }
+
+            std::array<boost::log::record_view, capacity> records;
+            std::atomic<size_t> head{0};
+            std::atomic<size_t> tail{0};
+            ring* next = nullptr;
+        };
+
+        ring& local_ring()
+        {
+            // rings are found by the queue's id so a queue at a reused address never sees a stale one...
+            thread_local std::vector<std::pair<uint64_t, ring*>> local;
+
+            for (const auto& [id, found] : local)
+            {
+                if (id == this->id)
+                {
+                    return *found;
+                }
+            }
+
+            auto created = new ring;
+            created->next = this->rings.load(std::memory_order_relaxed);
+
+            while (!this->rings.compare_exchange_weak(created->next, created, std::memory_order_release, std::memory_order_relaxed));
+
+            local.emplace_back(this->id, created);
+
+            return *created;
+        }
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> ids{0};
+            return ++ids;
+        }
+
+        const uint64_t id = next_id();
+
+        // rings are added as threads first log and freed with the queue...
+        std::atomic<ring*> rings{nullptr};
+        ring* cursor = nullptr; // writer only
+        std::atomic<bool> interrupted{false};
+    };
+
+} // bzn::utils
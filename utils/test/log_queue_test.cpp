@@ -0,0 +1,230 @@
+// Copyright (C) 2018 Bluzelle
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License, version 3,
+// as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <utils/log_queue.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/sinks/block_on_overflow.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <gmock/gmock.h>
+
+
+namespace
+{
+    // keeps the messages it is fed, and can be made to write slowly...
+    class collecting_backend : public boost::log::sinks::basic_sink_backend<boost::log::sinks::synchronized_feeding>
+    {
+    public:
+        explicit collecting_backend(std::chrono::nanoseconds write_time = std::chrono::nanoseconds(0))
+            : write_time(write_time)
+        {
+        }
+
+        void consume(const boost::log::record_view& rec)
+        {
+            if (this->write_time.count())
+            {
+                const auto done = std::chrono::steady_clock::now() + this->write_time;
+                while (std::chrono::steady_clock::now() < done);
+            }
+
+            std::lock_guard<std::mutex> lock(this->messages_lock);
+            this->messages.emplace_back(*boost::log::extract<std::string>("Message", rec));
+        }
+
+        std::vector<std::string> get_messages()
+        {
+            std::lock_guard<std::mutex> lock(this->messages_lock);
+            return this->messages;
+        }
+
+    private:
+        const std::chrono::nanoseconds write_time;
+        std::mutex messages_lock;
+        std::vector<std::string> messages;
+    };
+
+    template<typename queue>
+    using test_sink = boost::log::sinks::asynchronous_sink<collecting_backend, queue>;
+}
+
+
+namespace bzn::utils
+{
+    TEST(per_thread_log_queue, test_that_every_thread_s_records_arrive_in_order)
+    {
+        const size_t THREADS = 4;
+        const size_t RECORDS = 1000;
+
+        auto backend = boost::make_shared<collecting_backend>();
+        auto sink = boost::make_shared<test_sink<per_thread_log_queue<16, false>>>(backend);
+        boost::log::core::get()->add_sink(sink);
+
+        // rings this small fill up, so records wait for the writer rather than being lost...
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < THREADS; ++t)
+        {
+            threads.emplace_back(
+                [t]()
+                {
+                    for (size_t i = 0; i < RECORDS; ++i)
+                    {
+                        BOOST_LOG_TRIVIAL(info) << t << " " << i;
+                    }
+                });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        sink->flush();
+        boost::log::core::get()->remove_sink(sink);
+        sink->stop();
+
+        const auto messages = backend->get_messages();
+        ASSERT_EQ(messages.size(), THREADS * RECORDS);
+
+        std::vector<size_t> next(THREADS, 0);
+        for (const auto& message : messages)
+        {
+            const size_t t = std::stoul(message.substr(0, message.find(' ')));
+            const size_t i = std::stoul(message.substr(message.find(' ') + 1));
+
+            ASSERT_LT(t, THREADS);
+            EXPECT_EQ(i, next[t]++);
+        }
+    }
+
+
+    TEST(per_thread_log_queue, test_that_a_full_ring_drops_records_below_error_and_keeps_errors)
+    {
+        auto& dropped = bzn::metrics::registry::global().get_counter("log_records_dropped_total", "");
+        const auto dropped_before = dropped.value();
+
+        // nothing drains the rings until the test flushes the sink...
+        auto backend = boost::make_shared<collecting_backend>();
+        auto sink = boost::make_shared<test_sink<per_thread_log_queue<4, true>>>(backend, boost::log::keywords::start_thread = false);
+        boost::log::core::get()->add_sink(sink);
+
+        for (size_t i = 0; i < 10; ++i)
+        {
+            BOOST_LOG_TRIVIAL(info) << "info " << i;
+        }
+
+        EXPECT_EQ(dropped.value() - dropped_before, 6u);
+
+        // an error on a full ring waits for the writer...
+        std::atomic<bool> logged{false};
+        std::thread error_thread(
+            [&]()
+            {
+                for (size_t i = 0; i < 4; ++i)
+                {
+                    BOOST_LOG_TRIVIAL(info) << "filler " << i;
+                }
+
+                BOOST_LOG_TRIVIAL(error) << "error";
+                logged = true;
+            });
+
+        while (!logged)
+        {
+            sink->flush();
+            std::this_thread::yield();
+        }
+
+        error_thread.join();
+        sink->flush();
+        boost::log::core::get()->remove_sink(sink);
+
+        const auto messages = backend->get_messages();
+        EXPECT_EQ(std::count(messages.begin(), messages.end(), "error"), 1);
+        EXPECT_EQ(std::count_if(messages.begin(), messages.end(), [](const auto& m){ return m.rfind("info ", 0) == 0; }), 4);
+        EXPECT_EQ(dropped.value() - dropped_before, 6u);
+    }
+
+
+    // LOG() latency seen by the io threads while the writer is slower than they are, per thread rings against
+    // the shared bounded queue they replaced:
+    // ./utils_tests --gtest_also_run_disabled_tests --gtest_filter=per_thread_log_queue.DISABLED_benchmark_log_call_tail_latency
+    template<typename queue>
+    void measure_log_calls(const std::string& name)
+    {
+        const size_t THREADS = 4;
+        const size_t RECORDS = 100000;
+
+        auto backend = boost::make_shared<collecting_backend>(std::chrono::microseconds(1));
+        auto sink = boost::make_shared<test_sink<queue>>(backend);
+        boost::log::core::get()->add_sink(sink);
+
+        std::vector<std::vector<uint64_t>> latencies(THREADS);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < THREADS; ++t)
+        {
+            threads.emplace_back(
+                [t, &latencies]()
+                {
+                    latencies[t].reserve(RECORDS);
+
+                    for (size_t i = 0; i < RECORDS; ++i)
+                    {
+                        const auto start = std::chrono::steady_clock::now();
+                        BOOST_LOG_TRIVIAL(info) << "record " << i << " from " << t;
+                        latencies[t].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                    }
+                });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        boost::log::core::get()->remove_sink(sink);
+        sink->stop();
+        sink->flush();
+
+        std::vector<uint64_t> all;
+        for (const auto& thread : latencies)
+        {
+            all.insert(all.end(), thread.begin(), thread.end());
+        }
+        std::sort(all.begin(), all.end());
+
+        auto percentile = [&](double p){ return all[std::min(all.size() - 1, size_t(p * all.size()))]; };
+
+        std::cout << name << " p50: " << percentile(0.5) << "ns, p99: " << percentile(0.99) << "ns, p99.9: " << percentile(0.999)
+            << "ns, max: " << all.back() << "ns, written: " << backend->get_messages().size() << "/" << all.size() << "\n";
+    }
+
+
+    TEST(per_thread_log_queue, DISABLED_benchmark_log_call_tail_latency)
+    {
+        measure_log_calls<boost::log::sinks::bounded_fifo_queue<64 * 1024, boost::log::sinks::block_on_overflow>>("shared queue, block");
+        measure_log_calls<per_thread_log_queue<8 * 1024, false>>("per thread rings, block");
+        measure_log_calls<per_thread_log_queue<8 * 1024, true>>("per thread rings, drop below error");
+    }
+
+} // bzn::utils